@@ -24,6 +24,7 @@
 #include <linux/virtio_net.h>
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
+#include <linux/if_packet.h>
 #include <linux/slab.h>
 #include <linux/cpu.h>
 #include <linux/average.h>
@@ -92,6 +93,15 @@ struct receive_queue {
 	/* RX: fragments + linear part + virtio header */
 	struct scatterlist sg[MAX_SKB_FRAGS + 2];
 
+	/* User memory frames are posted from, see virtnet_umem_setup() */
+	struct netdev_umem *umem;
+
+	/* # of its frames the device holds */
+	unsigned int umem_posted;
+
+	/* Still bound: take new frames from it */
+	bool umem_active;
+
 	/* Name of this receive queue: input.$index */
 	char name[40];
 };
@@ -245,6 +255,91 @@ static unsigned long mergeable_buf_to_ctx(void *buf, unsigned int truesize)
 	return (unsigned long)buf | (size - 1);
 }
 
+/*
+ * Frames of user memory (see virtnet_umem_setup()) are posted as the
+ * virtio header right in front of the packet data, both in the frame's
+ * page.  The buffer is the frame's address in the kernel mapping of the
+ * area, which tells them apart from all other buffers.
+ */
+static bool is_umem_buf(struct receive_queue *rq, void *buf)
+{
+	struct netdev_umem *umem = rq->umem;
+
+	return umem && buf >= umem->frames && buf < umem->frames + umem->len;
+}
+
+static unsigned int umem_hdr_len(struct virtnet_info *vi)
+{
+	if (vi->mergeable_rx_bufs)
+		return sizeof(struct virtio_net_hdr_mrg_rxbuf);
+	return sizeof(struct virtio_net_hdr);
+}
+
+static int post_umem_frame(struct receive_queue *rq, u64 addr, gfp_t gfp)
+{
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	struct netdev_umem *umem = rq->umem;
+	struct page *page = umem->pages[addr >> PAGE_SHIFT];
+	unsigned int offset = offset_in_page(addr) + umem->headroom;
+	unsigned int hdr_len = umem_hdr_len(vi);
+	int err;
+
+	sg_set_page(&rq->sg[0], page, hdr_len, offset - hdr_len);
+	sg_set_page(&rq->sg[1], page, umem->frame_size - umem->headroom,
+		    offset);
+
+	err = virtqueue_add_inbuf(rq->vq, rq->sg, 2, umem->frames + addr, gfp);
+	if (err < 0)
+		return err;
+
+	rq->umem_posted++;
+	return 0;
+}
+
+/* A frame came off the ring, let go of the memory once unbound and empty */
+static void umem_frame_done(struct receive_queue *rq)
+{
+	if (--rq->umem_posted || rq->umem_active)
+		return;
+
+	rq->umem->release(rq->umem);
+	rq->umem = NULL;
+}
+
+/* Post a frame that got no packet for user space again */
+static void recycle_umem_buf(struct receive_queue *rq, void *buf)
+{
+	struct netdev_umem *umem = rq->umem;
+	u64 addr = buf - umem->frames;
+
+	if (rq->umem_active && post_umem_frame(rq, addr, GFP_ATOMIC) < 0)
+		umem->put_frame(umem, addr, 0, TP_STATUS_KERNEL);
+	umem_frame_done(rq);
+}
+
+/* Drop the remaining num buffers of a mergeable packet */
+static void put_mergeable_bufs(struct receive_queue *rq, int num)
+{
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	unsigned int len;
+	void *buf;
+
+	while (num--) {
+		buf = virtqueue_get_buf(rq->vq, &len);
+		if (unlikely(!buf)) {
+			pr_debug("%s: rx error: %d buffers missing\n",
+				 vi->dev->name, num + 1);
+			vi->dev->stats.rx_length_errors++;
+			break;
+		}
+		if (is_umem_buf(rq, buf))
+			recycle_umem_buf(rq, buf);
+		else
+			put_page(virt_to_head_page(
+				mergeable_ctx_to_buf_address((unsigned long)buf)));
+	}
+}
+
 /* Called from bottom half context */
 static struct sk_buff *page_to_skb(struct receive_queue *rq,
 				   struct page *page, unsigned int offset,
@@ -379,6 +474,14 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 			goto err_buf;
 		}
 
+		if (unlikely(is_umem_buf(rq, (void *)ctx))) {
+			/* A frame of user memory can't go into an skb */
+			recycle_umem_buf(rq, (void *)ctx);
+			put_mergeable_bufs(rq, num_buf - 1);
+			dev->stats.rx_length_errors++;
+			goto err_buf;
+		}
+
 		buf = mergeable_ctx_to_buf_address(ctx);
 		page = virt_to_head_page(buf);
 
@@ -418,23 +521,63 @@ static struct sk_buff *receive_mergeable(struct net_device *dev,
 
 err_skb:
 	put_page(page);
-	while (--num_buf) {
-		ctx = (unsigned long)virtqueue_get_buf(rq->vq, &len);
-		if (unlikely(!ctx)) {
-			pr_debug("%s: rx error: %d buffers missing\n",
-				 dev->name, num_buf);
-			dev->stats.rx_length_errors++;
-			break;
-		}
-		page = virt_to_head_page(mergeable_ctx_to_buf_address(ctx));
-		put_page(page);
-	}
+	put_mergeable_bufs(rq, num_buf - 1);
 err_buf:
 	dev->stats.rx_dropped++;
 	dev_kfree_skb(head_skb);
 	return NULL;
 }
 
+/* Hand a packet the device wrote into a frame of user memory to its owner */
+static void receive_umem(struct receive_queue *rq, void *buf, unsigned int len)
+{
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	struct net_device *dev = vi->dev;
+	struct virtnet_stats *stats = this_cpu_ptr(vi->stats);
+	struct netdev_umem *umem = rq->umem;
+	unsigned int hdr_len = umem_hdr_len(vi);
+	u64 addr = buf - umem->frames;
+	u32 status = TP_STATUS_USER;
+	struct skb_vnet_hdr hdr;
+
+	/* User space can write to the frame, read the header only once */
+	memcpy(&hdr, buf + umem->headroom - hdr_len, hdr_len);
+
+	if (vi->mergeable_rx_bufs && hdr.mhdr.num_buffers > 1) {
+		pr_debug("%s: packet too big for a frame\n", dev->name);
+		put_mergeable_bufs(rq, hdr.mhdr.num_buffers - 1);
+		dev->stats.rx_length_errors++;
+		goto recycle;
+	}
+	if (unlikely(len < hdr_len + ETH_HLEN)) {
+		pr_debug("%s: short packet %i\n", dev->name, len);
+		dev->stats.rx_length_errors++;
+		goto recycle;
+	}
+	if (!rq->umem_active)
+		goto recycle;
+
+	len -= hdr_len;
+	if (hdr.hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+		status |= TP_STATUS_CSUMNOTREADY;
+
+	if (!umem->put_frame(umem, addr, len, status)) {
+		dev->stats.rx_dropped++;
+		goto recycle;
+	}
+
+	u64_stats_update_begin(&stats->rx_syncp);
+	stats->rx_bytes += len;
+	stats->rx_packets++;
+	u64_stats_update_end(&stats->rx_syncp);
+
+	umem_frame_done(rq);
+	return;
+
+recycle:
+	recycle_umem_buf(rq, buf);
+}
+
 static void receive_buf(struct receive_queue *rq, void *buf, unsigned int len)
 {
 	struct virtnet_info *vi = rq->vq->vdev->priv;
@@ -443,6 +586,11 @@ static void receive_buf(struct receive_queue *rq, void *buf, unsigned int len)
 	struct sk_buff *skb;
 	struct skb_vnet_hdr *hdr;
 
+	if (is_umem_buf(rq, buf)) {
+		receive_umem(rq, buf, len);
+		return;
+	}
+
 	if (unlikely(len < sizeof(struct virtio_net_hdr) + ETH_HLEN)) {
 		pr_debug("%s: short packet %i\n", dev->name, len);
 		dev->stats.rx_length_errors++;
@@ -485,6 +633,7 @@ static void receive_buf(struct receive_queue *rq, void *buf, unsigned int len)
 		skb->ip_summed = CHECKSUM_UNNECESSARY;
 	}
 
+	skb_record_rx_queue(skb, vq2rxq(rq->vq));
 	skb->protocol = eth_type_trans(skb, dev);
 	pr_debug("Receiving skb proto 0x%04x len %i type %i\n",
 		 ntohs(skb->protocol), skb->len, skb->pkt_type);
@@ -645,6 +794,36 @@ static int add_recvbuf_mergeable(struct receive_queue *rq, gfp_t gfp)
 	return err;
 }
 
+static int add_recvbuf_umem(struct receive_queue *rq, gfp_t gfp)
+{
+	struct netdev_umem *umem = rq->umem;
+	u64 addr;
+	int err;
+
+	if (!rq->vq->num_free)
+		return -ENOSPC;
+	if (!umem->get_frame(umem, &addr))
+		return -ENOBUFS;
+
+	err = post_umem_frame(rq, addr, gfp);
+	if (err < 0)
+		umem->put_frame(umem, addr, 0, TP_STATUS_KERNEL);
+
+	return err;
+}
+
+static int add_recvbuf(struct receive_queue *rq, gfp_t gfp)
+{
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+
+	if (vi->mergeable_rx_bufs)
+		return add_recvbuf_mergeable(rq, gfp);
+	else if (vi->big_packets)
+		return add_recvbuf_big(rq, gfp);
+	else
+		return add_recvbuf_small(rq, gfp);
+}
+
 /*
  * Returns false if we couldn't fill entirely (OOM).
  *
@@ -654,18 +833,25 @@ static int add_recvbuf_mergeable(struct receive_queue *rq, gfp_t gfp)
  */
 static bool try_fill_recv(struct receive_queue *rq, gfp_t gfp)
 {
-	struct virtnet_info *vi = rq->vq->vdev->priv;
 	int err;
 	bool oom;
 
 	gfp |= __GFP_COLD;
 	do {
-		if (vi->mergeable_rx_bufs)
-			err = add_recvbuf_mergeable(rq, gfp);
-		else if (vi->big_packets)
-			err = add_recvbuf_big(rq, gfp);
-		else
-			err = add_recvbuf_small(rq, gfp);
+		if (rq->umem_active) {
+			err = add_recvbuf_umem(rq, gfp);
+			/*
+			 * Out of user frames: post one ordinary buffer, so the
+			 * ring never runs empty and stops being refilled.
+			 */
+			if (err == -ENOBUFS) {
+				err = add_recvbuf(rq, gfp);
+				oom = err == -ENOMEM;
+				break;
+			}
+		} else {
+			err = add_recvbuf(rq, gfp);
+		}
 
 		oom = err == -ENOMEM;
 		if (err)
@@ -1333,6 +1519,59 @@ static int virtnet_change_mtu(struct net_device *dev, int new_mtu)
 	return 0;
 }
 
+/*
+ * Have receive queue 'queue' take its buffers from the frames of 'umem'
+ * while user space keeps the fill ring stocked, or stop doing so.  Frames
+ * the device still has when told to stop are dropped as they come back,
+ * 'umem' is released after the last one.
+ */
+static int virtnet_umem_setup(struct net_device *dev, u16 queue,
+			      struct netdev_umem *umem)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	bool running = netif_running(dev);
+	struct receive_queue *rq;
+
+	if (queue >= vi->max_queue_pairs)
+		return -EINVAL;
+	rq = &vi->rq[queue];
+
+	if (umem) {
+		if (queue >= vi->curr_queue_pairs)
+			return -EINVAL;
+		/* Big packets are page chains the host fills in one go */
+		if (vi->big_packets && !vi->mergeable_rx_bufs)
+			return -EOPNOTSUPP;
+		if (umem->headroom < sizeof(struct virtio_net_hdr_mrg_rxbuf) ||
+		    umem->frame_size - umem->headroom < GOOD_PACKET_LEN)
+			return -EINVAL;
+		/* Frames of an earlier one are still out */
+		if (rq->umem)
+			return -EBUSY;
+	} else if (!rq->umem || !rq->umem_active) {
+		return 0;
+	}
+
+	if (running)
+		napi_disable(&rq->napi);
+
+	if (umem) {
+		rq->umem = umem;
+		rq->umem_active = true;
+	} else {
+		rq->umem_active = false;
+		if (!rq->umem_posted) {
+			rq->umem->release(rq->umem);
+			rq->umem = NULL;
+		}
+	}
+
+	if (running)
+		virtnet_napi_enable(rq);
+
+	return 0;
+}
+
 static const struct net_device_ops virtnet_netdev = {
 	.ndo_open            = virtnet_open,
 	.ndo_stop   	     = virtnet_close,
@@ -1347,6 +1586,7 @@ static const struct net_device_ops virtnet_netdev = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller = virtnet_netpoll,
 #endif
+	.ndo_umem_setup      = virtnet_umem_setup,
 };
 
 static void virtnet_config_changed_work(struct work_struct *work)
@@ -1435,10 +1675,17 @@ static void free_unused_bufs(struct virtnet_info *vi)
 	}
 
 	for (i = 0; i < vi->max_queue_pairs; i++) {
-		struct virtqueue *vq = vi->rq[i].vq;
+		struct receive_queue *rq = &vi->rq[i];
+		struct virtqueue *vq = rq->vq;
 
 		while ((buf = virtqueue_detach_unused_buf(vq)) != NULL) {
-			if (vi->mergeable_rx_bufs) {
+			if (is_umem_buf(rq, buf)) {
+				if (rq->umem_active)
+					rq->umem->put_frame(rq->umem,
+							    buf - rq->umem->frames,
+							    0, TP_STATUS_KERNEL);
+				umem_frame_done(rq);
+			} else if (vi->mergeable_rx_bufs) {
 				unsigned long ctx = (unsigned long)buf;
 				void *base = mergeable_ctx_to_buf_address(ctx);
 				put_page(virt_to_head_page(base));
@@ -1448,6 +1695,17 @@ static void free_unused_bufs(struct virtnet_info *vi)
 				dev_kfree_skb(buf);
 			}
 		}
+
+		/*
+		 * The device was reset, frames it used but we didn't get to
+		 * are gone with the ring.  The owner falls back to copying.
+		 */
+		if (rq->umem) {
+			rq->umem_active = false;
+			rq->umem_posted = 0;
+			rq->umem->release(rq->umem);
+			rq->umem = NULL;
+		}
 	}
 }
 
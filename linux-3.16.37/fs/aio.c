@@ -1433,6 +1433,10 @@ rw_common:
 		if (!rw_op && !iter_op)
 			return -EINVAL;
 
+		/* Only ->read_iter() knows what to do with the flags */
+		if (req->ki_flags && (rw != READ || !iter_op))
+			return -EOPNOTSUPP;
+
 		ret = (opcode == IOCB_CMD_PREADV ||
 		       opcode == IOCB_CMD_PWRITEV)
 			? aio_setup_vectored_rw(req, rw, buf, &nr_segs,
@@ -1471,14 +1475,14 @@ rw_common:
 		break;
 
 	case IOCB_CMD_FDSYNC:
-		if (!file->f_op->aio_fsync)
+		if (!file->f_op->aio_fsync || req->ki_flags)
 			return -EINVAL;
 
 		ret = file->f_op->aio_fsync(req, 1);
 		break;
 
 	case IOCB_CMD_FSYNC:
-		if (!file->f_op->aio_fsync)
+		if (!file->f_op->aio_fsync || req->ki_flags)
 			return -EINVAL;
 
 		ret = file->f_op->aio_fsync(req, 0);
@@ -1514,7 +1518,7 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	ssize_t ret;
 
 	/* enforce forwards compatibility on users */
-	if (unlikely(iocb->aio_reserved1 || iocb->aio_reserved2)) {
+	if (unlikely(iocb->aio_reserved2)) {
 		pr_debug("EINVAL: reserve field set\n");
 		return -EINVAL;
 	}
@@ -1565,6 +1569,12 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	req->ki_pos = iocb->aio_offset;
 	req->ki_nbytes = iocb->aio_nbytes;
 
+	ret = kiocb_set_rw_flags(req, iocb->aio_rw_flags);
+	if (unlikely(ret)) {
+		pr_debug("EOPNOTSUPP: aio_rw_flags\n");
+		goto out_put_req;
+	}
+
 	ret = aio_run_iocb(req, iocb->aio_lio_opcode,
 			   (char __user *)(unsigned long)iocb->aio_buf,
 			   compat);
@@ -15,6 +15,7 @@
 #include <linux/security.h>
 #include <linux/evm.h>
 #include <linux/ima.h>
+#include <linux/path_cache.h>
 
 /**
  * inode_change_ok - check if attribute changes to an inode are allowed
@@ -271,6 +272,8 @@ int notify_change(struct dentry * dentry, struct iattr * attr, struct inode **de
 		fsnotify_change(dentry, ia_valid);
 		ima_inode_post_setattr(dentry);
 		evm_inode_post_setattr(dentry, ia_valid);
+		if (ia_valid & (ATTR_MODE | ATTR_UID | ATTR_GID))
+			d_path_cache_invalidate(dentry);
 	}
 
 	return error;
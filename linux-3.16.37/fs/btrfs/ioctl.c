@@ -3709,17 +3709,23 @@ out:
 	return ret;
 }
 
-static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
-				       u64 off, u64 olen, u64 destoff)
+/*
+ * Clone @olen bytes at @off of @file_src into @file at @destoff, sharing the
+ * extents instead of copying the data.  An @olen of zero clones up to the end
+ * of @file_src.  The range must be block aligned except for a tail that ends
+ * at EOF of the source; -EINVAL is returned for anything that can't be
+ * cloned.  Used by the clone ioctls and by ->copy_file_range.
+ */
+int btrfs_clone_files(struct file *file, struct file *file_src,
+		      u64 off, u64 olen, u64 destoff)
 {
 	struct inode *inode = file_inode(file);
+	struct inode *src = file_inode(file_src);
 	struct btrfs_root *root = BTRFS_I(inode)->root;
-	struct fd src_file;
-	struct inode *src;
 	int ret;
 	u64 len = olen;
 	u64 bs = root->fs_info->sb->s_blocksize;
-	int same_inode = 0;
+	int same_inode = src == inode;
 
 	/*
 	 * TODO:
@@ -3732,49 +3738,19 @@ static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
 	 *   be either compressed or non-compressed.
 	 */
 
-	/* the destination must be opened for writing */
-	if (!(file->f_mode & FMODE_WRITE) || (file->f_flags & O_APPEND))
-		return -EINVAL;
-
 	if (btrfs_root_readonly(root))
 		return -EROFS;
 
-	ret = mnt_want_write_file(file);
-	if (ret)
-		return ret;
-
-	src_file = fdget(srcfd);
-	if (!src_file.file) {
-		ret = -EBADF;
-		goto out_drop_write;
-	}
-
-	ret = -EXDEV;
-	if (src_file.file->f_path.mnt != file->f_path.mnt)
-		goto out_fput;
-
-	src = file_inode(src_file.file);
-
-	ret = -EINVAL;
-	if (src == inode)
-		same_inode = 1;
-
-	/* the src must be open for reading */
-	if (!(src_file.file->f_mode & FMODE_READ))
-		goto out_fput;
-
 	/* don't make the dst file partly checksummed */
 	if ((BTRFS_I(src)->flags & BTRFS_INODE_NODATASUM) !=
 	    (BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM))
-		goto out_fput;
+		return -EINVAL;
 
-	ret = -EISDIR;
 	if (S_ISDIR(src->i_mode) || S_ISDIR(inode->i_mode))
-		goto out_fput;
+		return -EISDIR;
 
-	ret = -EXDEV;
 	if (src->i_sb != inode->i_sb)
-		goto out_fput;
+		return -EXDEV;
 
 	if (!same_inode) {
 		if (inode < src) {
@@ -3867,6 +3843,103 @@ out_unlock:
 	} else {
 		mutex_unlock(&src->i_mutex);
 	}
+	return ret;
+}
+
+/*
+ * ->copy_file_range: share the extents of the source range with the
+ * destination when the range can be cloned and let the VFS fall back to
+ * copying the data through splice when it can't, e.g. for ranges that
+ * aren't block aligned or when only one of the files is checksummed.
+ */
+ssize_t btrfs_copy_file_range(struct file *file_in, loff_t pos_in,
+			      struct file *file_out, loff_t pos_out,
+			      size_t len, unsigned int flags)
+{
+	struct inode *src = file_inode(file_in);
+	struct inode *inode = file_inode(file_out);
+	u64 bs = BTRFS_I(inode)->root->fs_info->sb->s_blocksize;
+	loff_t isize = i_size_read(src);
+	int ret;
+
+	if (pos_in >= isize)
+		return 0;
+	if (len > isize - pos_in)
+		len = isize - pos_in;
+
+	if (!IS_ALIGNED(pos_in, bs) || !IS_ALIGNED(pos_out, bs) ||
+	    (!IS_ALIGNED(pos_in + len, bs) && pos_in + len != isize))
+		return -EOPNOTSUPP;
+	if (src == inode && pos_out + len > pos_in && pos_out < pos_in + len)
+		return -EOPNOTSUPP;
+
+	ret = btrfs_clone_files(file_out, file_in, pos_in, len, pos_out);
+	if (ret == -EINVAL)
+		return -EOPNOTSUPP;
+	if (ret)
+		return ret;
+	return len;
+}
+
+/* ->clone_file_range: FICLONE and FICLONERANGE */
+int btrfs_clone_file_range(struct file *file_in, loff_t pos_in,
+			   struct file *file_out, loff_t pos_out, u64 len)
+{
+	return btrfs_clone_files(file_out, file_in, pos_in, len, pos_out);
+}
+
+/* ->dedupe_file_range: FIDEDUPERANGE, same limits as the btrfs ioctl */
+ssize_t btrfs_dedupe_file_range(struct file *src_file, u64 loff, u64 olen,
+				struct file *dst_file, u64 dst_loff)
+{
+	struct inode *src = file_inode(src_file);
+	struct inode *dst = file_inode(dst_file);
+	u64 bs = BTRFS_I(src)->root->fs_info->sb->s_blocksize;
+	u64 len = min_t(u64, olen, BTRFS_MAX_DEDUPE_LEN);
+	int ret;
+
+	/* btrfs_cmp_data() can't handle blocks smaller than a page */
+	if (WARN_ON_ONCE(bs < PAGE_CACHE_SIZE))
+		return -EINVAL;
+
+	ret = btrfs_extent_same(src, loff, len, dst, dst_loff);
+	if (ret == BTRFS_SAME_DATA_DIFFERS)
+		return -EBADE;
+	if (ret)
+		return ret;
+	return len;
+}
+
+static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
+				       u64 off, u64 olen, u64 destoff)
+{
+	struct fd src_file;
+	int ret;
+
+	/* the destination must be opened for writing */
+	if (!(file->f_mode & FMODE_WRITE) || (file->f_flags & O_APPEND))
+		return -EINVAL;
+
+	ret = mnt_want_write_file(file);
+	if (ret)
+		return ret;
+
+	src_file = fdget(srcfd);
+	if (!src_file.file) {
+		ret = -EBADF;
+		goto out_drop_write;
+	}
+
+	ret = -EXDEV;
+	if (src_file.file->f_path.mnt != file->f_path.mnt)
+		goto out_fput;
+
+	/* the src must be open for reading */
+	ret = -EINVAL;
+	if (!(src_file.file->f_mode & FMODE_READ))
+		goto out_fput;
+
+	ret = btrfs_clone_files(file, src_file.file, off, olen, destoff);
 out_fput:
 	fdput(src_file);
 out_drop_write:
@@ -38,6 +38,8 @@
 #include <linux/prefetch.h>
 #include <linux/ratelimit.h>
 #include <linux/list_lru.h>
+#include <linux/workqueue.h>
+#include <linux/path_cache.h>
 #include "internal.h"
 #include "mount.h"
 
@@ -109,6 +111,15 @@ static inline struct hlist_bl_head *d_hash(const struct dentry *parent,
 	return dentry_hashtable + hash_32(hash, d_hash_shift);
 }
 
+/*
+ * Start pulling in the hash chain @name will be looked up in, so that the
+ * miss overlaps with the permission check on @parent.
+ */
+void d_prefetch_hash(const struct dentry *parent, const struct qstr *name)
+{
+	prefetch(d_hash(parent, name->hash));
+}
+
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
@@ -116,8 +127,7 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
-
-#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+static DEFINE_PER_CPU(long, nr_dentry_negative);
 
 /*
  * Here we resort to our own counters instead of using generic per-cpu counters
@@ -140,6 +150,16 @@ static long get_nr_dentry(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 static long get_nr_dentry_unused(void)
 {
 	int i;
@@ -154,10 +174,49 @@ int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
 #endif
 
+/*
+ * Negative dentries on the LRU are capped at sysctl_negative_dentry_ratio
+ * percent of all dentries (0 means no limit).  Going over the limit kicks
+ * off a work item that trims them, down to 90% of the limit so that it
+ * isn't immediately triggered again, without waiting for memory pressure.
+ *
+ * The per-cpu counters are summed at most every NEG_DENTRY_CHECK_INTERVAL.
+ */
+int sysctl_negative_dentry_ratio __read_mostly;
+EXPORT_SYMBOL_GPL(sysctl_negative_dentry_ratio);
+
+#define NEG_DENTRY_CHECK_INTERVAL	(HZ / 10)
+#define NEG_DENTRY_TRIM_BATCH		1024UL
+
+static unsigned long negative_dentry_next_check;
+
+static void negative_dentry_trim(struct work_struct *work);
+static DECLARE_WORK(negative_dentry_trim_work, negative_dentry_trim);
+
+/* How many negative dentries there are above @percent of all dentries */
+static long negative_dentry_excess(int percent)
+{
+	return get_nr_dentry_negative() - get_nr_dentry() / 100 * percent;
+}
+
+static void negative_dentry_check(void)
+{
+	int ratio = ACCESS_ONCE(sysctl_negative_dentry_ratio);
+
+	if (!ratio ||
+	    time_before(jiffies, ACCESS_ONCE(negative_dentry_next_check)))
+		return;
+
+	negative_dentry_next_check = jiffies + NEG_DENTRY_CHECK_INTERVAL;
+	if (negative_dentry_excess(ratio) > 0)
+		schedule_work(&negative_dentry_trim_work);
+}
+
 /*
  * Compare 2 name strings, return 0 if they match, otherwise non-zero.
  * The strings are both count bytes long, and count is non-zero.
@@ -306,6 +365,9 @@ static void dentry_unlink_inode(struct dentry * dentry)
 	struct inode *inode = dentry->d_inode;
 	__d_clear_type(dentry);
 	dentry->d_inode = NULL;
+	if (dentry->d_flags & DCACHE_LRU_LIST)
+		this_cpu_inc(nr_dentry_negative);
+	d_path_cache_invalidate(dentry);
 	hlist_del_init(&dentry->d_u.d_alias);
 	dentry_rcuwalk_barrier(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -327,7 +389,8 @@ static void dentry_unlink_inode(struct dentry * dentry)
  * on the shrink list (ie not on the superblock LRU list).
  *
  * The per-cpu "nr_dentry_unused" counters are updated with
- * the DCACHE_LRU_LIST bit.
+ * the DCACHE_LRU_LIST bit, and so are the "nr_dentry_negative"
+ * ones for negative dentries.
  *
  * These helper functions make sure we always follow the
  * rules. d_lock must be held by the caller.
@@ -339,6 +402,10 @@ static void d_lru_add(struct dentry *dentry)
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
 	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	if (d_is_negative(dentry)) {
+		this_cpu_inc(nr_dentry_negative);
+		negative_dentry_check();
+	}
 }
 
 static void d_lru_del(struct dentry *dentry)
@@ -346,6 +413,8 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
 }
 
@@ -355,6 +424,8 @@ static void d_shrink_del(struct dentry *dentry)
 	list_del_init(&dentry->d_lru);
 	dentry->d_flags &= ~(DCACHE_SHRINK_LIST | DCACHE_LRU_LIST);
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 }
 
 static void d_shrink_add(struct dentry *dentry, struct list_head *list)
@@ -363,6 +434,8 @@ static void d_shrink_add(struct dentry *dentry, struct list_head *list)
 	list_add(&dentry->d_lru, list);
 	dentry->d_flags |= DCACHE_SHRINK_LIST | DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_inc(nr_dentry_negative);
 }
 
 /*
@@ -376,6 +449,8 @@ static void d_lru_isolate(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	if (d_is_negative(dentry))
+		this_cpu_dec(nr_dentry_negative);
 	list_del_init(&dentry->d_lru);
 }
 
@@ -429,6 +504,7 @@ void __d_drop(struct dentry *dentry)
 		dentry->d_hash.pprev = NULL;
 		hlist_bl_unlock(b);
 		dentry_rcuwalk_barrier(dentry);
+		d_path_cache_invalidate(dentry);
 	}
 }
 EXPORT_SYMBOL(__d_drop);
@@ -971,24 +1047,22 @@ dentry_lru_isolate(struct list_head *item, spinlock_t *lru_lock, void *arg)
 /**
  * prune_dcache_sb - shrink the dcache
  * @sb: superblock
- * @nr_to_scan : number of entries to try to free
- * @nid: which node to scan for freeable entities
+ * @sc: shrink control, passed to list_lru_shrink_walk()
  *
- * Attempt to shrink the superblock dcache LRU by @nr_to_scan entries. This is
- * done when we need more memory an called from the superblock shrinker
- * function.
+ * Attempt to shrink the superblock dcache LRU by @sc->nr_to_scan entries,
+ * from the node and memory cgroup @sc asks for. This is done when we need
+ * more memory and called from the superblock shrinker function.
  *
  * This function may fail to free any resources if all the dentries are in
  * use.
  */
-long prune_dcache_sb(struct super_block *sb, unsigned long nr_to_scan,
-		     int nid)
+long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 {
 	LIST_HEAD(dispose);
 	long freed;
 
-	freed = list_lru_walk_node(&sb->s_dentry_lru, nid, dentry_lru_isolate,
-				       &dispose, &nr_to_scan);
+	freed = list_lru_shrink_walk(&sb->s_dentry_lru, sc,
+				     dentry_lru_isolate, &dispose);
 	shrink_dentry_list(&dispose);
 	return freed;
 }
@@ -1031,12 +1105,84 @@ void shrink_dcache_sb(struct super_block *sb)
 		freed = list_lru_walk(&sb->s_dentry_lru,
 			dentry_lru_isolate_shrink, &dispose, UINT_MAX);
 
-		this_cpu_sub(nr_dentry_unused, freed);
 		shrink_dentry_list(&dispose);
 	} while (freed > 0);
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
+static enum lru_status dentry_lru_isolate_negative(struct list_head *item,
+						spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *freeable = arg;
+	struct dentry	*dentry = container_of(item, struct dentry, d_lru);
+
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	if (dentry->d_lockref.count) {
+		d_lru_isolate(dentry);
+		spin_unlock(&dentry->d_lock);
+		return LRU_REMOVED;
+	}
+
+	/*
+	 * Rotate whatever we pass over, so that the next batch gets to
+	 * look further down the list.  That costs the positive dentries
+	 * some LRU age, but we only get here while negative dentries are
+	 * over their limit.
+	 */
+	if (d_is_positive(dentry)) {
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	if (dentry->d_flags & DCACHE_REFERENCED) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	d_lru_shrink_move(dentry, freeable);
+	spin_unlock(&dentry->d_lock);
+
+	return LRU_REMOVED;
+}
+
+static void trim_negative_dentries_sb(struct super_block *sb, void *arg)
+{
+	int percent = *(int *)arg;
+	struct list_lru *lru = &sb->s_dentry_lru;
+	int nid;
+
+	for_each_node_mask(nid, lru->active_nodes) {
+		unsigned long nr_to_walk = list_lru_count_node(lru, nid);
+
+		while (nr_to_walk) {
+			unsigned long batch = min(nr_to_walk,
+						  NEG_DENTRY_TRIM_BATCH);
+			LIST_HEAD(dispose);
+
+			if (negative_dentry_excess(percent) <= 0)
+				return;
+
+			nr_to_walk -= batch;
+			list_lru_walk_node(lru, nid, dentry_lru_isolate_negative,
+					   &dispose, &batch);
+			shrink_dentry_list(&dispose);
+			cond_resched();
+		}
+	}
+}
+
+static void negative_dentry_trim(struct work_struct *work)
+{
+	int ratio = ACCESS_ONCE(sysctl_negative_dentry_ratio);
+	int percent = ratio * 9 / 10;
+
+	if (ratio)
+		iterate_supers(trim_negative_dentries_sb, &percent);
+}
+
 /**
  * enum d_walk_ret - action to talke during tree walk
  * @D_WALK_CONTINUE:	contrinue walk
@@ -1601,6 +1747,9 @@ static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 	unsigned add_flags = d_flags_for_inode(inode);
 
 	spin_lock(&dentry->d_lock);
+	if (inode && d_is_negative(dentry) &&
+	    (dentry->d_flags & DCACHE_LRU_LIST))
+		this_cpu_dec(nr_dentry_negative);
 	__d_set_type(dentry, add_flags);
 	if (inode)
 		hlist_add_head(&dentry->d_u.d_alias, &inode->i_dentry);
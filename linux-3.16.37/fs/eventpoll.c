@@ -42,6 +42,9 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <linux/llist.h>
+#include <linux/net.h>
+#include <net/busy_poll.h>
 
 /*
  * LOCKING:
@@ -52,11 +55,13 @@
  * 3) ep->lock (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * The poll callback might be triggered from a wake_up() that in
+ * turn might be called from IRQ context, so it can't sleep. It
+ * doesn't take any epoll lock either: it queues the item on the
+ * lock-less ep->rdlhead list, and ep_scan_ready_list() moves such
+ * items onto the ready list under the ep->lock spinlock. This way
+ * event sources firing on many CPUs don't serialize on ep->lock.
+ * During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -92,7 +97,13 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+#define EPOLLINOUT_BITS (POLLIN | POLLOUT)
+
+/* Events that may be combined with EPOLLEXCLUSIVE */
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLINOUT_BITS | POLLERR | POLLHUP | \
+				EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
@@ -103,6 +114,9 @@
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
+/* Number of NAPI contexts an epoll instance busy polls */
+#define EP_BUSY_POLL_NAPI 4
+
 struct epoll_filefd {
 	struct file *file;
 	int fd;
@@ -145,10 +159,10 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * Links this item on "struct eventpoll"->rdlhead. The next pointer
+	 * is EP_UNACTIVE_PTR while the item isn't queued there.
 	 */
-	struct epitem *next;
+	struct llist_node rdlnode;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -202,11 +216,10 @@ struct eventpoll {
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->lock.
+	 * Items reported by the poll callback. They are queued here without
+	 * taking ->lock and moved to the ready list by ep_scan_ready_list().
 	 */
-	struct epitem *ovflist;
+	struct llist_head rdlhead;
 
 	/* wakeup_source used when ep_scan_ready_list is running */
 	struct wakeup_source *ws;
@@ -219,6 +232,12 @@ struct eventpoll {
 	/* used to optimize loop detection check */
 	int visited;
 	struct list_head visited_list_link;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* NAPI contexts that last fed our sockets, 0 for unused slots */
+	unsigned int napi_id[EP_BUSY_POLL_NAPI];
+	unsigned int napi_next;
+#endif
 };
 
 /* Wait structure used by the poll hooks */
@@ -376,9 +395,91 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty(&ep->rdllist) || !llist_empty(&ep->rdlhead);
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ * ep_set_busy_poll_napi_id - Remembers the NAPI context a socket is fed by.
+ *
+ * @epi: Pointer to the epitem of a socket, with "mtx" held.
+ *
+ * Sockets have no NAPI context until their first packet arrives, so this is
+ * called when they are added and again each time they are reported ready.
+ * The few most recently seen contexts are kept, which covers the receive
+ * queues that typically feed a large number of sockets.
+ */
+static void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+	unsigned int napi_id, i;
+	struct socket *sock;
+	int err;
+
+	if (!net_busy_loop_on())
+		return;
+
+	sock = sock_from_file(epi->ffd.file, &err);
+	if (!sock || !sock->sk)
+		return;
+
+	napi_id = ACCESS_ONCE(sock->sk->sk_napi_id);
+	if (!napi_id)
+		return;
+
+	for (i = 0; i < EP_BUSY_POLL_NAPI; i++) {
+		if (ep->napi_id[i] == napi_id)
+			return;
+	}
+
+	ACCESS_ONCE(ep->napi_id[ep->napi_next]) = napi_id;
+	ep->napi_next = (ep->napi_next + 1) % EP_BUSY_POLL_NAPI;
 }
 
+/**
+ * ep_busy_loop - Busy polls the NAPI contexts of the watched sockets.
+ *
+ * @ep: Pointer to the eventpoll context.
+ * @nonblock: Poll every context once instead of until the busy poll
+ *            time runs out.
+ *
+ * Like poll() and select(), this is controlled by net.core.busy_poll.
+ *
+ * Returns: Returns true if events became available.
+ */
+static bool ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+	unsigned long end_time = !nonblock ? busy_loop_end_time() : 0;
+	unsigned int napi_id, i;
+
+	if (!net_busy_loop_on() || !ACCESS_ONCE(ep->napi_id[0]))
+		return false;
+
+	do {
+		for (i = 0; i < EP_BUSY_POLL_NAPI; i++) {
+			napi_id = ACCESS_ONCE(ep->napi_id[i]);
+			if (!napi_id)
+				break;
+			napi_busy_poll_once(napi_id);
+		}
+		cpu_relax();
+	} while (!nonblock && !ep_events_available(ep) &&
+		 !need_resched() && !signal_pending(current) &&
+		 !busy_loop_timeout(end_time));
+
+	return ep_events_available(ep);
+}
+#else
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+}
+
+static inline bool ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+	return false;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -576,6 +677,35 @@ static inline void ep_pm_stay_awake_rcu(struct epitem *epi)
 	rcu_read_unlock();
 }
 
+/**
+ * ep_collect_ready - Moves the items queued by the poll callback onto the
+ *                    ready list, in the order they were reported.
+ *
+ * @ep: Pointer to the epoll private data structure.
+ *
+ * Must be called with "mtx" and "lock" held. Items that are already linked
+ * somewhere, the ready list or the private list of ep_scan_ready_list(),
+ * stay where they are.
+ */
+static void ep_collect_ready(struct eventpoll *ep)
+{
+	struct llist_node *node, *next;
+	struct epitem *epi;
+
+	node = llist_reverse_order(llist_del_all(&ep->rdlhead));
+	for (; node; node = next) {
+		epi = llist_entry(node, struct epitem, rdlnode);
+		next = node->next;
+		/* From here on the poll callback may queue the item again */
+		smp_store_release(&epi->rdlnode.next, EP_UNACTIVE_PTR);
+
+		if (!ep_is_linked(&epi->rdllink)) {
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+			ep_pm_stay_awake(epi);
+		}
+	}
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -594,9 +724,8 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 					   struct list_head *, void *),
 			      void *priv, int depth, bool ep_locked)
 {
-	int error, pwake = 0;
+	int error, wake = 0, pwake = 0;
 	unsigned long flags;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	/*
@@ -609,15 +738,13 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * empty list. Events happening while looping w/out locks pile
+	 * up in ep->rdlhead, the poll callback never touches ep->rdllist,
+	 * so the "sproc" callback is able to do it in a lockless way.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_collect_ready(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
 	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/*
@@ -629,27 +756,10 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
-	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
-		}
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
+	 * We re-insert them inside the main ready-list here. Those
+	 * still on "txlist" are taken care of by the list_splice() below.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep_collect_ready(ep);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
@@ -663,7 +773,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake++;
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -673,6 +783,8 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		mutex_unlock(&ep->mtx);
 
 	/* We have to call this outside the lock */
+	if (wake)
+		wake_up(&ep->wq);
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
@@ -711,7 +823,9 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
+	/* The item may still be queued by a callback that ran before */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_collect_ready(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -953,7 +1067,7 @@ static int ep_alloc(struct eventpoll **pep)
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	init_llist_head(&ep->rdlhead);
 	ep->user = user;
 
 	*pep = ep;
@@ -998,11 +1112,16 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  * This is the callback that is passed to the wait queue wakeup
  * mechanism. It is called by the stored file descriptors when they
  * have events to report.
+ *
+ * Items added with EPOLLEXCLUSIVE sit on the target wait queue as
+ * exclusive waiters, and we only return nonzero for them if we woke up
+ * a task waiting in epoll_wait() for these events. That way a wakeup
+ * of the target moves on to the next epoll instance until one of them
+ * has a waiter.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
+	int pwake = 0, ewake = 0;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 
@@ -1017,8 +1136,6 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
@@ -1026,7 +1143,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -1035,33 +1152,18 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Queue the item for ep_scan_ready_list() unless it is queued
+	 * already. Claiming the item with cmpxchg() keeps concurrent
+	 * callbacks from adding it twice, and llist_add() orders the
+	 * queueing before the waitqueue_active() checks below, pairing
+	 * with set_current_state() in ep_poll().
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-			if (epi->ws) {
-				/*
-				 * Activate ep->ws since epi->ws may get
-				 * deactivated at any time.
-				 */
-				__pm_stay_awake(ep->ws);
-			}
-
-		}
-		goto out_unlock;
-	}
-
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (cmpxchg(&epi->rdlnode.next, EP_UNACTIVE_PTR, NULL) ==
+	    EP_UNACTIVE_PTR) {
+		llist_add(&epi->rdlnode, &ep->rdlhead);
 		ep_pm_stay_awake_rcu(epi);
 	}
 
@@ -1069,18 +1171,35 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+	if (waitqueue_active(&ep->wq)) {
+		if ((epi->event.events & EPOLLEXCLUSIVE) &&
+		    !((unsigned long)key & POLLFREE)) {
+			switch ((unsigned long)key & EPOLLINOUT_BITS) {
+			case POLLIN:
+				if (epi->event.events & POLLIN)
+					ewake = 1;
+				break;
+			case POLLOUT:
+				if (epi->event.events & POLLOUT)
+					ewake = 1;
+				break;
+			case 0:
+				ewake = 1;
+				break;
+			}
+		}
+		wake_up(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
+out:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
+	if (epi->event.events & EPOLLEXCLUSIVE)
+		return ewake;
+
 	return 1;
 }
 
@@ -1098,7 +1217,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1267,7 +1389,7 @@ static noinline void ep_destroy_wakeup_source(struct epitem *epi)
 static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd, int full_check)
 {
-	int error, revents, pwake = 0;
+	int error, revents, wake = 0, pwake = 0;
 	unsigned long flags;
 	long user_watches;
 	struct epitem *epi;
@@ -1287,7 +1409,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	epi->rdlnode.next = EP_UNACTIVE_PTR;
 	if (epi->event.events & EPOLLWAKEUP) {
 		error = ep_create_wakeup_source(epi);
 		if (error)
@@ -1328,6 +1450,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	 * protected by "mtx", and ep_insert() is called with "mtx" held.
 	 */
 	ep_rbtree_insert(ep, epi);
+	ep_set_busy_poll_napi_id(epi);
 
 	/* now check if we've created too many backpaths */
 	error = -EINVAL;
@@ -1344,7 +1467,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake++;
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -1354,6 +1477,8 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	atomic_long_inc(&ep->user->epoll_watches);
 
 	/* We have to call this outside the lock */
+	if (wake)
+		wake_up(&ep->wq);
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
@@ -1371,11 +1496,10 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and the item queued on ep->rdlhead.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_collect_ready(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -1394,7 +1518,7 @@ error_create_wakeup_source:
  */
 static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_event *event)
 {
-	int pwake = 0;
+	int wake = 0, pwake = 0;
 	unsigned int revents;
 	poll_table pt;
 
@@ -1420,9 +1544,8 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * 1) Flush epi changes above to other CPUs.  This ensures
 	 *    we do not miss events from ep_poll_callback if an
 	 *    event occurs immediately after we call f_op->poll().
-	 *    We need this because we did not take ep->lock while
-	 *    changing epi above (but ep_poll_callback does take
-	 *    ep->lock).
+	 *    We need this because ep_poll_callback reads the new
+	 *    mask without taking any lock.
 	 *
 	 * 2) We also need to ensure we do not miss _past_ events
 	 *    when calling f_op->poll().  This barrier also
@@ -1452,7 +1575,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake++;
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
@@ -1460,6 +1583,8 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	}
 
 	/* We have to call this outside the lock */
+	if (wake)
+		wake_up(&ep->wq);
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
@@ -1515,6 +1640,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		 * can change the item.
 		 */
 		if (revents) {
+			ep_set_busy_poll_napi_id(epi);
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
 				list_add(&epi->rdllink, head);
@@ -1535,7 +1661,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback will queue them in ep->rdlhead.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 				ep_pm_stay_awake(epi);
@@ -1589,7 +1715,6 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		   int maxevents, long timeout)
 {
 	int res = 0, eavail, timed_out = 0;
-	unsigned long flags;
 	long slack = 0;
 	wait_queue_t wait;
 	ktime_t expires, *to = NULL;
@@ -1606,21 +1731,24 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
-	spin_lock_irqsave(&ep->lock, flags);
+	if (!ep_events_available(ep))
+		ep_busy_loop(ep, timed_out);
 
 	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
+		 * The callback doesn't take ep->lock, ep->wq has its own.
 		 */
 		init_waitqueue_entry(&wait, current);
+		spin_lock_irq(&ep->wq.lock);
 		__add_wait_queue_exclusive(&ep->wq, &wait);
+		spin_unlock_irq(&ep->wq.lock);
 
 		for (;;) {
 			/*
@@ -1636,13 +1764,10 @@ fetch_events:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
+		remove_wait_queue(&ep->wq, &wait);
 
 		set_current_state(TASK_RUNNING);
 	}
@@ -1650,8 +1775,6 @@ check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
@@ -1855,6 +1978,19 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (ep_op_has_event(op))
 		ep_take_care_of_epollwakeup(&epds);
 
+	/*
+	 * EPOLLEXCLUSIVE can only be given on EPOLL_CTL_ADD, for files that
+	 * aren't epoll instances, and together with a limited set of events.
+	 */
+	error = -EINVAL;
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			goto error_tgt_fput;
+		if (op == EPOLL_CTL_ADD && (is_file_epoll(tf.file) ||
+				(epds.events & ~EPOLLEXCLUSIVE_OK_BITS)))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * We have to check that the file structure underneath the file descriptor
 	 * the user passed to us _is_ an eventpoll file. And also we do not permit
@@ -1935,8 +2071,11 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
+			/* The exclusive wait queue entries can't be changed */
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds.events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, &epds);
+			}
 		} else
 			error = -ENOENT;
 		break;
@@ -33,6 +33,7 @@
 #include <linux/ratelimit.h>
 #include <crypto/hash.h>
 #include <linux/falloc.h>
+#include <linux/range_lock.h>
 #ifdef __KERNEL__
 #include <linux/compat.h>
 #endif
@@ -993,6 +994,9 @@ struct ext4_inode_info {
 	atomic_t i_unwritten; /* Nr. of inflight conversions pending */
 	struct work_struct i_rsv_conversion_work;
 
+	/* Buffered writers, see ext4_file_write_iter() */
+	struct range_lock_tree i_write_ranges;
+
 	spinlock_t i_block_reservation_lock;
 
 	/*
@@ -1002,6 +1006,16 @@ struct ext4_inode_info {
 	tid_t i_sync_tid;
 	tid_t i_datasync_tid;
 
+	/*
+	 * Fast commit tracking: the inode's place on sbi->s_fc_q, the range
+	 * of logical blocks whose mapping changed and the last transaction
+	 * that changed it.  [sbi->s_fc_lock]
+	 */
+	struct list_head i_fc_list;
+	ext4_lblk_t i_fc_lblk_start;
+	ext4_lblk_t i_fc_lblk_len;
+	tid_t i_fc_tid;
+
 	/* Precomputed uuid+inum+igen checksum for seeding inode checksums */
 	__u32 i_csum_seed;
 };
@@ -1012,6 +1026,7 @@ struct ext4_inode_info {
 #define	EXT4_VALID_FS			0x0001	/* Unmounted cleanly */
 #define	EXT4_ERROR_FS			0x0002	/* Errors detected */
 #define	EXT4_ORPHAN_FS			0x0004	/* Orphans being recovered */
+#define	EXT4_FC_REPLAYING		0x8000	/* Fast commit replay ongoing */
 
 /*
  * Misc. filesystem flags
@@ -1047,6 +1062,7 @@ struct ext4_inode_info {
 #define EXT4_MOUNT_DIOREAD_NOLOCK	0x400000 /* Enable support for dio read nolocking */
 #define EXT4_MOUNT_JOURNAL_CHECKSUM	0x800000 /* Journal checksums */
 #define EXT4_MOUNT_JOURNAL_ASYNC_COMMIT	0x1000000 /* Journal Async Commit */
+#define EXT4_MOUNT_JOURNAL_FAST_COMMIT	0x2000000 /* Fast commits for fsync */
 #define EXT4_MOUNT_DELALLOC		0x8000000 /* Delalloc support */
 #define EXT4_MOUNT_DATA_ERR_ABORT	0x10000000 /* Abort on file data write */
 #define EXT4_MOUNT_BLOCK_VALIDITY	0x20000000 /* Block validity checking */
@@ -1331,10 +1347,15 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_dir_size_kb;
-	/* where last allocation was done - for stream allocation */
-	unsigned long s_mb_last_group;
-	unsigned long s_mb_last_start;
+	/* where each CPU last allocated - for stream allocation */
+	struct ext4_mb_goal __percpu *s_mb_goals;
+	/* groups by the order of their largest free extent */
+	struct list_head *s_mb_largest_free_orders;
+	rwlock_t *s_mb_largest_free_orders_locks;
+	/* groups below have been brought onto the order lists */
+	ext4_group_t s_mb_uninit_cursor;
 
 	/* stats for buddy allocator */
 	atomic_t s_bal_reqs;	/* number of reqs with len > 1 */
@@ -1401,6 +1422,13 @@ struct ext4_sb_info {
 	struct ratelimit_state s_err_ratelimit_state;
 	struct ratelimit_state s_warning_ratelimit_state;
 	struct ratelimit_state s_msg_ratelimit_state;
+
+	/* Fast commits, see fast_commit.c */
+	struct list_head s_fc_q;	/* inodes to log */
+	struct list_head s_fc_dentry_q;	/* directory entry updates to log */
+	spinlock_t s_fc_lock;
+	tid_t s_fc_ineligible_tid;	/* needs a full commit if set */
+	bool s_fc_ineligible;
 };
 
 static inline struct ext4_sb_info *EXT4_SB(struct super_block *sb)
@@ -2091,6 +2119,20 @@ static inline  unsigned char get_dtype(struct super_block *sb, int filetype)
 	return ext4_filetype_table[filetype];
 }
 
+/* fast_commit.c */
+extern void ext4_fc_track_inode(handle_t *handle, struct inode *inode);
+extern void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+				ext4_lblk_t start, ext4_lblk_t end);
+extern void ext4_fc_track_create(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_track_link(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_track_unlink(handle_t *handle, struct dentry *dentry);
+extern void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle);
+extern void ext4_fc_del(struct inode *inode);
+extern void ext4_fc_cleanup(struct super_block *sb, tid_t tid);
+extern int ext4_fc_commit(journal_t *journal, tid_t tid);
+extern int ext4_fc_init(struct super_block *sb);
+extern void ext4_fc_replay(struct super_block *sb);
+
 /* fsync.c */
 extern int ext4_sync_file(struct file *, loff_t, loff_t, int);
 
@@ -2238,6 +2280,12 @@ extern int ext4_generic_delete_entry(handle_t *handle,
 				     void *entry_buf,
 				     int buf_size,
 				     int csum_size);
+extern int ext4_lookup_ino(struct inode *dir, const struct qstr *d_name,
+			   __u32 *ino);
+extern int __ext4_link(struct inode *dir, struct inode *inode,
+		       struct dentry *dentry);
+extern int __ext4_unlink(handle_t *handle, struct inode *dir,
+			 const struct qstr *d_name, struct inode *inode);
 
 /* resize.c */
 extern int ext4_group_add(struct super_block *sb,
@@ -2249,6 +2297,7 @@ extern int ext4_resize_fs(struct super_block *sb, ext4_fsblk_t n_blocks_count);
 
 /* super.c */
 extern int ext4_calculate_overhead(struct super_block *sb);
+extern int ext4_commit_super(struct super_block *sb, int sync);
 extern void ext4_superblock_csum_set(struct super_block *sb);
 extern void *ext4_kvmalloc(size_t size, gfp_t flags);
 extern void *ext4_kvzalloc(size_t size, gfp_t flags);
@@ -2515,8 +2564,13 @@ do {								\
 /* Update i_disksize. Requires i_mutex to avoid races with truncate */
 static inline void ext4_update_i_disksize(struct inode *inode, loff_t newsize)
 {
+	/*
+	 * Writers within i_size may get here without i_mutex, truncate
+	 * waits for them in ext4_range_write_wait().
+	 */
 	WARN_ON_ONCE(S_ISREG(inode->i_mode) &&
-		     !mutex_is_locked(&inode->i_mutex));
+		     !mutex_is_locked(&inode->i_mutex) &&
+		     newsize > i_size_read(inode));
 	down_write(&EXT4_I(inode)->i_data_sem);
 	if (newsize > EXT4_I(inode)->i_disksize)
 		EXT4_I(inode)->i_disksize = newsize;
@@ -2546,6 +2600,8 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	struct          list_head bb_largest_free_order_node;
+	ext4_group_t	bb_group;	/* group number */
 	struct          list_head bb_prealloc_list;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
@@ -2810,6 +2866,11 @@ extern int ext4_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 			__u64 start, __u64 len);
 extern int ext4_ext_precache(struct inode *inode);
 extern int ext4_collapse_range(struct inode *inode, loff_t offset, loff_t len);
+extern int ext4_ext_next_mapped(struct inode *inode, ext4_lblk_t lblk,
+				ext4_lblk_t *next);
+extern int ext4_ext_replay_add_range(struct inode *inode, ext4_lblk_t lblk,
+				     ext4_fsblk_t pblk, unsigned int len,
+				     int unwritten);
 
 /* move_extent.c */
 extern void ext4_double_down_write_data_sem(struct inode *first,
@@ -2884,6 +2945,15 @@ static inline void ext4_inode_resume_unlocked_dio(struct inode *inode)
 	ext4_clear_inode_state(inode, EXT4_STATE_DIOREAD_LOCK);
 }
 
+/*
+ * Wait for buffered writers that dropped i_mutex, see ext4_file_write_iter().
+ * Called with i_mutex held, which keeps new ones out.
+ */
+static inline void ext4_range_write_wait(struct inode *inode)
+{
+	range_lock_drain(&EXT4_I(inode)->i_write_ranges);
+}
+
 #define in_range(b, first, len)	((b) >= (first) && (b) <= (first) + (len) - 1)
 
 /* For ioend & aio unwritten conversion wait queues */
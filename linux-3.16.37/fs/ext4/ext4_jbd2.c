@@ -63,6 +63,7 @@ handle_t *__ext4_journal_start_sb(struct super_block *sb, unsigned int line,
 				  int type, int blocks, int rsv_blocks)
 {
 	journal_t *journal;
+	handle_t *handle;
 	int err;
 
 	trace_ext4_journal_start(sb, blocks, rsv_blocks, _RET_IP_);
@@ -73,8 +74,14 @@ handle_t *__ext4_journal_start_sb(struct super_block *sb, unsigned int line,
 	journal = EXT4_SB(sb)->s_journal;
 	if (!journal)
 		return ext4_get_nojournal();
-	return jbd2__journal_start(journal, blocks, rsv_blocks, GFP_NOFS,
-				   type, line);
+	handle = jbd2__journal_start(journal, blocks, rsv_blocks, GFP_NOFS,
+				     type, line);
+	/* Operations fast commits cannot describe */
+	if (!IS_ERR(handle) && (type == EXT4_HT_RESIZE ||
+				type == EXT4_HT_MIGRATE ||
+				type == EXT4_HT_MOVE_EXTENTS))
+		ext4_fc_mark_ineligible(sb, handle);
+	return handle;
 }
 
 int __ext4_journal_stop(const char *where, unsigned int line, handle_t *handle)
@@ -4796,6 +4796,7 @@ static long ext4_zero_range(struct file *file, loff_t offset,
 		max_blocks -= lblk;
 
 	mutex_lock(&inode->i_mutex);
+	ext4_range_write_wait(inode);
 
 	/*
 	 * Indirect files do not support unwritten extnets
@@ -4940,6 +4941,7 @@ long ext4_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
 		flags |= EXT4_GET_BLOCKS_KEEP_SIZE;
 
 	mutex_lock(&inode->i_mutex);
+	ext4_range_write_wait(inode);
 
 	/*
 	 * We only support preallocation for extent-based files only
@@ -5439,6 +5441,7 @@ int ext4_collapse_range(struct inode *inode, loff_t offset, loff_t len)
 
 	/* Take mutex lock */
 	mutex_lock(&inode->i_mutex);
+	ext4_range_write_wait(inode);
 
 	/*
 	 * There is no need to overlap collapse range with EOF, in which case
@@ -5467,6 +5470,8 @@ int ext4_collapse_range(struct inode *inode, loff_t offset, loff_t len)
 		ret = PTR_ERR(handle);
 		goto out_dio;
 	}
+	/* Blocks change their logical offset, which replay cannot redo */
+	ext4_fc_mark_ineligible(sb, handle);
 
 	down_write(&EXT4_I(inode)->i_data_sem);
 	ext4_discard_preallocations(inode);
@@ -5510,3 +5515,93 @@ out_mutex:
 	mutex_unlock(&inode->i_mutex);
 	return ret;
 }
+
+/*
+ * Find the first mapped logical block at or after @lblk, for telling how
+ * far a hole goes.  *next is EXT_MAX_BLOCKS if there is none.
+ */
+int ext4_ext_next_mapped(struct inode *inode, ext4_lblk_t lblk,
+			 ext4_lblk_t *next)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent *ex;
+	ext4_lblk_t ee_block;
+
+	down_read(&EXT4_I(inode)->i_data_sem);
+	path = ext4_ext_find_extent(inode, lblk, NULL, 0);
+	if (IS_ERR(path)) {
+		up_read(&EXT4_I(inode)->i_data_sem);
+		return PTR_ERR(path);
+	}
+
+	ex = path[ext_depth(inode)].p_ext;
+	if (!ex) {
+		*next = EXT_MAX_BLOCKS;
+	} else {
+		ee_block = le32_to_cpu(ex->ee_block);
+		if (lblk < ee_block)
+			*next = ee_block;
+		else if (lblk < ee_block + ext4_ext_get_actual_len(ex))
+			*next = lblk;
+		else
+			*next = ext4_ext_next_allocated_block(path);
+	}
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	up_read(&EXT4_I(inode)->i_data_sem);
+	return 0;
+}
+
+/*
+ * Map the hole at [@lblk, @lblk + @len) to the physical blocks starting
+ * at @pblk, for fast commit replay.  The caller owns the blocks already,
+ * they are only inserted into the extent tree and charged to @inode.
+ * Returns how many blocks were mapped, which may be fewer than @len, or
+ * an error.
+ */
+int ext4_ext_replay_add_range(struct inode *inode, ext4_lblk_t lblk,
+			      ext4_fsblk_t pblk, unsigned int len,
+			      int unwritten)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent newex;
+	handle_t *handle;
+	int err;
+
+	len = min_t(unsigned int, len, unwritten ? EXT_UNWRITTEN_MAX_LEN :
+						  EXT_INIT_MAX_LEN);
+
+	handle = ext4_journal_start(inode, EXT4_HT_MAP_BLOCKS,
+				    ext4_chunk_trans_blocks(inode, len));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	newex.ee_block = cpu_to_le32(lblk);
+	ext4_ext_store_pblock(&newex, pblk);
+	newex.ee_len = cpu_to_le16(len);
+	if (unwritten)
+		ext4_ext_mark_unwritten(&newex);
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	path = ext4_ext_find_extent(inode, lblk, NULL, 0);
+	if (IS_ERR(path)) {
+		err = PTR_ERR(path);
+	} else {
+		err = ext4_ext_insert_extent(handle, inode, path, &newex, 0);
+		ext4_ext_drop_refs(path);
+		kfree(path);
+	}
+	if (!err)
+		err = ext4_es_insert_extent(inode, lblk, len, pblk,
+					    unwritten ? EXTENT_STATUS_UNWRITTEN :
+							EXTENT_STATUS_WRITTEN);
+	up_write(&EXT4_I(inode)->i_data_sem);
+	if (!err) {
+		dquot_alloc_block_nofail(inode, len);
+		err = ext4_mark_inode_dirty(handle, inode);
+		if (!err)
+			err = len;
+	}
+	ext4_journal_stop(handle);
+	return err;
+}
@@ -0,0 +1,1382 @@
+/*
+ *  fs/ext4/fast_commit.c
+ *
+ * Fast commits: fsync() without a full journal commit.
+ *
+ * While fast commits are enabled, ext4 keeps track of the inodes the
+ * running transaction changes, of the logical blocks of regular files it
+ * maps or unmaps, and of the directory entries it creates and removes.
+ * An fsync() whose transaction is still running logs the current state of
+ * all of those as the records of fast_commit.h to the fast commit area of
+ * the journal, which takes a handful of block writes, instead of
+ * committing the transaction.  Operations the records cannot describe
+ * (renames, new directories, xattrs, ...) make their transaction
+ * ineligible, and fsync() commits it in full as before.
+ *
+ * At mount, once the journal is recovered, the fast commits written for
+ * the transaction that was running at the time of the crash are replayed
+ * through the regular ext4 code paths.
+ */
+
+#include <linux/fs.h>
+#include <linux/jbd2.h>
+#include <linux/crc32.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/quotaops.h>
+#include <linux/pagemap.h>
+
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+#include "fast_commit.h"
+
+/* A directory entry update waiting to be logged */
+struct ext4_fc_dentry_update {
+	struct list_head	fcd_list;
+	tid_t			fcd_tid;
+	int			fcd_tag;	/* EXT4_FC_TAG_CREAT, ... */
+	__u32			fcd_parent;
+	__u32			fcd_ino;
+	__u32			fcd_generation;
+	umode_t			fcd_mode;
+	unsigned int		fcd_name_len;
+	unsigned char		fcd_name[0];
+};
+
+static bool ext4_fc_enabled(struct super_block *sb, handle_t *handle)
+{
+	return test_opt(sb, JOURNAL_FAST_COMMIT) &&
+	       !(EXT4_SB(sb)->s_mount_state & EXT4_FC_REPLAYING) &&
+	       ext4_handle_valid(handle);
+}
+
+/**
+ * ext4_fc_mark_ineligible() - make a transaction need a full commit
+ * @sb: Filesystem.
+ * @handle: Handle of the transaction doing something fast commits cannot
+ *	    describe.
+ */
+void ext4_fc_mark_ineligible(struct super_block *sb, handle_t *handle)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	tid_t tid;
+
+	if (!ext4_fc_enabled(sb, handle))
+		return;
+
+	tid = handle->h_transaction->t_tid;
+	spin_lock(&sbi->s_fc_lock);
+	if (!sbi->s_fc_ineligible || tid_gt(tid, sbi->s_fc_ineligible_tid)) {
+		sbi->s_fc_ineligible = true;
+		sbi->s_fc_ineligible_tid = tid;
+	}
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * Inodes the records cannot describe.  Only the root directory of the
+ * reserved inodes can be logged; the others (journal, resize, quota, ...)
+ * change through paths fast commits do not know about.
+ */
+static bool ext4_fc_ineligible_inode(struct inode *inode)
+{
+	if (inode->i_ino < EXT4_FIRST_INO(inode->i_sb) &&
+	    inode->i_ino != EXT4_ROOT_INO)
+		return true;
+	return ext4_should_journal_data(inode) || ext4_has_inline_data(inode);
+}
+
+static void __ext4_fc_track_inode(struct ext4_sb_info *sbi,
+				  struct ext4_inode_info *ei, tid_t tid)
+{
+	ei->i_fc_tid = tid;
+	if (list_empty(&ei->i_fc_list))
+		list_add_tail(&ei->i_fc_list, &sbi->s_fc_q);
+}
+
+/**
+ * ext4_fc_track_inode() - remember that a transaction changed an inode
+ * @handle: Handle the inode was changed in.
+ * @inode: The inode.
+ *
+ * Called from ext4_mark_inode_dirty(), so that the next fast commit logs
+ * the inode's attributes.
+ */
+void ext4_fc_track_inode(handle_t *handle, struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	tid_t tid;
+
+	if (!ext4_fc_enabled(inode->i_sb, handle))
+		return;
+	if (ext4_fc_ineligible_inode(inode)) {
+		ext4_fc_mark_ineligible(inode->i_sb, handle);
+		return;
+	}
+
+	/*
+	 * Unlocked check: an inode found queued for the running transaction
+	 * stays queued until that transaction commits, which it cannot do
+	 * while we hold a handle on it.
+	 */
+	tid = handle->h_transaction->t_tid;
+	if (ei->i_fc_tid == tid && !list_empty(&ei->i_fc_list))
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	__ext4_fc_track_inode(sbi, ei, tid);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/**
+ * ext4_fc_track_range() - remember that blocks of an inode were remapped
+ * @handle: Handle the mapping was changed in.
+ * @inode: The inode.
+ * @start: First logical block whose mapping changed.
+ * @end: Last logical block whose mapping changed.
+ *
+ * The next fast commit logs the mapping of the blocks as it is then.
+ * Directory blocks are not logged; replaying the directory entry records
+ * rebuilds them.
+ */
+void ext4_fc_track_range(handle_t *handle, struct inode *inode,
+			 ext4_lblk_t start, ext4_lblk_t end)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t old_end;
+
+	if (!ext4_fc_enabled(inode->i_sb, handle) || S_ISDIR(inode->i_mode) ||
+	    start > end)
+		return;
+	if (!S_ISREG(inode->i_mode) || ext4_fc_ineligible_inode(inode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
+		ext4_fc_mark_ineligible(inode->i_sb, handle);
+		return;
+	}
+
+	spin_lock(&sbi->s_fc_lock);
+	__ext4_fc_track_inode(sbi, ei, handle->h_transaction->t_tid);
+	if (ei->i_fc_lblk_len) {
+		old_end = ei->i_fc_lblk_start + ei->i_fc_lblk_len - 1;
+		start = min(start, ei->i_fc_lblk_start);
+		end = max(end, old_end);
+	}
+	ei->i_fc_lblk_start = start;
+	ei->i_fc_lblk_len = end - start + 1;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+static void ext4_fc_track_dentry(handle_t *handle, struct dentry *dentry,
+				 int tag)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct inode *inode = dentry->d_inode;
+	struct super_block *sb = dir->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_fc_dentry_update *fcd;
+	tid_t tid;
+
+	if (!ext4_fc_enabled(sb, handle))
+		return;
+	if (ext4_fc_ineligible_inode(dir) || ext4_fc_ineligible_inode(inode)) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+
+	fcd = kmalloc(sizeof(*fcd) + dentry->d_name.len, GFP_NOFS);
+	if (!fcd) {
+		ext4_fc_mark_ineligible(sb, handle);
+		return;
+	}
+	tid = handle->h_transaction->t_tid;
+	fcd->fcd_tid = tid;
+	fcd->fcd_tag = tag;
+	fcd->fcd_parent = dir->i_ino;
+	fcd->fcd_ino = inode->i_ino;
+	fcd->fcd_generation = inode->i_generation;
+	fcd->fcd_mode = inode->i_mode;
+	fcd->fcd_name_len = dentry->d_name.len;
+	memcpy(fcd->fcd_name, dentry->d_name.name, dentry->d_name.len);
+
+	spin_lock(&sbi->s_fc_lock);
+	list_add_tail(&fcd->fcd_list, &sbi->s_fc_dentry_q);
+	__ext4_fc_track_inode(sbi, EXT4_I(dir), tid);
+	__ext4_fc_track_inode(sbi, EXT4_I(inode), tid);
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+void ext4_fc_track_create(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_CREAT);
+}
+
+void ext4_fc_track_link(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_LINK);
+}
+
+void ext4_fc_track_unlink(handle_t *handle, struct dentry *dentry)
+{
+	ext4_fc_track_dentry(handle, dentry, EXT4_FC_TAG_UNLINK);
+}
+
+/**
+ * ext4_fc_del() - forget an inode that is being evicted
+ * @inode: The inode.
+ */
+void ext4_fc_del(struct inode *inode)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	if (list_empty(&ei->i_fc_list))
+		return;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_del_init(&ei->i_fc_list);
+	ei->i_fc_lblk_len = 0;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/**
+ * ext4_fc_cleanup() - forget what a committed transaction changed
+ * @sb: Filesystem.
+ * @tid: The transaction that committed.
+ *
+ * Called from the journal commit callback.
+ */
+void ext4_fc_cleanup(struct super_block *sb, tid_t tid)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_inode_info *ei, *ei_next;
+	struct ext4_fc_dentry_update *fcd, *fcd_next;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry_safe(ei, ei_next, &sbi->s_fc_q, i_fc_list) {
+		if (tid_gt(ei->i_fc_tid, tid))
+			continue;
+		list_del_init(&ei->i_fc_list);
+		ei->i_fc_lblk_len = 0;
+	}
+	list_for_each_entry_safe(fcd, fcd_next, &sbi->s_fc_dentry_q,
+				 fcd_list) {
+		if (tid_gt(fcd->fcd_tid, tid))
+			continue;
+		list_del(&fcd->fcd_list);
+		kfree(fcd);
+	}
+	if (sbi->s_fc_ineligible && !tid_gt(sbi->s_fc_ineligible_tid, tid))
+		sbi->s_fc_ineligible = false;
+	spin_unlock(&sbi->s_fc_lock);
+}
+
+/*
+ * Take references to the queued inodes, at most @nr of them.  Eviction
+ * removes inodes from the queue, so those being freed are skipped.
+ */
+static int ext4_fc_grab_inodes(struct ext4_sb_info *sbi,
+			       struct inode **inodes, int nr)
+{
+	struct ext4_inode_info *ei;
+	struct inode *inode;
+	int i = 0;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list) {
+		if (i == nr)
+			break;
+		inode = igrab(&ei->vfs_inode);
+		if (inode)
+			inodes[i++] = inode;
+	}
+	spin_unlock(&sbi->s_fc_lock);
+	return i;
+}
+
+static struct inode **ext4_fc_alloc_inodes(struct ext4_sb_info *sbi,
+					   int *nr)
+{
+	struct ext4_inode_info *ei;
+	int n = 0;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_for_each_entry(ei, &sbi->s_fc_q, i_fc_list)
+		n++;
+	spin_unlock(&sbi->s_fc_lock);
+
+	*nr = n;
+	return kmalloc_array(max(n, 1), sizeof(struct inode *), GFP_NOFS);
+}
+
+static void ext4_fc_put_inodes(struct inode **inodes, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		iput(inodes[i]);
+	kfree(inodes);
+}
+
+/*
+ * Write out and wait for the data of every queued inode, so that none of
+ * the blocks a fast commit maps can still hold stale data.  This has to
+ * happen before the fast commit owns the journal: writeback may need to
+ * start handles, and those may have to wait for a commit.
+ */
+static int ext4_fc_flush_data(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct inode **inodes;
+	int i, nr, ret = 0;
+
+	inodes = ext4_fc_alloc_inodes(sbi, &nr);
+	if (!inodes)
+		return -ENOMEM;
+	nr = ext4_fc_grab_inodes(sbi, inodes, nr);
+	for (i = 0; i < nr && !ret; i++)
+		if (S_ISREG(inodes[i]->i_mode))
+			ret = filemap_write_and_wait(inodes[i]->i_mapping);
+	ext4_fc_put_inodes(inodes, nr);
+	return ret;
+}
+
+/*
+ * Data that is not safely on disk yet: pages written back right now may
+ * belong to blocks the fast commit is about to map, and so may dirty
+ * pages without delayed allocation.  Unwritten extents waiting to be
+ * converted would be logged as unwritten.  Inodes in any of those states
+ * were changed again since ext4_fc_flush_data(); fall back to a full
+ * commit then.
+ */
+static bool ext4_fc_inode_busy(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+
+	if (!S_ISREG(inode->i_mode))
+		return false;
+	if (mapping_tagged(mapping, PAGECACHE_TAG_WRITEBACK) ||
+	    atomic_read(&EXT4_I(inode)->i_unwritten))
+		return true;
+	return !test_opt(inode->i_sb, DELALLOC) &&
+	       mapping_tagged(mapping, PAGECACHE_TAG_DIRTY);
+}
+
+/* Appends records to the fast commit area, block by block */
+struct ext4_fc_writer {
+	journal_t		*fcw_journal;
+	struct buffer_head	*fcw_bh;
+	unsigned int		fcw_off;	/* in fcw_bh */
+	int			fcw_nblocks;
+	u32			fcw_crc;
+};
+
+static int ext4_fc_write(struct ext4_fc_writer *w, const void *src,
+			 unsigned int len, bool crc)
+{
+	unsigned int blocksize = w->fcw_journal->j_blocksize;
+	unsigned int n;
+	int ret;
+
+	if (crc)
+		w->fcw_crc = crc32_le(w->fcw_crc, src, len);
+	while (len) {
+		if (!w->fcw_bh || w->fcw_off == blocksize) {
+			ret = jbd2_fc_get_buf(w->fcw_journal, &w->fcw_bh);
+			if (ret)
+				return ret;
+			w->fcw_nblocks++;
+			w->fcw_off = 0;
+		}
+		n = min(len, blocksize - w->fcw_off);
+		memcpy(w->fcw_bh->b_data + w->fcw_off, src, n);
+		w->fcw_off += n;
+		src += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int ext4_fc_write_tl(struct ext4_fc_writer *w, int tag,
+			    unsigned int len)
+{
+	struct ext4_fc_tl tl;
+
+	tl.fc_tag = cpu_to_le16(tag);
+	tl.fc_len = cpu_to_le16(len);
+	return ext4_fc_write(w, &tl, sizeof(tl), true);
+}
+
+static int ext4_fc_write_tlv(struct ext4_fc_writer *w, int tag,
+			     const void *val, unsigned int len)
+{
+	int ret;
+
+	ret = ext4_fc_write_tl(w, tag, len);
+	if (!ret)
+		ret = ext4_fc_write(w, val, len, true);
+	return ret;
+}
+
+static int ext4_fc_write_dentry(struct ext4_fc_writer *w,
+				struct ext4_fc_dentry_update *fcd)
+{
+	struct ext4_fc_dentry_info di;
+	int ret;
+
+	memset(&di, 0, sizeof(di));
+	di.fc_parent_ino = cpu_to_le32(fcd->fcd_parent);
+	di.fc_ino = cpu_to_le32(fcd->fcd_ino);
+	if (fcd->fcd_tag == EXT4_FC_TAG_CREAT) {
+		di.fc_generation = cpu_to_le32(fcd->fcd_generation);
+		di.fc_mode = cpu_to_le16(fcd->fcd_mode);
+	}
+	ret = ext4_fc_write_tl(w, fcd->fcd_tag,
+			       sizeof(di) + fcd->fcd_name_len);
+	if (!ret)
+		ret = ext4_fc_write(w, &di, sizeof(di), true);
+	if (!ret)
+		ret = ext4_fc_write(w, fcd->fcd_name, fcd->fcd_name_len, true);
+	return ret;
+}
+
+/*
+ * Log the current mapping of [@start, @start + @len) of @inode: mapped
+ * extents as ADD_RANGE records, split at block group boundaries so that
+ * replay can allocate each one in one go, and holes as DEL_RANGE records.
+ */
+static int ext4_fc_write_ranges(struct ext4_fc_writer *w, struct inode *inode,
+				ext4_lblk_t start, ext4_lblk_t len)
+{
+	struct super_block *sb = inode->i_sb;
+	ext4_lblk_t cur = start, end = start + len - 1, next;
+	struct ext4_fc_add_range add;
+	struct ext4_fc_del_range del;
+	struct ext4_map_blocks map;
+	ext4_group_t group;
+	ext4_grpblk_t offset;
+	unsigned int n;
+	int ret;
+
+	while (cur <= end) {
+		map.m_lblk = cur;
+		map.m_len = end - cur + 1;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+
+		if (ret > 0) {
+			ext4_get_group_no_and_offset(sb, map.m_pblk, &group,
+						     &offset);
+			n = min_t(unsigned int, ret,
+				  EXT4_BLOCKS_PER_GROUP(sb) - offset);
+			add.fc_ino = cpu_to_le32(inode->i_ino);
+			add.fc_lblk = cpu_to_le32(cur);
+			add.fc_pblk = cpu_to_le64(map.m_pblk);
+			add.fc_len = cpu_to_le32(n);
+			add.fc_unwritten = cpu_to_le32(
+				!!(map.m_flags & EXT4_MAP_UNWRITTEN));
+			ret = ext4_fc_write_tlv(w, EXT4_FC_TAG_ADD_RANGE,
+						&add, sizeof(add));
+		} else {
+			ret = ext4_ext_next_mapped(inode, cur, &next);
+			if (ret)
+				return ret;
+			if (next <= cur)
+				return -EIO;
+			n = min_t(ext4_lblk_t, next - 1, end) - cur + 1;
+			del.fc_ino = cpu_to_le32(inode->i_ino);
+			del.fc_lblk = cpu_to_le32(cur);
+			del.fc_len = cpu_to_le32(n);
+			ret = ext4_fc_write_tlv(w, EXT4_FC_TAG_DEL_RANGE,
+						&del, sizeof(del));
+		}
+		if (ret)
+			return ret;
+		if (end - cur < n)
+			break;
+		cur += n;
+	}
+	return 0;
+}
+
+static int ext4_fc_write_inode(struct ext4_fc_writer *w, struct inode *inode)
+{
+	struct ext4_fc_inode fi;
+
+	memset(&fi, 0, sizeof(fi));
+	fi.fc_ino = cpu_to_le32(inode->i_ino);
+	fi.fc_generation = cpu_to_le32(inode->i_generation);
+	fi.fc_mode = cpu_to_le16(inode->i_mode);
+	fi.fc_uid = cpu_to_le32(i_uid_read(inode));
+	fi.fc_gid = cpu_to_le32(i_gid_read(inode));
+	if (S_ISREG(inode->i_mode))
+		fi.fc_size = cpu_to_le64(EXT4_I(inode)->i_disksize);
+	fi.fc_atime = cpu_to_le64(inode->i_atime.tv_sec);
+	fi.fc_atime_nsec = cpu_to_le32(inode->i_atime.tv_nsec);
+	fi.fc_mtime = cpu_to_le64(inode->i_mtime.tv_sec);
+	fi.fc_mtime_nsec = cpu_to_le32(inode->i_mtime.tv_nsec);
+	fi.fc_ctime = cpu_to_le64(inode->i_ctime.tv_sec);
+	fi.fc_ctime_nsec = cpu_to_le32(inode->i_ctime.tv_nsec);
+	return ext4_fc_write_tlv(w, EXT4_FC_TAG_INODE, &fi, sizeof(fi));
+}
+
+/*
+ * Format and write the fast commit for @tid, which must still be the
+ * running transaction.  Updates are locked out while the records are
+ * formatted, so they are a consistent snapshot of the transaction, and
+ * what was logged is dropped from the queues before anyone can change
+ * it again.  The caller iputs *inodesp.
+ */
+static int ext4_fc_perform_commit(struct super_block *sb, tid_t tid,
+				  struct inode ***inodesp, int *nrp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	struct ext4_fc_dentry_update *fcd, *fcd_next;
+	struct ext4_fc_writer w = { .fcw_journal = journal, .fcw_crc = ~0 };
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_inode_info *ei;
+	struct inode **inodes;
+	LIST_HEAD(dentries);
+	bool eligible;
+	int i, nr, ret;
+
+	*nrp = 0;
+	*inodesp = NULL;
+	jbd2_journal_lock_updates(journal);
+
+	ret = -EAGAIN;
+	read_lock(&journal->j_state_lock);
+	eligible = journal->j_running_transaction &&
+		   journal->j_running_transaction->t_tid == tid;
+	read_unlock(&journal->j_state_lock);
+	/* Quota files are not logged */
+	if (!eligible || sb_any_quota_loaded(sb))
+		goto out_unlock;
+
+	spin_lock(&sbi->s_fc_lock);
+	eligible = !sbi->s_fc_ineligible ||
+		   tid_gt(tid, sbi->s_fc_ineligible_tid);
+	spin_unlock(&sbi->s_fc_lock);
+	if (!eligible)
+		goto out_unlock;
+
+	ret = -ENOMEM;
+	inodes = ext4_fc_alloc_inodes(sbi, &nr);
+	if (!inodes)
+		goto out_unlock;
+	nr = ext4_fc_grab_inodes(sbi, inodes, nr);
+	*inodesp = inodes;
+	*nrp = nr;
+
+	ret = -EAGAIN;
+	for (i = 0; i < nr; i++)
+		if (ext4_fc_inode_busy(inodes[i]))
+			goto out_unlock;
+
+	spin_lock(&sbi->s_fc_lock);
+	list_splice_init(&sbi->s_fc_dentry_q, &dentries);
+	spin_unlock(&sbi->s_fc_lock);
+
+	/* Nothing changed since the last fast commit */
+	ret = 0;
+	if (!nr && list_empty(&dentries))
+		goto out_unlock;
+
+	head.fc_features = 0;
+	head.fc_tid = cpu_to_le32(tid);
+	ret = ext4_fc_write_tlv(&w, EXT4_FC_TAG_HEAD, &head, sizeof(head));
+
+	list_for_each_entry(fcd, &dentries, fcd_list) {
+		if (ret)
+			break;
+		ret = ext4_fc_write_dentry(&w, fcd);
+	}
+
+	for (i = 0; i < nr && !ret; i++) {
+		ei = EXT4_I(inodes[i]);
+		if (S_ISREG(inodes[i]->i_mode) && ei->i_fc_lblk_len)
+			ret = ext4_fc_write_ranges(&w, inodes[i],
+						   ei->i_fc_lblk_start,
+						   ei->i_fc_lblk_len);
+		if (!ret)
+			ret = ext4_fc_write_inode(&w, inodes[i]);
+	}
+
+	if (!ret) {
+		tail.fc_tid = cpu_to_le32(tid);
+		ret = ext4_fc_write_tl(&w, EXT4_FC_TAG_TAIL, sizeof(tail));
+	}
+	if (!ret)
+		ret = ext4_fc_write(&w, &tail.fc_tid, sizeof(tail.fc_tid),
+				    true);
+	if (!ret) {
+		tail.fc_crc = cpu_to_le32(w.fcw_crc);
+		ret = ext4_fc_write(&w, &tail.fc_crc, sizeof(tail.fc_crc),
+				    false);
+	}
+	if (ret) {
+		jbd2_fc_release_bufs(journal, w.fcw_nblocks);
+		goto out_unlock;
+	}
+
+	spin_lock(&sbi->s_fc_lock);
+	for (i = 0; i < nr; i++) {
+		ei = EXT4_I(inodes[i]);
+		list_del_init(&ei->i_fc_list);
+		ei->i_fc_lblk_len = 0;
+	}
+	spin_unlock(&sbi->s_fc_lock);
+
+	jbd2_journal_unlock_updates(journal);
+	ret = jbd2_fc_write_bufs(journal, w.fcw_nblocks);
+	goto out_free;
+
+out_unlock:
+	jbd2_journal_unlock_updates(journal);
+out_free:
+	/* Records that were not logged are covered by the full commit */
+	list_for_each_entry_safe(fcd, fcd_next, &dentries, fcd_list)
+		kfree(fcd);
+	return ret;
+}
+
+/**
+ * ext4_fc_commit() - make a transaction durable with a fast commit
+ * @journal: Journal of the filesystem.
+ * @tid: The transaction to commit.
+ *
+ * Returns 0 once the changes @tid has made so far are durable, or -EAGAIN
+ * if the caller has to commit @tid in full, which has been started then.
+ */
+int ext4_fc_commit(journal_t *journal, tid_t tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct inode **inodes;
+	bool committed;
+	int nr, ret;
+
+	read_lock(&journal->j_state_lock);
+	committed = !tid_gt(tid, journal->j_commit_sequence);
+	read_unlock(&journal->j_state_lock);
+	if (committed)
+		return -EAGAIN;
+
+	if (ext4_fc_flush_data(sb))
+		return -EAGAIN;
+
+	if (jbd2_fc_begin_commit(journal, tid))
+		return -EAGAIN;
+	ret = ext4_fc_perform_commit(sb, tid, &inodes, &nr);
+	/* Before anyone can append to a fast commit that did not make it */
+	if (ret)
+		jbd2_log_start_commit(journal, tid);
+	jbd2_fc_end_commit(journal);
+
+	/* Evicting an unlinked inode needs a handle, so not before now */
+	if (inodes)
+		ext4_fc_put_inodes(inodes, nr);
+	if (ret)
+		return -EAGAIN;
+
+	/* The data written by the caller needs flushing all the same */
+	if (!nr && journal->j_flags & JBD2_BARRIER)
+		return blkdev_issue_flush(sb->s_bdev, GFP_KERNEL, NULL);
+	return 0;
+}
+
+/**
+ * ext4_fc_init() - set up fast commits for a mounted filesystem
+ * @sb: Filesystem, with its journal loaded.
+ *
+ * Gives the journal a fast commit area, if it has none yet.  Read-only
+ * mounts get theirs when remounted read-write.
+ */
+int ext4_fc_init(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int err;
+
+	if (!test_opt(sb, JOURNAL_FAST_COMMIT) || sb->s_flags & MS_RDONLY)
+		return 0;
+
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC) ||
+	    EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_INLINE_DATA)) {
+		ext4_msg(sb, KERN_ERR, "can't mount with journal_fast_commit "
+			 "on a filesystem with bigalloc or inline_data");
+		return -EINVAL;
+	}
+
+	err = jbd2_fc_init(sbi->s_journal, EXT4_FC_AREA_BLOCKS);
+	if (err) {
+		ext4_msg(sb, KERN_ERR, "can't set up a fast commit area "
+			 "in the journal: %d", err);
+		return err;
+	}
+	return 0;
+}
+
+/*
+ * Replay
+ */
+
+struct ext4_fc_replay_ctx {
+	struct super_block	*sb;
+	journal_t		*journal;
+	tid_t			tid;
+	bool			any_tid;	/* take the tid from the area */
+	char			*buf;		/* the area, as far as read */
+	unsigned long		nblocks;	/* of the area in buf */
+	unsigned long		maxblocks;
+	size_t			len;		/* of the valid fast commits */
+	unsigned int		nr_add;		/* ADD_RANGE records in them */
+	unsigned long		*claimed;	/* ADD_RANGE blocks claimed */
+	unsigned int		nr_records;
+};
+
+/* Read the area up to byte @end into ctx->buf */
+static int ext4_fc_read_upto(struct ext4_fc_replay_ctx *ctx, size_t end)
+{
+	unsigned int blocksize = ctx->journal->j_blocksize;
+	struct buffer_head *bh;
+
+	while ((size_t)ctx->nblocks * blocksize < end) {
+		if (ctx->nblocks == ctx->maxblocks)
+			return -ENODATA;
+		bh = jbd2_fc_read_buf(ctx->journal, ctx->nblocks);
+		if (!bh)
+			return -EIO;
+		memcpy(ctx->buf + ctx->nblocks * blocksize, bh->b_data,
+		       blocksize);
+		brelse(bh);
+		ctx->nblocks++;
+	}
+	return 0;
+}
+
+/*
+ * Find the fast commits to replay: a chain of them from the start of the
+ * area, each with a HEAD for ctx->tid and a TAIL whose checksum matches.
+ * The first one that does not qualify ends the chain.
+ */
+static int ext4_fc_scan(struct ext4_fc_replay_ctx *ctx)
+{
+	unsigned int blocksize = ctx->journal->j_blocksize;
+	struct ext4_fc_head head;
+	struct ext4_fc_tail tail;
+	struct ext4_fc_tl tl;
+	size_t start, pos = 0;
+	unsigned int nr_add;
+	int err;
+	u32 crc;
+
+	for (;;) {
+		start = pos;
+		err = ext4_fc_read_upto(ctx, pos + sizeof(tl) + sizeof(head));
+		if (err)
+			break;
+		memcpy(&tl, ctx->buf + pos, sizeof(tl));
+		memcpy(&head, ctx->buf + pos + sizeof(tl), sizeof(head));
+		if (le16_to_cpu(tl.fc_tag) != EXT4_FC_TAG_HEAD ||
+		    le16_to_cpu(tl.fc_len) != sizeof(head))
+			break;
+		if (ctx->any_tid) {
+			ctx->tid = le32_to_cpu(head.fc_tid);
+			ctx->any_tid = false;
+		}
+		if (le32_to_cpu(head.fc_tid) != ctx->tid)
+			break;
+		pos += sizeof(tl) + sizeof(head);
+
+		nr_add = 0;
+		for (;;) {
+			err = ext4_fc_read_upto(ctx, pos + sizeof(tl));
+			if (err)
+				goto out;
+			memcpy(&tl, ctx->buf + pos, sizeof(tl));
+			err = ext4_fc_read_upto(ctx, pos + sizeof(tl) +
+						le16_to_cpu(tl.fc_len));
+			if (err)
+				goto out;
+			if (le16_to_cpu(tl.fc_tag) == EXT4_FC_TAG_TAIL)
+				break;
+			if (le16_to_cpu(tl.fc_tag) == EXT4_FC_TAG_ADD_RANGE)
+				nr_add++;
+			pos += sizeof(tl) + le16_to_cpu(tl.fc_len);
+		}
+
+		if (le16_to_cpu(tl.fc_len) != sizeof(tail))
+			break;
+		memcpy(&tail, ctx->buf + pos + sizeof(tl), sizeof(tail));
+		crc = crc32_le(~0, ctx->buf + start,
+			       pos + sizeof(tl) + sizeof(tail.fc_tid) - start);
+		if (le32_to_cpu(tail.fc_tid) != ctx->tid ||
+		    le32_to_cpu(tail.fc_crc) != crc)
+			break;
+
+		pos += sizeof(tl) + sizeof(tail);
+		ctx->len = pos;
+		ctx->nr_add += nr_add;
+		pos = ALIGN(pos, blocksize);
+	}
+out:
+	return err == -EIO ? err : 0;
+}
+
+/*
+ * Call @fn for every record of the valid fast commits, HEAD and TAIL
+ * aside, with the number of ADD_RANGE records before it.
+ */
+static int ext4_fc_for_each_record(struct ext4_fc_replay_ctx *ctx,
+		int (*fn)(struct ext4_fc_replay_ctx *, int, void *, int, int))
+{
+	unsigned int blocksize = ctx->journal->j_blocksize;
+	union {
+		struct ext4_fc_add_range add;
+		struct ext4_fc_del_range del;
+		struct ext4_fc_inode inode;
+		struct ext4_fc_dentry_info di;
+		char raw[sizeof(struct ext4_fc_dentry_info) + EXT4_NAME_LEN];
+	} val;
+	struct ext4_fc_tl tl;
+	size_t pos = 0;
+	int tag, len, nr_add = 0;
+	int err;
+
+	ctx->nr_records = 0;
+	while (pos < ctx->len) {
+		memcpy(&tl, ctx->buf + pos, sizeof(tl));
+		tag = le16_to_cpu(tl.fc_tag);
+		len = le16_to_cpu(tl.fc_len);
+		pos += sizeof(tl) + len;
+		if (tag == EXT4_FC_TAG_TAIL) {
+			pos = ALIGN(pos, blocksize);
+			continue;
+		}
+		if (tag == EXT4_FC_TAG_HEAD)
+			continue;
+
+		if (len > sizeof(val))
+			return -EIO;
+		ctx->nr_records++;
+		memset(&val, 0, sizeof(val));
+		memcpy(&val, ctx->buf + pos - len, len);
+		err = fn(ctx, tag, &val, len, nr_add);
+		if (err)
+			return err;
+		if (tag == EXT4_FC_TAG_ADD_RANGE)
+			nr_add++;
+	}
+	return 0;
+}
+
+static struct inode *ext4_fc_iget(struct super_block *sb, __le32 ino)
+{
+	return ext4_iget(sb, le32_to_cpu(ino));
+}
+
+/*
+ * Inodes and names the records refer to may have gone away later in the
+ * same transaction, or in a replay that was interrupted.
+ */
+static bool ext4_fc_gone(struct inode *inode)
+{
+	return PTR_ERR(inode) == -ESTALE || PTR_ERR(inode) == -ENOENT;
+}
+
+/*
+ * Pass one: claim the blocks of every ADD_RANGE record in the bitmaps,
+ * before anything else replay does can allocate them for extent tree or
+ * directory blocks.  The root directory is charged for them until they
+ * are mapped.  Blocks in use already were claimed, and possibly mapped,
+ * by an interrupted replay; the blocks of a record are never used for
+ * anything else.
+ */
+static int ext4_fc_claim(struct ext4_fc_replay_ctx *ctx, int tag, void *val,
+			 int len, int idx)
+{
+	struct ext4_fc_add_range *add = val;
+	struct super_block *sb = ctx->sb;
+	struct inode *root = sb->s_root->d_inode;
+	struct ext4_allocation_request ar;
+	ext4_fsblk_t pblk;
+	handle_t *handle;
+	int err = 0;
+
+	if (tag != EXT4_FC_TAG_ADD_RANGE)
+		return 0;
+	if (len != sizeof(*add))
+		return -EIO;
+
+	handle = ext4_journal_start(root, EXT4_HT_MAP_BLOCKS,
+				    EXT4_DATA_TRANS_BLOCKS(sb));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	memset(&ar, 0, sizeof(ar));
+	ar.inode = root;
+	ar.goal = le64_to_cpu(add->fc_pblk);
+	ar.len = le32_to_cpu(add->fc_len);
+	ar.flags = EXT4_MB_HINT_GOAL_ONLY | EXT4_MB_HINT_TRY_GOAL |
+		   EXT4_MB_USE_ROOT_BLOCKS;
+	pblk = ext4_mb_new_blocks(handle, &ar, &err);
+	if (pblk == le64_to_cpu(add->fc_pblk) &&
+	    ar.len == le32_to_cpu(add->fc_len)) {
+		set_bit(idx, ctx->claimed);
+	} else if (pblk) {
+		ext4_free_blocks(handle, root, NULL, pblk, ar.len, 0);
+		err = -ENOSPC;
+	} else if (err == -ENOSPC) {
+		err = 0;
+	}
+	ext4_journal_stop(handle);
+	return err;
+}
+
+/* Unmap [@lblk, @lblk + @len) of @inode */
+static int ext4_fc_replay_unmap(struct inode *inode, ext4_lblk_t lblk,
+				ext4_lblk_t len)
+{
+	int err;
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	err = ext4_es_remove_extent(inode, lblk, len);
+	if (!err)
+		err = ext4_ext_remove_space(inode, lblk, lblk + len - 1);
+	up_write(&EXT4_I(inode)->i_data_sem);
+	return err;
+}
+
+/* Convert [@lblk, @lblk + @len) of @inode back to unwritten */
+static int ext4_fc_replay_unwrite(struct inode *inode, ext4_lblk_t lblk,
+				  ext4_lblk_t len)
+{
+	struct ext4_map_blocks map;
+	handle_t *handle;
+	int ret;
+
+	handle = ext4_journal_start(inode, EXT4_HT_MAP_BLOCKS,
+				    ext4_chunk_trans_blocks(inode, len));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+	map.m_lblk = lblk;
+	map.m_len = len;
+	ret = ext4_map_blocks(handle, inode, &map,
+			      EXT4_GET_BLOCKS_CREATE_UNWRIT_EXT |
+			      EXT4_GET_BLOCKS_CONVERT_UNWRITTEN);
+	ext4_journal_stop(handle);
+	return ret < 0 ? ret : 0;
+}
+
+static int ext4_fc_replay_add_range(struct ext4_fc_replay_ctx *ctx,
+				    struct ext4_fc_add_range *add, int idx)
+{
+	struct super_block *sb = ctx->sb;
+	ext4_lblk_t lblk = le32_to_cpu(add->fc_lblk);
+	ext4_lblk_t end = lblk + le32_to_cpu(add->fc_len);
+	ext4_fsblk_t pblk = le64_to_cpu(add->fc_pblk);
+	bool unwritten = le32_to_cpu(add->fc_unwritten);
+	bool claimed = test_bit(idx, ctx->claimed);
+	struct ext4_map_blocks map;
+	struct inode *inode;
+	ext4_lblk_t cur, next;
+	int ret = 0;
+
+	inode = ext4_fc_iget(sb, add->fc_ino);
+	if (IS_ERR(inode)) {
+		if (!ext4_fc_gone(inode))
+			return PTR_ERR(inode);
+		inode = NULL;
+		goto out;
+	}
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
+		ret = -EIO;
+		goto out;
+	}
+
+	for (cur = lblk; cur < end && ret >= 0; ) {
+		map.m_lblk = cur;
+		map.m_len = end - cur;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			break;
+
+		if (ret > 0 && map.m_pblk == pblk + cur - lblk) {
+			/* In place already, maybe to convert */
+			if (!unwritten && map.m_flags & EXT4_MAP_UNWRITTEN)
+				ret = ext4_convert_unwritten_extents(NULL,
+					inode, (loff_t)cur << inode->i_blkbits,
+					(ssize_t)ret << inode->i_blkbits);
+			else if (unwritten && map.m_flags & EXT4_MAP_MAPPED)
+				ret = ext4_fc_replay_unwrite(inode, cur, ret);
+			cur += map.m_len;
+		} else if (ret > 0) {
+			/* Mapped elsewhere, unmap first */
+			ret = ext4_fc_replay_unmap(inode, cur, map.m_len);
+		} else {
+			ret = ext4_ext_next_mapped(inode, cur, &next);
+			if (ret)
+				break;
+			next = min(next, end);
+			ret = ext4_ext_replay_add_range(inode, cur,
+							pblk + cur - lblk,
+							next - cur, unwritten);
+			if (ret > 0)
+				cur += ret;
+		}
+	}
+	if (ret > 0)
+		ret = 0;
+out:
+	if (claimed) {
+		/* The blocks are charged to their inode now, or free again */
+		struct inode *root = sb->s_root->d_inode;
+
+		if (ret || !inode) {
+			handle_t *handle;
+
+			handle = ext4_journal_start(root, EXT4_HT_MAP_BLOCKS,
+						    EXT4_DATA_TRANS_BLOCKS(sb));
+			if (!IS_ERR(handle)) {
+				ext4_free_blocks(handle, root, NULL, pblk,
+						 end - lblk, 0);
+				ext4_journal_stop(handle);
+			}
+		} else {
+			dquot_free_block(root, end - lblk);
+		}
+	}
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_del_range(struct ext4_fc_replay_ctx *ctx,
+				    struct ext4_fc_del_range *del)
+{
+	struct inode *inode;
+	int ret;
+
+	inode = ext4_fc_iget(ctx->sb, del->fc_ino);
+	if (IS_ERR(inode))
+		return ext4_fc_gone(inode) ? 0 : PTR_ERR(inode);
+	ret = ext4_fc_replay_unmap(inode, le32_to_cpu(del->fc_lblk),
+				   le32_to_cpu(del->fc_len));
+	iput(inode);
+	return ret;
+}
+
+static int ext4_fc_replay_inode(struct ext4_fc_replay_ctx *ctx,
+				struct ext4_fc_inode *fi)
+{
+	struct inode *inode;
+	handle_t *handle;
+	int ret;
+
+	inode = ext4_fc_iget(ctx->sb, fi->fc_ino);
+	if (IS_ERR(inode))
+		return ext4_fc_gone(inode) ? 0 : PTR_ERR(inode);
+	/* A later incarnation of the inode number */
+	if (inode->i_generation != le32_to_cpu(fi->fc_generation)) {
+		iput(inode);
+		return 0;
+	}
+
+	handle = ext4_journal_start(inode, EXT4_HT_INODE, 1);
+	if (IS_ERR(handle)) {
+		iput(inode);
+		return PTR_ERR(handle);
+	}
+	inode->i_mode = le16_to_cpu(fi->fc_mode);
+	i_uid_write(inode, le32_to_cpu(fi->fc_uid));
+	i_gid_write(inode, le32_to_cpu(fi->fc_gid));
+	inode->i_atime.tv_sec = le64_to_cpu(fi->fc_atime);
+	inode->i_atime.tv_nsec = le32_to_cpu(fi->fc_atime_nsec);
+	inode->i_mtime.tv_sec = le64_to_cpu(fi->fc_mtime);
+	inode->i_mtime.tv_nsec = le32_to_cpu(fi->fc_mtime_nsec);
+	inode->i_ctime.tv_sec = le64_to_cpu(fi->fc_ctime);
+	inode->i_ctime.tv_nsec = le32_to_cpu(fi->fc_ctime_nsec);
+	if (S_ISREG(inode->i_mode)) {
+		i_size_write(inode, le64_to_cpu(fi->fc_size));
+		EXT4_I(inode)->i_disksize = inode->i_size;
+	}
+	ret = ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+	iput(inode);
+	return ret;
+}
+
+/* Link @inode into @dir as @name, with a dentry made up for it */
+static int ext4_fc_replay_link_inode(struct inode *dir, struct inode *inode,
+				     struct qstr *name)
+{
+	struct dentry *dentry_dir, *dentry;
+	int ret;
+
+	ihold(dir);
+	dentry_dir = d_obtain_alias(dir);
+	if (IS_ERR(dentry_dir))
+		return PTR_ERR(dentry_dir);
+	dentry = d_alloc(dentry_dir, name);
+	if (!dentry) {
+		dput(dentry_dir);
+		return -ENOMEM;
+	}
+	ret = __ext4_link(dir, inode, dentry);
+	dput(dentry);
+	dput(dentry_dir);
+	return ret;
+}
+
+/*
+ * Create the inode of a CREAT record with its old number, which is free
+ * since the transaction that allocated it never committed.  It starts
+ * out as an orphan, like an O_TMPFILE inode, until it is linked.
+ */
+static struct inode *ext4_fc_replay_new_inode(struct inode *dir,
+					      struct ext4_fc_dentry_info *di,
+					      struct qstr *name)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(dir->i_sb);
+	struct inode *inode;
+	handle_t *handle;
+	__le32 inum, gen;
+	__u32 csum;
+	int err;
+
+	inode = ext4_new_inode_start_handle(dir, le16_to_cpu(di->fc_mode),
+					    name, le32_to_cpu(di->fc_ino),
+					    NULL, EXT4_HT_DIR,
+			EXT4_MAXQUOTAS_INIT_BLOCKS(dir->i_sb) +
+			  4 + EXT4_XATTR_TRANS_BLOCKS);
+	handle = ext4_journal_current_handle();
+	if (IS_ERR(inode)) {
+		if (handle)
+			ext4_journal_stop(handle);
+		return inode;
+	}
+
+	inode->i_op = &ext4_file_inode_operations;
+	inode->i_fop = &ext4_file_operations;
+	ext4_set_aops(inode);
+	drop_nlink(inode);
+	if (inode->i_ino != le32_to_cpu(di->fc_ino)) {
+		/* Taken after all; iput() frees it again */
+		err = -EIO;
+		goto out;
+	}
+
+	inode->i_generation = le32_to_cpu(di->fc_generation);
+	if (ext4_has_metadata_csum(dir->i_sb)) {
+		inum = cpu_to_le32(inode->i_ino);
+		gen = cpu_to_le32(inode->i_generation);
+		csum = ext4_chksum(sbi, sbi->s_csum_seed, (__u8 *)&inum,
+				   sizeof(inum));
+		EXT4_I(inode)->i_csum_seed = ext4_chksum(sbi, csum,
+						(__u8 *)&gen, sizeof(gen));
+	}
+	err = ext4_orphan_add(handle, inode);
+	if (!err)
+		err = ext4_mark_inode_dirty(handle, inode);
+out:
+	ext4_journal_stop(handle);
+	unlock_new_inode(inode);
+	if (err) {
+		iput(inode);
+		return ERR_PTR(err);
+	}
+	return inode;
+}
+
+static int ext4_fc_replay_dentry(struct ext4_fc_replay_ctx *ctx, int tag,
+				 struct ext4_fc_dentry_info *di, int len)
+{
+	struct super_block *sb = ctx->sb;
+	struct inode *dir, *inode = NULL;
+	struct qstr name;
+	handle_t *handle;
+	__u32 ino;
+	int ret;
+
+	if (len <= sizeof(*di) || len > sizeof(*di) + EXT4_NAME_LEN)
+		return -EIO;
+	name.name = di->fc_dname;
+	name.len = len - sizeof(*di);
+
+	dir = ext4_fc_iget(sb, di->fc_parent_ino);
+	if (IS_ERR(dir))
+		return PTR_ERR(dir);
+	if (!S_ISDIR(dir->i_mode)) {
+		ret = -EIO;
+		goto out;
+	}
+
+	/* Done already, or undone by later records */
+	ret = ext4_lookup_ino(dir, &name, &ino);
+	if (ret && ret != -ENOENT)
+		goto out;
+	if (tag == EXT4_FC_TAG_UNLINK ?
+	    ret || ino != le32_to_cpu(di->fc_ino) : !ret) {
+		ret = 0;
+		goto out;
+	}
+
+	switch (tag) {
+	case EXT4_FC_TAG_CREAT:
+		inode = ext4_fc_replay_new_inode(dir, di, &name);
+		break;
+	case EXT4_FC_TAG_LINK:
+	case EXT4_FC_TAG_UNLINK:
+		inode = ext4_fc_iget(sb, di->fc_ino);
+		break;
+	}
+	if (IS_ERR(inode)) {
+		ret = ext4_fc_gone(inode) ? 0 : PTR_ERR(inode);
+		inode = NULL;
+		goto out;
+	}
+
+	if (tag != EXT4_FC_TAG_UNLINK) {
+		ret = ext4_fc_replay_link_inode(dir, inode, &name);
+		goto out;
+	}
+
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+				    EXT4_DATA_TRANS_BLOCKS(sb));
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out;
+	}
+	ret = __ext4_unlink(handle, dir, &name, inode);
+	ext4_journal_stop(handle);
+out:
+	iput(inode);
+	iput(dir);
+	return ret;
+}
+
+/* Pass two: redo the operations */
+static int ext4_fc_replay_record(struct ext4_fc_replay_ctx *ctx, int tag,
+				 void *val, int len, int idx)
+{
+	switch (tag) {
+	case EXT4_FC_TAG_ADD_RANGE:
+		if (len != sizeof(struct ext4_fc_add_range))
+			return -EIO;
+		return ext4_fc_replay_add_range(ctx, val, idx);
+	case EXT4_FC_TAG_DEL_RANGE:
+		if (len != sizeof(struct ext4_fc_del_range))
+			return -EIO;
+		return ext4_fc_replay_del_range(ctx, val);
+	case EXT4_FC_TAG_INODE:
+		if (len != sizeof(struct ext4_fc_inode))
+			return -EIO;
+		return ext4_fc_replay_inode(ctx, val);
+	case EXT4_FC_TAG_CREAT:
+	case EXT4_FC_TAG_LINK:
+	case EXT4_FC_TAG_UNLINK:
+		return ext4_fc_replay_dentry(ctx, tag, val, len);
+	}
+	return -EIO;
+}
+
+static int ext4_fc_do_replay(struct ext4_fc_replay_ctx *ctx)
+{
+	int err;
+
+	ctx->claimed = kcalloc(BITS_TO_LONGS(ctx->nr_add + 1),
+			       sizeof(unsigned long), GFP_KERNEL);
+	if (!ctx->claimed)
+		return -ENOMEM;
+
+	err = ext4_fc_for_each_record(ctx, ext4_fc_claim);
+	if (!err)
+		err = ext4_fc_for_each_record(ctx, ext4_fc_replay_record);
+	kfree(ctx->claimed);
+	return err;
+}
+
+/**
+ * ext4_fc_replay() - replay fast commits after journal recovery
+ * @sb: Filesystem, with its journal loaded and its root set up.
+ *
+ * The fast commits to replay are those for the transaction right after
+ * the last one recovery found, which is the one that was running.  Until
+ * the replay is on disk in full, EXT4_FC_REPLAYING in the superblock state
+ * says so, and a later mount replays again, taking the transaction from
+ * the fast commits themselves: the transactions of the interrupted replay
+ * may have committed.  All records can be replayed more than once.
+ */
+void ext4_fc_replay(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_super_block *es = sbi->s_es;
+	journal_t *journal = sbi->s_journal;
+	struct ext4_fc_replay_ctx ctx;
+	unsigned long s_flags = sb->s_flags;
+	int err;
+
+	if (!journal || !JBD2_HAS_INCOMPAT_FEATURE(journal,
+				JBD2_FEATURE_INCOMPAT_FC_AREA))
+		goto out_clear;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.sb = sb;
+	ctx.journal = journal;
+	ctx.tid = journal->j_transaction_sequence - 1;
+	ctx.any_tid = sbi->s_mount_state & EXT4_FC_REPLAYING;
+	ctx.maxblocks = journal->j_fc_last - journal->j_fc_first;
+	ctx.buf = vmalloc(ctx.maxblocks * journal->j_blocksize);
+	if (!ctx.buf) {
+		ext4_msg(sb, KERN_ERR, "no memory for fast commit replay");
+		goto out_clear;
+	}
+
+	err = ext4_fc_scan(&ctx);
+	if (err || !ctx.len)
+		goto out_free;
+
+	if (sbi->s_mount_state & EXT4_ERROR_FS) {
+		ext4_msg(sb, KERN_INFO, "Skipping fast commit replay on fs "
+			 "with errors");
+		goto out_free;
+	}
+	if (s_flags & MS_RDONLY) {
+		ext4_msg(sb, KERN_INFO, "fast commit replay on readonly fs");
+		sb->s_flags &= ~MS_RDONLY;
+	}
+
+	sbi->s_mount_state |= EXT4_FC_REPLAYING;
+	es->s_state |= cpu_to_le16(EXT4_FC_REPLAYING);
+	ext4_commit_super(sb, 1);
+
+	err = ext4_fc_do_replay(&ctx);
+	if (!err)
+		err = jbd2_journal_flush(journal);
+	if (err)
+		ext4_error(sb, "fast commit replay failed: %d", err);
+	else
+		ext4_msg(sb, KERN_INFO, "replayed %u fast commit records",
+			 ctx.nr_records);
+
+	sbi->s_mount_state &= ~EXT4_FC_REPLAYING;
+	es->s_state &= cpu_to_le16(~EXT4_FC_REPLAYING);
+	ext4_commit_super(sb, 1);
+	sb->s_flags = s_flags;
+out_free:
+	vfree(ctx.buf);
+out_clear:
+	/* An interrupted replay with nothing left to replay */
+	if (sbi->s_mount_state & EXT4_FC_REPLAYING) {
+		sbi->s_mount_state &= ~EXT4_FC_REPLAYING;
+		es->s_state &= cpu_to_le16(~EXT4_FC_REPLAYING);
+		if (!(sb->s_flags & MS_RDONLY))
+			ext4_commit_super(sb, 1);
+	}
+	if (journal)
+		jbd2_fc_replay_done(journal);
+}
@@ -0,0 +1,97 @@
+/*
+ *  fs/ext4/fast_commit.h
+ *
+ * On-disk format of ext4 fast commits.
+ */
+
+#ifndef _EXT4_FAST_COMMIT_H
+#define _EXT4_FAST_COMMIT_H
+
+/*
+ * A fast commit is a sequence of tag-length-value records in the fast
+ * commit area of the journal.  It starts on a block boundary with a HEAD
+ * record and ends with a TAIL record carrying a checksum of everything
+ * from the HEAD on; records may cross block boundaries.  Several fast
+ * commits for the same transaction may follow each other, each one
+ * starting on the block after the previous one's TAIL.
+ *
+ * The records describe operations rather than metadata blocks, so replay
+ * redoes them through the normal ext4 code paths.  All of them can be
+ * replayed more than once.
+ *
+ * This is not the mainline fast commit format.  Journals using it are
+ * marked with JBD2_FEATURE_INCOMPAT_FC_AREA, which mainline doesn't use.
+ */
+#define EXT4_FC_TAG_HEAD	0x0001
+#define EXT4_FC_TAG_TAIL	0x0002
+#define EXT4_FC_TAG_ADD_RANGE	0x0003
+#define EXT4_FC_TAG_DEL_RANGE	0x0004
+#define EXT4_FC_TAG_CREAT	0x0005
+#define EXT4_FC_TAG_LINK	0x0006
+#define EXT4_FC_TAG_UNLINK	0x0007
+#define EXT4_FC_TAG_INODE	0x0008
+
+/* Fast commit area size set up at mount, in blocks */
+#define EXT4_FC_AREA_BLOCKS	256
+
+struct ext4_fc_tl {
+	__le16 fc_tag;
+	__le16 fc_len;		/* of the value following this header */
+};
+
+/* EXT4_FC_TAG_HEAD */
+struct ext4_fc_head {
+	__le32 fc_features;	/* none defined yet */
+	__le32 fc_tid;
+};
+
+/* EXT4_FC_TAG_TAIL */
+struct ext4_fc_tail {
+	__le32 fc_tid;
+	__le32 fc_crc;		/* crc32 from the HEAD up to fc_tid */
+};
+
+/* EXT4_FC_TAG_ADD_RANGE: map blocks of a regular file */
+struct ext4_fc_add_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le64 fc_pblk;
+	__le32 fc_len;
+	__le32 fc_unwritten;
+};
+
+/* EXT4_FC_TAG_DEL_RANGE: unmap blocks of a regular file */
+struct ext4_fc_del_range {
+	__le32 fc_ino;
+	__le32 fc_lblk;
+	__le32 fc_len;
+};
+
+/* EXT4_FC_TAG_CREAT, EXT4_FC_TAG_LINK, EXT4_FC_TAG_UNLINK */
+struct ext4_fc_dentry_info {
+	__le32 fc_parent_ino;
+	__le32 fc_ino;
+	__le32 fc_generation;	/* of the new inode, EXT4_FC_TAG_CREAT only */
+	__le16 fc_mode;		/* ditto */
+	__le16 fc_reserved;
+	__u8 fc_dname[0];	/* up to EXT4_NAME_LEN, not NUL terminated */
+};
+
+/* EXT4_FC_TAG_INODE: attributes of an inode after the operations above */
+struct ext4_fc_inode {
+	__le32 fc_ino;
+	__le32 fc_generation;
+	__le16 fc_mode;
+	__le16 fc_reserved;
+	__le32 fc_uid;
+	__le32 fc_gid;
+	__le32 fc_atime_nsec;
+	__le64 fc_size;		/* i_disksize, regular files only */
+	__le64 fc_atime;
+	__le64 fc_mtime;
+	__le64 fc_ctime;
+	__le32 fc_mtime_nsec;
+	__le32 fc_ctime_nsec;
+};
+
+#endif /* _EXT4_FAST_COMMIT_H */
@@ -88,6 +88,21 @@ ext4_unaligned_aio(struct inode *inode, struct iov_iter *from, loff_t pos)
 	return 0;
 }
 
+/*
+ * Buffered writes within i_size only dirty pages and, with delalloc, update
+ * i_disksize under i_data_sem, so they can copy data without holding
+ * i_mutex: overlapping writers are kept apart by i_write_ranges instead.
+ * Journalled and inline data are changed in ->write_begin and ->write_end
+ * in ways that still rely on i_mutex.
+ */
+static bool ext4_can_share_write(struct inode *inode)
+{
+	return test_opt(inode->i_sb, DELALLOC) &&
+	       ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) &&
+	       !ext4_should_journal_data(inode) &&
+	       !ext4_has_inline_data(inode);
+}
+
 static ssize_t
 ext4_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
@@ -101,6 +116,15 @@ ext4_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	ssize_t ret;
 	loff_t pos = iocb->ki_pos;
 
+	/*
+	 * Block mapped files are left to the path below, which enforces
+	 * their smaller size limit.
+	 */
+	if (!o_direct && ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
+		return generic_file_range_write_iter(iocb, from,
+				&EXT4_I(inode)->i_write_ranges,
+				ext4_can_share_write);
+
 	/*
 	 * Unaligned direct AIO must be serialized; see comment above
 	 * In the case of O_APPEND, assume that we must always serialize
@@ -116,6 +140,7 @@ ext4_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	}
 
 	mutex_lock(&inode->i_mutex);
+	ext4_range_write_wait(inode);
 	if (file->f_flags & O_APPEND)
 		iocb->ki_pos = pos = i_size_read(inode);
 
@@ -258,6 +283,7 @@ static int ext4_file_open(struct inode * inode, struct file * filp)
 		if (ret < 0)
 			return ret;
 	}
+	filp->f_mode |= FMODE_NOWAIT;
 	return dquot_file_open(inode, filp);
 }
 
@@ -136,6 +136,11 @@ int ext4_sync_file(struct file *file, loff_t start, loff_t end, int datasync)
 	}
 
 	commit_tid = datasync ? ei->i_datasync_tid : ei->i_sync_tid;
+	if (test_opt(inode->i_sb, JOURNAL_FAST_COMMIT)) {
+		ret = ext4_fc_commit(journal, commit_tid);
+		if (ret != -EAGAIN)
+			goto out;
+	}
 	if (journal->j_flags & JBD2_BARRIER &&
 	    !jbd2_trans_will_send_data_barrier(journal, commit_tid))
 		needs_barrier = true;
@@ -704,6 +704,9 @@ found:
 
 has_zeroout:
 	up_write((&EXT4_I(inode)->i_data_sem));
+	if (retval > 0 && flags & EXT4_GET_BLOCKS_CREATE)
+		ext4_fc_track_range(handle, inode, map->m_lblk,
+				    map->m_lblk + map->m_len - 1);
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -3606,6 +3609,7 @@ int ext4_punch_hole(struct inode *inode, loff_t offset, loff_t length)
 	}
 
 	mutex_lock(&inode->i_mutex);
+	ext4_range_write_wait(inode);
 
 	/* No need to punch hole beyond i_size */
 	if (offset >= inode->i_size)
@@ -3687,6 +3691,7 @@ int ext4_punch_hole(struct inode *inode, loff_t offset, loff_t length)
 					    stop_block);
 
 	up_write(&EXT4_I(inode)->i_data_sem);
+	ext4_fc_track_range(handle, inode, first_block, stop_block - 1);
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
 
@@ -3833,6 +3838,9 @@ void ext4_truncate(struct inode *inode)
 		ext4_ind_truncate(handle, inode);
 
 	up_write(&ei->i_data_sem);
+	ext4_fc_track_range(handle, inode,
+			    (inode->i_size + inode->i_sb->s_blocksize - 1) >>
+			    inode->i_blkbits, EXT_MAX_BLOCKS - 1);
 
 	if (IS_SYNC(inode))
 		ext4_handle_sync(handle);
@@ -4686,6 +4694,7 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 	if (attr->ia_valid & ATTR_SIZE && attr->ia_size != inode->i_size) {
 		handle_t *handle;
 
+		ext4_range_write_wait(inode);
 		if (!(ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))) {
 			struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 
@@ -5015,6 +5024,7 @@ int ext4_mark_inode_dirty(handle_t *handle, struct inode *inode)
 	err = ext4_reserve_inode_write(handle, inode, &iloc);
 	if (err)
 		return err;
+	ext4_fc_track_inode(handle, inode);
 	if (ext4_handle_valid(handle) &&
 	    EXT4_I(inode)->i_extra_isize < sbi->s_want_extra_isize &&
 	    !ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND)) {
@@ -121,6 +121,8 @@ static long swap_inode_boot_loader(struct super_block *sb,
 	/* Protect orig inodes against a truncate and make sure,
 	 * that only 1 swap_inode_boot_loader is running. */
 	lock_two_nondirectories(inode, inode_bl);
+	ext4_range_write_wait(inode);
+	ext4_range_write_wait(inode_bl);
 
 	truncate_inode_pages(&inode->i_data, 0);
 	truncate_inode_pages(&inode_bl->i_data, 0);
@@ -233,6 +235,8 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 		err = -EPERM;
 		mutex_lock(&inode->i_mutex);
+		/* Flags can change how the file's data is written */
+		ext4_range_write_wait(inode);
 		/* Is it quota file? Do not allow user to mess with it */
 		if (IS_NOQUOTA(inode))
 			goto flags_out;
@@ -283,6 +287,7 @@ long ext4_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		err = ext4_reserve_inode_write(handle, inode, &iloc);
 		if (err)
 			goto flags_err;
+		ext4_fc_mark_ineligible(inode->i_sb, handle);
 
 		for (i = 0, mask = 1; i < 32; i++, mask <<= 1) {
 			if (!(mask & EXT4_FL_USER_MODIFIABLE))
@@ -353,6 +358,7 @@ flags_out:
 		}
 		err = ext4_reserve_inode_write(handle, inode, &iloc);
 		if (err == 0) {
+			ext4_fc_mark_ineligible(inode->i_sb, handle);
 			inode->i_ctime = ext4_current_time(inode);
 			inode->i_generation = generation;
 			err = ext4_mark_iloc_dirty(handle, inode, &iloc);
@@ -510,6 +516,7 @@ group_add_out:
 		 * inode format to prevent read.
 		 */
 		mutex_lock(&(inode->i_mutex));
+		ext4_range_write_wait(inode);
 		err = ext4_ext_migrate(inode);
 		mutex_unlock(&(inode->i_mutex));
 		mnt_drop_write_file(filp);
@@ -698,23 +698,38 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the list for that order.  A group is on a list
+ * exactly when its largest free order is >= 0.  Called under the group lock.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
+	int new = -1; /* uninit */
 	int i;
-	int bits;
-
-	grp->bb_largest_free_order = -1; /* uninit */
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new = i;
 			break;
 		}
 	}
+	if (new == old)
+		return;
+
+	if (old >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	grp->bb_largest_free_order = new;
+	if (new >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new]);
+	}
 }
 
 static noinline_for_stack
@@ -1652,10 +1667,11 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		spin_lock(&sbi->s_md_lock);
-		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
-		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_goal *goal = get_cpu_ptr(sbi->s_mb_goals);
+
+		goal->group = ac->ac_f_ex.fe_group;
+		goal->start = ac->ac_f_ex.fe_start;
+		put_cpu_ptr(sbi->s_mb_goals);
 	}
 }
 
@@ -2073,11 +2089,221 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Load the buddy of @group and look for blocks in it with criteria @cr,
+ * leaving what was found in @ac.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int err;
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (ext4_mb_good_group(ac, group, cr)) {
+		ac->ac_groups_scanned++;
+		if (cr == 0 && ac->ac_2order < sb->s_blocksize_bits+2)
+			ext4_mb_simple_scan_group(ac, &e4b);
+		else if (cr == 1 && sbi->s_stripe &&
+				!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+			ext4_mb_scan_aligned(ac, &e4b);
+		else
+			ext4_mb_complex_scan_group(ac, &e4b);
+	}
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+	return 0;
+}
+
+/*
+ * The smallest largest-free-order a group needs to serve @ac with criteria
+ * @cr, or -1 if the order lists can't be used for it.
+ */
+static int ext4_mb_scan_order(struct ext4_allocation_context *ac, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	int order;
+
+	if (cr > 1 || !EXT4_SB(sb)->s_mb_optimize_scan)
+		return -1;
+
+	order = cr == 0 ? ac->ac_2order : fls(ac->ac_g_ex.fe_len) - 1;
+	return order < MB_NUM_ORDERS(sb) ? order : -1;
+}
+
+/*
+ * Quick check of a group found on an order list.  We hold the list lock,
+ * so this mustn't sleep; ext4_mb_scan_group() checks the group properly.
+ */
+static bool ext4_mb_order_group_ok(struct ext4_allocation_context *ac,
+				   struct ext4_group_info *grp,
+				   ext4_group_t ngroups)
+{
+	int flex_size = ext4_flex_bg_size(EXT4_SB(ac->ac_sb));
+
+	if (grp->bb_group >= ngroups)
+		return false;
+	if (unlikely(EXT4_MB_GRP_BBITMAP_CORRUPT(grp)))
+		return false;
+
+	/* Avoid using the first bg of a flexgroup for data files */
+	if (ac->ac_criteria == 0 && (ac->ac_flags & EXT4_MB_HINT_DATA) &&
+	    flex_size >= EXT4_FLEX_SIZE_DIR_ALLOC_SCHEME &&
+	    (grp->bb_group % flex_size) == 0)
+		return false;
+
+	return true;
+}
+
+/*
+ * Take the group at the head of the list for @order as the next candidate
+ * and move it to the tail, so that concurrent and later allocations start
+ * with other groups.  Returns false once the list has come round to @first,
+ * the first group we took from it, again.  *@group is ngroups if the group
+ * taken isn't worth a look.
+ */
+static bool ext4_mb_next_order_group(struct ext4_allocation_context *ac,
+				     int order, ext4_group_t ngroups,
+				     struct ext4_group_info **first,
+				     ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct list_head *list = &sbi->s_mb_largest_free_orders[order];
+	struct ext4_group_info *grp;
+	bool more = false;
+
+	*group = ngroups;
+	write_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+	if (!list_empty(list)) {
+		grp = list_first_entry(list, struct ext4_group_info,
+				       bb_largest_free_order_node);
+		if (grp != *first) {
+			if (!*first)
+				*first = grp;
+			list_move_tail(&grp->bb_largest_free_order_node, list);
+			if (ext4_mb_order_group_ok(ac, grp, ngroups))
+				*group = grp->bb_group;
+			more = true;
+		}
+	}
+	write_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+	return more;
+}
+
+/*
+ * Criteria 0 and 1 want a free extent of at least the goal length, which
+ * only groups with a large enough largest free order have.  Take those
+ * from the order lists instead of checking every group, starting with the
+ * smallest order that will do so that big extents are kept for big
+ * requests.  Each list is gone through at most once, and never for more
+ * than ngroups candidates in case groups keep moving between lists.
+ */
+static int ext4_mb_scan_orders(struct ext4_allocation_context *ac, int cr,
+			       int order, ext4_group_t ngroups)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_group_info *first;
+	ext4_group_t group, tries;
+	int err;
+
+	for (; order < MB_NUM_ORDERS(sb); order++) {
+		first = NULL;
+		for (tries = 0; tries < ngroups; tries++) {
+			if (!ext4_mb_next_order_group(ac, order, ngroups,
+						      &first, &group))
+				break;
+			if (group == ngroups)
+				continue;
+
+			cond_resched();
+			err = ext4_mb_scan_group(ac, group, cr);
+			if (err || ac->ac_status != AC_STATUS_CONTINUE)
+				return err;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Start reading the block bitmaps of the next few groups from @group on
+ * that still need their buddy set up.  Returns the group after the last
+ * one looked at.
+ */
+static ext4_group_t ext4_mb_prefetch(struct super_block *sb,
+				     ext4_group_t group, ext4_group_t ngroups)
+{
+	struct ext4_group_info *grp;
+	struct buffer_head *bh;
+	struct blk_plug plug;
+	int nr = MB_DEFAULT_PREFETCH;
+
+	blk_start_plug(&plug);
+	for (; group < ngroups && nr; group++) {
+		grp = ext4_get_group_info(sb, group);
+		if (!EXT4_MB_GRP_NEED_INIT(grp) || !grp->bb_free)
+			continue;
+		bh = ext4_read_block_bitmap_nowait(sb, group);
+		if (bh)
+			brelse(bh);
+		nr--;
+	}
+	blk_finish_plug(&plug);
+	return group;
+}
+
+/*
+ * Groups whose buddy hasn't been set up since mount aren't on any order
+ * list yet.  Set them up in group order, with the bitmaps of the next
+ * few groups read ahead, until one of them can serve @ac with criteria
+ * @cr; each one goes on its list as it is set up.  s_mb_uninit_cursor
+ * remembers how far this has got, so every group is only tried once.
+ */
+static int ext4_mb_scan_uninit(struct ext4_allocation_context *ac, int cr,
+			       ext4_group_t ngroups)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	ext4_group_t group, prefetched;
+	int err = 0;
+
+	group = ACCESS_ONCE(sbi->s_mb_uninit_cursor);
+	for (prefetched = group; group < ngroups; group++) {
+		grp = ext4_get_group_info(sb, group);
+		if (EXT4_MB_GRP_NEED_INIT(grp) && grp->bb_free) {
+			if (prefetched <= group)
+				prefetched = ext4_mb_prefetch(sb, group,
+							      ngroups);
+			cond_resched();
+			/* a group that can't be read is left to cr 2 and 3 */
+			if (!ext4_mb_init_group(sb, group) &&
+			    ext4_mb_good_group(ac, group, cr))
+				err = ext4_mb_scan_group(ac, group, cr);
+		}
+		cmpxchg(&sbi->s_mb_uninit_cursor, group, group + 1);
+		if (err || ac->ac_status != AC_STATUS_CONTINUE)
+			break;
+	}
+	return err;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
 	ext4_group_t ngroups, group, i;
-	int cr;
+	int cr, order;
 	int err = 0;
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
@@ -2120,13 +2346,16 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
+	/*
+	 * if stream allocation is enabled, use this CPU's goal: it is
+	 * next to the locality group preallocations of this CPU
+	 */
 	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
-		/* TBD: may be hot point */
-		spin_lock(&sbi->s_md_lock);
-		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
-		ac->ac_g_ex.fe_start = sbi->s_mb_last_start;
-		spin_unlock(&sbi->s_md_lock);
+		struct ext4_mb_goal *goal = get_cpu_ptr(sbi->s_mb_goals);
+
+		ac->ac_g_ex.fe_group = goal->group;
+		ac->ac_g_ex.fe_start = goal->start;
+		put_cpu_ptr(sbi->s_mb_goals);
 	}
 
 	/* Let's just scan groups to find more-less suitable blocks */
@@ -2144,6 +2373,25 @@ repeat:
 		 */
 		group = ac->ac_g_ex.fe_group;
 
+		order = ext4_mb_scan_order(ac, cr);
+		if (order >= 0) {
+			/* the goal group first, to keep allocations close */
+			if (group < ngroups &&
+			    ext4_mb_good_group(ac, group, cr)) {
+				err = ext4_mb_scan_group(ac, group, cr);
+				if (err)
+					goto out;
+				if (ac->ac_status != AC_STATUS_CONTINUE)
+					break;
+			}
+			err = ext4_mb_scan_orders(ac, cr, order, ngroups);
+			if (!err && ac->ac_status == AC_STATUS_CONTINUE)
+				err = ext4_mb_scan_uninit(ac, cr, ngroups);
+			if (err)
+				goto out;
+			continue;
+		}
+
 		for (i = 0; i < ngroups; group++, i++) {
 			cond_resched();
 			/*
@@ -2157,34 +2405,10 @@ repeat:
 			if (!ext4_mb_good_group(ac, group, cr))
 				continue;
 
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0 && ac->ac_2order < sb->s_blocksize_bits+2)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2423,6 +2647,8 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2552,6 +2778,7 @@ static int ext4_groupinfo_create_slab(size_t size)
 int ext4_mb_init(struct super_block *sb)
 {
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t ngroups;
 	unsigned i, j;
 	unsigned offset;
 	unsigned max;
@@ -2640,10 +2867,40 @@ int ext4_mb_init(struct super_block *sb)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
+	sbi->s_mb_goals = alloc_percpu(struct ext4_mb_goal);
+	if (sbi->s_mb_goals == NULL) {
+		ret = -ENOMEM;
+		goto out_free_locality_groups;
+	}
+	/* Spread the CPUs' stream allocations over the filesystem */
+	ngroups = ext4_get_groups_count(sb);
+	for_each_possible_cpu(i) {
+		struct ext4_mb_goal *goal = per_cpu_ptr(sbi->s_mb_goals, i);
+
+		goal->group = div_u64((u64)ngroups * i, nr_cpu_ids);
+		goal->start = 0;
+	}
+
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
+	i = MB_NUM_ORDERS(sb);
+	sbi->s_mb_largest_free_orders =
+		kmalloc(i * sizeof(struct list_head), GFP_KERNEL);
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc(i * sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders ||
+	    !sbi->s_mb_largest_free_orders_locks) {
+		ret = -ENOMEM;
+		goto out_free_orders;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0)
-		goto out_free_locality_groups;
+		goto out_free_orders;
 
 	if (sbi->s_proc)
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
@@ -2651,6 +2908,13 @@ int ext4_mb_init(struct super_block *sb)
 
 	return 0;
 
+out_free_orders:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	free_percpu(sbi->s_mb_goals);
+	sbi->s_mb_goals = NULL;
 out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
@@ -2739,6 +3003,9 @@ int ext4_mb_release(struct super_block *sb)
 	}
 
 	free_percpu(sbi->s_locality_groups);
+	free_percpu(sbi->s_mb_goals);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 
 	return 0;
 }
@@ -89,6 +89,27 @@ extern ushort ext4_mballoc_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * pick groups for exact and good-enough allocations from the lists
+ * of groups by largest free order instead of scanning all groups
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * number of groups whose bitmaps are read ahead while groups not set
+ * up since mount are brought onto the order lists
+ */
+#define MB_DEFAULT_PREFETCH		8
+
+/* Number of buddy orders, order 0 being the bitmap itself */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
+/* Where a CPU last did a stream allocation */
+struct ext4_mb_goal {
+	ext4_group_t		group;
+	ext4_grpblk_t		start;
+};
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
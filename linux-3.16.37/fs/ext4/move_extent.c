@@ -1309,6 +1309,8 @@ ext4_move_extents(struct file *o_filp, struct file *d_filp,
 	}
 	/* Protect orig and donor inodes against a truncate */
 	lock_two_nondirectories(orig_inode, donor_inode);
+	ext4_range_write_wait(orig_inode);
+	ext4_range_write_wait(donor_inode);
 
 	/* Wait for all existing dio workers */
 	ext4_inode_block_unlocked_dio(orig_inode);
@@ -1409,6 +1409,25 @@ errout:
 	return NULL;
 }
 
+/*
+ * Look @d_name up in @dir without a dentry, for fast commit replay.
+ * Returns -ENOENT if there is no such entry.
+ */
+int ext4_lookup_ino(struct inode *dir, const struct qstr *d_name, __u32 *ino)
+{
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+
+	bh = ext4_find_entry(dir, d_name, &de, NULL);
+	if (IS_ERR(bh))
+		return PTR_ERR(bh);
+	if (!bh)
+		return -ENOENT;
+	*ino = le32_to_cpu(de->inode);
+	brelse(bh);
+	return 0;
+}
+
 static struct dentry *ext4_lookup(struct inode *dir, struct dentry *dentry, unsigned int flags)
 {
 	struct inode *inode;
@@ -2264,8 +2283,11 @@ retry:
 		inode->i_fop = &ext4_file_operations;
 		ext4_set_aops(inode);
 		err = ext4_add_nondir(handle, dentry, inode);
-		if (!err && IS_DIRSYNC(dir))
-			ext4_handle_sync(handle);
+		if (!err) {
+			ext4_fc_track_create(handle, dentry);
+			if (IS_DIRSYNC(dir))
+				ext4_handle_sync(handle);
+		}
 	}
 	if (handle)
 		ext4_journal_stop(handle);
@@ -2294,6 +2316,7 @@ retry:
 	handle = ext4_journal_current_handle();
 	err = PTR_ERR(inode);
 	if (!IS_ERR(inode)) {
+		ext4_fc_mark_ineligible(dir->i_sb, handle);
 		init_special_inode(inode, inode->i_mode, rdev);
 		inode->i_op = &ext4_special_inode_operations;
 		err = ext4_add_nondir(handle, dentry, inode);
@@ -2324,6 +2347,7 @@ retry:
 	handle = ext4_journal_current_handle();
 	err = PTR_ERR(inode);
 	if (!IS_ERR(inode)) {
+		ext4_fc_mark_ineligible(dir->i_sb, handle);
 		inode->i_op = &ext4_file_inode_operations;
 		inode->i_fop = &ext4_file_operations;
 		ext4_set_aops(inode);
@@ -2443,6 +2467,7 @@ retry:
 	if (IS_ERR(inode))
 		goto out_stop;
 
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 	inode->i_op = &ext4_dir_inode_operations;
 	inode->i_fop = &ext4_dir_operations;
 	err = ext4_init_new_dir(handle, dir, inode);
@@ -2762,6 +2787,7 @@ static int ext4_rmdir(struct inode *dir, struct dentry *dentry)
 	if (IS_DIRSYNC(dir))
 		ext4_handle_sync(handle);
 
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
 		goto end_rmdir;
@@ -2789,43 +2815,26 @@ end_rmdir:
 	return retval;
 }
 
-static int ext4_unlink(struct inode *dir, struct dentry *dentry)
+/*
+ * Remove the entry @d_name for @inode from @dir.  Returns -ENOENT if
+ * there is no such entry, which fast commit replay relies on.
+ */
+int __ext4_unlink(handle_t *handle, struct inode *dir,
+		  const struct qstr *d_name, struct inode *inode)
 {
 	int retval;
-	struct inode *inode;
 	struct buffer_head *bh;
 	struct ext4_dir_entry_2 *de;
-	handle_t *handle = NULL;
-
-	trace_ext4_unlink_enter(dir, dentry);
-	/* Initialize quotas before so that eventual writes go
-	 * in separate transaction */
-	dquot_initialize(dir);
-	dquot_initialize(dentry->d_inode);
 
-	retval = -ENOENT;
-	bh = ext4_find_entry(dir, &dentry->d_name, &de, NULL);
+	bh = ext4_find_entry(dir, d_name, &de, NULL);
 	if (IS_ERR(bh))
 		return PTR_ERR(bh);
 	if (!bh)
-		goto end_unlink;
-
-	inode = dentry->d_inode;
+		return -ENOENT;
 
 	retval = -EIO;
 	if (le32_to_cpu(de->inode) != inode->i_ino)
-		goto end_unlink;
-
-	handle = ext4_journal_start(dir, EXT4_HT_DIR,
-				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
-	if (IS_ERR(handle)) {
-		retval = PTR_ERR(handle);
-		handle = NULL;
-		goto end_unlink;
-	}
-
-	if (IS_DIRSYNC(dir))
-		ext4_handle_sync(handle);
+		goto out;
 
 	if (!inode->i_nlink) {
 		ext4_warning(inode->i_sb,
@@ -2835,7 +2844,7 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 	}
 	retval = ext4_delete_entry(handle, dir, de, bh);
 	if (retval)
-		goto end_unlink;
+		goto out;
 	dir->i_ctime = dir->i_mtime = ext4_current_time(dir);
 	ext4_update_dx_flag(dir);
 	ext4_mark_inode_dirty(handle, dir);
@@ -2844,12 +2853,38 @@ static int ext4_unlink(struct inode *dir, struct dentry *dentry)
 		ext4_orphan_add(handle, inode);
 	inode->i_ctime = ext4_current_time(inode);
 	ext4_mark_inode_dirty(handle, inode);
-	retval = 0;
 
-end_unlink:
+out:
 	brelse(bh);
-	if (handle)
-		ext4_journal_stop(handle);
+	return retval;
+}
+
+static int ext4_unlink(struct inode *dir, struct dentry *dentry)
+{
+	int retval;
+	handle_t *handle;
+
+	trace_ext4_unlink_enter(dir, dentry);
+	/* Initialize quotas before so that eventual writes go
+	 * in separate transaction */
+	dquot_initialize(dir);
+	dquot_initialize(dentry->d_inode);
+
+	handle = ext4_journal_start(dir, EXT4_HT_DIR,
+				    EXT4_DATA_TRANS_BLOCKS(dir->i_sb));
+	if (IS_ERR(handle)) {
+		retval = PTR_ERR(handle);
+		goto out;
+	}
+
+	if (IS_DIRSYNC(dir))
+		ext4_handle_sync(handle);
+
+	retval = __ext4_unlink(handle, dir, &dentry->d_name, dentry->d_inode);
+	if (!retval)
+		ext4_fc_track_unlink(handle, dentry);
+	ext4_journal_stop(handle);
+out:
 	trace_ext4_unlink_exit(dentry, retval);
 	return retval;
 }
@@ -2896,6 +2931,7 @@ retry:
 	if (IS_ERR(inode))
 		goto out_stop;
 
+	ext4_fc_mark_ineligible(dir->i_sb, handle);
 	if (l > EXT4_N_BLOCKS * 4) {
 		inode->i_op = &ext4_symlink_inode_operations;
 		ext4_set_aops(inode);
@@ -2959,18 +2995,15 @@ err_drop_inode:
 	return err;
 }
 
-static int ext4_link(struct dentry *old_dentry,
-		     struct inode *dir, struct dentry *dentry)
+/*
+ * Add a link to @inode as @dentry in @dir.  Also used by fast commit
+ * replay, with a dentry of its own making.
+ */
+int __ext4_link(struct inode *dir, struct inode *inode, struct dentry *dentry)
 {
 	handle_t *handle;
-	struct inode *inode = old_dentry->d_inode;
 	int err, retries = 0;
 
-	if (inode->i_nlink >= EXT4_LINK_MAX)
-		return -EMLINK;
-
-	dquot_initialize(dir);
-
 retry:
 	handle = ext4_journal_start(dir, EXT4_HT_DIR,
 		(EXT4_DATA_TRANS_BLOCKS(dir->i_sb) +
@@ -2994,6 +3027,7 @@ retry:
 		if (inode->i_nlink == 1)
 			ext4_orphan_del(handle, inode);
 		d_instantiate(dentry, inode);
+		ext4_fc_track_link(handle, dentry);
 	} else {
 		drop_nlink(inode);
 		iput(inode);
@@ -3004,6 +3038,18 @@ retry:
 	return err;
 }
 
+static int ext4_link(struct dentry *old_dentry,
+		     struct inode *dir, struct dentry *dentry)
+{
+	struct inode *inode = old_dentry->d_inode;
+
+	if (inode->i_nlink >= EXT4_LINK_MAX)
+		return -EMLINK;
+
+	dquot_initialize(dir);
+	return __ext4_link(dir, inode, dentry);
+}
+
 
 /*
  * Try to find buffer head where contains the parent block.
@@ -3256,6 +3302,7 @@ static int ext4_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		if (new.inode) {
@@ -3399,6 +3446,7 @@ static int ext4_cross_rename(struct inode *old_dir, struct dentry *old_dentry,
 
 	if (IS_DIRSYNC(old.dir) || IS_DIRSYNC(new.dir))
 		ext4_handle_sync(handle);
+	ext4_fc_mark_ineligible(old.dir->i_sb, handle);
 
 	if (S_ISDIR(old.inode->i_mode)) {
 		old.is_dir = true;
@@ -518,7 +518,8 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
 		fuse_conn_put(&cc->fc);
 		return rc;
 	}
-	file->private_data = &cc->fc;	/* channel owns base reference to cc */
+	/* channel owns base reference to cc */
+	file->private_data = &cc->fc.main_queue;
 
 	return 0;
 }
@@ -536,7 +537,7 @@ static int cuse_channel_open(struct inode *inode, struct file *file)
  */
 static int cuse_channel_release(struct inode *inode, struct file *file)
 {
-	struct cuse_conn *cc = fc_to_cc(file->private_data);
+	struct cuse_conn *cc = fc_to_cc(fuse_dev_conn(file));
 	int rc;
 
 	/* remove from the conntbl, no more access from this point on */
@@ -20,6 +20,9 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/aio.h>
+#include <linux/hash.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -28,11 +31,7 @@ static struct kmem_cache *fuse_req_cachep;
 
 static struct fuse_conn *fuse_get_conn(struct file *file)
 {
-	/*
-	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
-	 */
-	return file->private_data;
+	return fuse_dev_conn(file);
 }
 
 static void fuse_request_init(struct fuse_req *req, struct page **pages,
@@ -299,62 +298,150 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
-static u64 fuse_get_unique(struct fuse_conn *fc)
+/*
+ * Pick the queue for a new request.  Requests are spread over the queues
+ * by the submitting CPU, so with a daemon thread per queue bound to the
+ * matching CPUs, a request is queued, read and answered on one CPU.
+ */
+static struct fuse_queue *fuse_select_queue(struct fuse_conn *fc)
+{
+	unsigned nr = ACCESS_ONCE(fc->nr_queues);
+
+	/* pairs with smp_wmb() in fuse_dev_clone() */
+	smp_rmb();
+	return fc->queues[raw_smp_processor_id() % nr];
+}
+
+/* The queue a unique ID was handed out by, or NULL */
+static struct fuse_queue *fuse_unique_queue(struct fuse_conn *fc, u64 unique)
+{
+	unsigned idx = unique & FUSE_QUEUE_MASK;
+	unsigned nr = ACCESS_ONCE(fc->nr_queues);
+
+	smp_rmb();
+	return idx < nr ? fc->queues[idx] : NULL;
+}
+
+static u64 fuse_get_unique(struct fuse_queue *fq)
 {
-	fc->reqctr++;
-	/* zero is special */
-	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+	fq->reqctr++;
+	/* zero is special, and so is FUSE_INT_REQ_BIT */
+	if (fq->reqctr >= (FUSE_INT_REQ_BIT >> FUSE_QUEUE_BITS))
+		fq->reqctr = 1;
 
-	return fc->reqctr;
+	return (fq->reqctr << FUSE_QUEUE_BITS) | fq->idx;
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+static struct list_head *fuse_pqueue_hash(struct fuse_queue *fq, u64 unique)
 {
+	unique = (unique & ~FUSE_INT_REQ_BIT) >> FUSE_QUEUE_BITS;
+
+	return &fq->processing[hash_64(unique, FUSE_PQ_HASH_BITS)];
+}
+
+/* Called with fq->lock held */
+static void queue_request(struct fuse_queue *fq, struct fuse_req *req)
+{
+	req->fq = fq;
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	list_add_tail(&req->list, &fq->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
-		atomic_inc(&fc->num_waiting);
+		atomic_inc(&fq->fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	wake_up(&fq->waitq);
+	kill_fasync(&fq->fasync, SIGIO, POLL_IN);
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 		       u64 nodeid, u64 nlookup)
 {
+	struct fuse_queue *fq = fuse_select_queue(fc);
+
 	forget->forget_one.nodeid = nodeid;
 	forget->forget_one.nlookup = nlookup;
 
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		fc->forget_list_tail->next = forget;
-		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	spin_lock(&fq->lock);
+	if (fq->connected) {
+		fq->forget_list_tail->next = forget;
+		fq->forget_list_tail = forget;
+		wake_up(&fq->waitq);
+		kill_fasync(&fq->fasync, SIGIO, POLL_IN);
 	} else {
 		kfree(forget);
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 }
 
+/* Called with fc->lock held */
 static void flush_bg_queue(struct fuse_conn *fc)
 {
 	while (fc->active_background < fc->max_background &&
 	       !list_empty(&fc->bg_queue)) {
 		struct fuse_req *req;
+		struct fuse_queue *fq;
 
 		req = list_entry(fc->bg_queue.next, struct fuse_req, list);
 		list_del(&req->list);
 		fc->active_background++;
-		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		fq = fuse_select_queue(fc);
+		spin_lock(&fq->lock);
+		req->in.h.unique = fuse_get_unique(fq);
+		queue_request(fq, req);
+		spin_unlock(&fq->lock);
 	}
 }
 
+static void fuse_shm_put(struct fuse_shm *shm)
+{
+	if (atomic_dec_and_test(&shm->count))
+		kfree(shm);
+}
+
+/*
+ * Take back the shared memory slot of a request that is off the lists,
+ * so no reply can come for it any more.  The pages are unmapped from
+ * the daemon before the slot is given back; as faults hold shm->mutex
+ * too, nothing can map them again meanwhile, and whoever else tries to
+ * take the slot waits until they are gone.
+ *
+ * Called with fq->lock held, drops it while unmapping
+ */
+static void fuse_shm_put_slot(struct fuse_queue *fq, struct fuse_req *req)
+__releases(fq->lock)
+__acquires(fq->lock)
+{
+	struct fuse_shm *shm = fq->shm;
+	unsigned slot;
+	unsigned i;
+
+	atomic_inc(&shm->count);
+	spin_unlock(&fq->lock);
+	mutex_lock(&shm->mutex);
+	spin_lock(&fq->lock);
+	slot = req->shm_slot;
+	spin_unlock(&fq->lock);
+	if (slot--) {
+		unmap_mapping_range(&shm->mapping,
+				    (loff_t) slot * shm->slot_pages << PAGE_SHIFT,
+				    (loff_t) shm->slot_pages << PAGE_SHIFT, 1);
+		/* the daemon wrote the data of a READ through its mapping */
+		if (slot < shm->nr_slots) {
+			for (i = 0; i < req->num_pages; i++)
+				flush_dcache_page(req->pages[i]);
+		}
+		spin_lock(&fq->lock);
+		shm->reqs[slot] = NULL;
+		req->shm_slot = 0;
+		spin_unlock(&fq->lock);
+	}
+	mutex_unlock(&shm->mutex);
+	spin_lock(&fq->lock);
+	fuse_shm_put(shm);
+}
+
 /*
  * This function is called when a request is finished.  Either a reply
  * has arrived or it was aborted (and not yet sent) or some error
@@ -363,19 +450,29 @@ static void flush_bg_queue(struct fuse_conn *fc)
  * the 'end' callback is called if given, else the reference to the
  * request is released
  *
- * Called with fc->lock, unlocks it
+ * Called with the lock of the request's queue held if it was queued,
+ * unlocks it
  */
 static void request_end(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
 {
+	struct fuse_queue *fq = req->fq;
 	void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
+	bool background = req->background;
+
 	req->end = NULL;
 	list_del(&req->list);
+	if (req->shm_slot)
+		fuse_shm_put_slot(fq, req);
 	list_del(&req->intr_entry);
+	req->background = 0;
 	req->state = FUSE_REQ_FINISHED;
-	if (req->background) {
-		req->background = 0;
+	if (fq) {
+		req->fq = NULL;
+		spin_unlock(&fq->lock);
+	}
 
+	if (background) {
+		spin_lock(&fc->lock);
 		if (fc->num_background == fc->max_background)
 			fc->blocked = 0;
 
@@ -391,41 +488,43 @@ __releases(fc->lock)
 		fc->num_background--;
 		fc->active_background--;
 		flush_bg_queue(fc);
+		spin_unlock(&fc->lock);
 	}
-	spin_unlock(&fc->lock);
 	wake_up(&req->waitq);
 	if (end)
 		end(fc, req);
 	fuse_put_request(fc, req);
 }
 
-static void wait_answer_interruptible(struct fuse_conn *fc,
+static void wait_answer_interruptible(struct fuse_queue *fq,
 				      struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
+__releases(fq->lock)
+__acquires(fq->lock)
 {
 	if (signal_pending(current))
 		return;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 	wait_event_interruptible(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
+	spin_lock(&fq->lock);
 }
 
-static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
+static void queue_interrupt(struct fuse_queue *fq, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &fq->interrupts);
+	wake_up(&fq->waitq);
+	kill_fasync(&fq->fasync, SIGIO, POLL_IN);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
-__releases(fc->lock)
-__acquires(fc->lock)
+__releases(req->fq->lock)
+__acquires(req->fq->lock)
 {
+	struct fuse_queue *fq = req->fq;
+
 	if (!fc->no_interrupt) {
 		/* Any signal may interrupt this */
-		wait_answer_interruptible(fc, req);
+		wait_answer_interruptible(fq, req);
 
 		if (req->aborted)
 			goto aborted;
@@ -434,7 +533,7 @@ __acquires(fc->lock)
 
 		req->interrupted = 1;
 		if (req->state == FUSE_REQ_SENT)
-			queue_interrupt(fc, req);
+			queue_interrupt(fq, req);
 	}
 
 	if (!req->force) {
@@ -442,7 +541,7 @@ __acquires(fc->lock)
 
 		/* Only fatal signals may interrupt this */
 		block_sigs(&oldset);
-		wait_answer_interruptible(fc, req);
+		wait_answer_interruptible(fq, req);
 		restore_sigs(&oldset);
 
 		if (req->aborted)
@@ -463,9 +562,9 @@ __acquires(fc->lock)
 	 * Either request is already in userspace, or it was forced.
 	 * Wait it out.
 	 */
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 	wait_event(req->waitq, req->state == FUSE_REQ_FINISHED);
-	spin_lock(&fc->lock);
+	spin_lock(&fq->lock);
 
 	if (!req->aborted)
 		return;
@@ -478,30 +577,32 @@ __acquires(fc->lock)
 		   locked state, there mustn't be any filesystem
 		   operation (e.g. page fault), since that could lead
 		   to deadlock */
-		spin_unlock(&fc->lock);
+		spin_unlock(&fq->lock);
 		wait_event(req->waitq, !req->locked);
-		spin_lock(&fc->lock);
+		spin_lock(&fq->lock);
 	}
 }
 
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_queue *fq = fuse_select_queue(fc);
+
 	BUG_ON(req->background);
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	spin_lock(&fq->lock);
+	if (!fq->connected || !fc->connected)
 		req->out.h.error = -ENOTCONN;
 	else if (fc->conn_error)
 		req->out.h.error = -ECONNREFUSED;
 	else {
-		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		req->in.h.unique = fuse_get_unique(fq);
+		queue_request(fq, req);
 		/* acquire extra reference, since request is still needed
 		   after request_end() */
 		__fuse_get_request(req);
 
 		request_wait_answer(fc, req);
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 }
 
 void fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
@@ -534,6 +635,7 @@ static void fuse_request_send_nowait(struct fuse_conn *fc, struct fuse_req *req)
 		fuse_request_send_nowait_locked(fc, req);
 		spin_unlock(&fc->lock);
 	} else {
+		spin_unlock(&fc->lock);
 		req->out.h.error = -ENOTCONN;
 		request_end(fc, req);
 	}
@@ -549,16 +651,17 @@ EXPORT_SYMBOL_GPL(fuse_request_send_background);
 static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 					  struct fuse_req *req, u64 unique)
 {
+	struct fuse_queue *fq = fuse_select_queue(fc);
 	int err = -ENODEV;
 
 	req->isreply = 0;
 	req->in.h.unique = unique;
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		queue_request(fc, req);
+	spin_lock(&fq->lock);
+	if (fq->connected) {
+		queue_request(fq, req);
 		err = 0;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 
 	return err;
 }
@@ -575,6 +678,36 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 	fuse_request_send_nowait_locked(fc, req);
 }
 
+/*
+ * Called with fc->lock held, which keeps a request that hasn't been
+ * queued yet off the queues.  Once queued, the queue lock keeps the
+ * daemon from reading the request while the page is replaced.
+ */
+bool fuse_request_replace_page(struct fuse_req *req, struct page *page)
+{
+	struct fuse_queue *fq;
+	bool replaced = false;
+
+	if (req->state == FUSE_REQ_INIT) {
+		copy_highpage(req->pages[0], page);
+		return true;
+	}
+
+	/* queues are only freed with the connection */
+	fq = ACCESS_ONCE(req->fq);
+	if (!fq)
+		return false;
+
+	spin_lock(&fq->lock);
+	if (req->state == FUSE_REQ_PENDING) {
+		copy_highpage(req->pages[0], page);
+		replaced = true;
+	}
+	spin_unlock(&fq->lock);
+
+	return replaced;
+}
+
 void fuse_force_forget(struct file *file, u64 nodeid)
 {
 	struct inode *inode = file_inode(file);
@@ -601,16 +734,16 @@ void fuse_force_forget(struct file *file, u64 nodeid)
  * anything that could cause a page-fault.  If the request was already
  * aborted bail out.
  */
-static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
+static int lock_request(struct fuse_req *req)
 {
 	int err = 0;
 	if (req) {
-		spin_lock(&fc->lock);
+		spin_lock(&req->fq->lock);
 		if (req->aborted)
 			err = -ENOENT;
 		else
 			req->locked = 1;
-		spin_unlock(&fc->lock);
+		spin_unlock(&req->fq->lock);
 	}
 	return err;
 }
@@ -620,14 +753,14 @@ static int lock_request(struct fuse_conn *fc, struct fuse_req *req)
  * requester thread is currently waiting for it to be unlocked, so
  * wake it up.
  */
-static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
+static void unlock_request(struct fuse_req *req)
 {
 	if (req) {
-		spin_lock(&fc->lock);
+		spin_lock(&req->fq->lock);
 		req->locked = 0;
 		if (req->aborted)
 			wake_up(&req->waitq);
-		spin_unlock(&fc->lock);
+		spin_unlock(&req->fq->lock);
 	}
 }
 
@@ -645,6 +778,7 @@ struct fuse_copy_state {
 	struct page *pg;
 	unsigned len;
 	unsigned offset;
+	unsigned shm_slot;
 	unsigned move_pages:1;
 };
 
@@ -687,7 +821,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 	struct page *page;
 	int err;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 	if (cs->pipebufs) {
 		struct pipe_buffer *buf = cs->pipebufs;
@@ -742,7 +876,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 		cs->addr += cs->len;
 	}
 
-	return lock_request(cs->fc, cs->req);
+	return lock_request(cs->req);
 }
 
 /* Do as much copy to/from userspace buffer as we can */
@@ -793,7 +927,7 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 	struct page *newpage;
 	struct pipe_buffer *buf = cs->pipebufs;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	err = buf->ops->confirm(cs->pipe, buf);
@@ -847,12 +981,12 @@ static int fuse_try_move_page(struct fuse_copy_state *cs, struct page **pagep)
 		lru_cache_add_file(newpage);
 
 	err = 0;
-	spin_lock(&cs->fc->lock);
+	spin_lock(&cs->req->fq->lock);
 	if (cs->req->aborted)
 		err = -ENOENT;
 	else
 		*pagep = newpage;
-	spin_unlock(&cs->fc->lock);
+	spin_unlock(&cs->req->fq->lock);
 
 	if (err) {
 		unlock_page(newpage);
@@ -872,7 +1006,7 @@ out_fallback:
 	cs->pg = buf->page;
 	cs->offset = buf->offset;
 
-	err = lock_request(cs->fc, cs->req);
+	err = lock_request(cs->req);
 	if (err)
 		return err;
 
@@ -887,7 +1021,7 @@ static int fuse_ref_page(struct fuse_copy_state *cs, struct page *page,
 	if (cs->nr_segs == cs->pipe->buffers)
 		return -EIO;
 
-	unlock_request(cs->fc, cs->req);
+	unlock_request(cs->req);
 	fuse_copy_finish(cs);
 
 	buf = cs->pipebufs;
@@ -998,49 +1132,153 @@ static int fuse_copy_args(struct fuse_copy_state *cs, unsigned numargs,
 	return err;
 }
 
-static int forget_pending(struct fuse_conn *fc)
+/*
+ * Take a free slot of the shared memory area for a READ or WRITE whose
+ * payload is whole pages and fits, called with fq->lock held.  READs
+ * take the first half of the slots, WRITEs the second.  Returns the
+ * index of the slot among those of its kind plus one, or zero.
+ */
+static unsigned fuse_shm_get_slot(struct fuse_queue *fq, struct fuse_req *req)
 {
-	return fc->forget_list_head.next != NULL;
+	struct fuse_shm *shm = fq->shm;
+	unsigned size;
+	unsigned slot;
+	unsigned i;
+
+	if (!shm)
+		return 0;
+
+	switch (req->in.h.opcode) {
+	case FUSE_READ:
+		if (req->in.numargs != 1 ||
+		    req->in.args[0].size != sizeof(struct fuse_read_in) ||
+		    req->out.numargs != 1 || !req->out.argpages)
+			return 0;
+		size = req->out.args[0].size;
+		break;
+	case FUSE_WRITE:
+		if (req->in.numargs != 2 ||
+		    req->in.args[0].size != sizeof(struct fuse_write_in) ||
+		    !req->in.argpages)
+			return 0;
+		size = req->in.args[1].size;
+		break;
+	default:
+		return 0;
+	}
+	if (req->num_pages > shm->slot_pages ||
+	    size > req->num_pages << PAGE_SHIFT)
+		return 0;
+	for (i = 0; i < req->num_pages; i++) {
+		if (req->page_descs[i].offset ||
+		    req->page_descs[i].length != PAGE_SIZE)
+			return 0;
+	}
+
+	i = req->in.h.opcode == FUSE_READ ? 0 : shm->nr_slots;
+	for (slot = 0; slot < shm->nr_slots; slot++) {
+		if (!shm->reqs[i + slot]) {
+			shm->reqs[i + slot] = req;
+			req->shm_slot = i + slot + 1;
+			return slot + 1;
+		}
+	}
+	return 0;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * Copy a READ or WRITE request that has a shared memory slot.  Only the
+ * header and the fuse_read_in or fuse_write_in, flagged and naming the
+ * slot, go to the userspace buffer; the payload stays in the pages of
+ * the request, mapped through the slot.  The pages of a READ are
+ * cleared first, so the daemon never sees what they held before.
+ */
+static int fuse_copy_shm_request(struct fuse_copy_state *cs, unsigned slot,
+				 unsigned reqsize)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	struct fuse_req *req = cs->req;
+	struct fuse_in *in = &req->in;
+	struct fuse_in_header ih;
+	union {
+		struct fuse_read_in read;
+		struct fuse_write_in write;
+	} arg;
+	unsigned argsize;
+	int err;
+
+	err = lock_request(req);
+	if (err)
+		return err;
+
+	ih = in->h;
+	ih.len = reqsize;
+	argsize = in->args[0].size;
+	memcpy(&arg, in->args[0].value, argsize);
+	if (in->h.opcode == FUSE_READ) {
+		unsigned i;
+
+		arg.read.read_flags |= FUSE_READ_SHM;
+		arg.read.shm_slot = slot;
+		for (i = 0; i < req->num_pages; i++)
+			clear_highpage(req->pages[i]);
+	} else {
+		arg.write.write_flags |= FUSE_WRITE_SHM;
+		arg.write.shm_slot = slot;
+	}
+	unlock_request(req);
+
+	err = fuse_copy_one(cs, &ih, sizeof(ih));
+	if (!err)
+		err = fuse_copy_one(cs, &arg, argsize);
+	return err;
+}
+
+static int forget_pending(struct fuse_queue *fq)
+{
+	return fq->forget_list_head.next != NULL;
+}
+
+static int request_pending(struct fuse_queue *fq)
+{
+	return !list_empty(&fq->pending) || !list_empty(&fq->interrupts) ||
+		forget_pending(fq);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void request_wait(struct fuse_queue *fq)
+__releases(fq->lock)
+__acquires(fq->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&fq->waitq, &wait);
+	while (fq->connected && fq->fc->connected && !request_pending(fq)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&fq->lock);
 		schedule();
-		spin_lock(&fc->lock);
+		spin_lock(&fq->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&fq->waitq, &wait);
 }
 
 /*
  * Transfer an interrupt request to userspace
  *
  * Unlike other requests this is assembled on demand, without a need
- * to allocate a separate fuse_req structure.
+ * to allocate a separate fuse_req structure.  Its unique ID is the one
+ * of the interrupted request with FUSE_INT_REQ_BIT set, so the reply
+ * finds its way back to the same queue.
  *
- * Called with fc->lock held, releases it
+ * Called with fq->lock held, releases it
  */
-static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_interrupt(struct fuse_queue *fq,
+			       struct fuse_copy_state *cs,
 			       size_t nbytes, struct fuse_req *req)
-__releases(fc->lock)
+__releases(fq->lock)
 {
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
@@ -1048,7 +1286,7 @@ __releases(fc->lock)
 	int err;
 
 	list_del_init(&req->intr_entry);
-	req->intr_unique = fuse_get_unique(fc);
+	req->intr_unique = req->in.h.unique | FUSE_INT_REQ_BIT;
 	memset(&ih, 0, sizeof(ih));
 	memset(&arg, 0, sizeof(arg));
 	ih.len = reqsize;
@@ -1056,7 +1294,7 @@ __releases(fc->lock)
 	ih.unique = req->intr_unique;
 	arg.unique = req->in.h.unique;
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 	if (nbytes < reqsize)
 		return -EINVAL;
 
@@ -1068,21 +1306,21 @@ __releases(fc->lock)
 	return err ? err : reqsize;
 }
 
-static struct fuse_forget_link *dequeue_forget(struct fuse_conn *fc,
+static struct fuse_forget_link *dequeue_forget(struct fuse_queue *fq,
 					       unsigned max,
 					       unsigned *countp)
 {
-	struct fuse_forget_link *head = fc->forget_list_head.next;
+	struct fuse_forget_link *head = fq->forget_list_head.next;
 	struct fuse_forget_link **newhead = &head;
 	unsigned count;
 
 	for (count = 0; *newhead != NULL && count < max; count++)
 		newhead = &(*newhead)->next;
 
-	fc->forget_list_head.next = *newhead;
+	fq->forget_list_head.next = *newhead;
 	*newhead = NULL;
-	if (fc->forget_list_head.next == NULL)
-		fc->forget_list_tail = &fc->forget_list_head;
+	if (fq->forget_list_head.next == NULL)
+		fq->forget_list_tail = &fq->forget_list_head;
 
 	if (countp != NULL)
 		*countp = count;
@@ -1090,24 +1328,24 @@ static struct fuse_forget_link *dequeue_forget(struct fuse_conn *fc,
 	return head;
 }
 
-static int fuse_read_single_forget(struct fuse_conn *fc,
+static int fuse_read_single_forget(struct fuse_queue *fq,
 				   struct fuse_copy_state *cs,
 				   size_t nbytes)
-__releases(fc->lock)
+__releases(fq->lock)
 {
 	int err;
-	struct fuse_forget_link *forget = dequeue_forget(fc, 1, NULL);
+	struct fuse_forget_link *forget = dequeue_forget(fq, 1, NULL);
 	struct fuse_forget_in arg = {
 		.nlookup = forget->forget_one.nlookup,
 	};
 	struct fuse_in_header ih = {
 		.opcode = FUSE_FORGET,
 		.nodeid = forget->forget_one.nodeid,
-		.unique = fuse_get_unique(fc),
+		.unique = fuse_get_unique(fq),
 		.len = sizeof(ih) + sizeof(arg),
 	};
 
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 	kfree(forget);
 	if (nbytes < ih.len)
 		return -EINVAL;
@@ -1123,9 +1361,9 @@ __releases(fc->lock)
 	return ih.len;
 }
 
-static int fuse_read_batch_forget(struct fuse_conn *fc,
+static int fuse_read_batch_forget(struct fuse_queue *fq,
 				   struct fuse_copy_state *cs, size_t nbytes)
-__releases(fc->lock)
+__releases(fq->lock)
 {
 	int err;
 	unsigned max_forgets;
@@ -1134,18 +1372,18 @@ __releases(fc->lock)
 	struct fuse_batch_forget_in arg = { .count = 0 };
 	struct fuse_in_header ih = {
 		.opcode = FUSE_BATCH_FORGET,
-		.unique = fuse_get_unique(fc),
+		.unique = fuse_get_unique(fq),
 		.len = sizeof(ih) + sizeof(arg),
 	};
 
 	if (nbytes < ih.len) {
-		spin_unlock(&fc->lock);
+		spin_unlock(&fq->lock);
 		return -EINVAL;
 	}
 
 	max_forgets = (nbytes - ih.len) / sizeof(struct fuse_forget_one);
-	head = dequeue_forget(fc, max_forgets, &count);
-	spin_unlock(&fc->lock);
+	head = dequeue_forget(fq, max_forgets, &count);
+	spin_unlock(&fq->lock);
 
 	arg.count = count;
 	ih.len += count * sizeof(struct fuse_forget_one);
@@ -1172,68 +1410,73 @@ __releases(fc->lock)
 	return ih.len;
 }
 
-static int fuse_read_forget(struct fuse_conn *fc, struct fuse_copy_state *cs,
+static int fuse_read_forget(struct fuse_queue *fq, struct fuse_copy_state *cs,
 			    size_t nbytes)
-__releases(fc->lock)
+__releases(fq->lock)
 {
-	if (fc->minor < 16 || fc->forget_list_head.next->next == NULL)
-		return fuse_read_single_forget(fc, cs, nbytes);
+	if (fq->fc->minor < 16 || fq->forget_list_head.next->next == NULL)
+		return fuse_read_single_forget(fq, cs, nbytes);
 	else
-		return fuse_read_batch_forget(fc, cs, nbytes);
+		return fuse_read_batch_forget(fq, cs, nbytes);
 }
 
 /*
  * Read a single request into the userspace filesystem's buffer.  This
  * function waits until a request is available, then removes it from
- * the pending list and copies request data to userspace buffer.  If
- * no reply is needed (FORGET) or request has been aborted or there
- * was an error during the copying then it's finished by calling
- * request_end().  Otherwise add it to the processing list, and set
- * the 'sent' flag.
+ * the pending list of the queue and copies request data to userspace
+ * buffer.  If no reply is needed (FORGET) or request has been aborted
+ * or there was an error during the copying then it's finished by
+ * calling request_end().  Otherwise add it to the processing hash of
+ * the queue, and set the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_queue *fq, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = fq->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
+	unsigned slot;
 
  restart:
-	spin_lock(&fc->lock);
+	spin_lock(&fq->lock);
 	err = -EAGAIN;
-	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	if ((file->f_flags & O_NONBLOCK) && fq->connected && fc->connected &&
+	    !request_pending(fq))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fq);
 	err = -ENODEV;
-	if (!fc->connected)
+	if (!fq->connected || !fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(fq))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&fq->interrupts)) {
+		req = list_entry(fq->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, cs, nbytes, req);
+		return fuse_read_interrupt(fq, cs, nbytes, req);
 	}
 
-	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
-			return fuse_read_forget(fc, cs, nbytes);
+	if (forget_pending(fq)) {
+		if (list_empty(&fq->pending) || fq->forget_batch-- > 0)
+			return fuse_read_forget(fq, cs, nbytes);
 
-		if (fc->forget_batch <= -8)
-			fc->forget_batch = 16;
+		if (fq->forget_batch <= -8)
+			fq->forget_batch = 16;
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(fq->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &fq->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
+	slot = fuse_shm_get_slot(fq, req);
+	if (slot && in->argpages)
+		reqsize -= in->args[in->numargs - 1].size;
 	/* If request is too large, reply with an error and restart the read */
 	if (nbytes < reqsize) {
 		req->out.h.error = -EIO;
@@ -1243,14 +1486,18 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 		goto restart;
 	}
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 	cs->req = req;
-	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
-	if (!err)
-		err = fuse_copy_args(cs, in->numargs, in->argpages,
-				     (struct fuse_arg *) in->args, 0);
+	if (slot) {
+		err = fuse_copy_shm_request(cs, slot - 1, reqsize);
+	} else {
+		err = fuse_copy_one(cs, &in->h, sizeof(in->h));
+		if (!err)
+			err = fuse_copy_args(cs, in->numargs, in->argpages,
+					     (struct fuse_arg *) in->args, 0);
+	}
 	fuse_copy_finish(cs);
-	spin_lock(&fc->lock);
+	spin_lock(&fq->lock);
 	req->locked = 0;
 	if (req->aborted) {
 		request_end(fc, req);
@@ -1265,15 +1512,15 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, fuse_pqueue_hash(fq, in->h.unique));
 		if (req->interrupted)
-			queue_interrupt(fc, req);
-		spin_unlock(&fc->lock);
+			queue_interrupt(fq, req);
+		spin_unlock(&fq->lock);
 	}
 	return reqsize;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 	return err;
 }
 
@@ -1282,13 +1529,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_queue *fq = fuse_dev_queue(file);
+	if (!fq)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, fq->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(fq, file, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
@@ -1300,18 +1547,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_queue *fq = fuse_dev_queue(in);
+	if (!fq)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, fq->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(fq, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1749,12 +1996,12 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 	}
 }
 
-/* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+/* Look up request on the processing hash of the queue by unique ID */
+static struct fuse_req *request_find(struct fuse_queue *fq, u64 unique)
 {
 	struct fuse_req *req;
 
-	list_for_each_entry(req, &fc->processing, list) {
+	list_for_each_entry(req, fuse_pqueue_hash(fq, unique), list) {
 		if (req->in.h.unique == unique || req->intr_unique == unique)
 			return req;
 	}
@@ -1765,6 +2012,7 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 			 unsigned nbytes)
 {
 	unsigned reqsize = sizeof(struct fuse_out_header);
+	struct fuse_arg *lastarg = &out->args[out->numargs-1];
 
 	if (out->h.error)
 		return nbytes != reqsize ? -EINVAL : 0;
@@ -1774,12 +2022,27 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 	if (reqsize < nbytes || (reqsize > nbytes && !out->argvar))
 		return -EINVAL;
 	else if (reqsize > nbytes) {
-		struct fuse_arg *lastarg = &out->args[out->numargs-1];
 		unsigned diffsize = reqsize - nbytes;
 		if (diffsize > lastarg->size)
 			return -EINVAL;
 		lastarg->size -= diffsize;
 	}
+	if (cs->shm_slot) {
+		/*
+		 * The daemon wrote the data through the slot, the buffer
+		 * only has the header.  Clear whatever it left past the end.
+		 */
+		if (out->page_zeroing) {
+			struct fuse_req *req = cs->req;
+			unsigned i = lastarg->size >> PAGE_SHIFT;
+			unsigned offset = lastarg->size & ~PAGE_MASK;
+
+			for (; i < req->num_pages; i++, offset = 0)
+				zero_user_segment(req->pages[i], offset,
+						  PAGE_SIZE);
+		}
+		return fuse_copy_args(cs, out->numargs - 1, 0, out->args, 0);
+	}
 	return fuse_copy_args(cs, out->numargs, out->argpages, out->args,
 			      out->page_zeroing);
 }
@@ -1787,14 +2050,16 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
 /*
  * Write a single reply to a request.  First the header is copied from
  * the write buffer.  The request is then searched on the processing
- * list by the unique ID found in the header.  If found, then remove
- * it from the list and copy the rest of the buffer to the request.
- * The request is finished by calling request_end()
+ * hash of the queue found in the unique ID of the header, so a reply
+ * may be written to any device file of the connection.  If found, then
+ * remove it from the list and copy the rest of the buffer to the
+ * request.  The request is finished by calling request_end()
  */
 static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
+	struct fuse_queue *fq;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
 
@@ -1805,15 +2070,15 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (err)
 		goto err_finish;
 
-	err = -EINVAL;
-	if (oh.len != nbytes)
-		goto err_finish;
-
 	/*
 	 * Zero oh.unique indicates unsolicited notification message
 	 * and error contains notification code.
 	 */
 	if (!oh.unique) {
+		err = -EINVAL;
+		if (oh.len != nbytes)
+			goto err_finish;
+
 		err = fuse_notify(fc, oh.error, nbytes - sizeof(oh), cs);
 		return err ? err : nbytes;
 	}
@@ -1822,51 +2087,68 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (oh.error <= -1000 || oh.error > 0)
 		goto err_finish;
 
-	spin_lock(&fc->lock);
 	err = -ENOENT;
-	if (!fc->connected)
+	fq = fuse_unique_queue(fc, oh.unique);
+	if (!fq)
+		goto err_finish;
+
+	spin_lock(&fq->lock);
+	if (!fq->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(fq, oh.unique);
 	if (!req)
 		goto err_unlock;
 
 	if (req->aborted) {
-		spin_unlock(&fc->lock);
+		spin_unlock(&fq->lock);
 		fuse_copy_finish(cs);
-		spin_lock(&fc->lock);
+		spin_lock(&fq->lock);
 		request_end(fc, req);
 		return -ENOENT;
 	}
 	/* Is it an interrupt reply? */
 	if (req->intr_unique == oh.unique) {
 		err = -EINVAL;
-		if (nbytes != sizeof(struct fuse_out_header))
+		if (oh.len != nbytes ||
+		    nbytes != sizeof(struct fuse_out_header))
 			goto err_unlock;
 
 		if (oh.error == -ENOSYS)
 			fc->no_interrupt = 1;
 		else if (oh.error == -EAGAIN)
-			queue_interrupt(fc, req);
+			queue_interrupt(fq, req);
 
-		spin_unlock(&fc->lock);
+		spin_unlock(&fq->lock);
 		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
+	/*
+	 * A READ with a shared memory slot may be answered with just the
+	 * header, oh.len then also counts the data left in the slot.
+	 */
+	err = -EINVAL;
+	if (oh.len != nbytes &&
+	    (!req->shm_slot || !req->out.argpages || oh.error ||
+	     nbytes != sizeof(struct fuse_out_header) || oh.len < nbytes))
+		goto err_unlock;
+
 	req->state = FUSE_REQ_WRITING;
-	list_move(&req->list, &fc->io);
+	list_move(&req->list, &fq->io);
 	req->out.h = oh;
 	req->locked = 1;
 	cs->req = req;
+	if (oh.len != nbytes)
+		cs->shm_slot = req->shm_slot;
 	if (!req->out.page_replace)
 		cs->move_pages = 0;
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 
-	err = copy_out_args(cs, &req->out, nbytes);
+	err = copy_out_args(cs, &req->out, oh.len);
 	fuse_copy_finish(cs);
 
-	spin_lock(&fc->lock);
+	spin_lock(&fq->lock);
 	req->locked = 0;
 	if (!err) {
 		if (req->aborted)
@@ -1878,7 +2160,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	return err ? err : nbytes;
 
  err_unlock:
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
  err_finish:
 	fuse_copy_finish(cs);
 	return err;
@@ -1978,18 +2260,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_queue *fq = fuse_dev_queue(file);
+	if (!fq)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	poll_wait(file, &fq->waitq, wait);
 
-	spin_lock(&fc->lock);
-	if (!fc->connected)
+	spin_lock(&fq->lock);
+	if (!fq->connected || !fq->fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fq))
 		mask |= POLLIN | POLLRDNORM;
-	spin_unlock(&fc->lock);
+	spin_unlock(&fq->lock);
 
 	return mask;
 }
@@ -1997,18 +2279,19 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 /*
  * Abort all requests on the given list (pending or processing)
  *
- * This function releases and reacquires fc->lock
+ * This function releases and reacquires fq->lock
  */
-static void end_requests(struct fuse_conn *fc, struct list_head *head)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_requests(struct fuse_conn *fc, struct fuse_queue *fq,
+			 struct list_head *head)
+__releases(fq->lock)
+__acquires(fq->lock)
 {
 	while (!list_empty(head)) {
 		struct fuse_req *req;
 		req = list_entry(head->next, struct fuse_req, list);
 		req->out.h.error = -ECONNABORTED;
 		request_end(fc, req);
-		spin_lock(&fc->lock);
+		spin_lock(&fq->lock);
 	}
 }
 
@@ -2022,43 +2305,53 @@ __acquires(fc->lock)
  * If the request is asynchronous, then the end function needs to be
  * called after waiting for the request to be unlocked (if it was
  * locked).
+ *
+ * A shared memory slot is taken back before the waiter is woken up,
+ * so the pages are unmapped from the daemon by the time the requester
+ * may let go of them.  The copying thread finishing the request
+ * meanwhile waits for that in request_end().
  */
-static void end_io_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_io_requests(struct fuse_conn *fc, struct fuse_queue *fq)
+__releases(fq->lock)
+__acquires(fq->lock)
 {
-	while (!list_empty(&fc->io)) {
+	while (!list_empty(&fq->io)) {
 		struct fuse_req *req =
-			list_entry(fc->io.next, struct fuse_req, list);
+			list_entry(fq->io.next, struct fuse_req, list);
 		void (*end) (struct fuse_conn *, struct fuse_req *) = req->end;
 
 		req->aborted = 1;
 		req->out.h.error = -ECONNABORTED;
-		req->state = FUSE_REQ_FINISHED;
 		list_del_init(&req->list);
-		wake_up(&req->waitq);
 		if (end) {
 			req->end = NULL;
 			__fuse_get_request(req);
-			spin_unlock(&fc->lock);
+		}
+		if (req->shm_slot)
+			fuse_shm_put_slot(fq, req);
+		req->state = FUSE_REQ_FINISHED;
+		wake_up(&req->waitq);
+		if (end) {
+			spin_unlock(&fq->lock);
 			wait_event(req->waitq, !req->locked);
 			end(fc, req);
 			fuse_put_request(fc, req);
-			spin_lock(&fc->lock);
+			spin_lock(&fq->lock);
 		}
 	}
 }
 
-static void end_queued_requests(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+static void end_queued_requests(struct fuse_conn *fc, struct fuse_queue *fq)
+__releases(fq->lock)
+__acquires(fq->lock)
 {
-	fc->max_background = UINT_MAX;
-	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
-	while (forget_pending(fc))
-		kfree(dequeue_forget(fc, 1, NULL));
+	unsigned i;
+
+	end_requests(fc, fq, &fq->pending);
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		end_requests(fc, fq, &fq->processing[i]);
+	while (forget_pending(fq))
+		kfree(dequeue_forget(fq, 1, NULL));
 }
 
 static void end_polls(struct fuse_conn *fc)
@@ -2076,6 +2369,38 @@ static void end_polls(struct fuse_conn *fc)
 	}
 }
 
+/*
+ * End the requests of all queues of a connection that has just been
+ * disconnected.  The background requests are queued first, so they
+ * are ended with the rest.  No new requests or queues can be added
+ * once fc->connected is clear.
+ */
+static void end_queues(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	spin_lock(&fc->lock);
+	fc->blocked = 0;
+	fc->initialized = 1;
+	fc->max_background = UINT_MAX;
+	flush_bg_queue(fc);
+	end_polls(fc);
+	spin_unlock(&fc->lock);
+
+	for (i = 0; i < fc->nr_queues; i++) {
+		struct fuse_queue *fq = fc->queues[i];
+
+		spin_lock(&fq->lock);
+		fq->connected = 0;
+		end_io_requests(fc, fq);
+		end_queued_requests(fc, fq);
+		spin_unlock(&fq->lock);
+		wake_up_all(&fq->waitq);
+		kill_fasync(&fq->fasync, SIGIO, POLL_IN);
+	}
+	wake_up_all(&fc->blocked_waitq);
+}
+
 /*
  * Abort all requests.
  *
@@ -2089,7 +2414,7 @@ static void end_polls(struct fuse_conn *fc)
  *
  * During the aborting, progression of requests from the pending and
  * processing lists onto the io list, and progression of new requests
- * onto the pending list is prevented by req->connected being false.
+ * onto the pending list is prevented by fq->connected being false.
  *
  * Progression of requests under I/O to the processing list is
  * prevented by the req->aborted flag being true for these requests.
@@ -2100,31 +2425,39 @@ void fuse_abort_conn(struct fuse_conn *fc)
 	spin_lock(&fc->lock);
 	if (fc->connected) {
 		fc->connected = 0;
-		fc->blocked = 0;
-		fc->initialized = 1;
-		end_io_requests(fc);
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->waitq);
-		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		spin_unlock(&fc->lock);
+		end_queues(fc);
+	} else {
+		spin_unlock(&fc->lock);
 	}
-	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Releasing any of the device files of a connection ends it, the same
+ * as closing the only one did before queues could be cloned.  The
+ * other device files may still be in the middle of copying requests,
+ * so those under I/O are aborted as well.
+ */
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
+	struct fuse_queue *fq = fuse_dev_queue(file);
 	struct fuse_conn *fc = fuse_get_conn(file);
 	if (fc) {
+		struct fuse_shm *shm;
+
 		spin_lock(&fc->lock);
 		fc->connected = 0;
-		fc->blocked = 0;
-		fc->initialized = 1;
-		end_queued_requests(fc);
-		end_polls(fc);
-		wake_up_all(&fc->blocked_waitq);
 		spin_unlock(&fc->lock);
+		end_queues(fc);
+
+		/* No request holds a slot of the queue any more */
+		spin_lock(&fq->lock);
+		shm = fq->shm;
+		fq->shm = NULL;
+		spin_unlock(&fq->lock);
+		if (shm)
+			fuse_shm_put(shm);
 		fuse_conn_put(fc);
 	}
 
@@ -2134,12 +2467,262 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_queue *fq = fuse_dev_queue(file);
+	if (!fq)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &fq->fasync);
+}
+
+/*
+ * Bind a newly opened device file to a new queue of the connection of
+ * an already mounted one.  Returns the index of the queue.
+ */
+static long fuse_dev_clone(struct file *file, __u32 __user *argp)
+{
+	struct fuse_queue *fq;
+	struct fuse_conn *fc;
+	struct file *old;
+	unsigned idx;
+	__u32 oldfd;
+	long err;
+
+	if (get_user(oldfd, argp))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	err = -ENOMEM;
+	fq = kzalloc(sizeof(*fq), GFP_KERNEL);
+	if (!fq)
+		goto out_fput;
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	if (old->f_op != &fuse_dev_operations || file->private_data)
+		goto out_unlock;
+	/* only now is old->private_data known to be a queue */
+	fc = fuse_dev_conn(old);
+	if (!fc)
+		goto out_unlock;
+
+	spin_lock(&fc->lock);
+	err = -ENOTCONN;
+	if (!fc->connected)
+		goto out_unlock_fc;
+	err = -EBUSY;
+	if (fc->nr_queues >= min_t(unsigned, FUSE_MAX_QUEUES, nr_cpu_ids))
+		goto out_unlock_fc;
+
+	idx = fc->nr_queues;
+	fuse_queue_init(fq, fc, idx);
+	fc->queues[idx] = fq;
+	/* pairs with smp_rmb() in fuse_select_queue() */
+	smp_wmb();
+	fc->nr_queues++;
+	spin_unlock(&fc->lock);
+
+	file->private_data = fq;
+	fuse_conn_get(fc);
+	mutex_unlock(&fuse_mutex);
+	fput(old);
+	return idx;
+
+ out_unlock_fc:
+	spin_unlock(&fc->lock);
+ out_unlock:
+	mutex_unlock(&fuse_mutex);
+	kfree(fq);
+ out_fput:
+	fput(old);
+	return err;
+}
+
+/*
+ * Set up the shared memory payload area of a queue.  Faults on the
+ * device file are served from the slots, and unmapping a slot goes
+ * through the mapping of the area, which is why it becomes the mapping
+ * of the file.
+ */
+static long fuse_dev_shm_register(struct file *file, struct fuse_queue *fq,
+				  struct fuse_shm_register __user *argp)
+{
+	struct fuse_shm_register reg;
+	struct fuse_shm *shm;
+	long err;
+
+	if (copy_from_user(&reg, argp, sizeof(reg)))
+		return -EFAULT;
+
+	if (!reg.slot_size || (reg.slot_size & ~PAGE_MASK) ||
+	    reg.slot_size > FUSE_MAX_PAGES_PER_REQ << PAGE_SHIFT ||
+	    !reg.nr_slots || reg.nr_slots > FUSE_SHM_MAX_SLOTS)
+		return -EINVAL;
+
+	shm = kzalloc(sizeof(*shm), GFP_KERNEL);
+	if (!shm)
+		return -ENOMEM;
+	address_space_init_once(&shm->mapping);
+	shm->mapping.host = file_inode(file);
+	shm->mapping.backing_dev_info = file->f_mapping->backing_dev_info;
+	mutex_init(&shm->mutex);
+	atomic_set(&shm->count, 1);
+	shm->slot_pages = reg.slot_size >> PAGE_SHIFT;
+	shm->nr_slots = reg.nr_slots;
+
+	spin_lock(&fq->lock);
+	err = -EBUSY;
+	if (!fq->shm) {
+		/* Not mapped yet, mmap needs fq->shm */
+		file->f_mapping = &shm->mapping;
+		fq->shm = shm;
+		err = 0;
+	}
+	spin_unlock(&fq->lock);
+	if (err)
+		kfree(shm);
+	return err;
+}
+
+static int fuse_shm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct fuse_queue *fq = vma->vm_private_data;
+	struct fuse_shm *shm = fq->shm;
+	unsigned slot = vmf->pgoff / shm->slot_pages;
+	unsigned idx = vmf->pgoff % shm->slot_pages;
+	struct fuse_req *req;
+	struct page *page = NULL;
+	int err = 0;
+
+	mutex_lock(&shm->mutex);
+	spin_lock(&fq->lock);
+	req = shm->reqs[slot];
+	if (req && req->state == FUSE_REQ_SENT && idx < req->num_pages)
+		page = req->pages[idx];
+	spin_unlock(&fq->lock);
+	if (page)
+		err = vm_insert_pfn(vma, (unsigned long) vmf->virtual_address,
+				    page_to_pfn(page));
+	mutex_unlock(&shm->mutex);
+
+	if (!page)
+		return VM_FAULT_SIGBUS;
+	if (err == -ENOMEM)
+		return VM_FAULT_OOM;
+	if (err < 0 && err != -EBUSY)
+		return VM_FAULT_SIGBUS;
+	return VM_FAULT_NOPAGE;
+}
+
+static const struct vm_operations_struct fuse_shm_vm_ops = {
+	.fault		= fuse_shm_fault,
+};
+
+/*
+ * Map the slots of the shared memory payload area.  The WRITE slots
+ * hold the data of the requester, so they may only be mapped read-only.
+ */
+static int fuse_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_queue *fq = fuse_dev_queue(file);
+	struct fuse_shm *shm;
+	unsigned long nr_pages;
+
+	if (!fq)
+		return -EPERM;
+
+	spin_lock(&fq->lock);
+	shm = fq->shm;
+	spin_unlock(&fq->lock);
+	if (!shm)
+		return -ENODEV;
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	nr_pages = (unsigned long) shm->nr_slots * shm->slot_pages;
+	if (vma->vm_pgoff >= 2 * nr_pages ||
+	    vma_pages(vma) > 2 * nr_pages - vma->vm_pgoff)
+		return -EINVAL;
+	if (vma->vm_pgoff + vma_pages(vma) > nr_pages) {
+		if (vma->vm_pgoff < nr_pages || (vma->vm_flags & VM_WRITE))
+			return -EACCES;
+		vma->vm_flags &= ~VM_MAYWRITE;
+	}
+
+	vma->vm_flags |= VM_PFNMAP | VM_IO | VM_DONTEXPAND | VM_DONTDUMP |
+			 VM_DONTCOPY;
+	vma->vm_ops = &fuse_shm_vm_ops;
+	vma->vm_private_data = fq;
+	return 0;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fuse_queue *fq;
+
+	switch (cmd) {
+	case FUSE_DEV_IOC_CLONE:
+		return fuse_dev_clone(file, (__u32 __user *) arg);
+
+	case FUSE_DEV_IOC_SHM_REGISTER:
+		fq = fuse_dev_queue(file);
+		if (!fq)
+			return -EPERM;
+		return fuse_dev_shm_register(file, fq,
+				(struct fuse_shm_register __user *) arg);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+void fuse_queue_init(struct fuse_queue *fq, struct fuse_conn *fc,
+		     unsigned idx)
+{
+	unsigned i;
+
+	memset(fq, 0, sizeof(*fq));
+	spin_lock_init(&fq->lock);
+	fq->connected = 1;
+	fq->idx = idx;
+	fq->fc = fc;
+	init_waitqueue_head(&fq->waitq);
+	INIT_LIST_HEAD(&fq->pending);
+	INIT_LIST_HEAD(&fq->interrupts);
+	fq->forget_list_tail = &fq->forget_list_head;
+	for (i = 0; i < FUSE_PQ_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&fq->processing[i]);
+	INIT_LIST_HEAD(&fq->io);
+}
+
+void fuse_queues_wake_all(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->nr_queues; i++) {
+		struct fuse_queue *fq = fc->queues[i];
+
+		kill_fasync(&fq->fasync, SIGIO, POLL_IN);
+		wake_up_all(&fq->waitq);
+	}
+}
+
+void fuse_queues_free(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->nr_queues; i++) {
+		struct fuse_queue *fq = fc->queues[i];
+
+		if (fq->shm)
+			fuse_shm_put(fq->shm);
+		if (fq != &fc->main_queue)
+			kfree(fq);
+	}
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -2152,8 +2735,11 @@ const struct file_operations fuse_dev_operations = {
 	.aio_write	= fuse_dev_write,
 	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
+	.mmap		= fuse_dev_mmap,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -69,6 +69,9 @@ struct fuse_file *fuse_file_alloc(struct fuse_conn *fc)
 	atomic_set(&ff->count, 0);
 	RB_CLEAR_NODE(&ff->polled_node);
 	init_waitqueue_head(&ff->poll_wait);
+	ff->readdir.pos = 0;
+	ff->readdir.cache_off = 0;
+	ff->readdir.version = 0;
 
 	spin_lock(&fc->lock);
 	ff->kh = ++fc->khctr;
@@ -1811,11 +1814,10 @@ static bool fuse_writepage_in_flight(struct fuse_req *new_req,
 		}
 	}
 
-	if (old_req->num_pages == 1 && (old_req->state == FUSE_REQ_INIT ||
-					old_req->state == FUSE_REQ_PENDING)) {
+	if (old_req->num_pages == 1 &&
+	    fuse_request_replace_page(old_req, page)) {
 		struct backing_dev_info *bdi = page->mapping->backing_dev_info;
 
-		copy_highpage(old_req->pages[0], page);
 		spin_unlock(&fc->lock);
 
 		dec_bdi_stat(bdi, BDI_WRITEBACK);
@@ -47,6 +47,23 @@
 /** Number of page pointers embedded in fuse_req */
 #define FUSE_REQ_INLINE_PAGES 1
 
+/** Low bits of a request unique ID hold the index of its queue */
+#define FUSE_QUEUE_BITS 8
+#define FUSE_QUEUE_MASK ((1ULL << FUSE_QUEUE_BITS) - 1)
+
+/** Maximum number of request queues of a connection */
+#define FUSE_MAX_QUEUES (1 << FUSE_QUEUE_BITS)
+
+/** Unique ID bit marking an INTERRUPT for the request with the rest */
+#define FUSE_INT_REQ_BIT (1ULL << 63)
+
+/** Number of hash buckets for requests being processed */
+#define FUSE_PQ_HASH_BITS 6
+#define FUSE_PQ_HASH_SIZE (1 << FUSE_PQ_HASH_BITS)
+
+/** Maximum number of READ, and of WRITE, slots in a shared memory area */
+#define FUSE_SHM_MAX_SLOTS 256
+
 /** List of active connections */
 extern struct list_head fuse_conn_list;
 
@@ -109,6 +126,30 @@ struct fuse_inode {
 
 	/** Miscellaneous bits describing inode state */
 	unsigned long state;
+
+	/** Readdir cache of a directory, kept in its page cache */
+	struct {
+		/** true if fully cached */
+		bool cached;
+
+		/** size of cache */
+		loff_t size;
+
+		/** position at end of cache (position of next entry) */
+		loff_t pos;
+
+		/** version of cache, changes whenever it is reset */
+		u64 version;
+
+		/** modification time of directory when cache was started */
+		struct timespec mtime;
+
+		/** i_version of directory when cache was started */
+		u64 iversion;
+
+		/** protects above fields */
+		spinlock_t lock;
+	} rdc;
 };
 
 /** FUSE inode state bits */
@@ -155,6 +196,18 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Position of a directory stream in the readdir cache */
+	struct {
+		/** Dir stream position */
+		loff_t pos;
+
+		/** Offset in cache */
+		loff_t cache_off;
+
+		/** Version of cache we are reading */
+		u64 version;
+	} readdir;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -293,6 +346,12 @@ struct fuse_req {
 	/** State of the request */
 	enum fuse_req_state state;
 
+	/** Queue the request was sent on, its lock protects the above */
+	struct fuse_queue *fq;
+
+	/** Shared memory slot holding the payload plus one, or zero */
+	unsigned shm_slot;
+
 	/** The request input */
 	struct fuse_in in;
 
@@ -364,6 +423,86 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * Shared memory payload area of a request queue, set up by the daemon
+ * with FUSE_DEV_IOC_SHM_REGISTER.  Mapping the device file then maps
+ * the pages of the READ or WRITE request owning a slot, from the time
+ * the request is sent until its reply is written.
+ */
+struct fuse_shm {
+	/** Mapping of the device file, for unmapping the slots */
+	struct address_space mapping;
+
+	/** Serializes faults with taking the slots back */
+	struct mutex mutex;
+
+	/** References: the device file, and slots being taken back */
+	atomic_t count;
+
+	/** Pages per slot */
+	unsigned slot_pages;
+
+	/** Number of READ slots, the same number of WRITE slots follow */
+	unsigned nr_slots;
+
+	/** Requests owning the slots, protected by the queue lock */
+	struct fuse_req *reqs[2 * FUSE_SHM_MAX_SLOTS];
+};
+
+/**
+ * A request queue of a connection.
+ *
+ * Every connection starts with one queue, read through the device file
+ * the filesystem was mounted with.  Each device file cloned from it with
+ * FUSE_DEV_IOC_CLONE adds a queue of its own, and requests are queued on
+ * the queue of the submitting CPU, so daemon threads reading different
+ * device files don't share a lock, a pending list or a waitqueue.
+ */
+struct fuse_queue {
+	/** Lock protecting the lists and the requests on them */
+	spinlock_t lock;
+
+	/** Cleared when the connection is aborted or released */
+	unsigned connected;
+
+	/** Index of the queue, also the low bits of its unique IDs */
+	unsigned idx;
+
+	/** The connection */
+	struct fuse_conn *fc;
+
+	/** Readers of the queue are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** Queue of pending forgets */
+	struct fuse_forget_link forget_list_head;
+	struct fuse_forget_link *forget_list_tail;
+
+	/** Batching of FORGET requests (positive indicates FORGET batch) */
+	int forget_batch;
+
+	/** The requests being processed, hashed by unique ID */
+	struct list_head processing[FUSE_PQ_HASH_SIZE];
+
+	/** The list of requests under I/O */
+	struct list_head io;
+
+	/** The next unique request id */
+	u64 reqctr;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+
+	/** Shared memory payload area or NULL */
+	struct fuse_shm *shm;
+};
+
 /**
  * A Fuse connection.
  *
@@ -395,17 +534,14 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** Request queues, the first nr_queues are set */
+	struct fuse_queue *queues[FUSE_MAX_QUEUES];
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Number of request queues */
+	unsigned nr_queues;
 
-	/** The list of requests being processed */
-	struct list_head processing;
-
-	/** The list of requests under I/O */
-	struct list_head io;
+	/** The queue of the device file the filesystem was mounted with */
+	struct fuse_queue main_queue;
 
 	/** The next unique kernel file handle */
 	u64 khctr;
@@ -428,16 +564,6 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
-	/** Queue of pending forgets */
-	struct fuse_forget_link forget_list_head;
-	struct fuse_forget_link *forget_list_tail;
-
-	/** Batching of FORGET requests (positive indicates FORGET batch) */
-	int forget_batch;
-
 	/** Flag indicating that INIT reply has been received. Allocating
 	 * any fuse request will be suspended until the flag is set */
 	int initialized;
@@ -453,9 +579,6 @@ struct fuse_conn {
 	/** waitq for reserved requests */
 	wait_queue_head_t reserved_req_waitq;
 
-	/** The next unique request id */
-	u64 reqctr;
-
 	/** Connection established, cleared on umount, connection
 	    abort and device release */
 	unsigned connected;
@@ -548,6 +671,9 @@ struct fuse_conn {
 	/** Use enhanced/automatic page cache invalidation. */
 	unsigned auto_inval_data:1;
 
+	/** Only invalidate cached data on explicit request */
+	unsigned explicit_inval_data:1;
+
 	/** Does the filesystem support readdirplus? */
 	unsigned do_readdirplus:1;
 
@@ -578,9 +704,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -620,6 +743,22 @@ static inline u64 get_node_id(struct inode *inode)
 	return get_fuse_inode(inode)->nodeid;
 }
 
+/*
+ * Lockless access is OK, because file->private data is set once
+ * during mount or clone and is valid until the file is released.
+ */
+static inline struct fuse_queue *fuse_dev_queue(struct file *file)
+{
+	return file->private_data;
+}
+
+static inline struct fuse_conn *fuse_dev_conn(struct file *file)
+{
+	struct fuse_queue *fq = fuse_dev_queue(file);
+
+	return fq ? fq->fc : NULL;
+}
+
 /** Device operations */
 extern const struct file_operations fuse_dev_operations;
 
@@ -790,6 +929,28 @@ void fuse_request_send_background_locked(struct fuse_conn *fc,
 /* Abort all requests */
 void fuse_abort_conn(struct fuse_conn *fc);
 
+/**
+ * Replace the page of a single page background request not yet read
+ * by userspace, called with fc->lock held
+ */
+bool fuse_request_replace_page(struct fuse_req *req, struct page *page);
+
+/**
+ * Initialize a request queue
+ */
+void fuse_queue_init(struct fuse_queue *fq, struct fuse_conn *fc,
+		     unsigned idx);
+
+/**
+ * Wake up the readers of all request queues
+ */
+void fuse_queues_wake_all(struct fuse_conn *fc);
+
+/**
+ * Free the cloned request queues and shared memory areas
+ */
+void fuse_queues_free(struct fuse_conn *fc);
+
 /**
  * Invalidate inode attributes
  */
@@ -799,6 +960,12 @@ void fuse_invalidate_entry_cache(struct dentry *entry);
 
 void fuse_invalidate_atime(struct inode *inode);
 
+/**
+ * Invalidate the attributes and the readdir cache of a directory whose
+ * contents changed
+ */
+void fuse_dir_changed(struct inode *dir);
+
 /**
  * Acquire reference to fuse_conn
  */
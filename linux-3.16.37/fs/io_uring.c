@@ -0,0 +1,1498 @@
+/*
+ *	Shared application/kernel submission and completion ring pairs, for
+ *	supporting fast/efficient IO.
+ *
+ *	A note on the memory ordering matched between the application and
+ *	the kernel.  The kernel publishes CQ entries with a release store of
+ *	the CQ tail, so the application must read the tail with acquire
+ *	semantics (or follow it with smp_rmb()) before it reads the entries,
+ *	and must finish reading them before it stores the new CQ head.  The
+ *	other way round, the application fills SQ entries and the SQ array
+ *	before it stores the SQ tail with release semantics, and it needs a
+ *	full barrier between that store and its check of the SQ thread's
+ *	IORING_SQ_NEED_WAKEUP flag.
+ *
+ *	Requests that cannot complete right away run from a per-ring
+ *	workqueue, in the context of the ring's owner: its mm and its
+ *	credentials.  Files and buffers may be registered up front, so that
+ *	requests neither look up the file descriptor nor pin the pages of
+ *	the buffer each time.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/uio.h>
+#include <linux/aio.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fsnotify.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/cred.h>
+#include <linux/log2.h>
+#include <linux/sizes.h>
+
+#include <asm/uaccess.h>
+
+#include <uapi/linux/io_uring.h>
+
+#include "internal.h"
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+#define IORING_MAX_FIXED_BUFS	1024
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[] ____cacheline_aligned_in_smp;
+};
+
+struct io_mapped_ubuf {
+	u64		ubuf;
+	size_t		len;
+	struct bio_vec	*bvec;
+	unsigned int	nr_bvecs;
+};
+
+struct io_ring_ctx {
+	/* submission side, serialised by uring_lock */
+	struct {
+		struct io_sq_ring	*sq_ring;
+		unsigned		cached_sq_head;
+		unsigned		sq_entries;
+		unsigned		sq_mask;
+		struct io_uring_sqe	*sq_sqes;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		flags;
+
+	/* IO offload */
+	struct workqueue_struct	*sqo_wq;
+	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	struct mm_struct	*sqo_mm;
+	wait_queue_head_t	sqo_wait;
+	unsigned long		sq_thread_idle;
+	const struct cred	*creds;
+
+	/* registered files and buffers */
+	struct file		**user_files;
+	unsigned		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned		nr_user_bufs;
+	struct mm_struct	*user_bufs_mm;	/* charged for the pinning */
+	unsigned long		user_bufs_pinned;
+
+	/* completion side, serialised by completion_lock */
+	struct {
+		struct io_cq_ring	*cq_ring;
+		unsigned		cached_cq_tail;
+		unsigned		cq_entries;
+		unsigned		cq_mask;
+		wait_queue_head_t	cq_wait;
+	} ____cacheline_aligned_in_smp;
+
+	struct mutex		uring_lock;
+	unsigned		quiesce;	/* registrations waiting, no submits */
+	spinlock_t		completion_lock;
+	struct list_head	poll_list;
+	struct list_head	work_list;	/* punted requests being issued */
+	bool			dying;
+
+	atomic_t		inflight;
+	wait_queue_head_t	inflight_wait;
+};
+
+struct io_poll_iocb {
+	struct file			*file;
+	struct wait_queue_head		*head;
+	unsigned int			events;
+	bool				canceled;
+	wait_queue_t			wait;
+};
+
+struct io_kiocb {
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	struct io_uring_sqe	sqe;
+	struct list_head	list;
+	struct work_struct	work;
+	struct task_struct	*task;		/* worker issuing it */
+	unsigned int		flags;
+#define REQ_F_FIXED_FILE	1	/* ctx owns file */
+#define REQ_F_NO_INFLIGHT	2	/* not counted in ctx->inflight */
+	struct io_poll_iocb	poll;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static void io_put_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->file && !(req->flags & REQ_F_FIXED_FILE))
+		fput(req->file);
+	if (!(req->flags & REQ_F_NO_INFLIGHT) &&
+	    atomic_dec_and_test(&ctx->inflight))
+		wake_up(&ctx->inflight_wait);
+	kmem_cache_free(req_cachep, req);
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail = ctx->cached_cq_tail;
+
+	/*
+	 * An entry the application has not consumed yet cannot be
+	 * overwritten, count the event as lost instead.
+	 */
+	if (tail - ACCESS_ONCE(ring->r.head) == ctx->cq_entries) {
+		ACCESS_ONCE(ring->overflow) = ring->overflow + 1;
+		return;
+	}
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+
+	ctx->cached_cq_tail++;
+	smp_store_release(&ring->r.tail, ctx->cached_cq_tail);
+}
+
+static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
+{
+	smp_mb();
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up(&ctx->cq_wait);
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+}
+
+static void io_complete_req(struct io_kiocb *req, long res)
+{
+	io_cqring_add_event(req->ctx, req->sqe.user_data, res);
+	io_put_req(req);
+}
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+static unsigned io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	return smp_load_acquire(&ctx->sq_ring->r.tail) - ctx->cached_sq_head;
+}
+
+/*
+ * Read and write.  Plain requests go through the usual vectored helpers
+ * with the user's iovec.  Fixed ones are built from the pages pinned at
+ * registration time, so they need ->read_iter() or ->write_iter().
+ */
+static long io_rw(struct io_kiocb *req, int rw)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	const struct iovec __user *iov;
+	loff_t pos = sqe->off;
+
+	if (sqe->ioprio || sqe->buf_index)
+		return -EINVAL;
+
+	iov = (const struct iovec __user *)(unsigned long)sqe->addr;
+	if (rw == READ)
+		return vfs_readv_flags(req->file, iov, sqe->len, &pos,
+				       sqe->rw_flags);
+	if (sqe->rw_flags)
+		return -EOPNOTSUPP;
+	return vfs_writev(req->file, iov, sqe->len, &pos);
+}
+
+static long io_rw_fixed(struct io_kiocb *req, int rw)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct file *file = req->file;
+	struct io_mapped_ubuf *imu;
+	struct iov_iter iter;
+	struct kiocb kiocb;
+	u64 buf_addr = sqe->addr;
+	size_t len = sqe->len;
+	loff_t pos = sqe->off;
+	long ret;
+
+	if (sqe->ioprio)
+		return -EINVAL;
+	if (sqe->rw_flags && rw != READ)
+		return -EOPNOTSUPP;
+	if (unlikely(sqe->buf_index >= ctx->nr_user_bufs))
+		return -EFAULT;
+
+	imu = &ctx->user_bufs[sqe->buf_index];
+	if (buf_addr < imu->ubuf || buf_addr + len < buf_addr ||
+	    buf_addr + len > imu->ubuf + imu->len)
+		return -EFAULT;
+
+	if (!(file->f_mode & (rw == READ ? FMODE_READ : FMODE_WRITE)))
+		return -EBADF;
+	if (rw == READ ? !file->f_op->read_iter : !file->f_op->write_iter)
+		return -EINVAL;
+
+	ret = rw_verify_area(rw, file, &pos, len);
+	if (ret < 0)
+		return ret;
+	len = ret;
+
+	iter.type = ITER_BVEC | rw;
+	iter.bvec = imu->bvec;
+	iter.nr_segs = imu->nr_bvecs;
+	iter.iov_offset = 0;
+	iter.count = buf_addr - imu->ubuf + len;
+	iov_iter_advance(&iter, buf_addr - imu->ubuf);
+
+	init_sync_kiocb(&kiocb, file);
+	kiocb.ki_pos = pos;
+	kiocb.ki_nbytes = len;
+	ret = kiocb_set_rw_flags(&kiocb, sqe->rw_flags);
+	if (ret)
+		return ret;
+
+	if (rw == READ) {
+		ret = file->f_op->read_iter(&kiocb, &iter);
+	} else {
+		file_start_write(file);
+		ret = file->f_op->write_iter(&kiocb, &iter);
+		file_end_write(file);
+	}
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&kiocb);
+
+	if (ret > 0) {
+		if (rw == READ)
+			fsnotify_access(file);
+		else
+			fsnotify_modify(file);
+	}
+	return ret;
+}
+
+static long io_fsync(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t end = sqe->len ? sqe->off + sqe->len - 1 : LLONG_MAX;
+
+	if (sqe->addr || sqe->ioprio || sqe->buf_index)
+		return -EINVAL;
+	if (sqe->fsync_flags & ~IORING_FSYNC_DATASYNC)
+		return -EINVAL;
+
+	return vfs_fsync_range(req->file, sqe->off, end,
+			       sqe->fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+static long io_sendrecvmsg(struct io_kiocb *req, bool force_nonblock)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct msghdr __user *msg;
+	struct socket *sock;
+	unsigned flags;
+	int err;
+
+	sock = sock_from_file(req->file, &err);
+	if (!sock)
+		return err;
+
+	msg = (struct msghdr __user *)(unsigned long)sqe->addr;
+	flags = sqe->msg_flags & ~MSG_CMSG_COMPAT;
+	if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+
+	if (sqe->opcode == IORING_OP_SENDMSG)
+		return __sys_sendmsg_sock(sock, msg, flags);
+	return __sys_recvmsg_sock(sock, msg, flags);
+}
+
+static long io_issue_sqe(struct io_kiocb *req)
+{
+	switch (req->sqe.opcode) {
+	case IORING_OP_READV:
+		return io_rw(req, READ);
+	case IORING_OP_WRITEV:
+		return io_rw(req, WRITE);
+	case IORING_OP_READ_FIXED:
+		return io_rw_fixed(req, READ);
+	case IORING_OP_WRITE_FIXED:
+		return io_rw_fixed(req, WRITE);
+	case IORING_OP_FSYNC:
+		return io_fsync(req);
+	case IORING_OP_SENDMSG:
+	case IORING_OP_RECVMSG:
+		return io_sendrecvmsg(req, false);
+	}
+	return -EINVAL;
+}
+
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	struct mm_struct *mm = ctx->sqo_mm;
+	const struct cred *old_cred;
+	long ret = -EFAULT;
+
+	/* Let io_cancel_work() find us while we may block */
+	spin_lock_irq(&ctx->completion_lock);
+	if (ctx->dying) {
+		spin_unlock_irq(&ctx->completion_lock);
+		io_complete_req(req, -ECANCELED);
+		return;
+	}
+	req->task = current;
+	list_add_tail(&req->list, &ctx->work_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	old_cred = override_creds(ctx->creds);
+
+	/* The owner may be gone, its address space with it */
+	if (atomic_inc_not_zero(&mm->mm_users)) {
+		use_mm(mm);
+		ret = io_issue_sqe(req);
+		unuse_mm(mm);
+		mmput(mm);
+	}
+
+	revert_creds(old_cred);
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_del_init(&req->list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	/* The wakeup was for this request only, not for the worker */
+	if (unlikely(signal_pending(current))) {
+		spin_lock_irq(&current->sighand->siglock);
+		recalc_sigpending();
+		spin_unlock_irq(&current->sighand->siglock);
+	}
+	if (ret == -ERESTARTSYS || ret == -ERESTARTNOINTR ||
+	    ret == -ERESTARTNOHAND || ret == -ERESTART_RESTARTBLOCK)
+		ret = -EINTR;
+
+	io_complete_req(req, ret);
+}
+
+/*
+ * Punted requests can sleep for good on a pipe or socket, so the ring
+ * can't just be flushed away.  Kick every worker out of its sleep like a
+ * signal would, and fail whatever hasn't started yet.
+ */
+static void io_cancel_work(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+	unsigned long flags;
+
+	spin_lock_irq(&ctx->completion_lock);
+	ctx->dying = true;
+	list_for_each_entry(req, &ctx->work_list, list) {
+		spin_lock_irqsave(&req->task->sighand->siglock, flags);
+		signal_wake_up(req->task, 0);
+		spin_unlock_irqrestore(&req->task->sighand->siglock, flags);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+/*
+ * Poll.  The wakeup callback runs under the waitqueue lock, so it only
+ * takes the request off the waitqueue and leaves the rest to the
+ * workqueue.  Whoever takes a request off the waitqueue owns it.
+ */
+struct io_poll_table {
+	poll_table		pt;
+	struct io_kiocb		*req;
+	int			error;
+};
+
+static bool io_poll_disarm(struct io_poll_iocb *poll)
+{
+	unsigned long flags;
+	bool armed = true;
+
+	if (!poll->head)
+		return true;
+
+	spin_lock_irqsave(&poll->head->lock, flags);
+	if (list_empty(&poll->wait.task_list))
+		armed = false;
+	else
+		list_del_init(&poll->wait.task_list);
+	spin_unlock_irqrestore(&poll->head->lock, flags);
+
+	return armed;
+}
+
+static void io_poll_finish(struct io_kiocb *req, long res)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_del_init(&req->list);
+	io_cqring_fill_event(ctx, req->sqe.user_data, res);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cqring_ev_posted(ctx);
+	io_put_req(req);
+}
+
+static unsigned int io_poll_mask(struct io_poll_iocb *poll)
+{
+	return poll->file->f_op->poll(poll->file, NULL) & poll->events;
+}
+
+static void io_poll_complete_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_poll_iocb *poll = &req->poll;
+	unsigned int mask = 0;
+
+	if (ACCESS_ONCE(poll->canceled)) {
+		io_poll_finish(req, -ECANCELED);
+		return;
+	}
+
+	mask = io_poll_mask(poll);
+	if (mask) {
+		io_poll_finish(req, mask);
+		return;
+	}
+
+	/* Spurious wakeup, wait again and look once more */
+	add_wait_queue(poll->head, &poll->wait);
+	mask = io_poll_mask(poll);
+	if (!mask && !ACCESS_ONCE(poll->canceled))
+		return;
+
+	if (io_poll_disarm(poll))
+		io_poll_finish(req, ACCESS_ONCE(poll->canceled) ?
+					-ECANCELED : mask);
+}
+
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			void *key)
+{
+	struct io_poll_iocb *poll = container_of(wait, struct io_poll_iocb,
+						 wait);
+	struct io_kiocb *req = container_of(poll, struct io_kiocb, poll);
+	unsigned long mask = (unsigned long)key;
+
+	if (mask && !(mask & poll->events))
+		return 0;
+
+	list_del_init(&poll->wait.task_list);
+	queue_work(req->ctx->sqo_wq, &req->work);
+	return 1;
+}
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+
+	/* Only files with a single waitqueue */
+	if (unlikely(pt->req->poll.head)) {
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	pt->req->poll.head = head;
+	add_wait_queue(head, &pt->req->poll.wait);
+}
+
+static int io_poll_add(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_poll_iocb *poll = &req->poll;
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_poll_table ipt;
+	unsigned int mask;
+
+	if (sqe->addr || sqe->ioprio || sqe->off || sqe->len ||
+	    sqe->buf_index)
+		return -EINVAL;
+	if (!req->file->f_op->poll)
+		return -EBADF;
+
+	/*
+	 * A poll may stay armed for as long as the file stays quiet, so
+	 * io_uring_register() doesn't wait for it.  It owns a reference
+	 * to its file and never looks at the registered tables again.
+	 */
+	if (req->flags & REQ_F_FIXED_FILE) {
+		get_file(req->file);
+		req->flags &= ~REQ_F_FIXED_FILE;
+	}
+	req->flags |= REQ_F_NO_INFLIGHT;
+	if (atomic_dec_and_test(&ctx->inflight))
+		wake_up(&ctx->inflight_wait);
+
+	poll->file = req->file;
+	poll->head = NULL;
+	poll->canceled = false;
+	poll->events = sqe->poll_events | POLLERR | POLLHUP;
+	INIT_WORK(&req->work, io_poll_complete_work);
+	INIT_LIST_HEAD(&poll->wait.task_list);
+	init_waitqueue_func_entry(&poll->wait, io_poll_wake);
+
+	ipt.req = req;
+	ipt.error = 0;
+	init_poll_funcptr(&ipt.pt, io_poll_queue_proc);
+	ipt.pt._key = poll->events;
+
+	/* Findable by IORING_OP_POLL_REMOVE before it can complete */
+	spin_lock_irq(&ctx->completion_lock);
+	list_add_tail(&req->list, &ctx->poll_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	mask = req->file->f_op->poll(req->file, &ipt.pt) & poll->events;
+	if (!mask && !ipt.error && poll->head)
+		return 0;
+
+	if (io_poll_disarm(poll))
+		io_poll_finish(req, ipt.error ? ipt.error : mask);
+	return 0;
+}
+
+static void io_poll_cancel(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+
+	ACCESS_ONCE(poll->canceled) = true;
+	if (io_poll_disarm(poll))
+		queue_work(req->ctx->sqo_wq, &req->work);
+}
+
+static int io_poll_remove(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_kiocb *poll_req;
+	int ret = -ENOENT;
+
+	if (sqe->ioprio || sqe->off || sqe->len || sqe->buf_index ||
+	    sqe->poll_events)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry(poll_req, &ctx->poll_list, list) {
+		if (poll_req->sqe.user_data != sqe->addr ||
+		    poll_req->poll.canceled)
+			continue;
+		io_poll_cancel(poll_req);
+		ret = 0;
+		break;
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return ret;
+}
+
+static void io_poll_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry(req, &ctx->poll_list, list) {
+		if (!req->poll.canceled)
+			io_poll_cancel(req);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static int io_req_set_file(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct io_uring_sqe *sqe = &req->sqe;
+	int fd = sqe->fd;
+
+	if (sqe->flags & ~IOSQE_FIXED_FILE)
+		return -EINVAL;
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files ||
+			     (unsigned) fd >= ctx->nr_user_files))
+			return -EBADF;
+		req->file = ctx->user_files[fd];
+		req->flags |= REQ_F_FIXED_FILE;
+		return 0;
+	}
+
+	/* The SQ thread has no business with the owner's file table */
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		return -EBADF;
+
+	req->file = fget(fd);
+	if (unlikely(!req->file))
+		return -EBADF;
+	return 0;
+}
+
+static void io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			  bool mm_fault)
+{
+	u8 opcode = req->sqe.opcode;
+	long ret = 0;
+
+	if (opcode == IORING_OP_NOP)
+		goto complete;
+
+	ret = io_req_set_file(req);
+	if (ret)
+		goto complete;
+
+	switch (opcode) {
+	case IORING_OP_POLL_ADD:
+		ret = io_poll_add(req);
+		if (!ret)
+			return;
+		goto complete;
+	case IORING_OP_POLL_REMOVE:
+		ret = io_poll_remove(req);
+		goto complete;
+	case IORING_OP_SENDMSG:
+	case IORING_OP_RECVMSG:
+		/* The msghdr can't be read without the owner's memory */
+		if (unlikely(mm_fault)) {
+			ret = -EFAULT;
+			goto complete;
+		}
+		/* Sockets that have room or data complete right here */
+		ret = io_sendrecvmsg(req, true);
+		if (ret != -EAGAIN || (req->sqe.msg_flags & MSG_DONTWAIT) ||
+		    (req->file->f_flags & O_NONBLOCK))
+			goto complete;
+		break;
+	}
+
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	queue_work(ctx->sqo_wq, &req->work);
+	return;
+
+complete:
+	io_complete_req(req, ret);
+}
+
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int to_submit,
+			  bool mm_fault)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned tail = smp_load_acquire(&ring->r.tail);
+	int submitted = 0;
+
+	/* A registration is waiting for the ring to go idle */
+	if (ctx->quiesce)
+		return -EBUSY;
+
+	while (submitted < to_submit && ctx->cached_sq_head != tail) {
+		struct io_kiocb *req;
+		unsigned head;
+
+		head = ACCESS_ONCE(ring->array[ctx->cached_sq_head &
+					       ctx->sq_mask]);
+		if (unlikely(head >= ctx->sq_entries)) {
+			/* Invalid index, skip it */
+			ctx->cached_sq_head++;
+			ACCESS_ONCE(ring->dropped) = ring->dropped + 1;
+			continue;
+		}
+
+		req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+		if (unlikely(!req)) {
+			if (!submitted)
+				submitted = -EAGAIN;
+			break;
+		}
+
+		req->ctx = ctx;
+		req->file = NULL;
+		req->flags = 0;
+		INIT_LIST_HEAD(&req->list);
+		memcpy(&req->sqe, &ctx->sq_sqes[head], sizeof(req->sqe));
+		atomic_inc(&ctx->inflight);
+
+		ctx->cached_sq_head++;
+		submitted++;
+
+		io_submit_sqe(ctx, req, mm_fault);
+	}
+
+	/* Let the application reuse the entries */
+	smp_store_release(&ring->r.head, ctx->cached_sq_head);
+
+	return submitted;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct mm_struct *cur_mm = NULL;
+	const struct cred *old_cred;
+	unsigned long timeout;
+	DEFINE_WAIT(wait);
+	int ret;
+
+	old_cred = override_creds(ctx->creds);
+
+	timeout = jiffies + ctx->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		unsigned int to_submit = io_sqring_entries(ctx);
+
+		if (!to_submit) {
+			if (cur_mm) {
+				unuse_mm(cur_mm);
+				mmput(cur_mm);
+				cur_mm = NULL;
+			}
+
+			/* Busy poll for a while before going to sleep */
+			if (time_before(jiffies, timeout)) {
+				cond_resched();
+				continue;
+			}
+
+			prepare_to_wait(&ctx->sqo_wait, &wait,
+					TASK_INTERRUPTIBLE);
+
+			/* Tell the application to wake us up */
+			ACCESS_ONCE(ctx->sq_ring->flags) =
+				ctx->sq_ring->flags | IORING_SQ_NEED_WAKEUP;
+			smp_mb();
+
+			if (!io_sqring_entries(ctx) && !kthread_should_stop())
+				schedule();
+			finish_wait(&ctx->sqo_wait, &wait);
+
+			ACCESS_ONCE(ctx->sq_ring->flags) =
+				ctx->sq_ring->flags & ~IORING_SQ_NEED_WAKEUP;
+			timeout = jiffies + ctx->sq_thread_idle;
+			continue;
+		}
+
+		/* Iovecs and msghdrs are read from the owner's memory */
+		if (!cur_mm && atomic_inc_not_zero(&ctx->sqo_mm->mm_users)) {
+			cur_mm = ctx->sqo_mm;
+			use_mm(cur_mm);
+		}
+
+		mutex_lock(&ctx->uring_lock);
+		ret = io_submit_sqes(ctx, min(to_submit, ctx->sq_entries),
+				     !cur_mm);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (ret == -EBUSY)
+			wait_event_interruptible(ctx->sqo_wait,
+						 !ACCESS_ONCE(ctx->quiesce) ||
+						 kthread_should_stop());
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	if (cur_mm) {
+		unuse_mm(cur_mm);
+		mmput(cur_mm);
+	}
+	revert_creds(old_cred);
+
+	return 0;
+}
+
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned min_events)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	int ret;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	ret = wait_event_interruptible(ctx->cq_wait,
+				       io_cqring_events(ring) >= min_events);
+	return ret == -ERESTARTSYS ? -EINTR : ret;
+}
+
+SYSCALL_DEFINE4(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags)
+{
+	struct io_ring_ctx *ctx;
+	struct fd f;
+	long ret = -EBADF;
+	int submitted = 0;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+	if (f.file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f.file->private_data;
+
+	/*
+	 * With the SQ thread the application only has to kick it, the
+	 * thread does the submitting.
+	 */
+	ret = 0;
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit, false);
+		mutex_unlock(&ctx->uring_lock);
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete);
+	}
+
+out_fput:
+	fdput(f);
+	return submitted ? submitted : ret;
+}
+
+/*
+ * Registered buffers are pinned for as long as they stay registered and
+ * are described by bio_vecs, which fixed requests hand to the file.
+ */
+static void *io_kvcalloc(size_t n, size_t size)
+{
+	void *p = kcalloc(n, size, GFP_KERNEL | __GFP_NOWARN);
+
+	if (!p && n <= ULONG_MAX / size)
+		p = vzalloc(n * size);
+	return p;
+}
+
+static void io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i, j;
+
+	if (!ctx->user_bufs)
+		return;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+
+		for (j = 0; j < imu->nr_bvecs; j++) {
+			set_page_dirty_lock(imu->bvec[j].bv_page);
+			put_page(imu->bvec[j].bv_page);
+		}
+		kvfree(imu->bvec);
+	}
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+
+	if (ctx->user_bufs_mm) {
+		down_write(&ctx->user_bufs_mm->mmap_sem);
+		ctx->user_bufs_mm->pinned_vm -= ctx->user_bufs_pinned;
+		up_write(&ctx->user_bufs_mm->mmap_sem);
+		mmdrop(ctx->user_bufs_mm);
+		ctx->user_bufs_mm = NULL;
+		ctx->user_bufs_pinned = 0;
+	}
+}
+
+/* Charge pinned pages to @mm like mlocked memory */
+static int io_account_pinned(struct mm_struct *mm, unsigned long nr_pages)
+{
+	unsigned long locked;
+	int ret = 0;
+
+	down_write(&mm->mmap_sem);
+	locked = mm->pinned_vm + nr_pages;
+	if (locked > (rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT) &&
+	    !capable(CAP_IPC_LOCK))
+		ret = -ENOMEM;
+	else
+		mm->pinned_vm = locked;
+	up_write(&mm->mmap_sem);
+	return ret;
+}
+
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	struct page **pages = NULL;
+	unsigned i;
+	int ret;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_BUFS)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+	/* from here on io_sqe_buffer_unregister() gives back the charge */
+	ctx->user_bufs_mm = current->mm;
+	atomic_inc(&ctx->user_bufs_mm->mm_count);
+
+	for (i = 0; i < nr_args; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+		unsigned long off, start, end, ubuf;
+		unsigned nr_pages, j;
+		struct iovec iov;
+		size_t size;
+
+		ret = -EFAULT;
+		if (copy_from_user(&iov, (struct iovec __user *)arg + i,
+				   sizeof(iov)))
+			goto err;
+
+		/* Don't allow buffers larger than 1G */
+		ret = -EFAULT;
+		ubuf = (unsigned long) iov.iov_base;
+		if (!ubuf || !iov.iov_len || iov.iov_len > SZ_1G)
+			goto err;
+		end = (ubuf + iov.iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		start = ubuf >> PAGE_SHIFT;
+		nr_pages = end - start;
+
+		ret = io_account_pinned(ctx->user_bufs_mm, nr_pages);
+		if (ret)
+			goto err;
+		ctx->user_bufs_pinned += nr_pages;
+
+		ret = -ENOMEM;
+		pages = io_kvcalloc(nr_pages, sizeof(struct page *));
+		imu->bvec = io_kvcalloc(nr_pages, sizeof(struct bio_vec));
+		if (!pages || !imu->bvec)
+			goto err;
+
+		ret = get_user_pages_fast(ubuf, nr_pages, 1, pages);
+		if (ret != nr_pages) {
+			if (ret > 0) {
+				for (j = 0; j < ret; j++)
+					put_page(pages[j]);
+			}
+			ret = ret < 0 ? ret : -EFAULT;
+			goto err;
+		}
+
+		off = ubuf & ~PAGE_MASK;
+		size = iov.iov_len;
+		for (j = 0; j < nr_pages; j++) {
+			size_t vec_len = min_t(size_t, size, PAGE_SIZE - off);
+
+			imu->bvec[j].bv_page = pages[j];
+			imu->bvec[j].bv_len = vec_len;
+			imu->bvec[j].bv_offset = off;
+			off = 0;
+			size -= vec_len;
+		}
+		imu->ubuf = ubuf;
+		imu->len = iov.iov_len;
+		imu->nr_bvecs = nr_pages;
+		ctx->nr_user_bufs++;
+
+		kvfree(pages);
+		pages = NULL;
+	}
+	return 0;
+
+err:
+	kvfree(pages);
+	kvfree(ctx->user_bufs[i].bvec);
+	io_sqe_buffer_unregister(ctx);
+	return ret;
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	if (!ctx->user_files)
+		return;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = (__s32 __user *) arg;
+	int ret = 0;
+	unsigned i;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		struct file *file;
+		int fd;
+
+		ret = -EFAULT;
+		if (get_user(fd, &fds[i]))
+			break;
+
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+
+		/* A ring holding itself would never be released */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+
+		ctx->user_files[i] = file;
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+	return ret;
+}
+
+static int __io_uring_register_idle(struct io_ring_ctx *ctx, unsigned opcode,
+				    void __user *arg, unsigned nr_args)
+{
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		return io_sqe_buffer_register(ctx, arg, nr_args);
+	case IORING_UNREGISTER_BUFFERS:
+		if (arg || nr_args)
+			return -EINVAL;
+		if (!ctx->user_bufs)
+			return -ENXIO;
+		io_sqe_buffer_unregister(ctx);
+		return 0;
+	case IORING_REGISTER_FILES:
+		return io_sqe_files_register(ctx, arg, nr_args);
+	case IORING_UNREGISTER_FILES:
+		if (arg || nr_args)
+			return -EINVAL;
+		if (!ctx->user_files)
+			return -ENXIO;
+		io_sqe_files_unregister(ctx);
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
+			       void __user *arg, unsigned nr_args)
+{
+	int ret;
+
+	/*
+	 * Requests in flight may use what is about to change.  Armed polls
+	 * aren't counted, they don't use the registered tables.  That can
+	 * take as long as the slowest request, so only stop submissions and
+	 * don't hold io_uring_enter() and the SQ thread on uring_lock.
+	 */
+	ctx->quiesce++;
+	mutex_unlock(&ctx->uring_lock);
+	ret = wait_event_interruptible(ctx->inflight_wait,
+				       !atomic_read(&ctx->inflight));
+	mutex_lock(&ctx->uring_lock);
+	if (!ret)
+		ret = __io_uring_register_idle(ctx, opcode, arg, nr_args);
+	else
+		ret = -EINTR;
+	if (!--ctx->quiesce)
+		wake_up(&ctx->sqo_wait);
+	return ret;
+}
+
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	struct fd f;
+
+	f = fdget(fd);
+	if (!f.file)
+		return -EBADF;
+	if (f.file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f.file->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+	ret = __io_uring_register(ctx, opcode, arg, nr_args);
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fdput(f);
+	return ret;
+}
+
+static size_t io_sq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_sq_ring) + entries * sizeof(u32);
+}
+
+static size_t io_cq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_cq_ring) +
+	       entries * sizeof(struct io_uring_cqe);
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	/* Nothing may submit, then nothing may be left in flight */
+	if (ctx->sqo_thread)
+		kthread_stop(ctx->sqo_thread);
+	if (ctx->sqo_wq) {
+		io_poll_remove_all(ctx);
+		io_cancel_work(ctx);
+		destroy_workqueue(ctx->sqo_wq);
+	}
+	WARN_ON(atomic_read(&ctx->inflight));
+
+	io_sqe_buffer_unregister(ctx);
+	io_sqe_files_unregister(ctx);
+
+	vfree(ctx->sq_ring);
+	vfree(ctx->sq_sqes);
+	vfree(ctx->cq_ring);
+
+	if (ctx->sqo_mm)
+		mmdrop(ctx->sqo_mm);
+	put_cred(ctx->creds);
+	kfree(ctx);
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_free(ctx);
+	return 0;
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	smp_rmb();
+	if (ACCESS_ONCE(ctx->sq_ring->r.tail) -
+	    ACCESS_ONCE(ctx->sq_ring->r.head) != ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (io_cqring_events(ctx->cq_ring))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	struct io_ring_ctx *ctx = file->private_data;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, ptr, 0);
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+	.llseek		= noop_llseek,
+};
+
+static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
+				  struct io_uring_params *p)
+{
+	struct io_sq_ring *sq_ring;
+	struct io_cq_ring *cq_ring;
+
+	sq_ring = vmalloc_user(io_sq_ring_size(p->sq_entries));
+	if (!sq_ring)
+		return -ENOMEM;
+	ctx->sq_ring = sq_ring;
+	sq_ring->ring_mask = p->sq_entries - 1;
+	sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = sq_ring->ring_mask;
+	ctx->sq_entries = sq_ring->ring_entries;
+
+	ctx->sq_sqes = vmalloc_user(p->sq_entries *
+				    sizeof(struct io_uring_sqe));
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	cq_ring = vmalloc_user(io_cq_ring_size(p->cq_entries));
+	if (!cq_ring)
+		return -ENOMEM;
+	ctx->cq_ring = cq_ring;
+	cq_ring->ring_mask = p->cq_entries - 1;
+	cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = cq_ring->ring_mask;
+	ctx->cq_entries = cq_ring->ring_entries;
+
+	return 0;
+}
+
+static int io_sq_offload_start(struct io_ring_ctx *ctx,
+			       struct io_uring_params *p)
+{
+	/* Blocking requests are spread over a bounded number of workers */
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND | WQ_FREEZABLE,
+			min(ctx->sq_entries - 1, 2 * num_online_cpus()));
+	if (!ctx->sqo_wq)
+		return -ENOMEM;
+
+	if (!(ctx->flags & IORING_SETUP_SQPOLL)) {
+		if (ctx->flags & IORING_SETUP_SQ_AFF)
+			return -EINVAL;
+		return 0;
+	}
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+	if (!ctx->sq_thread_idle)
+		ctx->sq_thread_idle = HZ;
+
+	if (ctx->flags & IORING_SETUP_SQ_AFF) {
+		int cpu = p->sq_thread_cpu;
+
+		if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+			return -EINVAL;
+
+		ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
+						 "io_uring-sq/%d", cpu);
+		if (!IS_ERR(ctx->sqo_thread))
+			kthread_bind(ctx->sqo_thread, cpu);
+	} else {
+		ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
+						 "io_uring-sq");
+	}
+	if (IS_ERR(ctx->sqo_thread)) {
+		int ret = PTR_ERR(ctx->sqo_thread);
+
+		ctx->sqo_thread = NULL;
+		return ret;
+	}
+	wake_up_process(ctx->sqo_thread);
+
+	return 0;
+}
+
+static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	ctx->flags = p->flags;
+	init_waitqueue_head(&ctx->sqo_wait);
+	init_waitqueue_head(&ctx->cq_wait);
+	init_waitqueue_head(&ctx->inflight_wait);
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->poll_list);
+	INIT_LIST_HEAD(&ctx->work_list);
+	atomic_set(&ctx->inflight, 0);
+
+	ctx->creds = get_current_cred();
+	ctx->sqo_mm = current->mm;
+	atomic_inc(&ctx->sqo_mm->mm_count);
+
+	return ctx;
+}
+
+static int io_uring_get_fd(struct io_ring_ctx *ctx, struct io_uring_params *p,
+			   struct io_uring_params __user *params)
+{
+	struct file *file;
+	int fd;
+
+	fd = get_unused_fd_flags(O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	file = anon_inode_getfile("[io_uring]", &io_uring_fops, ctx,
+				  O_RDWR | O_CLOEXEC);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		io_ring_ctx_free(ctx);
+		return PTR_ERR(file);
+	}
+
+	if (copy_to_user(params, p, sizeof(*p))) {
+		put_unused_fd(fd);
+		fput(file);
+		return -EFAULT;
+	}
+
+	fd_install(fd, file);
+	return fd;
+}
+
+static long io_uring_create(unsigned entries, struct io_uring_params *p,
+			    struct io_uring_params __user *params)
+{
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Use twice as many entries for the CQ ring.  It's possible for the
+	 * application to drive a higher depth than the size of the SQ ring,
+	 * since the sqes are only used at submission time.
+	 */
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = io_ring_ctx_alloc(p);
+	if (!ctx)
+		return -ENOMEM;
+
+	ret = io_allocate_scq_urings(ctx, p);
+	if (ret)
+		goto err;
+
+	ret = io_sq_offload_start(ctx, p);
+	if (ret)
+		goto err;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+
+	return io_uring_get_fd(ctx, p, params);
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+/*
+ * Sets up an aio uring context, and returns the fd. Applications asks for a
+ * ring size, we return the actual sq/cq ring sizes (among other things) in the
+ * params structure passed in.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+
+	return io_uring_create(entries, &p, params);
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+}
+__initcall(io_uring_init);
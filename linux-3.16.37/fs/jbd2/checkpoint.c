@@ -23,6 +23,8 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include <trace/events/jbd2.h>
 
 /*
@@ -109,6 +111,119 @@ static int __try_to_free_cp_buf(struct journal_head *jh)
 	return ret;
 }
 
+/*
+ * Background checkpointing.
+ *
+ * Rather than having every task which runs out of log space checkpoint
+ * synchronously, one thread per journal writes back checkpointed buffers
+ * as soon as free log space drops below j_checkpoint_low_wm, which is
+ * well above what start_this_handle() needs.  Tasks which still find the
+ * log full ask the thread for a round and wait for it to complete, the way
+ * commits are requested from kjournald2.
+ */
+static int jbd2_checkpoint_wanted(journal_t *journal)
+{
+	int wanted;
+
+	read_lock(&journal->j_state_lock);
+	spin_lock(&journal->j_list_lock);
+	wanted = journal->j_checkpoint_request != journal->j_checkpoint_sequence;
+	if (!wanted && journal->j_checkpoint_transactions &&
+	    !is_journal_aborted(journal))
+		wanted = jbd2_log_space_left(journal) <
+			 journal->j_checkpoint_low_wm;
+	spin_unlock(&journal->j_list_lock);
+	read_unlock(&journal->j_state_lock);
+	return wanted;
+}
+
+static int jbd2_checkpoint_thread(void *arg)
+{
+	journal_t *journal = arg;
+	unsigned long request;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		wait_event_freezable(journal->j_wait_checkpoint,
+				     jbd2_checkpoint_wanted(journal) ||
+				     kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		spin_lock(&journal->j_list_lock);
+		request = journal->j_checkpoint_request;
+		spin_unlock(&journal->j_list_lock);
+
+		mutex_lock(&journal->j_checkpoint_mutex);
+		jbd2_log_do_checkpoint(journal);
+		mutex_unlock(&journal->j_checkpoint_mutex);
+
+		spin_lock(&journal->j_list_lock);
+		journal->j_checkpoint_sequence = request;
+		spin_unlock(&journal->j_list_lock);
+		wake_up_all(&journal->j_wait_checkpoint_done);
+		cond_resched();
+	}
+	return 0;
+}
+
+/*
+ * Start the checkpoint thread.  Failing that, tasks short of log space
+ * simply keep checkpointing themselves.
+ */
+int jbd2_checkpoint_start_thread(journal_t *journal)
+{
+	struct task_struct *t;
+
+	t = kthread_run(jbd2_checkpoint_thread, journal, "jbd2-ckpt/%s",
+			journal->j_devname);
+	if (IS_ERR(t)) {
+		printk(KERN_WARNING "JBD2: %s: no checkpoint thread: %ld\n",
+		       journal->j_devname, PTR_ERR(t));
+		return PTR_ERR(t);
+	}
+	spin_lock(&journal->j_list_lock);
+	journal->j_checkpoint_task = t;
+	spin_unlock(&journal->j_list_lock);
+	return 0;
+}
+
+/*
+ * Stop the checkpoint thread.  Must be done while kjournald2 still runs,
+ * a checkpoint round may have to wait for a commit.
+ */
+void jbd2_checkpoint_stop_thread(journal_t *journal)
+{
+	struct task_struct *t = journal->j_checkpoint_task;
+
+	if (!t)
+		return;
+	kthread_stop(t);
+	spin_lock(&journal->j_list_lock);
+	journal->j_checkpoint_task = NULL;
+	spin_unlock(&journal->j_list_lock);
+	/* Waiters fall back to checkpointing themselves */
+	wake_up_all(&journal->j_wait_checkpoint_done);
+}
+
+/*
+ * Kick the checkpoint thread, called when a commit has added a transaction
+ * to the checkpoint list.  The thread decides whether there is work.
+ */
+void jbd2_checkpoint_wakeup(journal_t *journal)
+{
+	if (journal->j_checkpoint_task)
+		wake_up(&journal->j_wait_checkpoint);
+}
+
+static void jbd2_checkpoint_wait(journal_t *journal, unsigned long request)
+{
+	wake_up(&journal->j_wait_checkpoint);
+	wait_event(journal->j_wait_checkpoint_done,
+		   (long)(journal->j_checkpoint_sequence - request) >= 0 ||
+		   !journal->j_checkpoint_task);
+}
+
 /*
  * __jbd2_log_wait_for_space: wait until there is space in the journal.
  *
@@ -144,13 +259,23 @@ void __jbd2_log_wait_for_space(journal_t *journal)
 		space_left = jbd2_log_space_left(journal);
 		if (space_left < nblocks) {
 			int chkpt = journal->j_checkpoint_transactions != NULL;
+			int delegate = chkpt && journal->j_checkpoint_task;
+			unsigned long request = 0;
 			tid_t tid = 0;
 
 			if (journal->j_committing_transaction)
 				tid = journal->j_committing_transaction->t_tid;
+			if (delegate)
+				request = ++journal->j_checkpoint_request;
 			spin_unlock(&journal->j_list_lock);
 			write_unlock(&journal->j_state_lock);
-			if (chkpt) {
+			if (delegate) {
+				/* The checkpoint thread needs the mutex */
+				mutex_unlock(&journal->j_checkpoint_mutex);
+				jbd2_checkpoint_wait(journal, request);
+				write_lock(&journal->j_state_lock);
+				continue;
+			} else if (chkpt) {
 				jbd2_log_do_checkpoint(journal);
 			} else if (jbd2_cleanup_journal_tail(journal) == 0) {
 				/* We were able to recover space; yay! */
@@ -724,7 +849,7 @@ void __jbd2_journal_drop_transaction(journal_t *journal, transaction_t *transact
 	J_ASSERT(transaction->t_checkpoint_list == NULL);
 	J_ASSERT(transaction->t_checkpoint_io_list == NULL);
 	J_ASSERT(atomic_read(&transaction->t_updates) == 0);
-	J_ASSERT(journal->j_committing_transaction != transaction);
+	J_ASSERT(!jbd2_transaction_committing(journal, transaction));
 	J_ASSERT(journal->j_running_transaction != transaction);
 
 	trace_jbd2_drop_transaction(journal, transaction);
@@ -27,6 +27,7 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/bitops.h>
+#include <linux/math64.h>
 #include <trace/events/jbd2.h>
 
 /*
@@ -114,6 +115,9 @@ static void jbd2_commit_block_csum_set(journal_t *j, struct buffer_head *bh)
  * mode we can now just skip the rest of the journal write
  * entirely.
  *
+ * The commit block in *cbh was allocated right after the transaction's
+ * other log blocks, so that those of the next transaction go after it.
+ *
  * Returns 1 if the journal needs to be aborted or 0 on success
  */
 static int journal_submit_commit_record(journal_t *journal,
@@ -122,16 +126,17 @@ static int journal_submit_commit_record(journal_t *journal,
 					__u32 crc32_sum)
 {
 	struct commit_header *tmp;
-	struct buffer_head *bh;
+	struct buffer_head *bh = *cbh;
 	int ret;
 	struct timespec now = current_kernel_time();
 
-	*cbh = NULL;
-
-	if (is_journal_aborted(journal))
+	if (is_journal_aborted(journal)) {
+		if (bh)
+			__brelse(bh);
+		*cbh = NULL;
 		return 0;
+	}
 
-	bh = jbd2_journal_get_descriptor_buffer(journal);
 	if (!bh)
 		return 1;
 
@@ -163,7 +168,6 @@ static int journal_submit_commit_record(journal_t *journal,
 	else
 		ret = submit_bh(WRITE_SYNC, bh);
 
-	*cbh = bh;
 	return ret;
 }
 
@@ -361,131 +365,39 @@ static void jbd2_block_tag_csum_set(journal_t *j, journal_block_tag_t *tag,
 	else
 		tag->t_checksum = cpu_to_be16(csum32);
 }
+
 /*
- * jbd2_journal_commit_transaction
- *
- * The primary function for committing a transaction to the log.  This
- * function is called by the journal thread to begin a complete commit.
+ * The commit of a transaction comes in three stages: jbd2_commit_start()
+ * locks the transaction down and writes out its data and log blocks,
+ * jbd2_commit_write_rest() logs the buffers it inherited from the previous
+ * commit in the meantime and sets aside its commit block, and
+ * jbd2_commit_finish() waits for the IO, writes the commit record and
+ * checkpoints the buffers.  Between the last two the commit of the next
+ * transaction may start, so struct jbd2_commit carries what a commit needs
+ * from one stage to the next.
  */
-void jbd2_journal_commit_transaction(journal_t *journal)
+struct jbd2_commit {
+	transaction_t		*transaction;
+	struct transaction_run_stats_s run;
+	ktime_t			start_time;
+	__u32			crc32_sum;
+	int			requested;
+	/* Started while the previous commit was still in flight */
+	int			overlapped;
+	/* The commit block, allocated after the other log blocks */
+	struct buffer_head	*cbh;
+	struct list_head	io_bufs;
+	struct list_head	log_bufs;
+};
+
+/*
+ * Discard any remaining BJ_Reserved buffers of the committing transaction.
+ */
+static void jbd2_commit_release_reserved(journal_t *journal,
+					 transaction_t *commit_transaction)
 {
-	struct transaction_stats_s stats;
-	transaction_t *commit_transaction;
 	struct journal_head *jh;
-	struct buffer_head *descriptor;
-	struct buffer_head **wbuf = journal->j_wbuf;
-	int bufs;
-	int flags;
-	int err;
-	unsigned long long blocknr;
-	ktime_t start_time;
-	u64 commit_time;
-	char *tagp = NULL;
-	journal_header_t *header;
-	journal_block_tag_t *tag = NULL;
-	int space_left = 0;
-	int first_tag = 0;
-	int tag_flag;
-	int i;
-	int tag_bytes = journal_tag_bytes(journal);
-	struct buffer_head *cbh = NULL; /* For transactional checksums */
-	__u32 crc32_sum = ~0;
-	struct blk_plug plug;
-	/* Tail of the journal */
-	unsigned long first_block;
-	tid_t first_tid;
-	int update_tail;
-	int csum_size = 0;
-	LIST_HEAD(io_bufs);
-	LIST_HEAD(log_bufs);
-
-	if (jbd2_journal_has_csum_v2or3(journal))
-		csum_size = sizeof(struct jbd2_journal_block_tail);
-
-	/*
-	 * First job: lock down the current transaction and wait for
-	 * all outstanding updates to complete.
-	 */
-
-	/* Do we need to erase the effects of a prior jbd2_journal_flush? */
-	if (journal->j_flags & JBD2_FLUSHED) {
-		jbd_debug(3, "super block updated\n");
-		mutex_lock(&journal->j_checkpoint_mutex);
-		/*
-		 * We hold j_checkpoint_mutex so tail cannot change under us.
-		 * We don't need any special data guarantees for writing sb
-		 * since journal is empty and it is ok for write to be
-		 * flushed only with transaction commit.
-		 */
-		jbd2_journal_update_sb_log_tail(journal,
-						journal->j_tail_sequence,
-						journal->j_tail,
-						WRITE_SYNC);
-		mutex_unlock(&journal->j_checkpoint_mutex);
-	} else {
-		jbd_debug(3, "superblock not updated\n");
-	}
-
-	J_ASSERT(journal->j_running_transaction != NULL);
-	J_ASSERT(journal->j_committing_transaction == NULL);
-
-	commit_transaction = journal->j_running_transaction;
-
-	trace_jbd2_start_commit(journal, commit_transaction);
-	jbd_debug(1, "JBD2: starting commit of transaction %d\n",
-			commit_transaction->t_tid);
-
-	write_lock(&journal->j_state_lock);
-	J_ASSERT(commit_transaction->t_state == T_RUNNING);
-	commit_transaction->t_state = T_LOCKED;
-
-	trace_jbd2_commit_locking(journal, commit_transaction);
-	stats.run.rs_wait = commit_transaction->t_max_wait;
-	stats.run.rs_request_delay = 0;
-	stats.run.rs_locked = jiffies;
-	if (commit_transaction->t_requested)
-		stats.run.rs_request_delay =
-			jbd2_time_diff(commit_transaction->t_requested,
-				       stats.run.rs_locked);
-	stats.run.rs_running = jbd2_time_diff(commit_transaction->t_start,
-					      stats.run.rs_locked);
-
-	spin_lock(&commit_transaction->t_handle_lock);
-	while (atomic_read(&commit_transaction->t_updates)) {
-		DEFINE_WAIT(wait);
-
-		prepare_to_wait(&journal->j_wait_updates, &wait,
-					TASK_UNINTERRUPTIBLE);
-		if (atomic_read(&commit_transaction->t_updates)) {
-			spin_unlock(&commit_transaction->t_handle_lock);
-			write_unlock(&journal->j_state_lock);
-			schedule();
-			write_lock(&journal->j_state_lock);
-			spin_lock(&commit_transaction->t_handle_lock);
-		}
-		finish_wait(&journal->j_wait_updates, &wait);
-	}
-	spin_unlock(&commit_transaction->t_handle_lock);
 
-	J_ASSERT (atomic_read(&commit_transaction->t_outstanding_credits) <=
-			journal->j_max_transaction_buffers);
-
-	/*
-	 * First thing we are allowed to do is to discard any remaining
-	 * BJ_Reserved buffers.  Note, it is _not_ permissible to assume
-	 * that there are no such buffers: if a large filesystem
-	 * operation like a truncate needs to split itself over multiple
-	 * transactions, then it may try to do a jbd2_journal_restart() while
-	 * there are still BJ_Reserved buffers outstanding.  These must
-	 * be released cleanly from the current transaction.
-	 *
-	 * In this case, the filesystem must still reserve write access
-	 * again before modifying the buffer in the new transaction, but
-	 * we do not require it to remember exactly which old buffers it
-	 * has reserved.  This is consistent with the existing behaviour
-	 * that multiple jbd2_journal_get_write_access() calls to the same
-	 * buffer are perfectly permissible.
-	 */
 	while (commit_transaction->t_reserved_list) {
 		jh = commit_transaction->t_reserved_list;
 		JBUFFER_TRACE(jh, "reserved, unused: refile");
@@ -503,85 +415,36 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		}
 		jbd2_journal_refile_buffer(journal, jh);
 	}
+}
 
-	/*
-	 * Now try to drop any written-back buffers from the journal's
-	 * checkpoint lists.  We do this *before* commit because it potentially
-	 * frees some memory
-	 */
-	spin_lock(&journal->j_list_lock);
-	__jbd2_journal_clean_checkpoint_list(journal, false);
-	spin_unlock(&journal->j_list_lock);
-
-	jbd_debug(3, "JBD2: commit phase 1\n");
-
-	/*
-	 * Clear revoked flag to reflect there is no revoked buffers
-	 * in the next transaction which is going to be started.
-	 */
-	jbd2_clear_buffer_revoked_flags(journal);
-
-	/*
-	 * Switch to a new revoke table.
-	 */
-	jbd2_journal_switch_revoke_table(journal);
-
-	/*
-	 * Reserved credits cannot be claimed anymore, free them
-	 */
-	atomic_sub(atomic_read(&journal->j_reserved_credits),
-		   &commit_transaction->t_outstanding_credits);
-
-	trace_jbd2_commit_flushing(journal, commit_transaction);
-	stats.run.rs_flushing = jiffies;
-	stats.run.rs_locked = jbd2_time_diff(stats.run.rs_locked,
-					     stats.run.rs_flushing);
-
-	commit_transaction->t_state = T_FLUSH;
-	journal->j_committing_transaction = commit_transaction;
-	journal->j_running_transaction = NULL;
-	start_time = ktime_get();
-	commit_transaction->t_log_start = journal->j_head;
-	wake_up(&journal->j_wait_transaction_locked);
-	write_unlock(&journal->j_state_lock);
-
-	jbd_debug(3, "JBD2: commit phase 2a\n");
-
-	/*
-	 * Now start flushing things to disk, in the order they appear
-	 * on the transaction lists.  Data blocks go first.
-	 */
-	err = journal_submit_data_buffers(journal, commit_transaction);
-	if (err)
-		jbd2_journal_abort(journal, err);
-
-	blk_start_plug(&plug);
-	jbd2_journal_write_revoke_records(journal, commit_transaction,
-					  &log_bufs, WRITE_SYNC);
-
-	jbd_debug(3, "JBD2: commit phase 2b\n");
-
-	/*
-	 * Way to go: we have now written out all of the data for a
-	 * transaction!  Now comes the tricky part: we need to write out
-	 * metadata.  Loop over the transaction's entire buffer list:
-	 */
-	write_lock(&journal->j_state_lock);
-	commit_transaction->t_state = T_COMMIT;
-	write_unlock(&journal->j_state_lock);
-
-	trace_jbd2_commit_logging(journal, commit_transaction);
-	stats.run.rs_logging = jiffies;
-	stats.run.rs_flushing = jbd2_time_diff(stats.run.rs_flushing,
-					       stats.run.rs_logging);
-	stats.run.rs_blocks =
-		atomic_read(&commit_transaction->t_outstanding_credits);
-	stats.run.rs_blocks_logged = 0;
+/*
+ * Write the metadata buffers on the transaction's t_buffers list to the
+ * log, with descriptor blocks describing them.
+ */
+static void jbd2_commit_write_metadata(journal_t *journal,
+				       struct jbd2_commit *cs)
+{
+	transaction_t *commit_transaction = cs->transaction;
+	struct journal_head *jh;
+	struct buffer_head *descriptor;
+	struct buffer_head **wbuf = journal->j_wbuf;
+	int bufs;
+	int flags;
+	int err;
+	unsigned long long blocknr;
+	char *tagp = NULL;
+	journal_header_t *header;
+	journal_block_tag_t *tag = NULL;
+	int space_left = 0;
+	int first_tag = 0;
+	int tag_flag;
+	int i;
+	int tag_bytes = journal_tag_bytes(journal);
+	int csum_size = 0;
 
-	J_ASSERT(commit_transaction->t_nr_buffers <=
-		 atomic_read(&commit_transaction->t_outstanding_credits));
+	if (jbd2_journal_has_csum_v2or3(journal))
+		csum_size = sizeof(struct jbd2_journal_block_tail);
 
-	err = 0;
 	bufs = 0;
 	descriptor = NULL;
 	while (commit_transaction->t_buffers) {
@@ -643,7 +506,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 			/* Record it so that we can wait for IO
                            completion later */
 			BUFFER_TRACE(descriptor, "ph3: file as descriptor");
-			jbd2_file_log_bh(&log_bufs, descriptor);
+			jbd2_file_log_bh(&cs->log_bufs, descriptor);
 		}
 
 		/* Where is the buffer to be written? */
@@ -681,7 +544,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 			jbd2_journal_abort(journal, flags);
 			continue;
 		}
-		jbd2_file_log_bh(&io_bufs, wbuf[bufs]);
+		jbd2_file_log_bh(&cs->io_bufs, wbuf[bufs]);
 
 		/* Record the new block's tag in the current descriptor
                    buffer */
@@ -732,8 +595,9 @@ start_journal_io:
 				 */
 				if (JBD2_HAS_COMPAT_FEATURE(journal,
 					JBD2_FEATURE_COMPAT_CHECKSUM)) {
-					crc32_sum =
-					    jbd2_checksum_data(crc32_sum, bh);
+					cs->crc32_sum =
+					    jbd2_checksum_data(cs->crc32_sum,
+							       bh);
 				}
 
 				lock_buffer(bh);
@@ -743,7 +607,7 @@ start_journal_io:
 				submit_bh(WRITE_SYNC, bh);
 			}
 			cond_resched();
-			stats.run.rs_blocks_logged += bufs;
+			cs->run.rs_blocks_logged += bufs;
 
 			/* Force a new descriptor to be generated next
                            time round the loop. */
@@ -751,6 +615,281 @@ start_journal_io:
 			bufs = 0;
 		}
 	}
+}
+
+/*
+ * Lock down the running transaction, wait for all outstanding updates to
+ * complete and write out its data and metadata.
+ *
+ * With @overlap, the commit of the previous transaction is still in
+ * flight.  We go ahead only if this commit has been asked for already and
+ * no handle is open against the transaction: an open handle may be waiting
+ * for the previous commit, which is not going to finish before we are
+ * done here.  Returns 1 if the commit was started.
+ */
+static int jbd2_commit_start(journal_t *journal, struct jbd2_commit *cs,
+			     int overlap)
+{
+	transaction_t *commit_transaction;
+	struct blk_plug plug;
+	int err;
+
+	/*
+	 * First job: lock down the current transaction and wait for
+	 * all outstanding updates to complete.
+	 */
+
+	/* Do we need to erase the effects of a prior jbd2_journal_flush? */
+	if (!overlap && (journal->j_flags & JBD2_FLUSHED)) {
+		jbd_debug(3, "super block updated\n");
+		mutex_lock(&journal->j_checkpoint_mutex);
+		/*
+		 * We hold j_checkpoint_mutex so tail cannot change under us.
+		 * We don't need any special data guarantees for writing sb
+		 * since journal is empty and it is ok for write to be
+		 * flushed only with transaction commit.
+		 */
+		jbd2_journal_update_sb_log_tail(journal,
+						journal->j_tail_sequence,
+						journal->j_tail,
+						WRITE_SYNC);
+		mutex_unlock(&journal->j_checkpoint_mutex);
+	} else {
+		jbd_debug(3, "superblock not updated\n");
+	}
+
+	write_lock(&journal->j_state_lock);
+	commit_transaction = journal->j_running_transaction;
+	if (overlap) {
+		/*
+		 * No handle can join once we hold j_state_lock for writing,
+		 * so if t_updates is zero now, we won't wait for updates.
+		 */
+		if (!commit_transaction || is_journal_aborted(journal) ||
+		    !tid_geq(journal->j_commit_request,
+			     commit_transaction->t_tid) ||
+		    atomic_read(&commit_transaction->t_updates)) {
+			write_unlock(&journal->j_state_lock);
+			return 0;
+		}
+		J_ASSERT(journal->j_finishing_transaction == NULL);
+	} else {
+		J_ASSERT(commit_transaction != NULL);
+		J_ASSERT(journal->j_committing_transaction == NULL);
+	}
+
+	memset(cs, 0, sizeof(*cs));
+	cs->transaction = commit_transaction;
+	cs->crc32_sum = ~0;
+	cs->overlapped = overlap;
+	INIT_LIST_HEAD(&cs->io_bufs);
+	INIT_LIST_HEAD(&cs->log_bufs);
+
+	trace_jbd2_start_commit(journal, commit_transaction);
+	jbd_debug(1, "JBD2: starting commit of transaction %d\n",
+			commit_transaction->t_tid);
+
+	/*
+	 * A fast commit being written goes to the fast commit area, which
+	 * this commit will recycle.  Let it finish, and keep new ones out
+	 * until we are done.
+	 */
+	journal->j_flags |= JBD2_FULL_COMMIT_ONGOING;
+	while (journal->j_flags & JBD2_FAST_COMMIT_ONGOING) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		write_lock(&journal->j_state_lock);
+	}
+	J_ASSERT(commit_transaction->t_state == T_RUNNING);
+	commit_transaction->t_state = T_LOCKED;
+
+	trace_jbd2_commit_locking(journal, commit_transaction);
+	cs->run.rs_wait = commit_transaction->t_max_wait;
+	cs->run.rs_request_delay = 0;
+	cs->run.rs_locked = jiffies;
+	if (commit_transaction->t_requested)
+		cs->run.rs_request_delay =
+			jbd2_time_diff(commit_transaction->t_requested,
+				       cs->run.rs_locked);
+	cs->run.rs_running = jbd2_time_diff(commit_transaction->t_start,
+					    cs->run.rs_locked);
+
+	spin_lock(&commit_transaction->t_handle_lock);
+	while (atomic_read(&commit_transaction->t_updates)) {
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&journal->j_wait_updates, &wait,
+					TASK_UNINTERRUPTIBLE);
+		if (atomic_read(&commit_transaction->t_updates)) {
+			spin_unlock(&commit_transaction->t_handle_lock);
+			write_unlock(&journal->j_state_lock);
+			schedule();
+			write_lock(&journal->j_state_lock);
+			spin_lock(&commit_transaction->t_handle_lock);
+		}
+		finish_wait(&journal->j_wait_updates, &wait);
+	}
+	spin_unlock(&commit_transaction->t_handle_lock);
+
+	J_ASSERT (atomic_read(&commit_transaction->t_outstanding_credits) <=
+			journal->j_max_transaction_buffers);
+
+	/*
+	 * First thing we are allowed to do is to discard any remaining
+	 * BJ_Reserved buffers.  Note, it is _not_ permissible to assume
+	 * that there are no such buffers: if a large filesystem
+	 * operation like a truncate needs to split itself over multiple
+	 * transactions, then it may try to do a jbd2_journal_restart() while
+	 * there are still BJ_Reserved buffers outstanding.  These must
+	 * be released cleanly from the current transaction.
+	 *
+	 * In this case, the filesystem must still reserve write access
+	 * again before modifying the buffer in the new transaction, but
+	 * we do not require it to remember exactly which old buffers it
+	 * has reserved.  This is consistent with the existing behaviour
+	 * that multiple jbd2_journal_get_write_access() calls to the same
+	 * buffer are perfectly permissible.
+	 */
+	jbd2_commit_release_reserved(journal, commit_transaction);
+
+	/*
+	 * Now try to drop any written-back buffers from the journal's
+	 * checkpoint lists.  We do this *before* commit because it potentially
+	 * frees some memory
+	 */
+	spin_lock(&journal->j_list_lock);
+	__jbd2_journal_clean_checkpoint_list(journal, false);
+	spin_unlock(&journal->j_list_lock);
+
+	jbd_debug(3, "JBD2: commit phase 1\n");
+
+	/*
+	 * Clear revoked flag to reflect there is no revoked buffers
+	 * in the next transaction which is going to be started.
+	 */
+	jbd2_clear_buffer_revoked_flags(journal);
+
+	/*
+	 * Switch to a new revoke table.
+	 */
+	jbd2_journal_switch_revoke_table(journal);
+
+	/*
+	 * Reserved credits cannot be claimed anymore, free them
+	 */
+	atomic_sub(atomic_read(&journal->j_reserved_credits),
+		   &commit_transaction->t_outstanding_credits);
+
+	trace_jbd2_commit_flushing(journal, commit_transaction);
+	cs->run.rs_flushing = jiffies;
+	cs->run.rs_locked = jbd2_time_diff(cs->run.rs_locked,
+					   cs->run.rs_flushing);
+
+	commit_transaction->t_state = T_FLUSH;
+	/* The previous commit, if still in flight, is now finishing */
+	journal->j_finishing_transaction = journal->j_committing_transaction;
+	journal->j_committing_transaction = commit_transaction;
+	journal->j_running_transaction = NULL;
+	cs->start_time = ktime_get();
+	commit_transaction->t_log_start = journal->j_head;
+	wake_up(&journal->j_wait_transaction_locked);
+	write_unlock(&journal->j_state_lock);
+
+	jbd_debug(3, "JBD2: commit phase 2a\n");
+
+	/*
+	 * Now start flushing things to disk, in the order they appear
+	 * on the transaction lists.  Data blocks go first.
+	 */
+	err = journal_submit_data_buffers(journal, commit_transaction);
+	if (err)
+		jbd2_journal_abort(journal, err);
+
+	blk_start_plug(&plug);
+	jbd2_journal_write_revoke_records(journal, commit_transaction,
+					  &cs->log_bufs, WRITE_SYNC);
+
+	jbd_debug(3, "JBD2: commit phase 2b\n");
+
+	/*
+	 * Way to go: we have now written out all of the data for a
+	 * transaction!  Now comes the tricky part: we need to write out
+	 * metadata.  Loop over the transaction's entire buffer list:
+	 */
+	write_lock(&journal->j_state_lock);
+	commit_transaction->t_state = T_COMMIT;
+	write_unlock(&journal->j_state_lock);
+
+	trace_jbd2_commit_logging(journal, commit_transaction);
+	cs->run.rs_logging = jiffies;
+	cs->run.rs_flushing = jbd2_time_diff(cs->run.rs_flushing,
+					     cs->run.rs_logging);
+	cs->run.rs_blocks =
+		atomic_read(&commit_transaction->t_outstanding_credits);
+	cs->run.rs_blocks_logged = 0;
+
+	J_ASSERT(commit_transaction->t_nr_buffers <=
+		 atomic_read(&commit_transaction->t_outstanding_credits));
+
+	jbd2_commit_write_metadata(journal, cs);
+	blk_finish_plug(&plug);
+	return 1;
+}
+
+/*
+ * Once the previous commit is done, log what it refiled to us: buffers
+ * and inodes the transaction modified while the previous one still had
+ * them.  Then set the commit block aside, so that it is the transaction's
+ * last log block whenever the next commit starts.
+ */
+static void jbd2_commit_write_rest(journal_t *journal, struct jbd2_commit *cs)
+{
+	transaction_t *commit_transaction = cs->transaction;
+	struct blk_plug plug;
+	int err;
+
+	if (cs->overlapped) {
+		jbd2_commit_release_reserved(journal, commit_transaction);
+		err = journal_submit_data_buffers(journal, commit_transaction);
+		if (err)
+			jbd2_journal_abort(journal, err);
+	}
+
+	blk_start_plug(&plug);
+	jbd2_commit_write_metadata(journal, cs);
+	blk_finish_plug(&plug);
+
+	if (!is_journal_aborted(journal))
+		cs->cbh = jbd2_journal_get_descriptor_buffer(journal);
+}
+
+static unsigned int jbd2_commit_hist_bucket(u64 commit_time)
+{
+	unsigned int bucket = fls64(div_u64(commit_time, NSEC_PER_USEC));
+
+	return min_t(unsigned int, bucket, JBD2_COMMIT_HIST_BUCKETS - 1);
+}
+
+/*
+ * Wait for the transaction's data and log blocks, write the commit record
+ * and hand the buffers over to checkpointing.
+ */
+static void jbd2_commit_finish(journal_t *journal, struct jbd2_commit *cs)
+{
+	transaction_t *commit_transaction = cs->transaction;
+	struct journal_head *jh;
+	int err;
+	u64 commit_time;
+	struct blk_plug plug;
+	/* Tail of the journal */
+	unsigned long first_block;
+	tid_t first_tid;
+	int update_tail;
 
 	err = journal_finish_inode_data_buffers(journal, commit_transaction);
 	if (err) {
@@ -797,10 +936,11 @@ start_journal_io:
 		blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
 
 	/* Done it all: now write the commit record asynchronously. */
+	blk_start_plug(&plug);
 	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
 				      JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
 		err = journal_submit_commit_record(journal, commit_transaction,
-						 &cbh, crc32_sum);
+						 &cs->cbh, cs->crc32_sum);
 		if (err)
 			__jbd2_journal_abort_hard(journal);
 	}
@@ -820,8 +960,8 @@ start_journal_io:
 
 	jbd_debug(3, "JBD2: commit phase 3\n");
 
-	while (!list_empty(&io_bufs)) {
-		struct buffer_head *bh = list_entry(io_bufs.prev,
+	while (!list_empty(&cs->io_bufs)) {
+		struct buffer_head *bh = list_entry(cs->io_bufs.prev,
 						    struct buffer_head,
 						    b_assoc_buffers);
 
@@ -863,10 +1003,11 @@ start_journal_io:
 	jbd_debug(3, "JBD2: commit phase 4\n");
 
 	/* Here we wait for the revoke record and descriptor record buffers */
-	while (!list_empty(&log_bufs)) {
+	while (!list_empty(&cs->log_bufs)) {
 		struct buffer_head *bh;
 
-		bh = list_entry(log_bufs.prev, struct buffer_head, b_assoc_buffers);
+		bh = list_entry(cs->log_bufs.prev, struct buffer_head,
+				b_assoc_buffers);
 		wait_on_buffer(bh);
 		cond_resched();
 
@@ -892,12 +1033,12 @@ start_journal_io:
 	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
 				       JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
 		err = journal_submit_commit_record(journal, commit_transaction,
-						&cbh, crc32_sum);
+						&cs->cbh, cs->crc32_sum);
 		if (err)
 			__jbd2_journal_abort_hard(journal);
 	}
-	if (cbh)
-		err = journal_wait_on_commit_record(journal, cbh);
+	if (cs->cbh)
+		err = journal_wait_on_commit_record(journal, cs->cbh);
 	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
 				      JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT) &&
 	    journal->j_flags & JBD2_BARRIER) {
@@ -1094,24 +1235,31 @@ restart_loop:
 	J_ASSERT(commit_transaction->t_state == T_COMMIT_JFLUSH);
 
 	commit_transaction->t_start = jiffies;
-	stats.run.rs_logging = jbd2_time_diff(stats.run.rs_logging,
-					      commit_transaction->t_start);
+	cs->run.rs_logging = jbd2_time_diff(cs->run.rs_logging,
+					    commit_transaction->t_start);
 
 	/*
 	 * File the transaction statistics
 	 */
-	stats.ts_tid = commit_transaction->t_tid;
-	stats.run.rs_handle_count =
+	cs->run.rs_handle_count =
 		atomic_read(&commit_transaction->t_handle_count);
+	cs->requested = (commit_transaction->t_requested) ? 1 : 0;
 	trace_jbd2_run_stats(journal->j_fs_dev->bd_dev,
-			     commit_transaction->t_tid, &stats.run);
-	stats.ts_requested = (commit_transaction->t_requested) ? 1 : 0;
+			     commit_transaction->t_tid, &cs->run);
 
 	commit_transaction->t_state = T_COMMIT_CALLBACK;
-	J_ASSERT(commit_transaction == journal->j_committing_transaction);
+	/* Commits finish in order: the finishing one goes first */
+	if (journal->j_finishing_transaction) {
+		J_ASSERT(commit_transaction ==
+			 journal->j_finishing_transaction);
+		journal->j_finishing_transaction = NULL;
+	} else {
+		J_ASSERT(commit_transaction ==
+			 journal->j_committing_transaction);
+		journal->j_committing_transaction = NULL;
+	}
 	journal->j_commit_sequence = commit_transaction->t_tid;
-	journal->j_committing_transaction = NULL;
-	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+	commit_time = ktime_to_ns(ktime_sub(ktime_get(), cs->start_time));
 
 	/*
 	 * weight the commit time higher than the average time so we don't
@@ -1133,6 +1281,15 @@ restart_loop:
 		  journal->j_commit_sequence, journal->j_tail_sequence);
 
 	write_lock(&journal->j_state_lock);
+	/*
+	 * The fast commits for this transaction are obsolete now.  With the
+	 * next commit in flight, that one keeps fast commits out still.
+	 */
+	if (!journal->j_committing_transaction) {
+		journal->j_fc_off = 0;
+		journal->j_flags &= ~JBD2_FULL_COMMIT_ONGOING;
+		wake_up(&journal->j_fc_wait);
+	}
 	spin_lock(&journal->j_list_lock);
 	commit_transaction->t_state = T_FINISHED;
 	/* Check if the transaction can be dropped now that we are finished */
@@ -1144,21 +1301,53 @@ restart_loop:
 	spin_unlock(&journal->j_list_lock);
 	write_unlock(&journal->j_state_lock);
 	wake_up(&journal->j_wait_done_commit);
+	jbd2_checkpoint_wakeup(journal);
 
 	/*
 	 * Calculate overall stats
 	 */
 	spin_lock(&journal->j_history_lock);
 	journal->j_stats.ts_tid++;
-	journal->j_stats.ts_requested += stats.ts_requested;
-	journal->j_stats.run.rs_wait += stats.run.rs_wait;
-	journal->j_stats.run.rs_request_delay += stats.run.rs_request_delay;
-	journal->j_stats.run.rs_running += stats.run.rs_running;
-	journal->j_stats.run.rs_locked += stats.run.rs_locked;
-	journal->j_stats.run.rs_flushing += stats.run.rs_flushing;
-	journal->j_stats.run.rs_logging += stats.run.rs_logging;
-	journal->j_stats.run.rs_handle_count += stats.run.rs_handle_count;
-	journal->j_stats.run.rs_blocks += stats.run.rs_blocks;
-	journal->j_stats.run.rs_blocks_logged += stats.run.rs_blocks_logged;
+	journal->j_stats.ts_requested += cs->requested;
+	journal->j_stats.ts_overlapped += cs->overlapped;
+	journal->j_stats.run.rs_wait += cs->run.rs_wait;
+	journal->j_stats.run.rs_request_delay += cs->run.rs_request_delay;
+	journal->j_stats.run.rs_running += cs->run.rs_running;
+	journal->j_stats.run.rs_locked += cs->run.rs_locked;
+	journal->j_stats.run.rs_flushing += cs->run.rs_flushing;
+	journal->j_stats.run.rs_logging += cs->run.rs_logging;
+	journal->j_stats.run.rs_handle_count += cs->run.rs_handle_count;
+	journal->j_stats.run.rs_blocks += cs->run.rs_blocks;
+	journal->j_stats.run.rs_blocks_logged += cs->run.rs_blocks_logged;
+	journal->j_stats.ts_commit_hist[jbd2_commit_hist_bucket(commit_time)]++;
 	spin_unlock(&journal->j_history_lock);
 }
+
+/*
+ * jbd2_journal_commit_transaction
+ *
+ * The primary function for committing a transaction to the log.  This
+ * function is called by the journal thread to begin a complete commit.
+ *
+ * Once a transaction's log blocks are out, the commit of the next one is
+ * started if it has been asked for already, and runs up to its own log
+ * blocks while we wait for the IO of the first: the two overlap.  We
+ * return when every commit we started is complete.
+ */
+void jbd2_journal_commit_transaction(journal_t *journal)
+{
+	struct jbd2_commit commits[2];
+	struct jbd2_commit *cs = &commits[0], *prev = NULL;
+
+	jbd2_commit_start(journal, cs, 0);
+	for (;;) {
+		if (prev)
+			jbd2_commit_finish(journal, prev);
+		jbd2_commit_write_rest(journal, cs);
+		prev = cs;
+		cs = (cs == &commits[0]) ? &commits[1] : &commits[0];
+		if (!jbd2_commit_start(journal, cs, 1))
+			break;
+	}
+	jbd2_commit_finish(journal, prev);
+}
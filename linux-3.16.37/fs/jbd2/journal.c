@@ -183,7 +183,8 @@ static void commit_timeout(unsigned long __data)
  * 2) CHECKPOINT: We cannot reuse a used section of the log file until all
  *    of the data in that part of the log has been rewritten elsewhere on
  *    the disk.  Flushing these old buffers to reclaim space in the log is
- *    known as checkpointing, and this thread is responsible for that job.
+ *    known as checkpointing, and the jbd2-ckpt thread next to this one is
+ *    responsible for that job.
  */
 
 static int kjournald2(void *arg)
@@ -668,6 +669,9 @@ int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid)
 	if (tid_geq(journal->j_commit_sequence, tid))
 		goto out;
 	commit_trans = journal->j_committing_transaction;
+	if (journal->j_finishing_transaction &&
+	    journal->j_finishing_transaction->t_tid == tid)
+		commit_trans = journal->j_finishing_transaction;
 	if (!commit_trans || commit_trans->t_tid != tid) {
 		ret = 1;
 		goto out;
@@ -744,7 +748,9 @@ int jbd2_complete_transaction(journal_t *journal, tid_t tid)
 			goto wait_commit;
 		}
 	} else if (!(journal->j_committing_transaction &&
-		     journal->j_committing_transaction->t_tid == tid))
+		     journal->j_committing_transaction->t_tid == tid) &&
+		   !(journal->j_finishing_transaction &&
+		     journal->j_finishing_transaction->t_tid == tid))
 		need_to_wait = 0;
 	read_unlock(&journal->j_state_lock);
 	if (!need_to_wait)
@@ -754,6 +760,212 @@ wait_commit:
 }
 EXPORT_SYMBOL(jbd2_complete_transaction);
 
+/*
+ * Fast commits.
+ *
+ * A fast commit is a compact, filesystem defined record of the changes a
+ * running transaction has made so far, written to an area at the end of
+ * the journal instead of committing the transaction.  The filesystem
+ * replays it after recovery if the transaction it stands in for never
+ * committed.  Fast commits and full commits exclude each other; the full
+ * commit of a transaction makes the fast commits written for it obsolete,
+ * so the area is reused from its start afterwards.
+ */
+
+/**
+ * int jbd2_fc_begin_commit() - start writing a fast commit
+ * @journal: Journal to act on.
+ * @tid: Transaction the fast commit stands in for.
+ *
+ * On success the caller owns the fast commit area until it calls
+ * jbd2_fc_end_commit().  -EALREADY means @tid has been committed or is
+ * being committed in full already, so the caller should simply wait for
+ * that with jbd2_complete_transaction().
+ */
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid)
+{
+	if (unlikely(is_journal_aborted(journal)))
+		return -EIO;
+	if (!journal->j_fc_wbuf)
+		return -EINVAL;
+
+	write_lock(&journal->j_state_lock);
+	for (;;) {
+		DEFINE_WAIT(wait);
+
+		/* Committed, or about to be */
+		if (!tid_gt(tid, journal->j_commit_sequence) ||
+		    tid_geq(journal->j_commit_request, tid)) {
+			write_unlock(&journal->j_state_lock);
+			return -EALREADY;
+		}
+		if (!(journal->j_flags & (JBD2_FAST_COMMIT_ONGOING |
+					  JBD2_FULL_COMMIT_ONGOING)))
+			break;
+
+		prepare_to_wait(&journal->j_fc_wait, &wait,
+				TASK_UNINTERRUPTIBLE);
+		write_unlock(&journal->j_state_lock);
+		schedule();
+		finish_wait(&journal->j_fc_wait, &wait);
+		write_lock(&journal->j_state_lock);
+	}
+	journal->j_flags |= JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_begin_commit);
+
+/**
+ * void jbd2_fc_end_commit() - finish a fast commit
+ * @journal: Journal to act on.
+ *
+ * Lets waiting full commits and fast commits proceed.  A caller that gave
+ * up on its fast commit falls back to jbd2_complete_transaction() after
+ * this.
+ */
+void jbd2_fc_end_commit(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FAST_COMMIT_ONGOING;
+	write_unlock(&journal->j_state_lock);
+	wake_up(&journal->j_fc_wait);
+}
+EXPORT_SYMBOL(jbd2_fc_end_commit);
+
+/**
+ * int jbd2_fc_get_buf() - get the next block of the fast commit area
+ * @journal: Journal to act on.
+ * @bhp: Returns a zeroed buffer for the block.
+ *
+ * Returns -ENOSPC once the area is full, in which case the caller has to
+ * fall back to a full commit.  The buffer is written by
+ * jbd2_fc_write_bufs().
+ */
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bhp)
+{
+	unsigned long long pblock;
+	struct buffer_head *bh;
+	int err;
+
+	*bhp = NULL;
+	if (journal->j_fc_first + journal->j_fc_off >= journal->j_fc_last)
+		return -ENOSPC;
+
+	err = jbd2_journal_bmap(journal, journal->j_fc_first + journal->j_fc_off,
+				&pblock);
+	if (err)
+		return err;
+
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+	lock_buffer(bh);
+	memset(bh->b_data, 0, journal->j_blocksize);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+
+	journal->j_fc_wbuf[journal->j_fc_off++] = bh;
+	*bhp = bh;
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
+static void jbd2_fc_submit_buf(struct buffer_head *bh, int write_op)
+{
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	get_bh(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	submit_bh(write_op, bh);
+}
+
+/**
+ * int jbd2_fc_write_bufs() - write out a fast commit
+ * @journal: Journal to act on.
+ * @num_blks: Number of blocks the fast commit got from jbd2_fc_get_buf().
+ *
+ * The last block, which is where the filesystem puts whatever marks its
+ * fast commit complete, only goes out once the others are done and after
+ * a cache flush, so that the fast commit is only ever found complete
+ * together with everything written before it, file data included.
+ */
+int jbd2_fc_write_bufs(journal_t *journal, int num_blks)
+{
+	struct buffer_head **wbuf = journal->j_fc_wbuf + journal->j_fc_off -
+				    num_blks;
+	int write_op = WRITE_SYNC;
+	int i, err = 0;
+
+	for (i = 0; i < num_blks - 1; i++)
+		jbd2_fc_submit_buf(wbuf[i], WRITE_SYNC);
+	for (i = 0; i < num_blks - 1; i++) {
+		wait_on_buffer(wbuf[i]);
+		if (unlikely(!buffer_uptodate(wbuf[i])))
+			err = -EIO;
+	}
+
+	if (journal->j_flags & JBD2_BARRIER) {
+		if (journal->j_fs_dev != journal->j_dev)
+			blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+		write_op = WRITE_FLUSH_FUA;
+	}
+	if (!err) {
+		jbd2_fc_submit_buf(wbuf[num_blks - 1], write_op);
+		wait_on_buffer(wbuf[num_blks - 1]);
+		if (unlikely(!buffer_uptodate(wbuf[num_blks - 1])))
+			err = -EIO;
+	}
+
+	for (i = 0; i < num_blks; i++) {
+		put_bh(wbuf[i]);
+		wbuf[i] = NULL;
+	}
+	return err;
+}
+EXPORT_SYMBOL(jbd2_fc_write_bufs);
+
+/**
+ * void jbd2_fc_release_bufs() - give up on a fast commit
+ * @journal: Journal to act on.
+ * @num_blks: Number of blocks the fast commit got from jbd2_fc_get_buf().
+ *
+ * Returns the blocks to the fast commit area without writing them.
+ */
+void jbd2_fc_release_bufs(journal_t *journal, int num_blks)
+{
+	struct buffer_head **wbuf = journal->j_fc_wbuf + journal->j_fc_off -
+				    num_blks;
+	int i;
+
+	for (i = 0; i < num_blks; i++) {
+		put_bh(wbuf[i]);
+		wbuf[i] = NULL;
+	}
+	journal->j_fc_off -= num_blks;
+}
+EXPORT_SYMBOL(jbd2_fc_release_bufs);
+
+/**
+ * struct buffer_head *jbd2_fc_read_buf() - read a block of the fast commit area
+ * @journal: Journal to act on.
+ * @off: Block number within the area.
+ *
+ * For the filesystem to find its fast commits after recovery.
+ */
+struct buffer_head *jbd2_fc_read_buf(journal_t *journal, unsigned long off)
+{
+	unsigned long long pblock;
+
+	if (journal->j_fc_first + off >= journal->j_fc_last)
+		return NULL;
+	if (jbd2_journal_bmap(journal, journal->j_fc_first + off, &pblock))
+		return NULL;
+	return __bread(journal->j_dev, pblock, journal->j_blocksize);
+}
+EXPORT_SYMBOL(jbd2_fc_read_buf);
+
 /*
  * Log buffer allocation routines:
  */
@@ -858,6 +1070,9 @@ int jbd2_journal_get_log_tail(journal_t *journal, tid_t *tid,
 	if (transaction) {
 		*tid = transaction->t_tid;
 		*block = transaction->t_log_start;
+	} else if ((transaction = journal->j_finishing_transaction) != NULL) {
+		*tid = transaction->t_tid;
+		*block = transaction->t_log_start;
 	} else if ((transaction = journal->j_committing_transaction) != NULL) {
 		*tid = transaction->t_tid;
 		*block = transaction->t_log_start;
@@ -952,6 +1167,34 @@ static void *jbd2_seq_info_next(struct seq_file *seq, void *v, loff_t *pos)
 	return NULL;
 }
 
+/* Commit latency histogram, the buckets between the first and last used */
+static void jbd2_seq_commit_hist_show(struct seq_file *seq,
+				      struct transaction_stats_s *stats)
+{
+	int first, last, i;
+
+	for (first = 0; first < JBD2_COMMIT_HIST_BUCKETS; first++)
+		if (stats->ts_commit_hist[first])
+			break;
+	for (last = JBD2_COMMIT_HIST_BUCKETS - 1; last > first; last--)
+		if (stats->ts_commit_hist[last])
+			break;
+	if (first == JBD2_COMMIT_HIST_BUCKETS)
+		return;
+
+	seq_puts(seq, "commit latency:\n");
+	for (i = first; i <= last; i++) {
+		unsigned long lo = i ? 1UL << (i - 1) : 0;
+
+		if (i == JBD2_COMMIT_HIST_BUCKETS - 1)
+			seq_printf(seq, "  %8lu+         us %lu\n", lo,
+				   stats->ts_commit_hist[i]);
+		else
+			seq_printf(seq, "  %8lu-%-8lu us %lu\n", lo,
+				   1UL << i, stats->ts_commit_hist[i]);
+	}
+}
+
 static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 {
 	struct jbd2_stats_proc_session *s = seq->private;
@@ -986,6 +1229,9 @@ static int jbd2_seq_info_show(struct seq_file *seq, void *v)
 	    s->stats->run.rs_blocks / s->stats->ts_tid);
 	seq_printf(seq, "  %lu logged blocks per transaction\n",
 	    s->stats->run.rs_blocks_logged / s->stats->ts_tid);
+	seq_printf(seq, "%lu commits overlapped with the previous one\n",
+		   s->stats->ts_overlapped);
+	jbd2_seq_commit_hist_show(seq, s->stats);
 	return 0;
 }
 
@@ -1089,6 +1335,9 @@ static journal_t * journal_init_common (void)
 	init_waitqueue_head(&journal->j_wait_commit);
 	init_waitqueue_head(&journal->j_wait_updates);
 	init_waitqueue_head(&journal->j_wait_reserved);
+	init_waitqueue_head(&journal->j_fc_wait);
+	init_waitqueue_head(&journal->j_wait_checkpoint);
+	init_waitqueue_head(&journal->j_wait_checkpoint_done);
 	mutex_init(&journal->j_barrier);
 	mutex_init(&journal->j_checkpoint_mutex);
 	spin_lock_init(&journal->j_revoke_lock);
@@ -1281,10 +1530,27 @@ static void journal_fail_superblock (journal_t *journal)
  * subsequent use.
  */
 
+/*
+ * The fast commit area, if the journal has one, is carved off the end of
+ * the log.
+ */
+static void journal_init_fc_area(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+
+	journal->j_fc_last = be32_to_cpu(sb->s_maxlen);
+	journal->j_fc_first = journal->j_fc_last;
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FC_AREA))
+		journal->j_fc_first -= be32_to_cpu(sb->s_fc_area_blks);
+	journal->j_last = journal->j_fc_first;
+}
+
 static int journal_reset(journal_t *journal)
 {
 	journal_superblock_t *sb = journal->j_superblock;
 	unsigned long long first, last;
+	int err;
 
 	first = be32_to_cpu(sb->s_first);
 	last = be32_to_cpu(sb->s_maxlen);
@@ -1296,7 +1562,8 @@ static int journal_reset(journal_t *journal)
 	}
 
 	journal->j_first = first;
-	journal->j_last = last;
+	journal_init_fc_area(journal);
+	last = journal->j_last;
 
 	journal->j_head = first;
 	journal->j_tail = first;
@@ -1307,6 +1574,8 @@ static int journal_reset(journal_t *journal)
 	journal->j_commit_request = journal->j_commit_sequence;
 
 	journal->j_max_transaction_buffers = journal->j_maxlen / 4;
+	/* Start checkpointing with room for two more full transactions */
+	journal->j_checkpoint_low_wm = 2 * journal->j_max_transaction_buffers;
 
 	/*
 	 * As a special case, if the on-disk copy is already marked as needing
@@ -1335,7 +1604,12 @@ static int journal_reset(journal_t *journal)
 						WRITE_FUA);
 		mutex_unlock(&journal->j_checkpoint_mutex);
 	}
-	return jbd2_journal_start_thread(journal);
+	err = jbd2_journal_start_thread(journal);
+	if (err)
+		return err;
+	/* Without it we checkpoint synchronously, as we always did */
+	jbd2_checkpoint_start_thread(journal);
+	return 0;
 }
 
 static int jbd2_write_superblock(journal_t *journal, int write_op)
@@ -1539,6 +1813,17 @@ static int journal_get_superblock(journal_t *journal)
 		goto out;
 	}
 
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FC_AREA) &&
+	    (be32_to_cpu(sb->s_fc_area_blks) == 0 ||
+	     be32_to_cpu(sb->s_first) + JBD2_MIN_JOURNAL_BLOCKS +
+	     be32_to_cpu(sb->s_fc_area_blks) > journal->j_maxlen)) {
+		printk(KERN_WARNING
+			"JBD2: Invalid fast commit area size: %u\n",
+			be32_to_cpu(sb->s_fc_area_blks));
+		goto out;
+	}
+
 	if (jbd2_journal_has_csum_v2or3(journal) &&
 	    JBD2_HAS_COMPAT_FEATURE(journal, JBD2_FEATURE_COMPAT_CHECKSUM)) {
 		/* Can't have checksum v1 and v2 on at the same time! */
@@ -1610,7 +1895,7 @@ static int load_superblock(journal_t *journal)
 	journal->j_tail_sequence = be32_to_cpu(sb->s_sequence);
 	journal->j_tail = be32_to_cpu(sb->s_start);
 	journal->j_first = be32_to_cpu(sb->s_first);
-	journal->j_last = be32_to_cpu(sb->s_maxlen);
+	journal_init_fc_area(journal);
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
 	return 0;
@@ -1676,6 +1961,8 @@ int jbd2_journal_load(journal_t *journal)
 
 	journal->j_flags &= ~JBD2_ABORT;
 	journal->j_flags |= JBD2_LOADED;
+	if (JBD2_HAS_INCOMPAT_FEATURE(journal, JBD2_FEATURE_INCOMPAT_FC_AREA))
+		journal->j_flags |= JBD2_FC_REPLAY_PENDING;
 	return 0;
 
 recovery_error:
@@ -1683,6 +1970,82 @@ recovery_error:
 	return -EIO;
 }
 
+/**
+ * int jbd2_fc_init() - set up fast commits
+ * @journal: Journal to act on.
+ * @num_fc_blks: Size of the fast commit area, if the journal has none yet.
+ *
+ * A journal without a fast commit area only gets one while its log is
+ * empty, as it is right after jbd2_journal_load().  The superblock is
+ * written before returning, so that recovery knows about the area before
+ * any fast commit can depend on it.  jbd2_journal_destroy() removes the
+ * area again, since a cleanly shut down journal has nothing in it to
+ * replay, unless the owner never got to replay what the area holds.
+ */
+int jbd2_fc_init(journal_t *journal, unsigned int num_fc_blks)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	struct buffer_head **wbuf;
+	int err = 0;
+
+	if (journal->j_format_version < 2)
+		return -EINVAL;
+
+	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FC_AREA)) {
+		if (journal->j_last - journal->j_first <
+		    JBD2_MIN_JOURNAL_BLOCKS + num_fc_blks)
+			return -ENOSPC;
+
+		mutex_lock(&journal->j_checkpoint_mutex);
+		write_lock(&journal->j_state_lock);
+		if (journal->j_running_transaction ||
+		    journal->j_committing_transaction ||
+		    journal->j_head != journal->j_tail ||
+		    journal->j_head >= journal->j_last - num_fc_blks) {
+			write_unlock(&journal->j_state_lock);
+			mutex_unlock(&journal->j_checkpoint_mutex);
+			return -EBUSY;
+		}
+		sb->s_fc_area_blks = cpu_to_be32(num_fc_blks);
+		sb->s_feature_incompat |=
+			cpu_to_be32(JBD2_FEATURE_INCOMPAT_FC_AREA);
+		journal_init_fc_area(journal);
+		journal->j_free = journal->j_last - journal->j_first;
+		write_unlock(&journal->j_state_lock);
+		err = jbd2_write_superblock(journal, WRITE_FUA);
+		mutex_unlock(&journal->j_checkpoint_mutex);
+		if (err)
+			return err;
+	}
+
+	if (journal->j_fc_wbuf)
+		return 0;
+	wbuf = kcalloc(journal->j_fc_last - journal->j_fc_first,
+		       sizeof(struct buffer_head *), GFP_KERNEL);
+	if (!wbuf)
+		return -ENOMEM;
+	journal->j_fc_wbuf = wbuf;
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_init);
+
+/**
+ * void jbd2_fc_replay_done() - the fast commit area may be discarded
+ * @journal: Journal to act on.
+ *
+ * Fast commits are replayed by the journal's owner after jbd2_journal_load().
+ * Until it says it is done with them, jbd2_journal_destroy() leaves them
+ * where the next mount can find them.
+ */
+void jbd2_fc_replay_done(journal_t *journal)
+{
+	write_lock(&journal->j_state_lock);
+	journal->j_flags &= ~JBD2_FC_REPLAY_PENDING;
+	write_unlock(&journal->j_state_lock);
+}
+EXPORT_SYMBOL(jbd2_fc_replay_done);
+
 /**
  * void jbd2_journal_destroy() - Release a journal_t structure.
  * @journal: Journal to act on.
@@ -1695,6 +2058,9 @@ int jbd2_journal_destroy(journal_t *journal)
 {
 	int err = 0;
 
+	/* Checkpoint rounds may wait for commits, stop them first */
+	jbd2_checkpoint_stop_thread(journal);
+
 	/* Wait for the commit thread to wake up and die. */
 	journal_kill_thread(journal);
 
@@ -1730,14 +2096,37 @@ int jbd2_journal_destroy(journal_t *journal)
 
 	if (journal->j_sb_buffer) {
 		if (!is_journal_aborted(journal)) {
+			bool keep_fc;
+
 			mutex_lock(&journal->j_checkpoint_mutex);
 
+			/*
+			 * Fast commits nobody replayed yet, e.g. when the
+			 * mount failed, are for the transaction after the
+			 * recovered ones.  Keep its number and the area, as
+			 * long as no transaction has taken that number.
+			 */
 			write_lock(&journal->j_state_lock);
-			journal->j_tail_sequence =
-				++journal->j_transaction_sequence;
+			keep_fc = (journal->j_flags & JBD2_FC_REPLAY_PENDING) &&
+				  journal->j_transaction_sequence ==
+				  journal->j_tail_sequence;
+			if (!keep_fc)
+				journal->j_tail_sequence =
+					++journal->j_transaction_sequence;
 			write_unlock(&journal->j_state_lock);
 
 			jbd2_mark_journal_empty(journal, WRITE_FLUSH_FUA);
+
+			/* Nothing to replay, the fast commit area can go */
+			if (!keep_fc && JBD2_HAS_INCOMPAT_FEATURE(journal,
+					JBD2_FEATURE_INCOMPAT_FC_AREA)) {
+				journal_superblock_t *sb = journal->j_superblock;
+
+				sb->s_feature_incompat &= ~cpu_to_be32(
+					JBD2_FEATURE_INCOMPAT_FC_AREA);
+				sb->s_fc_area_blks = 0;
+				jbd2_write_superblock(journal, WRITE_FUA);
+			}
 			mutex_unlock(&journal->j_checkpoint_mutex);
 		} else
 			err = -EIO;
@@ -1753,6 +2142,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_chksum_driver)
 		crypto_free_shash(journal->j_chksum_driver);
 	kfree(journal->j_wbuf);
+	kfree(journal->j_fc_wbuf);
 	kfree(journal);
 
 	return err;
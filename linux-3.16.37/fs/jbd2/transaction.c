@@ -832,11 +832,13 @@ repeat:
 		if (jh->b_transaction) {
 			J_ASSERT_JH(jh,
 				jh->b_transaction == transaction ||
-				jh->b_transaction ==
-					journal->j_committing_transaction);
+				jbd2_transaction_committing(journal,
+							jh->b_transaction));
 			if (jh->b_next_transaction)
 				J_ASSERT_JH(jh, jh->b_next_transaction ==
-							transaction);
+							transaction ||
+					jbd2_transaction_committing(journal,
+						jh->b_next_transaction));
 			warn_dirty_buffer(bh);
 		}
 		/*
@@ -866,6 +868,21 @@ repeat:
 	    jh->b_next_transaction == transaction)
 		goto done;
 
+	/*
+	 * With two commits in flight, the buffer may still belong to the
+	 * finishing transaction and already be claimed by the committing
+	 * one.  It can't be claimed a second time: wait for the older commit
+	 * to refile it to the newer one.
+	 */
+	if (jh->b_next_transaction) {
+		tid_t tid = jh->b_transaction->t_tid;
+
+		JBUFFER_TRACE(jh, "claimed by committing transaction: wait");
+		jbd_unlock_bh_state(bh);
+		jbd2_log_wait_commit(journal, tid);
+		goto repeat;
+	}
+
 	/*
 	 * this is the first time this transaction is touching this buffer,
 	 * reset the modified flag
@@ -888,8 +905,8 @@ repeat:
 	if (jh->b_transaction && jh->b_transaction != transaction) {
 		JBUFFER_TRACE(jh, "owned by older transaction");
 		J_ASSERT_JH(jh, jh->b_next_transaction == NULL);
-		J_ASSERT_JH(jh, jh->b_transaction ==
-					journal->j_committing_transaction);
+		J_ASSERT_JH(jh, jbd2_transaction_committing(journal,
+							jh->b_transaction));
 
 		/* There is one case we have to be very careful about.
 		 * If the committing transaction is currently writing
@@ -1068,12 +1085,22 @@ int jbd2_journal_get_create_access(handle_t *handle, struct buffer_head *bh)
 	 * that case: the transaction must have deleted the buffer for it to be
 	 * reused here.
 	 */
+repeat:
 	jbd_lock_bh_state(bh);
 	J_ASSERT_JH(jh, (jh->b_transaction == transaction ||
 		jh->b_transaction == NULL ||
-		(jh->b_transaction == journal->j_committing_transaction &&
+		(jbd2_transaction_committing(journal, jh->b_transaction) &&
 			  jh->b_jlist == BJ_Forget)));
 
+	/* Claimed by the committing transaction, see do_get_write_access() */
+	if (jh->b_next_transaction && jh->b_next_transaction != transaction) {
+		tid_t tid = jh->b_transaction->t_tid;
+
+		jbd_unlock_bh_state(bh);
+		jbd2_log_wait_commit(journal, tid);
+		goto repeat;
+	}
+
 	J_ASSERT_JH(jh, jh->b_next_transaction == NULL);
 	J_ASSERT_JH(jh, buffer_locked(jh2bh(jh)));
 
@@ -1093,7 +1120,7 @@ int jbd2_journal_get_create_access(handle_t *handle, struct buffer_head *bh)
 		JBUFFER_TRACE(jh, "file as BJ_Reserved");
 		spin_lock(&journal->j_list_lock);
 		__jbd2_journal_file_buffer(jh, transaction, BJ_Reserved);
-	} else if (jh->b_transaction == journal->j_committing_transaction) {
+	} else if (jbd2_transaction_committing(journal, jh->b_transaction)) {
 		/* first access by this transaction */
 		jh->b_modified = 0;
 
@@ -1331,8 +1358,8 @@ int jbd2_journal_dirty_metadata(handle_t *handle, struct buffer_head *bh)
 	 */
 	if (jh->b_transaction != transaction) {
 		JBUFFER_TRACE(jh, "already on other transaction");
-		if (unlikely(((jh->b_transaction !=
-			       journal->j_committing_transaction)) ||
+		if (unlikely(!jbd2_transaction_committing(journal,
+							jh->b_transaction) ||
 			     (jh->b_next_transaction != transaction))) {
 			printk(KERN_ERR "jbd2_journal_dirty_metadata: %s: "
 			       "bad jh for block %llu: "
@@ -1472,16 +1499,16 @@ int jbd2_journal_forget (handle_t *handle, struct buffer_head *bh)
 		}
 		spin_unlock(&journal->j_list_lock);
 	} else if (jh->b_transaction) {
-		J_ASSERT_JH(jh, (jh->b_transaction ==
-				 journal->j_committing_transaction));
+		J_ASSERT_JH(jh, jbd2_transaction_committing(journal,
+							jh->b_transaction));
 		/* However, if the buffer is still owned by a prior
 		 * (committing) transaction, we can't drop it yet... */
 		JBUFFER_TRACE(jh, "belongs to older transaction");
 		/* ... but we CAN drop it from the new transaction if we
-		 * have also modified it since the original commit. */
+		 * have also modified it since the original commit.  A
+		 * claim by a commit still in flight stays. */
 
-		if (jh->b_next_transaction) {
-			J_ASSERT(jh->b_next_transaction == transaction);
+		if (jh->b_next_transaction == transaction) {
 			spin_lock(&journal->j_list_lock);
 			jh->b_next_transaction = NULL;
 			spin_unlock(&journal->j_list_lock);
@@ -2098,7 +2125,7 @@ static int journal_unmap_buffer(journal_t *journal, struct buffer_head *bh,
 				goto zap_buffer;
 			}
 		}
-	} else if (transaction == journal->j_committing_transaction) {
+	} else if (jbd2_transaction_committing(journal, transaction)) {
 		JBUFFER_TRACE(jh, "on committing transaction");
 		/*
 		 * The buffer is committing, we simply cannot touch
@@ -2117,9 +2144,12 @@ static int journal_unmap_buffer(journal_t *journal, struct buffer_head *bh,
 		 * j_next_transaction to the running transaction (if there is
 		 * one) and mark buffer as freed so that commit code knows it
 		 * should clear dirty bits when it is done with the buffer.
+		 * If the finishing transaction's buffer is already claimed by
+		 * the committing one, that claim stays.
 		 */
 		set_buffer_freed(bh);
-		if (journal->j_running_transaction && buffer_jbddirty(bh))
+		if (journal->j_running_transaction && buffer_jbddirty(bh) &&
+		    !jh->b_next_transaction)
 			jh->b_next_transaction = journal->j_running_transaction;
 		jbd2_journal_put_journal_head(jh);
 		spin_unlock(&journal->j_list_lock);
@@ -2355,7 +2385,9 @@ void __jbd2_journal_refile_buffer(struct journal_head *jh)
 	else
 		jlist = BJ_Reserved;
 	__jbd2_journal_file_buffer(jh, jh->b_transaction, jlist);
-	J_ASSERT_JH(jh, jh->b_transaction->t_state == T_RUNNING);
+	/* A committing transaction logs what it gets from the finishing one */
+	J_ASSERT_JH(jh, jh->b_transaction->t_state == T_RUNNING ||
+			jh->b_transaction->t_state == T_COMMIT);
 
 	if (was_dirty)
 		set_buffer_jbddirty(bh);
@@ -2414,7 +2446,7 @@ int jbd2_journal_file_inode(handle_t *handle, struct jbd2_inode *jinode)
 		return 0;
 
 	spin_lock(&journal->j_list_lock);
-
+retry:
 	if (jinode->i_transaction == transaction ||
 	    jinode->i_next_transaction == transaction)
 		goto done;
@@ -2427,11 +2459,23 @@ int jbd2_journal_file_inode(handle_t *handle, struct jbd2_inode *jinode)
 	if (!transaction->t_need_data_flush)
 		transaction->t_need_data_flush = 1;
 	/* On some different transaction's list - should be
-	 * the committing one */
+	 * a committing one */
 	if (jinode->i_transaction) {
-		J_ASSERT(jinode->i_next_transaction == NULL);
-		J_ASSERT(jinode->i_transaction ==
-					journal->j_committing_transaction);
+		/*
+		 * Already claimed by the committing transaction while the
+		 * finishing one still has it: wait for the older commit to
+		 * refile it.
+		 */
+		if (jinode->i_next_transaction) {
+			tid_t tid = jinode->i_transaction->t_tid;
+
+			spin_unlock(&journal->j_list_lock);
+			jbd2_log_wait_commit(journal, tid);
+			spin_lock(&journal->j_list_lock);
+			goto retry;
+		}
+		J_ASSERT(jbd2_transaction_committing(journal,
+						     jinode->i_transaction));
 		jinode->i_next_transaction = transaction;
 		goto done;
 	}
@@ -2469,7 +2513,7 @@ int jbd2_journal_begin_ordered_truncate(journal_t *journal,
 					struct jbd2_inode *jinode,
 					loff_t new_size)
 {
-	transaction_t *inode_trans, *commit_trans;
+	int committing;
 	int ret = 0;
 
 	/* This is a quick check to avoid locking if not necessary */
@@ -2479,12 +2523,12 @@ int jbd2_journal_begin_ordered_truncate(journal_t *journal,
 	 * enough that the transaction was not committing before we started
 	 * a transaction adding the inode to orphan list */
 	read_lock(&journal->j_state_lock);
-	commit_trans = journal->j_committing_transaction;
-	read_unlock(&journal->j_state_lock);
 	spin_lock(&journal->j_list_lock);
-	inode_trans = jinode->i_transaction;
+	committing = jbd2_transaction_committing(journal,
+						 jinode->i_transaction);
 	spin_unlock(&journal->j_list_lock);
-	if (inode_trans == commit_trans) {
+	read_unlock(&journal->j_state_lock);
+	if (committing) {
 		ret = filemap_fdatawrite_range(jinode->i_vfs_inode->i_mapping,
 			new_size, LLONG_MAX);
 		if (ret)
@@ -35,6 +35,7 @@
 #include <linux/fs_struct.h>
 #include <linux/posix_acl.h>
 #include <linux/hash.h>
+#include <linux/path_cache.h>
 #include <asm/uaccess.h>
 
 #include "internal.h"
@@ -1778,14 +1779,22 @@ static int link_path_walk(const char *name, struct nameidata *nd)
 		long len;
 		int type;
 
-		err = may_lookup(nd);
- 		if (err)
-			break;
-
 		len = hash_name(name, &this.hash);
 		this.name = name;
 		this.len = len;
 
+		/*
+		 * Get the hash chain on its way in while we check permissions;
+		 * ->d_hash() may change the hash, and mustn't be called before
+		 * may_lookup().
+		 */
+		if (!(nd->path.dentry->d_flags & DCACHE_OP_HASH))
+			d_prefetch_hash(nd->path.dentry, &this);
+
+		err = may_lookup(nd);
+ 		if (err)
+			break;
+
 		type = LAST_NORM;
 		if (name[0] == '.') switch (len) {
 			case 2:
@@ -2018,15 +2027,25 @@ static int path_lookupat(int dfd, const char *name,
 static int filename_lookup(int dfd, struct filename *name,
 				unsigned int flags, struct nameidata *nd)
 {
-	int retval = path_lookupat(dfd, name->name, flags | LOOKUP_RCU, nd);
+	struct path_cache_snapshot snap;
+	int retval;
+
+	if (path_cache_lookup(name->name, flags, nd, &snap)) {
+		audit_inode(name, nd->path.dentry, 0);
+		return 0;
+	}
+
+	retval = path_lookupat(dfd, name->name, flags | LOOKUP_RCU, nd);
 	if (unlikely(retval == -ECHILD))
 		retval = path_lookupat(dfd, name->name, flags, nd);
 	if (unlikely(retval == -ESTALE))
 		retval = path_lookupat(dfd, name->name,
 						flags | LOOKUP_REVAL, nd);
 
-	if (likely(!retval))
+	if (likely(!retval)) {
+		path_cache_insert(name->name, flags, nd, &snap);
 		audit_inode(name, nd->path.dentry, flags & LOOKUP_PARENT);
+	}
 	return retval;
 }
 
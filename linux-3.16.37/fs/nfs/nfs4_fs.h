@@ -260,6 +260,10 @@ extern int nfs4_set_rw_stateid(nfs4_stateid *stateid,
 		const struct nfs_open_context *ctx,
 		const struct nfs_lock_context *l_ctx,
 		fmode_t fmode);
+#if defined(CONFIG_NFS_V4_2)
+extern ssize_t nfs42_proc_copy(struct file *src, loff_t pos_src,
+		struct file *dst, loff_t pos_dst, size_t count);
+#endif
 
 #if defined(CONFIG_NFS_V4_1)
 static inline struct nfs4_session *nfs4_get_session(const struct nfs_server *server)
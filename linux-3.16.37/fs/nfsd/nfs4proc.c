@@ -778,7 +778,8 @@ nfsd4_read(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 
 	/* check stateid */
 	if ((status = nfs4_preprocess_stateid_op(SVC_NET(rqstp),
-						 cstate, &read->rd_stateid,
+						 cstate, &cstate->current_fh,
+						 &read->rd_stateid,
 						 RD_STATE, &read->rd_filp))) {
 		dprintk("NFSD: nfsd4_read: couldn't process stateid!\n");
 		goto out;
@@ -925,7 +926,8 @@ nfsd4_setattr(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 
 	if (setattr->sa_iattr.ia_valid & ATTR_SIZE) {
 		status = nfs4_preprocess_stateid_op(SVC_NET(rqstp), cstate,
-			&setattr->sa_stateid, WR_STATE, NULL);
+			&cstate->current_fh, &setattr->sa_stateid,
+			WR_STATE, NULL);
 		if (status) {
 			dprintk("NFSD: nfsd4_setattr: couldn't process stateid!\n");
 			return status;
@@ -991,8 +993,9 @@ nfsd4_write(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 	if (write->wr_offset >= OFFSET_MAX)
 		return nfserr_inval;
 
-	status = nfs4_preprocess_stateid_op(SVC_NET(rqstp),
-					cstate, stateid, WR_STATE, &filp);
+	status = nfs4_preprocess_stateid_op(SVC_NET(rqstp), cstate,
+					&cstate->current_fh, stateid,
+					WR_STATE, &filp);
 	if (status) {
 		dprintk("NFSD: nfsd4_write: couldn't process stateid!\n");
 		return status;
@@ -1016,6 +1019,92 @@ nfsd4_write(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
 	return status;
 }
 
+static __be32
+nfsd4_copy_get_file(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
+		    struct svc_fh *fhp, stateid_t *stateid, int flags,
+		    struct file **filp)
+{
+	__be32 status;
+
+	status = nfs4_preprocess_stateid_op(SVC_NET(rqstp), cstate, fhp,
+					    stateid, flags, filp);
+	if (status)
+		return status;
+	/* special stateids don't come with an open file */
+	if (!*filp)
+		status = nfsd_open(rqstp, fhp, S_IFREG,
+				   flags == RD_STATE ? NFSD_MAY_READ :
+				   NFSD_MAY_WRITE, filp);
+	return status;
+}
+
+/*
+ * Intra-server copy from the file in the saved filehandle to the one in the
+ * current filehandle.  The copy is always done synchronously and may be
+ * short; the client issues another COPY for whatever is left.
+ */
+static __be32
+nfsd4_copy(struct svc_rqst *rqstp, struct nfsd4_compound_state *cstate,
+	   struct nfsd4_copy *copy)
+{
+	struct file *src = NULL, *dst = NULL;
+	ssize_t bytes;
+	__be32 status;
+
+	if (!cstate->save_fh.fh_dentry)
+		return nfserr_nofilehandle;
+	if (copy->cp_src_pos >= OFFSET_MAX || copy->cp_dst_pos >= OFFSET_MAX)
+		return nfserr_inval;
+
+	status = nfsd4_copy_get_file(rqstp, cstate, &cstate->save_fh,
+				     &copy->cp_src_stateid, RD_STATE, &src);
+	if (status) {
+		dprintk("NFSD: nfsd4_copy: couldn't process src stateid!\n");
+		return status;
+	}
+	status = nfsd4_copy_get_file(rqstp, cstate, &cstate->current_fh,
+				     &copy->cp_dst_stateid, WR_STATE, &dst);
+	if (status) {
+		dprintk("NFSD: nfsd4_copy: couldn't process dst stateid!\n");
+		goto out;
+	}
+
+	/* fix up for NFS-specific error code */
+	status = nfserr_wrong_type;
+	if (!S_ISREG(file_inode(src)->i_mode) ||
+	    !S_ISREG(file_inode(dst)->i_mode))
+		goto out;
+
+	bytes = nfsd_copy_file_range(src, copy->cp_src_pos, dst,
+				     copy->cp_dst_pos, copy->cp_count);
+	if (bytes < 0) {
+		status = nfserrno(bytes);
+		goto out;
+	}
+
+	copy->cp_bytes_written = bytes;
+	copy->cp_stable_how = NFS_UNSTABLE;
+	if (bytes && EX_ISSYNC(cstate->current_fh.fh_export)) {
+		int err = vfs_fsync_range(dst, copy->cp_dst_pos,
+					  copy->cp_dst_pos + bytes - 1, 0);
+		if (err) {
+			status = nfserrno(err);
+			goto out;
+		}
+		copy->cp_stable_how = NFS_FILE_SYNC;
+	}
+	copy->cp_consecutive = 1;
+	copy->cp_synchronous = 1;
+	gen_boot_verifier(&copy->cp_verifier, SVC_NET(rqstp));
+	status = nfs_ok;
+out:
+	if (dst)
+		fput(dst);
+	if (src)
+		fput(src);
+	return status;
+}
+
 /* This routine never returns NFS_OK!  If there are no other errors, it
  * will return NFSERR_SAME or NFSERR_NOT_SAME depending on whether the
  * attributes matched.  VERIFY is implemented by mapping NFSERR_SAME
@@ -1577,6 +1666,14 @@ static inline u32 nfsd4_write_rsize(struct svc_rqst *rqstp, struct nfsd4_op *op)
 	return (op_encode_hdr_size + 2 + op_encode_verifier_maxsz) * sizeof(__be32);
 }
 
+static inline u32 nfsd4_copy_rsize(struct svc_rqst *rqstp, struct nfsd4_op *op)
+{
+	return (op_encode_hdr_size + 1 /* wr_callback */ +
+		2 /* wr_count */ + 1 /* wr_committed */ +
+		op_encode_verifier_maxsz +
+		1 /* cr_consecutive */ + 1 /* cr_synchronous */) * sizeof(__be32);
+}
+
 static inline u32 nfsd4_exchange_id_rsize(struct svc_rqst *rqstp, struct nfsd4_op *op)
 {
 	return (op_encode_hdr_size + 2 + 1 + /* eir_clientid, eir_sequenceid */\
@@ -1894,6 +1991,14 @@ static struct nfsd4_operation nfsd4_ops[] = {
 		.op_get_currentstateid = (stateid_getter)nfsd4_get_freestateid,
 		.op_rsize_bop = (nfsd4op_rsize)nfsd4_only_status_rsize,
 	},
+
+	/* NFSv4.2 operations */
+	[OP_COPY] = {
+		.op_func = (nfsd4op_func)nfsd4_copy,
+		.op_flags = OP_MODIFIES_SOMETHING | OP_CACHEME,
+		.op_name = "OP_COPY",
+		.op_rsize_bop = (nfsd4op_rsize)nfsd4_copy_rsize,
+	},
 };
 
 int nfsd4_max_reply(struct svc_rqst *rqstp, struct nfsd4_op *op)
@@ -3732,16 +3732,17 @@ static __be32 nfsd4_lookup_stateid(stateid_t *stateid, unsigned char typemask,
 }
 
 /*
-* Checks for stateid operations
+* Checks for stateid operations on the file @current_fh, normally
+* &cstate->current_fh, but COPY also checks the source in cstate->save_fh
 */
 __be32
 nfs4_preprocess_stateid_op(struct net *net, struct nfsd4_compound_state *cstate,
-			   stateid_t *stateid, int flags, struct file **filpp)
+			   struct svc_fh *current_fh, stateid_t *stateid,
+			   int flags, struct file **filpp)
 {
 	struct nfs4_stid *s;
 	struct nfs4_ol_stateid *stp = NULL;
 	struct nfs4_delegation *dp = NULL;
-	struct svc_fh *current_fh = &cstate->current_fh;
 	struct inode *ino = current_fh->fh_dentry->d_inode;
 	struct nfsd_net *nn = net_generic(net, nfsd_net_id);
 	struct file *file = NULL;
@@ -1059,6 +1059,20 @@ out:
 	return err;
 }
 
+/*
+ * Copy a range of one file to another for NFSv4.2 COPY.  The copy is done
+ * synchronously by vfs_copy_file_range(), so it is capped at a few MB per
+ * call to keep an nfsd thread from being tied up by one huge request; the
+ * client simply sends another COPY for the rest.
+ */
+ssize_t
+nfsd_copy_file_range(struct file *src, u64 src_pos, struct file *dst,
+		     u64 dst_pos, u64 count)
+{
+	return vfs_copy_file_range(src, src_pos, dst, dst_pos,
+				   min_t(u64, count, NFSD_MAX_COPY_CHUNK), 0);
+}
+
 #ifdef CONFIG_NFSD_V3
 /*
  * Commit all pending writes to stable storage.
@@ -33,6 +33,9 @@
 #define NFSD_MAY_CREATE		(NFSD_MAY_EXEC|NFSD_MAY_WRITE)
 #define NFSD_MAY_REMOVE		(NFSD_MAY_EXEC|NFSD_MAY_WRITE|NFSD_MAY_TRUNC)
 
+/* Largest range a single NFSv4.2 COPY copies before returning */
+#define NFSD_MAX_COPY_CHUNK	(4 * 1024 * 1024)
+
 /*
  * Callback function for readdir
  */
@@ -82,6 +85,8 @@ __be32 		nfsd_read(struct svc_rqst *, struct svc_fh *,
 				loff_t, struct kvec *, int, unsigned long *);
 __be32 		nfsd_write(struct svc_rqst *, struct svc_fh *,struct file *,
 				loff_t, struct kvec *,int, unsigned long *, int *);
+ssize_t		nfsd_copy_file_range(struct file *, u64, struct file *,
+				u64, u64);
 __be32		nfsd_readlink(struct svc_rqst *, struct svc_fh *,
 				char *, int *);
 __be32		nfsd_symlink(struct svc_rqst *, struct svc_fh *,
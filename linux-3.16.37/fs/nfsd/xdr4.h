@@ -427,6 +427,20 @@ struct nfsd4_reclaim_complete {
 	u32 rca_one_fs;
 };
 
+struct nfsd4_copy {
+	stateid_t	cp_src_stateid;     /* request */
+	stateid_t	cp_dst_stateid;     /* request */
+	u64		cp_src_pos;         /* request */
+	u64		cp_dst_pos;         /* request */
+	u64		cp_count;           /* request */
+	u32		cp_consecutive;     /* request */
+	u32		cp_synchronous;     /* request */
+
+	u64		cp_bytes_written;   /* response */
+	u32		cp_stable_how;      /* response */
+	nfs4_verifier	cp_verifier;        /* response */
+};
+
 struct nfsd4_op {
 	int					opnum;
 	__be32					status;
@@ -472,6 +486,9 @@ struct nfsd4_op {
 		struct nfsd4_reclaim_complete	reclaim_complete;
 		struct nfsd4_test_stateid	test_stateid;
 		struct nfsd4_free_stateid	free_stateid;
+
+		/* NFSv4.2 */
+		struct nfsd4_copy		copy;
 	} u;
 	struct nfs4_replay *			replay;
 };
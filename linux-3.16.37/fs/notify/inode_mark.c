@@ -240,19 +240,17 @@ out:
 	return ret;
 }
 
-/**
- * fsnotify_unmount_inodes - an sb is unmounting.  handle any watched inodes.
- * @list: list of inodes being unmounted (sb->s_inodes)
- *
- * Called during unmount with no locks held, so needs to be safe against
- * concurrent modifiers. We temporarily drop inode_sb_list_lock and CAN block.
+/*
+ * Handle the watched inodes on one of the per-CPU sb->s_inodes lists.  We
+ * temporarily drop the list lock and CAN block.
  */
-void fsnotify_unmount_inodes(struct list_head *list)
+static void fsnotify_unmount_inode_list(struct pcpu_list_head *head)
 {
+	struct list_head *list = &head->list;
 	struct inode *inode, *next_i, *need_iput = NULL;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry_safe(inode, next_i, list, i_sb_list) {
+	spin_lock(&head->lock);
+	list_for_each_entry_safe(inode, next_i, list, i_sb_list.list) {
 		struct inode *need_iput_tmp;
 
 		/*
@@ -288,7 +286,7 @@ void fsnotify_unmount_inodes(struct list_head *list)
 		spin_unlock(&inode->i_lock);
 
 		/* In case the dropping of a reference would nuke next_i. */
-		while (&next_i->i_sb_list != list) {
+		while (&next_i->i_sb_list.list != list) {
 			spin_lock(&next_i->i_lock);
 			if (!(next_i->i_state & (I_FREEING | I_WILL_FREE)) &&
 						atomic_read(&next_i->i_count)) {
@@ -298,17 +296,17 @@ void fsnotify_unmount_inodes(struct list_head *list)
 				break;
 			}
 			spin_unlock(&next_i->i_lock);
-			next_i = list_entry(next_i->i_sb_list.next,
-						struct inode, i_sb_list);
+			next_i = list_entry(next_i->i_sb_list.list.next,
+						struct inode, i_sb_list.list);
 		}
 
 		/*
-		 * We can safely drop inode_sb_list_lock here because either
+		 * We can safely drop the list lock here because either
 		 * we actually hold references on both inode and next_i or
 		 * end of list.  Also no new inodes will be added since the
 		 * umount has begun.
 		 */
-		spin_unlock(&inode_sb_list_lock);
+		spin_unlock(&head->lock);
 
 		if (need_iput_tmp)
 			iput(need_iput_tmp);
@@ -320,7 +318,22 @@ void fsnotify_unmount_inodes(struct list_head *list)
 
 		iput(inode);
 
-		spin_lock(&inode_sb_list_lock);
+		spin_lock(&head->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
+	spin_unlock(&head->lock);
+}
+
+/**
+ * fsnotify_unmount_inodes - an sb is unmounting.  handle any watched inodes.
+ * @sb: superblock being unmounted
+ *
+ * Called during unmount with no locks held, so needs to be safe against
+ * concurrent modifiers.
+ */
+void fsnotify_unmount_inodes(struct super_block *sb)
+{
+	struct pcpu_list_head *head;
+
+	pcpu_list_for_each_head(head, &sb->s_inodes)
+		fsnotify_unmount_inode_list(head);
 }
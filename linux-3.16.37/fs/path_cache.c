@@ -0,0 +1,407 @@
+/*
+ * fs/path_cache.c
+ *
+ * Per-task cache of resolved absolute path names.
+ *
+ * Tools that resolve the same deep paths over and over (build systems
+ * stat'ing include directories, for one) pay for a full component by
+ * component walk every time.  Each task that has fs.path-cache enabled
+ * keeps the last few paths it resolved, without holding references, and
+ * hands out the cached result if nothing the walk depended on can have
+ * changed since:
+ *
+ *  - renames are caught by rename_lock, (u)mounts by mount_lock;
+ *  - the dentries on a cached path are marked DCACHE_PATH_CACHED, and
+ *    unhashing or turning negative a marked dentry bumps path_cache_gen,
+ *    which also guarantees that a cached dentry hasn't been freed;
+ *  - the cache is flushed when the task's credentials change, and every
+ *    hit checks MAY_EXEC on the directories the walk went through again,
+ *    so that changed modes, ACLs or LSM policy take effect at once;
+ *  - the root the name was resolved against must still be fs->root.
+ *
+ * Only absolute names without "." and ".." components are cached, and
+ * only if the walk followed no symlinks and went through no dentries that
+ * need revalidation.  The result is then the end of a d_parent chain (and
+ * mountpoints) leading back to the root, which is what gets marked.
+ */
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/cred.h>
+#include <linux/fs.h>
+#include <linux/fs_struct.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/percpu.h>
+#include <linux/sysctl.h>
+#include <linux/path_cache.h>
+#include "mount.h"
+
+#define PATH_CACHE_ENTRIES	8
+#define PATH_CACHE_NAME_MAX	240
+
+/* Only plain lookups of existing objects are cached */
+#define PATH_CACHE_FLAGS	(LOOKUP_FOLLOW | LOOKUP_DIRECTORY | \
+				 LOOKUP_AUTOMOUNT)
+
+struct path_cache_entry {
+	struct path	path;		/* result, no references held */
+	struct path	root;		/* fs->root it was resolved from */
+	unsigned int	gen;
+	unsigned	r_seq, m_seq, d_seq;
+	unsigned int	flags;
+	unsigned int	hash;
+	unsigned int	len;		/* 0 for an unused entry */
+	char		name[PATH_CACHE_NAME_MAX];
+};
+
+struct path_cache {
+	const struct cred	*cred;	/* the entries were resolved with */
+	unsigned int		next;	/* entry to replace next */
+	struct path_cache_entry	entries[PATH_CACHE_ENTRIES];
+};
+
+int sysctl_path_cache __read_mostly;
+atomic_t path_cache_gen = ATOMIC_INIT(0);
+EXPORT_SYMBOL_GPL(path_cache_gen);
+
+struct path_cache_stat_t path_cache_stat;
+
+static DEFINE_PER_CPU(long, path_cache_hits);
+static DEFINE_PER_CPU(long, path_cache_misses);
+static DEFINE_PER_CPU(long, path_cache_stale);
+static DEFINE_PER_CPU(long, path_cache_inserts);
+
+static long path_cache_sum(long __percpu *counter)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += *per_cpu_ptr(counter, i);
+	return sum;
+}
+
+int proc_path_cache_state(struct ctl_table *table, int write,
+			  void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	path_cache_stat.hits = path_cache_sum(&path_cache_hits);
+	path_cache_stat.misses = path_cache_sum(&path_cache_misses);
+	path_cache_stat.stale = path_cache_sum(&path_cache_stale);
+	path_cache_stat.inserts = path_cache_sum(&path_cache_inserts);
+	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
+}
+
+/* Length of @name if it may be cached, 0 otherwise */
+static unsigned int path_cache_name_len(const char *name)
+{
+	const char *p = name;
+
+	if (*p != '/')
+		return 0;
+
+	for (; *p; p++) {
+		if (p - name >= PATH_CACHE_NAME_MAX - 1)
+			return 0;
+		if (p[0] != '/' || p[1] != '.')
+			continue;
+		if (!p[2] || p[2] == '/')
+			return 0;
+		if (p[2] == '.' && (!p[3] || p[3] == '/'))
+			return 0;
+	}
+	return p - name;
+}
+
+static void path_cache_flush(struct path_cache *pc)
+{
+	int i;
+
+	for (i = 0; i < PATH_CACHE_ENTRIES; i++)
+		pc->entries[i].len = 0;
+	if (pc->cred)
+		put_cred(pc->cred);
+	pc->cred = NULL;
+}
+
+static void path_cache_root(struct path *root)
+{
+	struct fs_struct *fs = current->fs;
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&fs->seq);
+		*root = fs->root;
+	} while (read_seqcount_retry(&fs->seq, seq));
+}
+
+/*
+ * Check that the walk that resolved @path from @root could still look up
+ * each component in its directory, the way may_lookup() did.  A component
+ * at a mount root was looked up in the mount root, not in the directory
+ * it is mounted on.  Called under rcu_read_lock() with @path referenced,
+ * which pins the d_parent chain; the mounts were checked with mount_lock.
+ */
+static bool path_cache_may_walk(const struct path *path,
+				const struct path *root)
+{
+	struct dentry *dentry = path->dentry;
+	struct vfsmount *vfsmnt = path->mnt;
+	struct mount *mnt = real_mount(vfsmnt);
+	struct inode *inode;
+
+	for (;;) {
+		while (dentry == vfsmnt->mnt_root &&
+		       (dentry != root->dentry || vfsmnt != root->mnt)) {
+			struct mount *parent = ACCESS_ONCE(mnt->mnt_parent);
+
+			if (mnt == parent)
+				return false;
+			dentry = ACCESS_ONCE(mnt->mnt_mountpoint);
+			mnt = parent;
+			vfsmnt = &mnt->mnt;
+		}
+		if (dentry == root->dentry && vfsmnt == root->mnt)
+			return true;
+
+		dentry = ACCESS_ONCE(dentry->d_parent);
+		inode = ACCESS_ONCE(dentry->d_inode);
+		if (!inode || inode_permission(inode, MAY_EXEC | MAY_NOT_BLOCK))
+			return false;
+	}
+}
+
+/*
+ * Take references on a cached result, if it is still valid.
+ */
+static bool path_cache_get(struct path_cache_entry *e,
+			   struct path_cache_snapshot *snap)
+{
+	struct dentry *dentry = e->path.dentry;
+	struct path root;
+
+	if (e->gen != snap->gen || e->r_seq != snap->r_seq ||
+	    e->m_seq != snap->m_seq)
+		return false;
+
+	path_cache_root(&root);
+	if (!path_equal(&root, &e->root))
+		return false;
+
+	rcu_read_lock();
+	/*
+	 * As long as path_cache_gen hasn't moved, the dentry hasn't been
+	 * unhashed, so it can't have been freed either.
+	 */
+	if (atomic_read(&path_cache_gen) != e->gen ||
+	    !legitimize_mnt(e->path.mnt, e->m_seq)) {
+		rcu_read_unlock();
+		return false;
+	}
+	if (!lockref_get_not_dead(&dentry->d_lockref)) {
+		rcu_read_unlock();
+		mntput(e->path.mnt);
+		return false;
+	}
+
+	smp_rmb();
+	if (read_seqcount_retry(&dentry->d_seq, e->d_seq) ||
+	    atomic_read(&path_cache_gen) != e->gen ||
+	    read_seqretry(&rename_lock, e->r_seq) ||
+	    !path_cache_may_walk(&e->path, &e->root)) {
+		rcu_read_unlock();
+		path_put(&e->path);
+		return false;
+	}
+	rcu_read_unlock();
+	return true;
+}
+
+/**
+ * path_cache_lookup - look up a name in the current task's path cache
+ * @name:	name being resolved
+ * @flags:	LOOKUP_* flags of the lookup
+ * @nd:		nameidata to fill in on a hit
+ * @snap:	filled in for path_cache_insert() on a miss
+ *
+ * Returns true with @nd->path referenced on a hit.
+ */
+bool path_cache_lookup(const char *name, unsigned int flags,
+		       struct nameidata *nd, struct path_cache_snapshot *snap)
+{
+	struct path_cache *pc = current->path_cache;
+	struct path_cache_entry *e;
+	unsigned int hash;
+	int i;
+
+	snap->len = 0;
+	if (!sysctl_path_cache || (flags & ~PATH_CACHE_FLAGS) || !current->fs)
+		return false;
+
+	snap->len = path_cache_name_len(name);
+	if (!snap->len)
+		return false;
+
+	/*
+	 * A walk done from here on is checked against these before being
+	 * cached, and cached entries against the current values.
+	 */
+	snap->gen = atomic_read(&path_cache_gen);
+	smp_rmb();
+	snap->r_seq = read_seqbegin(&rename_lock);
+	snap->m_seq = read_seqbegin(&mount_lock);
+	snap->fs_seq = read_seqcount_begin(&current->fs->seq);
+
+	if (!pc || pc->cred != current_cred())
+		goto miss;
+
+	hash = full_name_hash((const unsigned char *)name, snap->len);
+	for (i = 0; i < PATH_CACHE_ENTRIES; i++) {
+		e = &pc->entries[i];
+		if (e->len == snap->len && e->hash == hash &&
+		    e->flags == flags && !memcmp(e->name, name, e->len))
+			goto found;
+	}
+miss:
+	this_cpu_inc(path_cache_misses);
+	return false;
+
+found:
+	if (!path_cache_get(e, snap)) {
+		e->len = 0;
+		this_cpu_inc(path_cache_stale);
+		return false;
+	}
+
+	nd->path = e->path;
+	nd->inode = e->path.dentry->d_inode;
+	nd->flags = flags;
+	nd->last_type = LAST_NORM;
+	nd->root.mnt = NULL;
+	this_cpu_inc(path_cache_hits);
+	return true;
+}
+
+static bool path_cache_mark_dentry(struct dentry *dentry)
+{
+	bool ret = false;
+
+	spin_lock(&dentry->d_lock);
+	if (!d_unhashed(dentry) &&
+	    !(dentry->d_flags & (DCACHE_OP_REVALIDATE |
+				 DCACHE_OP_WEAK_REVALIDATE))) {
+		dentry->d_flags |= DCACHE_PATH_CACHED;
+		ret = true;
+	}
+	spin_unlock(&dentry->d_lock);
+	return ret;
+}
+
+/*
+ * Mark the dentries from @path up to @root, crossing mountpoints the way
+ * prepend_path() does.  The caller holds a reference on @path, which pins
+ * the d_parent chain; the mount topology is rechecked with mount_lock.
+ */
+static bool path_cache_mark(const struct path *path, const struct path *root)
+{
+	struct dentry *dentry = path->dentry;
+	struct vfsmount *vfsmnt = path->mnt;
+	struct mount *mnt = real_mount(vfsmnt);
+	bool ret = true;
+
+	if (dentry->d_flags & DCACHE_OP_WEAK_REVALIDATE)
+		return false;
+
+	rcu_read_lock();
+	while (dentry != root->dentry || vfsmnt != root->mnt) {
+		if (dentry == vfsmnt->mnt_root || IS_ROOT(dentry)) {
+			struct mount *parent = ACCESS_ONCE(mnt->mnt_parent);
+
+			/* Global root, or not under @root at all */
+			if (mnt == parent || dentry != vfsmnt->mnt_root) {
+				ret = false;
+				break;
+			}
+			dentry = ACCESS_ONCE(mnt->mnt_mountpoint);
+			mnt = parent;
+			vfsmnt = &mnt->mnt;
+			continue;
+		}
+		if (!path_cache_mark_dentry(dentry)) {
+			ret = false;
+			break;
+		}
+		dentry = dentry->d_parent;
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+/**
+ * path_cache_insert - remember the result of a successful walk
+ * @name:	name that was resolved
+ * @flags:	LOOKUP_* flags of the lookup
+ * @nd:		nameidata holding the result
+ * @snap:	as filled in by path_cache_lookup() before the walk
+ */
+void path_cache_insert(const char *name, unsigned int flags,
+		       struct nameidata *nd, struct path_cache_snapshot *snap)
+{
+	struct path_cache *pc = current->path_cache;
+	struct path_cache_entry *e;
+	struct path root;
+	unsigned d_seq;
+
+	/* Symlinks aren't on the d_parent chain, so we can't track them */
+	if (!snap->len || current->total_link_count)
+		return;
+
+	if (!pc) {
+		pc = kzalloc(sizeof(*pc), GFP_KERNEL);
+		if (!pc)
+			return;
+		current->path_cache = pc;
+	}
+	if (pc->cred != current_cred()) {
+		path_cache_flush(pc);
+		pc->cred = get_current_cred();
+	}
+
+	path_cache_root(&root);
+	d_seq = raw_seqcount_begin(&nd->path.dentry->d_seq);
+	if (!path_cache_mark(&nd->path, &root))
+		return;
+
+	/* Did anything change under the walk? */
+	smp_mb();
+	if (atomic_read(&path_cache_gen) != snap->gen ||
+	    read_seqretry(&rename_lock, snap->r_seq) ||
+	    read_seqretry(&mount_lock, snap->m_seq) ||
+	    read_seqcount_retry(&current->fs->seq, snap->fs_seq))
+		return;
+
+	e = &pc->entries[pc->next++ % PATH_CACHE_ENTRIES];
+	e->path = nd->path;
+	e->root = root;
+	e->gen = snap->gen;
+	e->r_seq = snap->r_seq;
+	e->m_seq = snap->m_seq;
+	e->d_seq = d_seq;
+	e->flags = flags;
+	e->hash = full_name_hash((const unsigned char *)name, snap->len);
+	e->len = snap->len;
+	memcpy(e->name, name, snap->len);
+	this_cpu_inc(path_cache_inserts);
+}
+
+void exit_path_cache(struct task_struct *tsk)
+{
+	struct path_cache *pc = tsk->path_cache;
+
+	if (!pc)
+		return;
+
+	tsk->path_cache = NULL;
+	path_cache_flush(pc);
+	kfree(pc);
+}
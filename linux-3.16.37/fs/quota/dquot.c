@@ -915,42 +915,45 @@ static int dqinit_needed(struct inode *inode, int type)
 static void add_dquot_ref(struct super_block *sb, int type)
 {
 	struct inode *inode, *old_inode = NULL;
+	struct pcpu_list_head *head;
 #ifdef CONFIG_QUOTA_DEBUG
 	int reserved = 0;
 #endif
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
-		spin_lock(&inode->i_lock);
-		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
-		    !atomic_read(&inode->i_writecount) ||
-		    !dqinit_needed(inode, type)) {
+	pcpu_list_for_each_head(head, &sb->s_inodes) {
+		spin_lock(&head->lock);
+		list_for_each_entry(inode, &head->list, i_sb_list.list) {
+			spin_lock(&inode->i_lock);
+			if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
+			    !atomic_read(&inode->i_writecount) ||
+			    !dqinit_needed(inode, type)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+			__iget(inode);
 			spin_unlock(&inode->i_lock);
-			continue;
-		}
-		__iget(inode);
-		spin_unlock(&inode->i_lock);
-		spin_unlock(&inode_sb_list_lock);
+			spin_unlock(&head->lock);
 
 #ifdef CONFIG_QUOTA_DEBUG
-		if (unlikely(inode_get_rsv_space(inode) > 0))
-			reserved = 1;
+			if (unlikely(inode_get_rsv_space(inode) > 0))
+				reserved = 1;
 #endif
-		iput(old_inode);
-		__dquot_initialize(inode, type);
+			iput(old_inode);
+			__dquot_initialize(inode, type);
 
-		/*
-		 * We hold a reference to 'inode' so it couldn't have been
-		 * removed from s_inodes list while we dropped the
-		 * inode_sb_list_lock We cannot iput the inode now as we can be
-		 * holding the last reference and we cannot iput it under
-		 * inode_sb_list_lock. So we keep the reference and iput it
-		 * later.
-		 */
-		old_inode = inode;
-		spin_lock(&inode_sb_list_lock);
+			/*
+			 * We hold a reference to 'inode' so it couldn't have
+			 * been removed from its s_inodes list while we dropped
+			 * the list lock. We cannot iput the inode now as we
+			 * can be holding the last reference and we cannot iput
+			 * it under the list lock. So we keep the reference and
+			 * iput it later.
+			 */
+			old_inode = inode;
+			spin_lock(&head->lock);
+		}
+		spin_unlock(&head->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 	iput(old_inode);
 
 #ifdef CONFIG_QUOTA_DEBUG
@@ -1028,24 +1031,27 @@ static void put_dquot_list(struct list_head *tofree_head)
 static void remove_dquot_ref(struct super_block *sb, int type,
 		struct list_head *tofree_head)
 {
+	struct pcpu_list_head *head;
 	struct inode *inode;
 	int reserved = 0;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
-		/*
-		 *  We have to scan also I_NEW inodes because they can already
-		 *  have quota pointer initialized. Luckily, we need to touch
-		 *  only quota pointers and these have separate locking
-		 *  (dqptr_sem).
-		 */
-		if (!IS_NOQUOTA(inode)) {
-			if (unlikely(inode_get_rsv_space(inode) > 0))
-				reserved = 1;
-			remove_inode_dquot_ref(inode, type, tofree_head);
+	pcpu_list_for_each_head(head, &sb->s_inodes) {
+		spin_lock(&head->lock);
+		list_for_each_entry(inode, &head->list, i_sb_list.list) {
+			/*
+			 *  We have to scan also I_NEW inodes because they can
+			 *  already have quota pointer initialized. Luckily, we
+			 *  need to touch only quota pointers and these have
+			 *  separate locking (dqptr_sem).
+			 */
+			if (!IS_NOQUOTA(inode)) {
+				if (unlikely(inode_get_rsv_space(inode) > 0))
+					reserved = 1;
+				remove_inode_dquot_ref(inode, type, tofree_head);
+			}
 		}
+		spin_unlock(&head->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 #ifdef CONFIG_QUOTA_DEBUG
 	if (reserved) {
 		printk(KERN_WARNING "VFS (%s): Writes happened after quota"
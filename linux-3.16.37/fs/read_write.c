@@ -17,6 +17,7 @@
 #include <linux/pagemap.h>
 #include <linux/splice.h>
 #include <linux/compat.h>
+#include <linux/mount.h>
 #include "internal.h"
 
 #include <asm/uaccess.h>
@@ -650,8 +651,32 @@ unsigned long iov_shorten(struct iovec *iov, unsigned long nr_segs, size_t to)
 }
 EXPORT_SYMBOL(iov_shorten);
 
+/**
+ * kiocb_set_rw_flags - apply per-call RWF_* flags to a read request
+ * @kiocb:	request, its ki_filp must be set
+ * @flags:	RWF_* flags from preadv2(), aio or io_uring
+ *
+ * Only reads take flags for now.  RWF_NOWAIT needs a file whose
+ * ->read_iter() knows about IOCB_NOWAIT, which the filesystem advertises
+ * by setting FMODE_NOWAIT at open time.
+ */
+int kiocb_set_rw_flags(struct kiocb *kiocb, int flags)
+{
+	if (unlikely(flags & ~RWF_SUPPORTED))
+		return -EOPNOTSUPP;
+
+	if (flags & RWF_NOWAIT) {
+		if (!(kiocb->ki_filp->f_mode & FMODE_NOWAIT))
+			return -EOPNOTSUPP;
+		kiocb->ki_flags |= IOCB_NOWAIT;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(kiocb_set_rw_flags);
+
 static ssize_t do_iter_readv_writev(struct file *filp, int rw, const struct iovec *iov,
-		unsigned long nr_segs, size_t len, loff_t *ppos, iter_fn_t fn)
+		unsigned long nr_segs, size_t len, loff_t *ppos, iter_fn_t fn,
+		int flags)
 {
 	struct kiocb kiocb;
 	struct iov_iter iter;
@@ -660,6 +685,9 @@ static ssize_t do_iter_readv_writev(struct file *filp, int rw, const struct iove
 	init_sync_kiocb(&kiocb, filp);
 	kiocb.ki_pos = *ppos;
 	kiocb.ki_nbytes = len;
+	ret = kiocb_set_rw_flags(&kiocb, flags);
+	if (ret)
+		return ret;
 
 	iov_iter_init(&iter, rw, iov, nr_segs, len);
 	ret = fn(&kiocb, &iter);
@@ -798,7 +826,7 @@ out:
 
 static ssize_t do_readv_writev(int type, struct file *file,
 			       const struct iovec __user * uvector,
-			       unsigned long nr_segs, loff_t *pos)
+			       unsigned long nr_segs, loff_t *pos, int flags)
 {
 	size_t tot_len;
 	struct iovec iovstack[UIO_FASTIOV];
@@ -818,6 +846,12 @@ static ssize_t do_readv_writev(int type, struct file *file,
 	if (ret < 0)
 		goto out;
 
+	/* Only ->read_iter() knows what to do with the flags */
+	if (flags && (type != READ || !file->f_op->read_iter)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
 	fnv = NULL;
 	if (type == READ) {
 		fn = file->f_op->read;
@@ -832,7 +866,7 @@ static ssize_t do_readv_writev(int type, struct file *file,
 
 	if (iter_fn)
 		ret = do_iter_readv_writev(file, type, iov, nr_segs, tot_len,
-						pos, iter_fn);
+						pos, iter_fn, flags);
 	else if (fnv)
 		ret = do_sync_readv_writev(file, iov, nr_segs, tot_len,
 						pos, fnv);
@@ -854,15 +888,23 @@ out:
 	return ret;
 }
 
-ssize_t vfs_readv(struct file *file, const struct iovec __user *vec,
-		  unsigned long vlen, loff_t *pos)
+ssize_t vfs_readv_flags(struct file *file, const struct iovec __user *vec,
+			unsigned long vlen, loff_t *pos, int flags)
 {
 	if (!(file->f_mode & FMODE_READ))
 		return -EBADF;
 	if (!(file->f_mode & FMODE_CAN_READ))
 		return -EINVAL;
 
-	return do_readv_writev(READ, file, vec, vlen, pos);
+	return do_readv_writev(READ, file, vec, vlen, pos, flags);
+}
+
+EXPORT_SYMBOL(vfs_readv_flags);
+
+ssize_t vfs_readv(struct file *file, const struct iovec __user *vec,
+		  unsigned long vlen, loff_t *pos)
+{
+	return vfs_readv_flags(file, vec, vlen, pos, 0);
 }
 
 EXPORT_SYMBOL(vfs_readv);
@@ -875,7 +917,7 @@ ssize_t vfs_writev(struct file *file, const struct iovec __user *vec,
 	if (!(file->f_mode & FMODE_CAN_WRITE))
 		return -EINVAL;
 
-	return do_readv_writev(WRITE, file, vec, vlen, pos);
+	return do_readv_writev(WRITE, file, vec, vlen, pos, 0);
 }
 
 EXPORT_SYMBOL(vfs_writev);
@@ -950,6 +992,47 @@ SYSCALL_DEFINE5(preadv, unsigned long, fd, const struct iovec __user *, vec,
 	return ret;
 }
 
+/*
+ * preadv() with RWF_* flags.  An offset of -1 reads at, and advances, the
+ * file position like readv().
+ */
+SYSCALL_DEFINE6(preadv2, unsigned long, fd, const struct iovec __user *, vec,
+		unsigned long, vlen, unsigned long, pos_l, unsigned long, pos_h,
+		int, flags)
+{
+	loff_t pos = pos_from_hilo(pos_h, pos_l);
+	struct fd f;
+	ssize_t ret = -EBADF;
+
+	if (pos == -1) {
+		f = fdget_pos(fd);
+		if (f.file) {
+			pos = file_pos_read(f.file);
+			ret = vfs_readv_flags(f.file, vec, vlen, &pos, flags);
+			if (ret >= 0)
+				file_pos_write(f.file, pos);
+			fdput_pos(f);
+		}
+	} else {
+		if (pos < 0)
+			return -EINVAL;
+
+		f = fdget(fd);
+		if (f.file) {
+			ret = -ESPIPE;
+			if (f.file->f_mode & FMODE_PREAD)
+				ret = vfs_readv_flags(f.file, vec, vlen, &pos,
+						      flags);
+			fdput(f);
+		}
+	}
+
+	if (ret > 0)
+		add_rchar(current, ret);
+	inc_syscr(current);
+	return ret;
+}
+
 SYSCALL_DEFINE5(pwritev, unsigned long, fd, const struct iovec __user *, vec,
 		unsigned long, vlen, unsigned long, pos_l, unsigned long, pos_h)
 {
@@ -978,7 +1061,7 @@ SYSCALL_DEFINE5(pwritev, unsigned long, fd, const struct iovec __user *, vec,
 
 static ssize_t compat_do_readv_writev(int type, struct file *file,
 			       const struct compat_iovec __user *uvector,
-			       unsigned long nr_segs, loff_t *pos)
+			       unsigned long nr_segs, loff_t *pos, int flags)
 {
 	compat_ssize_t tot_len;
 	struct iovec iovstack[UIO_FASTIOV];
@@ -998,6 +1081,12 @@ static ssize_t compat_do_readv_writev(int type, struct file *file,
 	if (ret < 0)
 		goto out;
 
+	/* Only ->read_iter() knows what to do with the flags */
+	if (flags && (type != READ || !file->f_op->read_iter)) {
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
 	fnv = NULL;
 	if (type == READ) {
 		fn = file->f_op->read;
@@ -1012,7 +1101,7 @@ static ssize_t compat_do_readv_writev(int type, struct file *file,
 
 	if (iter_fn)
 		ret = do_iter_readv_writev(file, type, iov, nr_segs, tot_len,
-						pos, iter_fn);
+						pos, iter_fn, flags);
 	else if (fnv)
 		ret = do_sync_readv_writev(file, iov, nr_segs, tot_len,
 						pos, fnv);
@@ -1036,7 +1125,7 @@ out:
 
 static size_t compat_readv(struct file *file,
 			   const struct compat_iovec __user *vec,
-			   unsigned long vlen, loff_t *pos)
+			   unsigned long vlen, loff_t *pos, int flags)
 {
 	ssize_t ret = -EBADF;
 
@@ -1047,7 +1136,7 @@ static size_t compat_readv(struct file *file,
 	if (!(file->f_mode & FMODE_CAN_READ))
 		goto out;
 
-	ret = compat_do_readv_writev(READ, file, vec, vlen, pos);
+	ret = compat_do_readv_writev(READ, file, vec, vlen, pos, flags);
 
 out:
 	if (ret > 0)
@@ -1067,7 +1156,7 @@ COMPAT_SYSCALL_DEFINE3(readv, compat_ulong_t, fd,
 	if (!f.file)
 		return -EBADF;
 	pos = f.file->f_pos;
-	ret = compat_readv(f.file, vec, vlen, &pos);
+	ret = compat_readv(f.file, vec, vlen, &pos, 0);
 	if (ret >= 0)
 		f.file->f_pos = pos;
 	fdput_pos(f);
@@ -1076,7 +1165,7 @@ COMPAT_SYSCALL_DEFINE3(readv, compat_ulong_t, fd,
 
 static long __compat_sys_preadv64(unsigned long fd,
 				  const struct compat_iovec __user *vec,
-				  unsigned long vlen, loff_t pos)
+				  unsigned long vlen, loff_t pos, int flags)
 {
 	struct fd f;
 	ssize_t ret;
@@ -1088,7 +1177,7 @@ static long __compat_sys_preadv64(unsigned long fd,
 		return -EBADF;
 	ret = -ESPIPE;
 	if (f.file->f_mode & FMODE_PREAD)
-		ret = compat_readv(f.file, vec, vlen, &pos);
+		ret = compat_readv(f.file, vec, vlen, &pos, flags);
 	fdput(f);
 	return ret;
 }
@@ -1098,7 +1187,7 @@ COMPAT_SYSCALL_DEFINE4(preadv64, unsigned long, fd,
 		const struct compat_iovec __user *,vec,
 		unsigned long, vlen, loff_t, pos)
 {
-	return __compat_sys_preadv64(fd, vec, vlen, pos);
+	return __compat_sys_preadv64(fd, vec, vlen, pos, 0);
 }
 #endif
 
@@ -1108,7 +1197,29 @@ COMPAT_SYSCALL_DEFINE5(preadv, compat_ulong_t, fd,
 {
 	loff_t pos = ((loff_t)pos_high << 32) | pos_low;
 
-	return __compat_sys_preadv64(fd, vec, vlen, pos);
+	return __compat_sys_preadv64(fd, vec, vlen, pos, 0);
+}
+
+COMPAT_SYSCALL_DEFINE6(preadv2, compat_ulong_t, fd,
+		const struct compat_iovec __user *,vec,
+		compat_ulong_t, vlen, u32, pos_low, u32, pos_high, int, flags)
+{
+	loff_t pos = ((loff_t)pos_high << 32) | pos_low;
+	struct fd f;
+	ssize_t ret;
+
+	if (pos != -1)
+		return __compat_sys_preadv64(fd, vec, vlen, pos, flags);
+
+	f = fdget_pos(fd);
+	if (!f.file)
+		return -EBADF;
+	pos = f.file->f_pos;
+	ret = compat_readv(f.file, vec, vlen, &pos, flags);
+	if (ret >= 0)
+		f.file->f_pos = pos;
+	fdput_pos(f);
+	return ret;
 }
 
 static size_t compat_writev(struct file *file,
@@ -1124,7 +1235,7 @@ static size_t compat_writev(struct file *file,
 	if (!(file->f_mode & FMODE_CAN_WRITE))
 		goto out;
 
-	ret = compat_do_readv_writev(WRITE, file, vec, vlen, pos);
+	ret = compat_do_readv_writev(WRITE, file, vec, vlen, pos, 0);
 
 out:
 	if (ret > 0)
@@ -1364,3 +1475,370 @@ COMPAT_SYSCALL_DEFINE4(sendfile64, int, out_fd, int, in_fd,
 	return do_sendfile(out_fd, in_fd, NULL, count, 0);
 }
 #endif
+
+/**
+ * vfs_copy_file_range - copy a range of data between two files
+ * @file_in:	source file, open for reading
+ * @pos_in:	offset in @file_in to copy from
+ * @file_out:	destination file, open for writing
+ * @pos_out:	offset in @file_out to copy to
+ * @len:	number of bytes to copy
+ * @flags:	must be zero
+ *
+ * Lets the filesystem of @file_out offload the copy (a reflink on btrfs, a
+ * server side COPY on NFSv4.2) when both files live on the same superblock;
+ * a filesystem that has no ->copy_file_range but can share data gets the
+ * range cloned instead.  Falls back to moving the data through a pipe with
+ * do_splice_direct() otherwise, or when the filesystem can't offload this
+ * range.
+ * Like read and write, a single call copies at most MAX_RW_COUNT bytes and
+ * may copy less than @len.
+ *
+ * Returns the number of bytes copied or a negative errno.
+ */
+ssize_t vfs_copy_file_range(struct file *file_in, loff_t pos_in,
+			    struct file *file_out, loff_t pos_out,
+			    size_t len, unsigned int flags)
+{
+	struct inode *inode_in = file_inode(file_in);
+	struct inode *inode_out = file_inode(file_out);
+	ssize_t ret;
+
+	if (flags != 0)
+		return -EINVAL;
+
+	if (S_ISDIR(inode_in->i_mode) || S_ISDIR(inode_out->i_mode))
+		return -EISDIR;
+	if (!S_ISREG(inode_in->i_mode) || !S_ISREG(inode_out->i_mode))
+		return -EINVAL;
+
+	if (!(file_in->f_mode & FMODE_READ) ||
+	    !(file_out->f_mode & FMODE_WRITE) ||
+	    (file_out->f_flags & O_APPEND))
+		return -EBADF;
+
+	ret = rw_verify_area(READ, file_in, &pos_in, len);
+	if (ret < 0)
+		return ret;
+	len = ret;
+
+	ret = rw_verify_area(WRITE, file_out, &pos_out, len);
+	if (ret < 0)
+		return ret;
+	len = ret;
+
+	if (len == 0)
+		return 0;
+
+	/* the splice fallback would read back data it has just written */
+	if (inode_in == inode_out &&
+	    pos_in + len > pos_out && pos_out + len > pos_in)
+		return -EINVAL;
+
+	file_start_write(file_out);
+
+	/*
+	 * ->copy_file_range knows best, and clones itself where it can.
+	 * Otherwise a clone is the cheapest copy there is.
+	 */
+	ret = -EOPNOTSUPP;
+	if (inode_in->i_sb != inode_out->i_sb) {
+		/* nothing to offload */
+	} else if (file_out->f_op->copy_file_range) {
+		ret = file_out->f_op->copy_file_range(file_in, pos_in, file_out,
+						      pos_out, len, flags);
+	} else if (file_in->f_op->clone_file_range) {
+		ret = file_in->f_op->clone_file_range(file_in, pos_in,
+						      file_out, pos_out, len);
+		if (ret == 0)
+			ret = len;
+		else
+			ret = -EOPNOTSUPP;
+	}
+	if (ret == -EOPNOTSUPP)
+		ret = do_splice_direct(file_in, &pos_in, file_out, &pos_out,
+				       len, 0);
+
+	file_end_write(file_out);
+
+	if (ret > 0) {
+		fsnotify_access(file_in);
+		add_rchar(current, ret);
+		fsnotify_modify(file_out);
+		add_wchar(current, ret);
+	}
+	inc_syscr(current);
+	inc_syscw(current);
+
+	return ret;
+}
+EXPORT_SYMBOL(vfs_copy_file_range);
+
+static int clone_verify_area(struct file *file, loff_t pos, u64 len,
+			     int read_write)
+{
+	struct inode *inode = file_inode(file);
+	int retval;
+
+	if (unlikely(pos < 0 || (loff_t) (pos + len) < pos))
+		return -EINVAL;
+
+	if (unlikely(inode->i_flock && mandatory_lock(inode))) {
+		retval = locks_mandatory_area(
+			read_write == READ ? FLOCK_VERIFY_READ : FLOCK_VERIFY_WRITE,
+			inode, file, pos, len ? len : OFFSET_MAX - pos);
+		if (retval < 0)
+			return retval;
+	}
+	return security_file_permission(file,
+				read_write == READ ? MAY_READ : MAY_WRITE);
+}
+
+/**
+ * vfs_clone_file_range - share a range of data between two files
+ * @file_in:	source file, open for reading
+ * @pos_in:	offset in @file_in
+ * @file_out:	destination file, open for writing
+ * @pos_out:	offset in @file_out
+ * @len:	number of bytes, zero for everything up to the end of @file_in
+ *
+ * Makes the range of @file_out refer to the same blocks on disk as the range
+ * of @file_in, replacing what was there before.  Unlike a copy this either
+ * does the whole range or fails; the filesystem decides which alignment it
+ * needs, typically block aligned offsets and a length that is block aligned
+ * or ends at the end of @file_in.
+ *
+ * Returns 0 or a negative errno, -EOPNOTSUPP if the filesystem can't share
+ * data and -EXDEV if the files are on different mounts.
+ */
+int vfs_clone_file_range(struct file *file_in, loff_t pos_in,
+			 struct file *file_out, loff_t pos_out, u64 len)
+{
+	struct inode *inode_in = file_inode(file_in);
+	struct inode *inode_out = file_inode(file_out);
+	int ret;
+
+	if (inode_in->i_sb != inode_out->i_sb ||
+	    file_in->f_path.mnt != file_out->f_path.mnt)
+		return -EXDEV;
+
+	if (S_ISDIR(inode_in->i_mode) || S_ISDIR(inode_out->i_mode))
+		return -EISDIR;
+	if (!S_ISREG(inode_in->i_mode) || !S_ISREG(inode_out->i_mode))
+		return -EINVAL;
+
+	if (!(file_in->f_mode & FMODE_READ) ||
+	    !(file_out->f_mode & FMODE_WRITE) ||
+	    (file_out->f_flags & O_APPEND))
+		return -EBADF;
+
+	if (!file_in->f_op->clone_file_range)
+		return -EOPNOTSUPP;
+
+	ret = clone_verify_area(file_in, pos_in, len, READ);
+	if (ret)
+		return ret;
+	ret = clone_verify_area(file_out, pos_out, len, WRITE);
+	if (ret)
+		return ret;
+
+	if (pos_in + len > i_size_read(inode_in))
+		return -EINVAL;
+
+	ret = mnt_want_write_file(file_out);
+	if (ret)
+		return ret;
+
+	ret = file_in->f_op->clone_file_range(file_in, pos_in,
+					      file_out, pos_out, len);
+	if (!ret) {
+		fsnotify_access(file_in);
+		fsnotify_modify(file_out);
+	}
+
+	mnt_drop_write_file(file_out);
+	return ret;
+}
+EXPORT_SYMBOL(vfs_clone_file_range);
+
+/**
+ * vfs_dedupe_file_range - share identical data between files
+ * @file:	source file, open for reading
+ * @same:	source range and the destinations to share it with
+ *
+ * For every destination whose range has the same contents as the source
+ * range, make it refer to the blocks of the source range, leaving the data
+ * as it was.  The result of each destination is reported in its info
+ * entry: FILE_DEDUPE_RANGE_SAME and the number of bytes deduplicated,
+ * FILE_DEDUPE_RANGE_DIFFERS, or a negative errno.  Filesystems may
+ * deduplicate less than asked for in one call.
+ *
+ * Returns 0 or a negative errno for errors that concern all destinations.
+ */
+int vfs_dedupe_file_range(struct file *file, struct file_dedupe_range *same)
+{
+	struct file_dedupe_range_info *info;
+	struct inode *src = file_inode(file);
+	u64 off = same->src_offset;
+	u64 len = same->src_length;
+	bool is_admin = capable(CAP_SYS_ADMIN);
+	u16 count = same->dest_count;
+	struct file *dst_file;
+	loff_t dst_off;
+	ssize_t deduped;
+	int ret, i;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EINVAL;
+	if (same->reserved1 || same->reserved2)
+		return -EINVAL;
+
+	ret = -EISDIR;
+	if (S_ISDIR(src->i_mode))
+		goto out;
+	ret = -EINVAL;
+	if (!S_ISREG(src->i_mode))
+		goto out;
+
+	ret = clone_verify_area(file, off, len, READ);
+	if (ret < 0)
+		goto out;
+	ret = 0;
+
+	/* pre-format output fields to sane values */
+	for (i = 0; i < count; i++) {
+		same->info[i].bytes_deduped = 0ULL;
+		same->info[i].status = FILE_DEDUPE_RANGE_SAME;
+	}
+
+	for (i = 0, info = same->info; i < count; i++, info++) {
+		struct inode *dst;
+		struct fd dst_fd = fdget(info->dest_fd);
+
+		dst_file = dst_fd.file;
+		if (!dst_file) {
+			info->status = -EBADF;
+			goto next_loop;
+		}
+		dst = file_inode(dst_file);
+
+		ret = mnt_want_write_file(dst_file);
+		if (ret) {
+			info->status = ret;
+			goto next_fdput;
+		}
+
+		dst_off = info->dest_offset;
+		ret = clone_verify_area(dst_file, dst_off, len, WRITE);
+		if (ret < 0) {
+			info->status = ret;
+			goto next_file;
+		}
+		ret = 0;
+
+		if (info->reserved) {
+			info->status = -EINVAL;
+		} else if (!(is_admin || (dst_file->f_mode & FMODE_WRITE))) {
+			info->status = -EINVAL;
+		} else if (file->f_path.mnt != dst_file->f_path.mnt) {
+			info->status = -EXDEV;
+		} else if (S_ISDIR(dst->i_mode)) {
+			info->status = -EISDIR;
+		} else if (!S_ISREG(dst->i_mode)) {
+			info->status = -EINVAL;
+		} else if (!file->f_op->dedupe_file_range) {
+			info->status = -EOPNOTSUPP;
+		} else {
+			deduped = file->f_op->dedupe_file_range(file, off,
+							len, dst_file,
+							info->dest_offset);
+			if (deduped == -EBADE)
+				info->status = FILE_DEDUPE_RANGE_DIFFERS;
+			else if (deduped < 0)
+				info->status = deduped;
+			else
+				info->bytes_deduped += deduped;
+		}
+
+next_file:
+		mnt_drop_write_file(dst_file);
+next_fdput:
+		fdput(dst_fd);
+next_loop:
+		if (fatal_signal_pending(current))
+			goto out;
+	}
+
+out:
+	return ret;
+}
+EXPORT_SYMBOL(vfs_dedupe_file_range);
+
+SYSCALL_DEFINE6(copy_file_range, int, fd_in, loff_t __user *, off_in,
+		int, fd_out, loff_t __user *, off_out,
+		size_t, len, unsigned int, flags)
+{
+	loff_t pos_in;
+	loff_t pos_out;
+	struct fd f_in;
+	struct fd f_out;
+	ssize_t ret = -EBADF;
+
+	f_in = fdget(fd_in);
+	if (!f_in.file)
+		goto out2;
+
+	f_out = fdget(fd_out);
+	if (!f_out.file)
+		goto out1;
+
+	ret = -ESPIPE;
+	if (off_in) {
+		if (!(f_in.file->f_mode & FMODE_PREAD))
+			goto out;
+		ret = -EFAULT;
+		if (copy_from_user(&pos_in, off_in, sizeof(loff_t)))
+			goto out;
+	} else {
+		pos_in = f_in.file->f_pos;
+	}
+
+	ret = -ESPIPE;
+	if (off_out) {
+		if (!(f_out.file->f_mode & FMODE_PWRITE))
+			goto out;
+		ret = -EFAULT;
+		if (copy_from_user(&pos_out, off_out, sizeof(loff_t)))
+			goto out;
+	} else {
+		pos_out = f_out.file->f_pos;
+	}
+
+	ret = vfs_copy_file_range(f_in.file, pos_in, f_out.file, pos_out, len,
+				  flags);
+	if (ret > 0) {
+		pos_in += ret;
+		pos_out += ret;
+
+		if (off_in) {
+			if (copy_to_user(off_in, &pos_in, sizeof(loff_t)))
+				ret = -EFAULT;
+		} else {
+			f_in.file->f_pos = pos_in;
+		}
+
+		if (off_out) {
+			if (copy_to_user(off_out, &pos_out, sizeof(loff_t)))
+				ret = -EFAULT;
+		} else {
+			f_out.file->f_pos = pos_out;
+		}
+	}
+
+out:
+	fdput(f_out);
+out1:
+	fdput(f_in);
+out2:
+	return ret;
+}
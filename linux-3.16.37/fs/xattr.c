@@ -21,6 +21,7 @@
 #include <linux/audit.h>
 #include <linux/vmalloc.h>
 #include <linux/posix_acl_xattr.h>
+#include <linux/path_cache.h>
 
 #include <asm/uaccess.h>
 
@@ -113,6 +114,9 @@ int __vfs_setxattr_noperm(struct dentry *dentry, const char *name,
 		if (!error)
 			fsnotify_xattr(dentry);
 	}
+	/* ACLs and security labels can change who may walk through it */
+	if (!error)
+		d_path_cache_invalidate(dentry);
 
 	return error;
 }
@@ -309,6 +313,7 @@ vfs_removexattr(struct dentry *dentry, const char *name)
 	if (!error) {
 		fsnotify_xattr(dentry);
 		evm_inode_post_removexattr(dentry, name);
+		d_path_cache_invalidate(dentry);
 	}
 	return error;
 }
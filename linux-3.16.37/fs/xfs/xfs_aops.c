@@ -34,6 +34,7 @@
 #include "xfs_bmap_util.h"
 #include "xfs_bmap_btree.h"
 #include "xfs_dinode.h"
+#include "xfs_reflink.h"
 #include <linux/aio.h>
 #include <linux/gfp.h>
 #include <linux/mpage.h>
@@ -183,7 +184,8 @@ xfs_finish_ioend(
 	if (atomic_dec_and_test(&ioend->io_remaining)) {
 		struct xfs_mount	*mp = XFS_I(ioend->io_inode)->i_mount;
 
-		if (ioend->io_type == XFS_IO_UNWRITTEN)
+		if (ioend->io_type == XFS_IO_UNWRITTEN ||
+		    ioend->io_type == XFS_IO_COW)
 			queue_work(mp->m_unwritten_workqueue, &ioend->io_work);
 		else if (ioend->io_append_trans ||
 			 (ioend->io_isdirect && xfs_ioend_is_append(ioend)))
@@ -193,6 +195,67 @@ xfs_finish_ioend(
 	}
 }
 
+/*
+ * The CoW staging block a buffer of a CoW ioend was written to.
+ */
+static inline xfs_fsblock_t
+xfs_cow_buffer_fsb(
+	struct inode		*inode,
+	struct buffer_head	*bh)
+{
+	return XFS_DADDR_TO_FSB(XFS_I(inode)->i_mount,
+			(xfs_daddr_t)bh->b_blocknr <<
+			(inode->i_blkbits - BBSHIFT));
+}
+
+/*
+ * Throw away the CoW staging block of a buffer that was not written, and
+ * unmap the buffer so that the next write maps and copies the block again.
+ * If the staging block cannot be freed now, the next mount frees it.
+ */
+STATIC void
+xfs_cow_cancel_buffer(
+	struct inode		*inode,
+	struct buffer_head	*bh)
+{
+	struct xfs_mount	*mp = XFS_I(inode)->i_mount;
+
+	if (!XFS_FORCED_SHUTDOWN(mp))
+		xfs_reflink_cancel_cow(mp, xfs_cow_buffer_fsb(inode, bh));
+	clear_buffer_mapped(bh);
+}
+
+/*
+ * Move the staging blocks a CoW ioend has written into the file, each
+ * buffer in its own transaction.  If the I/O failed, or moving a block
+ * does, free the staging blocks that are left instead.
+ */
+STATIC int
+xfs_end_cow(
+	struct xfs_ioend	*ioend)
+{
+	struct inode		*inode = ioend->io_inode;
+	struct xfs_mount	*mp = XFS_I(inode)->i_mount;
+	struct buffer_head	*bh;
+	xfs_off_t		offset = ioend->io_offset;
+	int			error = 0;
+
+	if (XFS_FORCED_SHUTDOWN(mp))
+		error = EIO;
+
+	for (bh = ioend->io_buffer_head; bh; bh = bh->b_private) {
+		if (!error && !ioend->io_error)
+			error = xfs_reflink_end_cow(XFS_I(inode),
+					XFS_B_TO_FSBT(mp, offset),
+					xfs_cow_buffer_fsb(inode, bh),
+					offset + bh->b_size);
+		if (error || ioend->io_error)
+			xfs_cow_cancel_buffer(inode, bh);
+		offset += bh->b_size;
+	}
+	return error;
+}
+
 /*
  * IO write completion.
  */
@@ -204,6 +267,12 @@ xfs_end_io(
 	struct xfs_inode *ip = XFS_I(ioend->io_inode);
 	int		error = 0;
 
+	/* staging blocks have to be moved into the file or freed either way */
+	if (ioend->io_type == XFS_IO_COW) {
+		error = xfs_end_cow(ioend);
+		goto done;
+	}
+
 	if (XFS_FORCED_SHUTDOWN(ip->i_mount)) {
 		ioend->io_error = -EIO;
 		goto done;
@@ -296,7 +365,7 @@ xfs_map_blocks(
 	struct inode		*inode,
 	loff_t			offset,
 	struct xfs_bmbt_irec	*imap,
-	int			type,
+	unsigned int		*type,
 	int			nonblocking)
 {
 	struct xfs_inode	*ip = XFS_I(inode);
@@ -306,11 +375,12 @@ xfs_map_blocks(
 	int			error = 0;
 	int			bmapi_flags = XFS_BMAPI_ENTIRE;
 	int			nimaps = 1;
+	bool			cow;
 
 	if (XFS_FORCED_SHUTDOWN(mp))
 		return -XFS_ERROR(EIO);
 
-	if (type == XFS_IO_UNWRITTEN)
+	if (*type == XFS_IO_UNWRITTEN)
 		bmapi_flags |= XFS_BMAPI_IGSTATE;
 
 	if (!xfs_ilock_nowait(ip, XFS_ILOCK_SHARED)) {
@@ -334,23 +404,33 @@ xfs_map_blocks(
 	if (error)
 		return -XFS_ERROR(error);
 
-	if (type == XFS_IO_DELALLOC &&
+	if (*type == XFS_IO_DELALLOC &&
 	    (!nimaps || isnullstartblock(imap->br_startblock))) {
 		error = xfs_iomap_write_allocate(ip, offset, imap);
 		if (!error)
-			trace_xfs_map_blocks_alloc(ip, offset, count, type, imap);
+			trace_xfs_map_blocks_alloc(ip, offset, count, *type,
+						   imap);
 		return -XFS_ERROR(error);
 	}
 
+	/* a shared block is written to a staging block instead */
+	if (*type == XFS_IO_OVERWRITE && nimaps) {
+		error = xfs_iomap_write_cow(ip, offset, imap, &cow);
+		if (error)
+			return -XFS_ERROR(error);
+		if (cow)
+			*type = XFS_IO_COW;
+	}
+
 #ifdef DEBUG
-	if (type == XFS_IO_UNWRITTEN) {
+	if (*type == XFS_IO_UNWRITTEN) {
 		ASSERT(nimaps);
 		ASSERT(imap->br_startblock != HOLESTARTBLOCK);
 		ASSERT(imap->br_startblock != DELAYSTARTBLOCK);
 	}
 #endif
 	if (nimaps)
-		trace_xfs_map_blocks_found(ip, offset, count, type, imap);
+		trace_xfs_map_blocks_found(ip, offset, count, *type, imap);
 	return 0;
 }
 
@@ -560,6 +640,8 @@ xfs_cancel_ioend(
 		bh = ioend->io_buffer_head;
 		do {
 			next_bh = bh->b_private;
+			if (ioend->io_type == XFS_IO_COW)
+				xfs_cow_cancel_buffer(ioend->io_inode, bh);
 			clear_buffer_async_write(bh);
 			unlock_buffer(bh);
 		} while ((bh = next_bh) != NULL);
@@ -1126,7 +1208,7 @@ xfs_vm_writepage(
 			 * time.
 			 */
 			new_ioend = 1;
-			err = xfs_map_blocks(inode, offset, &imap, type,
+			err = xfs_map_blocks(inode, offset, &imap, &type,
 					     nonblocking);
 			if (err)
 				goto error;
@@ -1186,7 +1268,8 @@ xfs_vm_writepage(
 	 * Reserve log space if we might write beyond the on-disk inode size.
 	 */
 	err = 0;
-	if (ioend->io_type != XFS_IO_UNWRITTEN && xfs_ioend_is_append(ioend))
+	if (ioend->io_type != XFS_IO_UNWRITTEN &&
+	    ioend->io_type != XFS_IO_COW && xfs_ioend_is_append(ioend))
 		err = xfs_setfilesize_trans_alloc(ioend);
 
 	xfs_submit_ioend(wbc, iohead, err);
@@ -4708,6 +4708,107 @@ error0:
 	return error;
 }
 
+/*
+ * Map an existing extent of the filesystem into a hole in the data fork of a
+ * file without allocating anything.  This is how a clone shares the blocks
+ * of another file; the caller has already taken the extra reference to the
+ * blocks in the refcount btree.
+ */
+int
+xfs_bmapi_remap(
+	struct xfs_trans	*tp,		/* transaction pointer */
+	struct xfs_inode	*ip,		/* incore inode */
+	xfs_fileoff_t		bno,		/* starting file offs. mapped */
+	xfs_filblks_t		len,		/* length to map in file */
+	xfs_fsblock_t		startblock,	/* filesystem block to map */
+	xfs_exntst_t		state,		/* extent state of the mapping */
+	xfs_fsblock_t		*firstblock,	/* first allocated block
+						   controls a.g. for allocs */
+	struct xfs_bmap_free	*flist)		/* i/o: list extents to free */
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
+	struct xfs_bmalloca	bma = { NULL };
+	int			eof;
+	int			error;
+
+	ASSERT(tp != NULL);
+	ASSERT(len > 0);
+	ASSERT(len <= (xfs_filblks_t)MAXEXTLEN);
+	ASSERT(!isnullstartblock(startblock));
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_EXCL));
+
+	if (unlikely(XFS_TEST_ERROR(
+	    (XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_EXTENTS &&
+	     XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_BTREE),
+	     mp, XFS_ERRTAG_BMAPIFORMAT, XFS_RANDOM_BMAPIFORMAT))) {
+		XFS_ERROR_REPORT("xfs_bmapi_remap", XFS_ERRLEVEL_LOW, mp);
+		return XFS_ERROR(EFSCORRUPTED);
+	}
+
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return XFS_ERROR(EIO);
+
+	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
+		error = xfs_iread_extents(tp, ip, XFS_DATA_FORK);
+		if (error)
+			return error;
+	}
+
+	xfs_bmap_search_extents(ip, bno, XFS_DATA_FORK, &eof, &bma.idx,
+				&bma.got, &bma.prev);
+
+	/* The caller must have punched out the range already. */
+	if (!eof && bma.got.br_startoff < bno + len) {
+		ASSERT(0);
+		return XFS_ERROR(EFSCORRUPTED);
+	}
+
+	bma.tp = tp;
+	bma.ip = ip;
+	bma.flist = flist;
+	bma.firstblock = firstblock;
+	bma.offset = bno;
+	bma.length = len;
+
+	if (XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) == XFS_DINODE_FMT_BTREE) {
+		bma.cur = xfs_bmbt_init_cursor(mp, tp, ip, XFS_DATA_FORK);
+		bma.cur->bc_private.b.firstblock = *firstblock;
+		bma.cur->bc_private.b.flist = flist;
+	}
+
+	bma.got.br_startoff = bno;
+	bma.got.br_startblock = startblock;
+	bma.got.br_blockcount = len;
+	bma.got.br_state = state;
+
+	error = xfs_bmap_add_extent_hole_real(&bma, XFS_DATA_FORK);
+	if (error)
+		goto error0;
+
+	ip->i_d.di_nblocks += len;
+	bma.logflags |= XFS_ILOG_CORE;
+	xfs_trans_mod_dquot_byino(tp, ip, XFS_TRANS_DQ_BCOUNT, (long)len);
+
+error0:
+	if ((bma.logflags & XFS_ILOG_DEXT) &&
+	    XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_EXTENTS)
+		bma.logflags &= ~XFS_ILOG_DEXT;
+	else if ((bma.logflags & XFS_ILOG_DBROOT) &&
+		 XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_BTREE)
+		bma.logflags &= ~XFS_ILOG_DBROOT;
+	if (bma.logflags)
+		xfs_trans_log_inode(tp, ip, bma.logflags);
+
+	if (bma.cur) {
+		if (!error)
+			*firstblock = bma.cur->bc_private.b.firstblock;
+		xfs_btree_del_cursor(bma.cur,
+			error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	}
+	return error;
+}
+
 /*
  * Called by xfs_bmapi to update file extent records and the btree
  * after removing space (or undoing a delayed allocation).
@@ -35,6 +35,7 @@
 #include "xfs_bmap.h"
 #include "xfs_bmap_util.h"
 #include "xfs_bmap_btree.h"
+#include "xfs_refcount.h"
 #include "xfs_rtalloc.h"
 #include "xfs_error.h"
 #include "xfs_quota.h"
@@ -43,6 +44,7 @@
 #include "xfs_icache.h"
 #include "xfs_log.h"
 #include "xfs_dinode.h"
+#include "xfs_reflink.h"
 
 /* Kernel only BMAP related definitions and functions */
 
@@ -120,7 +122,8 @@ xfs_bmap_finish(
 	efd = xfs_trans_get_efd(ntp, efi, flist->xbf_count);
 	for (free = flist->xbf_first; free != NULL; free = next) {
 		next = free->xbfi_next;
-		if ((error = xfs_free_extent(ntp, free->xbfi_startblock,
+		if ((error = xfs_refcount_free_extent(ntp,
+				free->xbfi_startblock,
 				free->xbfi_blockcount))) {
 			/*
 			 * The bmap free list will be cleaned up at a
@@ -1122,6 +1125,21 @@ xfs_zero_remaining_bytes(
 	if (endoff > XFS_ISIZE(ip))
 		endoff = XFS_ISIZE(ip);
 
+	/*
+	 * The blocks are zeroed in place below the page cache, so they must
+	 * not be shared with other files.  Unsharing goes through the page
+	 * cache, drop it again before it goes stale.
+	 */
+	if (xfs_is_reflink_inode(ip)) {
+		error = xfs_reflink_unshare_range(ip, startoff,
+						  endoff - startoff + 1);
+		if (error)
+			return error;
+		truncate_pagecache_range(VFS_I(ip),
+				round_down(startoff, PAGE_CACHE_SIZE),
+				round_up(endoff + 1, PAGE_CACHE_SIZE) - 1);
+	}
+
 	bp = xfs_buf_get_uncached(XFS_IS_REALTIME_INODE(ip) ?
 					mp->m_rtdev_targp : mp->m_ddev_targp,
 				  BTOBB(mp->m_sb.sb_blocksize), 0);
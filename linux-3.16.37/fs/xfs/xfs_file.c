@@ -38,6 +38,7 @@
 #include "xfs_trace.h"
 #include "xfs_log.h"
 #include "xfs_dinode.h"
+#include "xfs_reflink.h"
 
 #include <linux/aio.h>
 #include <linux/dcache.h>
@@ -281,8 +282,20 @@ xfs_file_read_iter(
 	 * only take lock exclusively if the page cache needs invalidation.
 	 * This allows the normal direct IO case of no page cache pages to
 	 * proceeed concurrently without serialisation.
+	 *
+	 * IOCB_NOWAIT callers only get in if the shared lock is free and
+	 * there is no page cache to invalidate.
 	 */
-	xfs_rw_ilock(ip, XFS_IOLOCK_SHARED);
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!xfs_ilock_nowait(ip, XFS_IOLOCK_SHARED))
+			return -EAGAIN;
+		if ((ioflags & IO_ISDIRECT) && inode->i_mapping->nrpages) {
+			xfs_rw_iunlock(ip, XFS_IOLOCK_SHARED);
+			return -EAGAIN;
+		}
+	} else {
+		xfs_rw_ilock(ip, XFS_IOLOCK_SHARED);
+	}
 	if ((ioflags & IO_ISDIRECT) && inode->i_mapping->nrpages) {
 		xfs_rw_iunlock(ip, XFS_IOLOCK_SHARED);
 		xfs_rw_ilock(ip, XFS_IOLOCK_EXCL);
@@ -622,7 +635,7 @@ xfs_file_dio_aio_write(
 	 * xfs_file_aio_write_checks() will relock the inode as necessary for
 	 * EOF zeroing cases and fill out the new inode size as appropriate.
 	 */
-	if (unaligned_io || mapping->nrpages)
+	if (unaligned_io || mapping->nrpages || xfs_is_reflink_inode(ip))
 		iolock = XFS_IOLOCK_EXCL;
 	else
 		iolock = XFS_IOLOCK_SHARED;
@@ -644,6 +657,17 @@ xfs_file_dio_aio_write(
 		goto out;
 	iov_iter_truncate(from, count);
 
+	/*
+	 * Direct I/O overwrites blocks in place, so blocks shared with other
+	 * files must get copies of their own first.  That goes through the
+	 * page cache, which is invalidated below.
+	 */
+	if (xfs_is_reflink_inode(ip)) {
+		ret = -xfs_reflink_unshare_range(ip, pos, count);
+		if (ret)
+			goto out;
+	}
+
 	if (mapping->nrpages) {
 		ret = filemap_write_and_wait_range(VFS_I(ip)->i_mapping,
 						    pos, -1);
@@ -870,6 +894,47 @@ out_unlock:
 	return -error;
 }
 
+STATIC int
+xfs_file_clone_range(
+	struct file	*file_in,
+	loff_t		pos_in,
+	struct file	*file_out,
+	loff_t		pos_out,
+	u64		len)
+{
+	return -xfs_reflink_remap_range(XFS_I(file_inode(file_in)), pos_in,
+					XFS_I(file_inode(file_out)), pos_out,
+					len, false);
+}
+
+/*
+ * Bound the time spent comparing data with both iolocks held, callers are
+ * expected to come back for the rest.
+ */
+#define XFS_MAX_DEDUPE_LEN	(16 * 1024 * 1024)
+
+STATIC ssize_t
+xfs_file_dedupe_range(
+	struct file	*src_file,
+	u64		loff,
+	u64		len,
+	struct file	*dst_file,
+	u64		dst_loff)
+{
+	int		error;
+
+	if (len == 0)
+		return 0;
+	if (len > XFS_MAX_DEDUPE_LEN)
+		len = XFS_MAX_DEDUPE_LEN;
+
+	error = xfs_reflink_remap_range(XFS_I(file_inode(src_file)), loff,
+					XFS_I(file_inode(dst_file)), dst_loff,
+					len, true);
+	if (error)
+		return -error;
+	return len;
+}
 
 STATIC int
 xfs_file_open(
@@ -880,6 +945,7 @@ xfs_file_open(
 		return -EFBIG;
 	if (XFS_FORCED_SHUTDOWN(XFS_M(inode->i_sb)))
 		return -EIO;
+	file->f_mode |= FMODE_NOWAIT;
 	return 0;
 }
 
@@ -1474,6 +1540,8 @@ const struct file_operations xfs_file_operations = {
 	.release	= xfs_file_release,
 	.fsync		= xfs_file_fsync,
 	.fallocate	= xfs_file_fallocate,
+	.clone_file_range = xfs_file_clone_range,
+	.dedupe_file_range = xfs_file_dedupe_range,
 };
 
 const struct file_operations xfs_dir_file_operations = {
@@ -249,15 +249,63 @@ typedef __be32 xfs_inobt_ptr_t;
 #define	XFS_FIBT_BLOCK(mp)		((xfs_agblock_t)(XFS_IBT_BLOCK(mp) + 1))
 
 /*
- * The first data block of an AG depends on whether the filesystem was formatted
- * with the finobt feature. If so, account for the finobt reserved root btree
- * block.
+ * The refcount btree root follows the inode btree roots.
  */
-#define XFS_PREALLOC_BLOCKS(mp) \
+#define	XFS_REFC_BLOCK(mp) \
 	(xfs_sb_version_hasfinobt(&((mp)->m_sb)) ? \
 	 XFS_FIBT_BLOCK(mp) + 1 : \
 	 XFS_IBT_BLOCK(mp) + 1)
 
+/*
+ * The first data block of an AG depends on whether the filesystem was formatted
+ * with the finobt and reflink features. If so, account for their reserved root
+ * btree blocks.
+ */
+#define XFS_PREALLOC_BLOCKS(mp) \
+	(xfs_sb_version_hasreflink(&((mp)->m_sb)) ? \
+	 XFS_REFC_BLOCK(mp) + 1 : \
+	 XFS_REFC_BLOCK(mp))
+
+
+/*
+ * Reference Count Btree format definitions
+ *
+ * There is a btree of shared extents per allocation group on filesystems
+ * with the reflink feature.  Extents that are not in the tree are owned by
+ * exactly one file (or are free); a record covers a range of blocks that
+ * are all mapped rc_refcount (>= 2) times.
+ */
+#define	XFS_REFC_CRC_MAGIC	0x52334643	/* 'R3FC' */
+
+typedef struct xfs_refcount_rec {
+	__be32		rc_startblock;	/* starting block number */
+	__be32		rc_blockcount;	/* count of blocks */
+	__be32		rc_refcount;	/* number of owners */
+} xfs_refcount_rec_t;
+
+typedef struct xfs_refcount_key {
+	__be32		rc_startblock;	/* starting block number */
+} xfs_refcount_key_t;
+
+typedef struct xfs_refcount_rec_incore {
+	xfs_agblock_t	rc_startblock;	/* starting block number */
+	xfs_extlen_t	rc_blockcount;	/* count of blocks */
+	__uint32_t	rc_refcount;	/* number of owners */
+} xfs_refcount_irec_t;
+
+/* btree pointer type */
+typedef __be32 xfs_refcount_ptr_t;
+
+/* refcounts are capped so that a record never overflows */
+#define	XFS_REFC_REFCOUNT_MAX	((__uint32_t)~0U)
+
+/*
+ * Blocks allocated for copy-on-write that are not mapped by the file yet
+ * have a record with a refcount of one whose start block has this bit set,
+ * which sorts them after all the records of shared blocks.
+ */
+#define	XFS_REFC_COW_START	((xfs_agblock_t)(1U << 31))
+
 
 
 /*
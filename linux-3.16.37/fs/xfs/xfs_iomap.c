@@ -29,6 +29,7 @@
 #include "xfs_bmap_btree.h"
 #include "xfs_bmap.h"
 #include "xfs_bmap_util.h"
+#include "xfs_alloc.h"
 #include "xfs_error.h"
 #include "xfs_trans.h"
 #include "xfs_trans_space.h"
@@ -39,6 +40,8 @@
 #include "xfs_dquot_item.h"
 #include "xfs_dquot.h"
 #include "xfs_dinode.h"
+#include "xfs_refcount.h"
+#include "xfs_reflink.h"
 
 
 #define XFS_WRITEIO_ALIGN(mp,off)	(((off) >> mp->m_writeio_log) \
@@ -796,6 +799,120 @@ error0:
 	return XFS_ERROR(error);
 }
 
+/*
+ * Writeback is about to overwrite the block at offset in place, and imap
+ * maps it.  If the inode shares blocks with other files, make sure that
+ * block is not shared: trim imap to end before the next shared block, or,
+ * if this block is shared, allocate a new block for the data and return a
+ * mapping of that with *cow set.  The new block is not mapped into the file
+ * here, only recorded as a CoW staging extent, so the file keeps the old
+ * data, also across a crash, until I/O completion has the new data on disk
+ * and moves the block into the file (see xfs_reflink_end_cow()).
+ */
+int
+xfs_iomap_write_cow(
+	xfs_inode_t	*ip,
+	xfs_off_t	offset,
+	xfs_bmbt_irec_t *imap,
+	bool		*cow)
+{
+	xfs_mount_t	*mp = ip->i_mount;
+	xfs_fileoff_t	offset_fsb = XFS_B_TO_FSBT(mp, offset);
+	xfs_alloc_arg_t	args;
+	xfs_bmbt_irec_t	cmap;
+	xfs_extlen_t	soff, slen;
+	xfs_trans_t	*tp;
+	int		nimaps;
+	int		error;
+	uint		resblks;
+
+	*cow = false;
+	ASSERT(imap->br_startoff <= offset_fsb);
+	ASSERT(offset_fsb < imap->br_startoff + imap->br_blockcount);
+	if (!xfs_is_reflink_inode(ip) ||
+	    imap->br_startblock == HOLESTARTBLOCK ||
+	    imap->br_startblock == DELAYSTARTBLOCK ||
+	    imap->br_state == XFS_EXT_UNWRITTEN)
+		return 0;
+
+	error = xfs_refcount_find_shared(mp, NULL,
+			imap->br_startblock + offset_fsb - imap->br_startoff,
+			imap->br_startoff + imap->br_blockcount - offset_fsb,
+			&soff, &slen);
+	if (error)
+		return XFS_ERROR(error);
+	if (!slen)
+		return 0;
+	if (soff) {
+		imap->br_blockcount = offset_fsb + soff - imap->br_startoff;
+		return 0;
+	}
+
+	resblks = 1 + XFS_REFCOUNT_SPACE_RES(mp);
+	tp = xfs_trans_alloc(mp, XFS_TRANS_STRAT_WRITE);
+	error = xfs_trans_reserve(tp, &M_RES(mp)->tr_write, resblks, 0);
+	if (error) {
+		xfs_trans_cancel(tp, 0);
+		return XFS_ERROR(error);
+	}
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+
+	/*
+	 * The page is locked, so nothing else can have written this block
+	 * since we looked, but check that it is still mapped the same way.
+	 */
+	nimaps = 1;
+	error = xfs_bmapi_read(ip, offset_fsb, 1, &cmap, &nimaps, 0);
+	if (error)
+		goto error0;
+	if (!nimaps || cmap.br_startblock !=
+			imap->br_startblock + offset_fsb - imap->br_startoff ||
+	    cmap.br_state == XFS_EXT_UNWRITTEN) {
+		error = XFS_ERROR(EAGAIN);
+		goto error0;
+	}
+
+	/* put the copy next to the block it replaces if there is room */
+	memset(&args, 0, sizeof(args));
+	args.tp = tp;
+	args.mp = mp;
+	args.fsbno = cmap.br_startblock;
+	args.type = XFS_ALLOCTYPE_START_BNO;
+	args.firstblock = NULLFSBLOCK;
+	args.total = resblks;
+	args.minlen = args.maxlen = args.prod = 1;
+	args.userdata = XFS_ALLOC_USERDATA;
+	error = xfs_alloc_vextent(&args);
+	if (error)
+		goto error0;
+	if (args.fsbno == NULLFSBLOCK) {
+		error = XFS_ERROR(ENOSPC);
+		goto error0;
+	}
+	ASSERT(args.len == 1);
+
+	error = xfs_refcount_alloc_cow_extent(tp, args.fsbno, 1);
+	if (error)
+		goto error0;
+
+	error = xfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	if (error)
+		return XFS_ERROR(error);
+
+	imap->br_startoff = offset_fsb;
+	imap->br_startblock = args.fsbno;
+	imap->br_blockcount = 1;
+	imap->br_state = XFS_EXT_NORM;
+	*cow = true;
+	return 0;
+
+error0:
+	xfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES | XFS_TRANS_ABORT);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return XFS_ERROR(error);
+}
+
 int
 xfs_iomap_write_unwritten(
 	xfs_inode_t	*ip,
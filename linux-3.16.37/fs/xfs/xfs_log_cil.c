@@ -276,6 +276,13 @@ insert:
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * Items, busy extents and header reservations go on the per-cpu part of the
+ * CIL of the CPU we are running on, so commits on different CPUs don't contend
+ * on a CIL lock. The only shared state we touch is the context space and
+ * ordering counters, which are atomic. An item already in the CIL stays on the
+ * per-cpu list it was first added to; the order id we stamp on it here lets
+ * the push put the items back into commit order.
  */
 static void
 xlog_cil_insert_items(
@@ -285,9 +292,12 @@ xlog_cil_insert_items(
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
 	struct xfs_log_item_desc *lidp;
+	struct xlog_cil_pcp	*cilpcp;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
+	int			space_used;
+	uint			order;
 
 	ASSERT(tp);
 
@@ -297,60 +307,61 @@ xlog_cil_insert_items(
 	 */
 	xlog_cil_insert_format_items(log, tp, &len, &diff_iovecs);
 
-	/*
-	 * Now (re-)position everything modified at the tail of the CIL.
-	 * We do this here so we only need to take the CIL lock once during
-	 * the transaction commit.
-	 */
-	spin_lock(&cil->xc_cil_lock);
-	list_for_each_entry(lidp, &tp->t_items, lid_trans) {
-		struct xfs_log_item	*lip = lidp->lid_item;
-
-		/* Skip items which aren't dirty in this transaction. */
-		if (!(lidp->lid_flags & XFS_LID_DIRTY))
-			continue;
-
-		list_move_tail(&lip->li_cil, &cil->xc_cil);
-	}
-
 	/* account for space used by new iovec headers  */
 	len += diff_iovecs * sizeof(xlog_op_header_t);
-	ctx->nvecs += diff_iovecs;
+
+	cilpcp = get_cpu_ptr(cil->xc_pcp);
+	if (!cpumask_test_cpu(smp_processor_id(), &ctx->cil_pcpmask))
+		cpumask_set_cpu(smp_processor_id(), &ctx->cil_pcpmask);
+	cilpcp->nvecs += diff_iovecs;
 
 	/* attach the transaction to the CIL if it has any busy extents */
 	if (!list_empty(&tp->t_busy))
-		list_splice_init(&tp->t_busy, &ctx->busy_extents);
+		list_splice_init(&tp->t_busy, &cilpcp->busy_extents);
 
 	/*
 	 * Now transfer enough transaction reservation to the context ticket
-	 * for the checkpoint. The context ticket is special - the unit
-	 * reservation has to grow as well as the current reservation as we
-	 * steal from tickets so we can correctly determine the space used
-	 * during the transaction commit.
+	 * for the checkpoint. The first commit into an empty context steals
+	 * the basic transaction overhead; the push moves it onto the context
+	 * ticket along with the per-cpu header reservations.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
-		ctx->ticket->t_curr_res = ctx->ticket->t_unit_res;
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) &&
+	    test_and_clear_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		tp->t_ticket->t_curr_res -= ctx->ticket->t_unit_res;
-	}
 
 	/* do we need space for more log record headers? */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
+	space_used = atomic_add_return(len, &ctx->space_used) - len;
+	if (len > 0 && (space_used / iclog_space !=
+				(space_used + len) / iclog_space)) {
 		int hdrs;
 
 		hdrs = (len + iclog_space - 1) / iclog_space;
 		/* need to take into account split region headers, too */
 		hdrs *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += hdrs;
-		ctx->ticket->t_curr_res += hdrs;
+		cilpcp->space_reserved += hdrs;
 		tp->t_ticket->t_curr_res -= hdrs;
 		ASSERT(tp->t_ticket->t_curr_res >= len);
 	}
 	tp->t_ticket->t_curr_res -= len;
-	ctx->space_used += len;
 
-	spin_unlock(&cil->xc_cil_lock);
+	/*
+	 * Now (re-)position everything modified in this transaction at the tail
+	 * of the CIL by giving it the next commit order id.
+	 */
+	order = atomic_inc_return(&ctx->order_id);
+	list_for_each_entry(lidp, &tp->t_items, lid_trans) {
+		struct xfs_log_item	*lip = lidp->lid_item;
+
+		/* Skip items which aren't dirty in this transaction. */
+		if (!(lidp->lid_flags & XFS_LID_DIRTY))
+			continue;
+
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &cilpcp->log_items);
+	}
+	put_cpu_ptr(cilpcp);
 }
 
 static void
@@ -410,6 +421,61 @@ xlog_cil_committed(
 	kmem_free(ctx);
 }
 
+static void xlog_cil_push_work(struct work_struct *work);
+
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_log_item	*la = list_entry(a, struct xfs_log_item, li_cil);
+	struct xfs_log_item	*lb = list_entry(b, struct xfs_log_item, li_cil);
+
+	return la->li_order_id > lb->li_order_id;
+}
+
+/*
+ * Pull the per-cpu state of every CPU that committed into @ctx onto the
+ * context: move the log record header reservations to the checkpoint ticket,
+ * gather the busy extents and return the log items in commit order on
+ * @log_items. Called with the context lock held exclusively so there are no
+ * concurrent commits modifying the per-cpu structures.
+ */
+static void
+xlog_cil_pcp_aggregate(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx,
+	struct list_head	*log_items)
+{
+	struct xlog_cil_pcp	*cilpcp;
+	int			cpu;
+
+	/* the first commit stole the base reservation for us */
+	ctx->ticket->t_curr_res = ctx->ticket->t_unit_res;
+
+	for_each_cpu(cpu, &ctx->cil_pcpmask) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		ctx->ticket->t_unit_res += cilpcp->space_reserved;
+		ctx->ticket->t_curr_res += cilpcp->space_reserved;
+		cilpcp->space_reserved = 0;
+		ctx->nvecs += cilpcp->nvecs;
+		cilpcp->nvecs = 0;
+
+		list_splice_init(&cilpcp->busy_extents, &ctx->busy_extents);
+		list_splice_init(&cilpcp->log_items, log_items);
+	}
+
+	/*
+	 * Items are only ever added to the per-cpu list of the CPU they were
+	 * first committed on, so the lists have to be merged back into the
+	 * order the items were last committed in for the checkpoint to replay
+	 * the same way the single CIL list used to.
+	 */
+	list_sort(NULL, log_items, xlog_cil_order_cmp);
+}
+
 /*
  * Push the Committed Item List to the log. If @push_seq flag is zero, then it
  * is a background flush and so we can chose to ignore it. Otherwise, if the
@@ -439,8 +505,11 @@ xlog_cil_push(
 	struct xfs_trans_header thdr;
 	struct xfs_log_iovec	lhdr;
 	struct xfs_log_vec	lvhdr = { NULL };
+	xfs_lsn_t		start_lsn;
+	xfs_lsn_t		body_lsn;
 	xfs_lsn_t		commit_lsn;
 	xfs_lsn_t		push_seq;
+	LIST_HEAD		(log_items);
 
 	if (!cil)
 		return 0;
@@ -460,7 +529,7 @@ xlog_cil_push(
 	 * move on to a new sequence number and so we have to be able to push
 	 * this sequence again later.
 	 */
-	if (list_empty(&cil->xc_cil)) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_push_lock);
 		goto out_skip;
@@ -474,16 +543,17 @@ xlog_cil_push(
 
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL. We don't need any locks
+	 * here because the transaction commit side which modifies the
+	 * per-cpu CIL structures is currently locked out by the flush lock.
 	 */
+	xlog_cil_pcp_aggregate(cil, ctx, &log_items);
 	lv = NULL;
 	num_iovecs = 0;
-	while (!list_empty(&cil->xc_cil)) {
+	while (!list_empty(&log_items)) {
 		struct xfs_log_item	*item;
 
-		item = list_first_entry(&cil->xc_cil,
+		item = list_first_entry(&log_items,
 					struct xfs_log_item, li_cil);
 		list_del_init(&item->li_cil);
 		if (!ctx->lv_chain)
@@ -503,9 +573,9 @@ xlog_cil_push(
 	 */
 	INIT_LIST_HEAD(&new_ctx->committing);
 	INIT_LIST_HEAD(&new_ctx->busy_extents);
+	INIT_WORK(&new_ctx->push_work, xlog_cil_push_work);
 	new_ctx->sequence = ctx->sequence + 1;
 	new_ctx->cil = cil;
-	cil->xc_ctx = new_ctx;
 
 	/*
 	 * The switch is now done, so we can drop the context lock and move out
@@ -530,14 +600,43 @@ xlog_cil_push(
 	 * structure atomically with the addition of this sequence to the
 	 * committing list. This also ensures that we can do unlocked checks
 	 * against the current sequence in log forces without risking
-	 * deferencing a freed context pointer.
+	 * deferencing a freed context pointer. The context pointer itself is
+	 * switched under the push lock as well, so that xlog_cil_push_now()
+	 * only ever queues the push work of a context that hasn't been pushed
+	 * yet.
 	 */
 	spin_lock(&cil->xc_push_lock);
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
+	cil->xc_ctx = new_ctx;
 	cil->xc_current_sequence = new_ctx->sequence;
 	list_add(&ctx->committing, &cil->xc_committing);
 	spin_unlock(&cil->xc_push_lock);
 	up_write(&cil->xc_ctx_lock);
 
+	/*
+	 * Pushes of successive checkpoints run concurrently on the CIL
+	 * workqueue, so the next checkpoint can be aggregated and formatted
+	 * into iclogs while the iclogs of this one are still being written.
+	 * The start records still have to go into the log in sequence order,
+	 * though, so wait for all previous checkpoints to have started before
+	 * we write ours. The commit records are ordered below.
+	 */
+restart_start:
+	spin_lock(&cil->xc_push_lock);
+	list_for_each_entry(new_ctx, &cil->xc_committing, committing) {
+		if (XLOG_FORCED_SHUTDOWN(log)) {
+			spin_unlock(&cil->xc_push_lock);
+			goto out_abort_free_ticket;
+		}
+		if (new_ctx->sequence >= ctx->sequence)
+			continue;
+		if (!new_ctx->start_lsn) {
+			xlog_wait(&cil->xc_commit_wait, &cil->xc_push_lock);
+			goto restart_start;
+		}
+	}
+	spin_unlock(&cil->xc_push_lock);
+
 	/*
 	 * Build a checkpoint transaction header and write it to the log to
 	 * begin the transaction. We need to account for the space used by the
@@ -546,6 +645,12 @@ xlog_cil_push(
 	 * The LSN we need to pass to the log items on transaction commit is
 	 * the LSN reported by the first log vector write. If we use the commit
 	 * record lsn then we can move the tail beyond the grant write head.
+	 *
+	 * The start record and header go out on their own, so the start LSN
+	 * can be published, and the next checkpoint can start writing, before
+	 * the body of this one has been copied into the iclogs. Recovery finds
+	 * the regions of a checkpoint by its tid, so they don't have to be
+	 * contiguous with the start record.
 	 */
 	tic = ctx->ticket;
 	thdr.th_magic = XFS_TRANS_HEADER_MAGIC;
@@ -559,9 +664,18 @@ xlog_cil_push(
 
 	lvhdr.lv_niovecs = 1;
 	lvhdr.lv_iovecp = &lhdr;
-	lvhdr.lv_next = ctx->lv_chain;
+	lvhdr.lv_next = NULL;
 
-	error = xlog_write(log, &lvhdr, tic, &ctx->start_lsn, NULL, 0);
+	error = xlog_write(log, &lvhdr, tic, &start_lsn, NULL, 0);
+	if (error)
+		goto out_abort_free_ticket;
+
+	spin_lock(&cil->xc_push_lock);
+	ctx->start_lsn = start_lsn;
+	wake_up_all(&cil->xc_commit_wait);
+	spin_unlock(&cil->xc_push_lock);
+
+	error = xlog_write(log, ctx->lv_chain, tic, &body_lsn, NULL, 0);
 	if (error)
 		goto out_abort_free_ticket;
 
@@ -641,9 +755,9 @@ static void
 xlog_cil_push_work(
 	struct work_struct	*work)
 {
-	struct xfs_cil		*cil = container_of(work, struct xfs_cil,
-							xc_push_work);
-	xlog_cil_push(cil->xc_log);
+	struct xfs_cil_ctx	*ctx = container_of(work, struct xfs_cil_ctx,
+							push_work);
+	xlog_cil_push(ctx->cil->xc_log);
 }
 
 /*
@@ -663,19 +777,20 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(!test_bit(XLOG_CIL_EMPTY, &cil->xc_flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
 	 * space available yet.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log))
+	if (atomic_read(&cil->xc_ctx->space_used) < XLOG_CIL_SPACE_LIMIT(log))
 		return;
 
 	spin_lock(&cil->xc_push_lock);
 	if (cil->xc_push_seq < cil->xc_current_sequence) {
 		cil->xc_push_seq = cil->xc_current_sequence;
-		queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
+		queue_work(log->l_mp->m_cil_workqueue,
+			   &cil->xc_ctx->push_work);
 	}
 	spin_unlock(&cil->xc_push_lock);
 
@@ -699,21 +814,25 @@ xlog_cil_push_now(
 
 	ASSERT(push_seq && push_seq <= cil->xc_current_sequence);
 
-	/* start on any pending background push to minimise wait time on it */
-	flush_work(&cil->xc_push_work);
+	/*
+	 * start on any pending background push to minimise wait time on it.
+	 * Each context has its own push work, so flush the whole workqueue.
+	 */
+	flush_workqueue(log->l_mp->m_cil_workqueue);
 
 	/*
 	 * If the CIL is empty or we've already pushed the sequence then
 	 * there's no work we need to do.
 	 */
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) ||
+	    push_seq <= cil->xc_push_seq) {
 		spin_unlock(&cil->xc_push_lock);
 		return;
 	}
 
 	cil->xc_push_seq = push_seq;
-	queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
+	queue_work(log->l_mp->m_cil_workqueue, &cil->xc_ctx->push_work);
 	spin_unlock(&cil->xc_push_lock);
 }
 
@@ -725,7 +844,7 @@ xlog_cil_empty(
 	bool		empty = false;
 
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil))
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		empty = true;
 	spin_unlock(&cil->xc_push_lock);
 	return empty;
@@ -866,7 +985,7 @@ restart:
 	 * try the push for this sequence again from the start just in case.
 	 */
 	if (sequence == cil->xc_current_sequence &&
-	    !list_empty(&cil->xc_cil)) {
+	    !test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		spin_unlock(&cil->xc_push_lock);
 		goto restart;
 	}
@@ -925,6 +1044,8 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	struct xlog_cil_pcp *cilpcp;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
 	if (!cil)
@@ -936,16 +1057,28 @@ xlog_cil_init(
 		return ENOMEM;
 	}
 
-	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
-	INIT_LIST_HEAD(&cil->xc_cil);
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp) {
+		kmem_free(ctx);
+		kmem_free(cil);
+		return ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+		INIT_LIST_HEAD(&cilpcp->busy_extents);
+		INIT_LIST_HEAD(&cilpcp->log_items);
+	}
+
 	INIT_LIST_HEAD(&cil->xc_committing);
-	spin_lock_init(&cil->xc_cil_lock);
 	spin_lock_init(&cil->xc_push_lock);
 	init_rwsem(&cil->xc_ctx_lock);
 	init_waitqueue_head(&cil->xc_commit_wait);
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 
 	INIT_LIST_HEAD(&ctx->committing);
 	INIT_LIST_HEAD(&ctx->busy_extents);
+	INIT_WORK(&ctx->push_work, xlog_cil_push_work);
 	ctx->sequence = 1;
 	ctx->cil = cil;
 	cil->xc_ctx = ctx;
@@ -966,7 +1099,8 @@ xlog_cil_destroy(
 		kmem_free(log->l_cilp->xc_ctx);
 	}
 
-	ASSERT(list_empty(&log->l_cilp->xc_cil));
+	ASSERT(test_bit(XLOG_CIL_EMPTY, &log->l_cilp->xc_flags));
+	free_percpu(log->l_cilp->xc_pcp);
 	kmem_free(log->l_cilp);
 }
 
@@ -252,11 +252,28 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* last transaction commit order */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
 	struct list_head	committing;	/* ctx committing list */
+	struct work_struct	push_work;	/* checkpoint push */
+	cpumask_t		cil_pcpmask;	/* CPUs with items in the CIL */
+};
+
+/*
+ * Per-cpu part of the CIL.  Transaction commits add their items, busy extents
+ * and log record header reservation to the structure of the CPU they run on,
+ * so concurrent commits don't share any cachelines apart from the context
+ * space and ordering counters.  The push aggregates all the CPUs marked in the
+ * context cpumask with the context lock held exclusively.
+ */
+struct xlog_cil_pcp {
+	int			space_reserved;	/* split header reservation */
+	int			nvecs;		/* number of regions */
+	struct list_head	busy_extents;	/* busy extents committed */
+	struct list_head	log_items;	/* items committed */
 };
 
 /*
@@ -277,8 +294,8 @@ struct xfs_cil_ctx {
  */
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	unsigned long		xc_flags;
+	struct xlog_cil_pcp __percpu *xc_pcp;
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -288,9 +305,11 @@ struct xfs_cil {
 	struct list_head	xc_committing;
 	wait_queue_head_t	xc_commit_wait;
 	xfs_lsn_t		xc_current_sequence;
-	struct work_struct	xc_push_work;
 } ____cacheline_aligned_in_smp;
 
+/* xc_flags bit values */
+#define	XLOG_CIL_EMPTY		0	/* no items in the current context */
+
 /*
  * The amount of log space we allow the CIL to aggregate is difficult to size.
  * Whatever we choose, we have to make sure we can get a reservation for the
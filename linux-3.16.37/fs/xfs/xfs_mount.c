@@ -30,6 +30,8 @@
 #include "xfs_inode.h"
 #include "xfs_dir2.h"
 #include "xfs_ialloc.h"
+#include "xfs_refcount_btree.h"
+#include "xfs_refcount.h"
 #include "xfs_alloc.h"
 #include "xfs_rtalloc.h"
 #include "xfs_bmap.h"
@@ -728,6 +730,7 @@ xfs_mountfs(
 	xfs_bmap_compute_maxlevels(mp, XFS_DATA_FORK);
 	xfs_bmap_compute_maxlevels(mp, XFS_ATTR_FORK);
 	xfs_ialloc_compute_maxlevels(mp);
+	xfs_refcountbt_compute_maxlevels(mp);
 
 	xfs_set_maxicount(mp);
 
@@ -942,6 +945,18 @@ xfs_mountfs(
 		goto out_rtunmount;
 	}
 
+	/*
+	 * Free the blocks that copy-on-write had allocated for writes that
+	 * never completed.
+	 */
+	if (!(mp->m_flags & XFS_MOUNT_RDONLY)) {
+		error = xfs_refcount_recover_cow_leftovers(mp);
+		if (error) {
+			xfs_warn(mp, "freeing CoW staging extents failed");
+			goto out_rtunmount;
+		}
+	}
+
 	/*
 	 * Complete the quota initialisation, post-log-replay component.
 	 */
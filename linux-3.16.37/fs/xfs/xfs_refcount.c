@@ -0,0 +1,642 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_sb.h"
+#include "xfs_ag.h"
+#include "xfs_mount.h"
+#include "xfs_btree.h"
+#include "xfs_refcount_btree.h"
+#include "xfs_refcount.h"
+#include "xfs_alloc.h"
+#include "xfs_error.h"
+#include "xfs_trace.h"
+#include "xfs_trans.h"
+#include "xfs_trans_space.h"
+
+/*
+ * Reference counts of shared extents.
+ *
+ * The refcount btree of an AG has a record for every range of blocks that
+ * is mapped more than once, i.e. by more than one file or more than once by
+ * the same file.  Blocks without a record are owned by exactly one mapping,
+ * or are free, or are metadata, so filesystems that never share anything
+ * have an empty tree, and freeing an extent only needs to look at the tree
+ * to find out which of its blocks are still in use elsewhere.
+ */
+
+/*
+ * Lookup a record by starting block in the btree given by cur.
+ */
+int					/* error */
+xfs_refcount_lookup(
+	struct xfs_btree_cur	*cur,	/* btree cursor */
+	xfs_agblock_t		bno,	/* starting block of extent */
+	xfs_lookup_t		dir,	/* <=, >=, == */
+	int			*stat)	/* success/failure */
+{
+	cur->bc_rec.rc.rc_startblock = bno;
+	cur->bc_rec.rc.rc_blockcount = 0;
+	cur->bc_rec.rc.rc_refcount = 0;
+	return xfs_btree_lookup(cur, dir, stat);
+}
+
+/*
+ * Get the data from the pointed-to record.
+ */
+int					/* error */
+xfs_refcount_get_rec(
+	struct xfs_btree_cur		*cur,	/* btree cursor */
+	struct xfs_refcount_rec_incore	*irec,	/* btree record */
+	int				*stat)	/* output: success/failure */
+{
+	union xfs_btree_rec	*rec;
+	int			error;
+
+	error = xfs_btree_get_rec(cur, &rec, stat);
+	if (!error && *stat == 1) {
+		irec->rc_startblock = be32_to_cpu(rec->refc.rc_startblock);
+		irec->rc_blockcount = be32_to_cpu(rec->refc.rc_blockcount);
+		irec->rc_refcount = be32_to_cpu(rec->refc.rc_refcount);
+	}
+	return error;
+}
+
+/*
+ * Update the record referred to by cur to the value given.
+ * This either works (return 0) or gets an EFSCORRUPTED error.
+ */
+STATIC int
+xfs_refcount_update(
+	struct xfs_btree_cur		*cur,
+	struct xfs_refcount_rec_incore	*irec)
+{
+	union xfs_btree_rec	rec;
+
+	rec.refc.rc_startblock = cpu_to_be32(irec->rc_startblock);
+	rec.refc.rc_blockcount = cpu_to_be32(irec->rc_blockcount);
+	rec.refc.rc_refcount = cpu_to_be32(irec->rc_refcount);
+	return xfs_btree_update(cur, &rec);
+}
+
+/*
+ * Insert a record, which must not overlap any existing one.
+ */
+STATIC int
+xfs_refcount_insert(
+	struct xfs_btree_cur		*cur,
+	struct xfs_refcount_rec_incore	*irec)
+{
+	int			error;
+	int			i;
+
+	error = xfs_refcount_lookup(cur, irec->rc_startblock, XFS_LOOKUP_EQ,
+				    &i);
+	if (error)
+		return error;
+	XFS_WANT_CORRUPTED_RETURN(i == 0);
+	cur->bc_rec.rc = *irec;
+	error = xfs_btree_insert(cur, &i);
+	if (error)
+		return error;
+	XFS_WANT_CORRUPTED_RETURN(i == 1);
+	return 0;
+}
+
+/*
+ * Point the cursor at the record containing bno or, if there is none, at
+ * the first record after it.  *stat is 0 if there is no such record.
+ */
+STATIC int
+xfs_refcount_find_next(
+	struct xfs_btree_cur		*cur,
+	xfs_agblock_t			bno,
+	struct xfs_refcount_rec_incore	*irec,
+	int				*stat)
+{
+	int				error;
+	int				i;
+
+	error = xfs_refcount_lookup(cur, bno, XFS_LOOKUP_LE, &i);
+	if (error)
+		return error;
+	if (i) {
+		error = xfs_refcount_get_rec(cur, irec, &i);
+		if (error)
+			return error;
+		XFS_WANT_CORRUPTED_RETURN(i == 1);
+		if (irec->rc_startblock + irec->rc_blockcount > bno) {
+			*stat = 1;
+			return 0;
+		}
+		error = xfs_btree_increment(cur, 0, &i);
+	} else {
+		error = xfs_refcount_lookup(cur, bno, XFS_LOOKUP_GE, &i);
+	}
+	if (error)
+		return error;
+	if (i) {
+		error = xfs_refcount_get_rec(cur, irec, &i);
+		if (error)
+			return error;
+		XFS_WANT_CORRUPTED_RETURN(i == 1);
+	}
+	*stat = i;
+	return 0;
+}
+
+/*
+ * Split the record the cursor points at, which contains bno, in two so that
+ * a record starts at bno.
+ */
+STATIC int
+xfs_refcount_split(
+	struct xfs_btree_cur		*cur,
+	struct xfs_refcount_rec_incore	*irec,
+	xfs_agblock_t			bno)
+{
+	struct xfs_refcount_rec_incore	left = *irec;
+	struct xfs_refcount_rec_incore	right = *irec;
+	int				error;
+
+	ASSERT(bno > irec->rc_startblock);
+	ASSERT(bno < irec->rc_startblock + irec->rc_blockcount);
+
+	left.rc_blockcount = bno - irec->rc_startblock;
+	right.rc_startblock = bno;
+	right.rc_blockcount -= left.rc_blockcount;
+
+	error = xfs_refcount_update(cur, &left);
+	if (error)
+		return error;
+	return xfs_refcount_insert(cur, &right);
+}
+
+/*
+ * Merge the records on both sides of bno if they have the same refcount, so
+ * that adjusting the same blocks back and forth does not fragment the tree.
+ */
+STATIC int
+xfs_refcount_merge_at(
+	struct xfs_btree_cur		*cur,
+	xfs_agblock_t			bno)
+{
+	struct xfs_refcount_rec_incore	left;
+	struct xfs_refcount_rec_incore	right;
+	int				error;
+	int				i;
+
+	if (bno == 0)
+		return 0;
+
+	error = xfs_refcount_lookup(cur, bno, XFS_LOOKUP_EQ, &i);
+	if (error || !i)
+		return error;
+	error = xfs_refcount_get_rec(cur, &right, &i);
+	if (error)
+		return error;
+	XFS_WANT_CORRUPTED_RETURN(i == 1);
+
+	error = xfs_btree_decrement(cur, 0, &i);
+	if (error || !i)
+		return error;
+	error = xfs_refcount_get_rec(cur, &left, &i);
+	if (error)
+		return error;
+	XFS_WANT_CORRUPTED_RETURN(i == 1);
+
+	if (left.rc_startblock + left.rc_blockcount != bno ||
+	    left.rc_refcount != right.rc_refcount)
+		return 0;
+
+	left.rc_blockcount += right.rc_blockcount;
+	error = xfs_refcount_update(cur, &left);
+	if (error)
+		return error;
+	error = xfs_btree_increment(cur, 0, &i);
+	if (error)
+		return error;
+	XFS_WANT_CORRUPTED_RETURN(i == 1);
+	error = xfs_btree_delete(cur, &i);
+	if (error)
+		return error;
+	XFS_WANT_CORRUPTED_RETURN(i == 1);
+	return 0;
+}
+
+/*
+ * Add adj (+1 or -1) to the refcount of every block in [agbno, agbno + aglen).
+ *
+ * Blocks without a record have an implicit refcount of one: taking a
+ * reference to them inserts a record with a refcount of two, dropping it
+ * frees them.  Records that drop to a refcount of one are deleted.
+ * Records are split where they stick out of the range, and a refcount that
+ * has reached XFS_REFC_REFCOUNT_MAX stays there, leaking the blocks rather
+ * than freeing them while they are still in use.
+ */
+STATIC int
+xfs_refcount_adjust(
+	struct xfs_btree_cur	*cur,
+	xfs_agblock_t		agbno,
+	xfs_extlen_t		aglen,
+	int			adj)
+{
+	struct xfs_mount	*mp = cur->bc_mp;
+	xfs_agnumber_t		agno = cur->bc_private.a.agno;
+	xfs_agblock_t		end = agbno + aglen;
+	struct xfs_refcount_rec_incore	irec;
+	struct xfs_refcount_rec_incore	tmp;
+	xfs_extlen_t		len;
+	int			found;
+	int			error;
+	int			i;
+
+	while (agbno < end) {
+		error = xfs_refcount_find_next(cur, agbno, &irec, &found);
+		if (error)
+			return error;
+
+		/* blocks up to the next record are referenced once */
+		if (!found || irec.rc_startblock > agbno) {
+			len = end - agbno;
+			if (found && irec.rc_startblock < end)
+				len = irec.rc_startblock - agbno;
+			if (adj > 0) {
+				tmp.rc_startblock = agbno;
+				tmp.rc_blockcount = len;
+				tmp.rc_refcount = 2;
+				error = xfs_refcount_insert(cur, &tmp);
+			} else {
+				error = xfs_free_extent(cur->bc_tp,
+						XFS_AGB_TO_FSB(mp, agno, agbno),
+						len);
+			}
+			if (error)
+				return error;
+			agbno += len;
+			continue;
+		}
+
+		/* cut off the parts of the record outside of the range */
+		if (irec.rc_startblock < agbno) {
+			error = xfs_refcount_split(cur, &irec, agbno);
+			if (error)
+				return error;
+			continue;
+		}
+		if (irec.rc_startblock + irec.rc_blockcount > end) {
+			error = xfs_refcount_split(cur, &irec, end);
+			if (error)
+				return error;
+			continue;
+		}
+
+		if (irec.rc_refcount != XFS_REFC_REFCOUNT_MAX) {
+			irec.rc_refcount += adj;
+			if (irec.rc_refcount == 1) {
+				error = xfs_btree_delete(cur, &i);
+				if (error)
+					return error;
+				XFS_WANT_CORRUPTED_RETURN(i == 1);
+			} else {
+				error = xfs_refcount_update(cur, &irec);
+				if (error)
+					return error;
+			}
+		}
+		agbno += irec.rc_blockcount;
+	}
+	return 0;
+}
+
+STATIC int
+xfs_refcount_adjust_extent(
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len,
+	int			adj)
+{
+	struct xfs_mount	*mp = tp->t_mountp;
+	xfs_agnumber_t		agno = XFS_FSB_TO_AGNO(mp, fsbno);
+	xfs_agblock_t		agbno = XFS_FSB_TO_AGBNO(mp, fsbno);
+	struct xfs_btree_cur	*cur;
+	struct xfs_buf		*agbp;
+	int			error;
+
+	ASSERT(agno < mp->m_sb.sb_agcount);
+	ASSERT(len > 0);
+	ASSERT(agbno + len <= mp->m_sb.sb_agblocks);
+
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &agbp);
+	if (error)
+		return error;
+	ASSERT(agbp != NULL);
+
+	cur = xfs_refcountbt_init_cursor(mp, tp, agbp, agno);
+	error = xfs_refcount_adjust(cur, agbno, len, adj);
+	if (!error)
+		error = xfs_refcount_merge_at(cur, agbno);
+	if (!error)
+		error = xfs_refcount_merge_at(cur, agbno + len);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	return error;
+}
+
+/*
+ * Take another reference to every block of the extent, which must be mapped
+ * by a file already.
+ */
+int
+xfs_refcount_increase(
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len)
+{
+	ASSERT(xfs_sb_version_hasreflink(&tp->t_mountp->m_sb));
+
+	return xfs_refcount_adjust_extent(tp, fsbno, len, 1);
+}
+
+/*
+ * Drop a reference to every block of the extent and free the blocks that
+ * are not referenced any more, all in the given transaction.  This is what
+ * processing an extent free intention means on a reflink filesystem, both
+ * at runtime and in log recovery, so that blocks are never freed while
+ * another file still maps them.
+ */
+int
+xfs_refcount_free_extent(
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len)
+{
+	if (!xfs_sb_version_hasreflink(&tp->t_mountp->m_sb))
+		return xfs_free_extent(tp, fsbno, len);
+
+	return xfs_refcount_adjust_extent(tp, fsbno, len, -1);
+}
+
+/*
+ * Find the first range of shared blocks in the extent [fsbno, fsbno + len).
+ * On return *offset is the offset of the range into the extent and *flen its
+ * length, which is zero if no block of the extent is shared.  tp may be
+ * NULL.
+ */
+int
+xfs_refcount_find_shared(
+	struct xfs_mount	*mp,
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len,
+	xfs_extlen_t		*offset,
+	xfs_extlen_t		*flen)
+{
+	xfs_agnumber_t		agno = XFS_FSB_TO_AGNO(mp, fsbno);
+	xfs_agblock_t		agbno = XFS_FSB_TO_AGBNO(mp, fsbno);
+	xfs_agblock_t		start;
+	xfs_agblock_t		end;
+	struct xfs_refcount_rec_incore	irec;
+	struct xfs_btree_cur	*cur;
+	struct xfs_buf		*agbp;
+	int			error;
+	int			i;
+
+	*offset = len;
+	*flen = 0;
+	if (!xfs_sb_version_hasreflink(&mp->m_sb))
+		return 0;
+
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &agbp);
+	if (error)
+		return error;
+	ASSERT(agbp != NULL);
+
+	cur = xfs_refcountbt_init_cursor(mp, tp, agbp, agno);
+	error = xfs_refcount_find_next(cur, agbno, &irec, &i);
+	if (error || !i || irec.rc_startblock >= agbno + len)
+		goto out;
+
+	start = max(irec.rc_startblock, agbno);
+	end = min(irec.rc_startblock + irec.rc_blockcount, agbno + len);
+
+	/* adjacent records with different refcounts are one shared range */
+	while (end < agbno + len) {
+		error = xfs_btree_increment(cur, 0, &i);
+		if (error || !i)
+			break;
+		error = xfs_refcount_get_rec(cur, &irec, &i);
+		if (error)
+			break;
+		if (irec.rc_startblock != end)
+			break;
+		end = min(irec.rc_startblock + irec.rc_blockcount,
+			  agbno + len);
+	}
+	if (!error) {
+		*offset = start - agbno;
+		*flen = end - start;
+	}
+out:
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_trans_brelse(tp, agbp);
+	return error;
+}
+
+/*
+ * Copy-on-write staging extents.
+ *
+ * Writeback does not overwrite a shared block in place but writes the data
+ * to a newly allocated block, and only replaces the shared block with it in
+ * the file once the data is on disk.  Until then the new block is owned by
+ * nothing but a record in the refcount btree, at its start block plus
+ * XFS_REFC_COW_START, so that the blocks of writes a crash interrupted can
+ * be found and freed at the next mount.
+ */
+STATIC int
+xfs_refcount_adjust_cow(
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len,
+	bool			alloc)
+{
+	struct xfs_mount	*mp = tp->t_mountp;
+	xfs_agnumber_t		agno = XFS_FSB_TO_AGNO(mp, fsbno);
+	xfs_agblock_t		agbno = XFS_FSB_TO_AGBNO(mp, fsbno);
+	struct xfs_refcount_rec_incore	irec;
+	struct xfs_btree_cur	*cur;
+	struct xfs_buf		*agbp;
+	int			error;
+	int			i;
+
+	ASSERT(xfs_sb_version_hasreflink(&mp->m_sb));
+	ASSERT(agbno + len <= mp->m_sb.sb_agblocks);
+
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &agbp);
+	if (error)
+		return error;
+	ASSERT(agbp != NULL);
+
+	cur = xfs_refcountbt_init_cursor(mp, tp, agbp, agno);
+	if (alloc) {
+		irec.rc_startblock = agbno + XFS_REFC_COW_START;
+		irec.rc_blockcount = len;
+		irec.rc_refcount = 1;
+		error = xfs_refcount_insert(cur, &irec);
+		goto out;
+	}
+
+	error = xfs_refcount_lookup(cur, agbno + XFS_REFC_COW_START,
+				    XFS_LOOKUP_EQ, &i);
+	if (error)
+		goto out;
+	XFS_WANT_CORRUPTED_GOTO(i == 1, out);
+	error = xfs_refcount_get_rec(cur, &irec, &i);
+	if (error)
+		goto out;
+	XFS_WANT_CORRUPTED_GOTO(i == 1 && irec.rc_blockcount == len &&
+				irec.rc_refcount == 1, out);
+	error = xfs_btree_delete(cur, &i);
+	if (error)
+		goto out;
+	XFS_WANT_CORRUPTED_GOTO(i == 1, out);
+out:
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	return error;
+}
+
+/*
+ * Record a newly allocated extent as CoW staging.
+ */
+int
+xfs_refcount_alloc_cow_extent(
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len)
+{
+	return xfs_refcount_adjust_cow(tp, fsbno, len, true);
+}
+
+/*
+ * Remove the staging record of an extent, which is either mapped into a
+ * file or freed in the same transaction.
+ */
+int
+xfs_refcount_free_cow_extent(
+	struct xfs_trans	*tp,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len)
+{
+	return xfs_refcount_adjust_cow(tp, fsbno, len, false);
+}
+
+struct xfs_refcount_recovery {
+	struct list_head		rr_list;
+	struct xfs_refcount_rec_incore	rr_rrec;
+};
+
+/*
+ * Free the staging extents of one AG.  They are collected first so that the
+ * AGF is not held while the transactions freeing them are set up.
+ */
+STATIC int
+xfs_refcount_recover_cow_ag(
+	struct xfs_mount		*mp,
+	xfs_agnumber_t			agno)
+{
+	struct xfs_refcount_recovery	*rr, *n;
+	struct list_head		debris;
+	struct xfs_btree_cur		*cur;
+	struct xfs_buf			*agbp;
+	struct xfs_trans		*tp;
+	xfs_fsblock_t			fsbno;
+	int				error;
+	int				i;
+
+	INIT_LIST_HEAD(&debris);
+
+	error = xfs_alloc_read_agf(mp, NULL, agno, 0, &agbp);
+	if (error)
+		return error;
+	cur = xfs_refcountbt_init_cursor(mp, NULL, agbp, agno);
+	error = xfs_refcount_lookup(cur, XFS_REFC_COW_START, XFS_LOOKUP_GE,
+				    &i);
+	while (!error && i) {
+		rr = kmem_alloc(sizeof(*rr), KM_SLEEP);
+		error = xfs_refcount_get_rec(cur, &rr->rr_rrec, &i);
+		if (error || !i) {
+			kmem_free(rr);
+			break;
+		}
+		list_add_tail(&rr->rr_list, &debris);
+		error = xfs_btree_increment(cur, 0, &i);
+	}
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_buf_relse(agbp);
+
+	list_for_each_entry_safe(rr, n, &debris, rr_list) {
+		list_del(&rr->rr_list);
+		fsbno = XFS_AGB_TO_FSB(mp, agno,
+			rr->rr_rrec.rc_startblock - XFS_REFC_COW_START);
+		if (!error) {
+			tp = xfs_trans_alloc(mp, XFS_TRANS_REFLINK);
+			error = xfs_trans_reserve(tp, &M_RES(mp)->tr_write,
+					XFS_REFCOUNT_SPACE_RES(mp), 0);
+			if (error) {
+				xfs_trans_cancel(tp, 0);
+			} else {
+				error = xfs_refcount_free_cow_extent(tp, fsbno,
+						rr->rr_rrec.rc_blockcount);
+				if (!error)
+					error = xfs_free_extent(tp, fsbno,
+						rr->rr_rrec.rc_blockcount);
+				if (error)
+					xfs_trans_cancel(tp,
+						XFS_TRANS_RELEASE_LOG_RES |
+						XFS_TRANS_ABORT);
+				else
+					error = xfs_trans_commit(tp,
+						XFS_TRANS_RELEASE_LOG_RES);
+			}
+		}
+		kmem_free(rr);
+	}
+	return error;
+}
+
+/*
+ * Free the blocks of copy-on-write staging extents that a crash left
+ * behind.  Called at mount time, after log recovery.
+ */
+int
+xfs_refcount_recover_cow_leftovers(
+	struct xfs_mount	*mp)
+{
+	xfs_agnumber_t		agno;
+	int			error;
+
+	if (!xfs_sb_version_hasreflink(&mp->m_sb))
+		return 0;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		error = xfs_refcount_recover_cow_ag(mp, agno);
+		if (error)
+			return error;
+	}
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __XFS_REFCOUNT_H__
+#define	__XFS_REFCOUNT_H__
+
+struct xfs_btree_cur;
+struct xfs_mount;
+struct xfs_trans;
+
+/*
+ * Lookup a refcount btree record by starting block.
+ */
+int xfs_refcount_lookup(struct xfs_btree_cur *cur, xfs_agblock_t bno,
+		xfs_lookup_t dir, int *stat);
+
+/*
+ * Get the data from the pointed-to record.
+ */
+int xfs_refcount_get_rec(struct xfs_btree_cur *cur,
+		struct xfs_refcount_rec_incore *irec, int *stat);
+
+/*
+ * Take another reference to every block of an extent, e.g. for a clone.
+ */
+int xfs_refcount_increase(struct xfs_trans *tp, xfs_fsblock_t fsbno,
+		xfs_extlen_t len);
+
+/*
+ * Drop a reference to every block of an extent and free the blocks nobody
+ * references any more.
+ */
+int xfs_refcount_free_extent(struct xfs_trans *tp, xfs_fsblock_t fsbno,
+		xfs_extlen_t len);
+
+/*
+ * Find the first shared range of blocks in an extent.
+ */
+int xfs_refcount_find_shared(struct xfs_mount *mp, struct xfs_trans *tp,
+		xfs_fsblock_t fsbno, xfs_extlen_t len, xfs_extlen_t *offset,
+		xfs_extlen_t *flen);
+
+/*
+ * Record a newly allocated extent as a copy-on-write staging extent, or
+ * remove that record again.
+ */
+int xfs_refcount_alloc_cow_extent(struct xfs_trans *tp, xfs_fsblock_t fsbno,
+		xfs_extlen_t len);
+int xfs_refcount_free_cow_extent(struct xfs_trans *tp, xfs_fsblock_t fsbno,
+		xfs_extlen_t len);
+
+/*
+ * Free the staging extents a crash left behind.
+ */
+int xfs_refcount_recover_cow_leftovers(struct xfs_mount *mp);
+
+#endif	/* __XFS_REFCOUNT_H__ */
@@ -0,0 +1,680 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_sb.h"
+#include "xfs_ag.h"
+#include "xfs_mount.h"
+#include "xfs_da_format.h"
+#include "xfs_inode.h"
+#include "xfs_trans.h"
+#include "xfs_bmap.h"
+#include "xfs_bmap_util.h"
+#include "xfs_alloc.h"
+#include "xfs_refcount.h"
+#include "xfs_error.h"
+#include "xfs_quota.h"
+#include "xfs_trans_space.h"
+#include "xfs_dinode.h"
+#include "xfs_reflink.h"
+#include <linux/pagemap.h>
+
+/*
+ * Sharing blocks between files.
+ *
+ * Cloning a range of a file maps the written extents of the source into the
+ * destination and takes an extra reference to their blocks in the refcount
+ * btree of their AG, one source extent per transaction.  Each transaction
+ * first unmaps whatever the destination had in that range, so replacing a
+ * single destination extent with a single source extent is atomic, which is
+ * what makes deduplication safe against crashes.  Holes, delayed
+ * allocations and unwritten extents of the source become holes in the
+ * destination, they read back as zeroes either way.
+ *
+ * Both inodes get XFS_DIFLAG2_REFLINK before anything is shared and keep it
+ * from then on.  Writeback of such an inode checks every block it is about
+ * to overwrite in place against the refcount btree and writes the data of
+ * shared blocks to newly allocated CoW staging blocks instead (see
+ * xfs_iomap_write_cow()).  I/O completion then replaces the shared block
+ * with the staging block in one transaction, so the file has either the
+ * old or the new data, never a block that was not written.  Direct I/O and
+ * the other paths that write below the page cache unshare the range through
+ * the page cache before they start.
+ */
+
+/*
+ * Mark an inode as possibly sharing blocks.  This is committed before the
+ * first block is shared so that log recovery never sees shared blocks in an
+ * inode without the flag.
+ */
+STATIC int
+xfs_reflink_set_inode_flag(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_trans	*tp;
+	int			error;
+
+	if (xfs_is_reflink_inode(ip))
+		return 0;
+
+	tp = xfs_trans_alloc(mp, XFS_TRANS_REFLINK);
+	error = xfs_trans_reserve(tp, &M_RES(mp)->tr_ichange, 0, 0);
+	if (error) {
+		xfs_trans_cancel(tp, 0);
+		return error;
+	}
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, ip, XFS_ILOCK_EXCL);
+	ip->i_d.di_flags2 |= XFS_DIFLAG2_REFLINK;
+	xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	return xfs_trans_commit(tp, 0);
+}
+
+/*
+ * Share the blocks backing the next piece of [srcoff_fsb, srcoff_fsb + len)
+ * of src with dest at destoff_fsb, replacing whatever dest had there.  The
+ * piece ends where the source or the destination mapping changes, so one
+ * transaction is always enough.  Returns the number of blocks done in
+ * *done_fsb.
+ */
+STATIC int
+xfs_reflink_remap_extent(
+	struct xfs_inode	*src,
+	xfs_fileoff_t		srcoff_fsb,
+	struct xfs_inode	*dest,
+	xfs_fileoff_t		destoff_fsb,
+	xfs_filblks_t		len,
+	xfs_filblks_t		*done_fsb)
+{
+	struct xfs_mount	*mp = src->i_mount;
+	struct xfs_trans	*tp;
+	struct xfs_bmbt_irec	irec;
+	struct xfs_bmbt_irec	direc;
+	struct xfs_bmap_free	free_list;
+	xfs_fsblock_t		firstfsb;
+	uint			resblks;
+	int			nimaps;
+	int			committed;
+	int			done;
+	int			error;
+
+	*done_fsb = 0;
+	resblks = XFS_DIOSTRAT_SPACE_RES(mp, 0) +
+		  XFS_EXTENTADD_SPACE_RES(mp, XFS_DATA_FORK) +
+		  2 * XFS_REFCOUNT_SPACE_RES(mp);
+
+	tp = xfs_trans_alloc(mp, XFS_TRANS_REFLINK);
+	error = xfs_trans_reserve(tp, &M_RES(mp)->tr_write, resblks, 0);
+	if (error) {
+		ASSERT(error == ENOSPC || XFS_FORCED_SHUTDOWN(mp));
+		xfs_trans_cancel(tp, 0);
+		return error;
+	}
+
+	if (src == dest)
+		xfs_ilock(src, XFS_ILOCK_EXCL);
+	else
+		xfs_lock_two_inodes(src, dest, XFS_ILOCK_EXCL);
+
+	nimaps = 1;
+	error = xfs_bmapi_read(src, srcoff_fsb, len, &irec, &nimaps, 0);
+	if (error)
+		goto out_cancel;
+	ASSERT(nimaps == 1 && irec.br_startoff == srcoff_fsb);
+	nimaps = 1;
+	error = xfs_bmapi_read(dest, destoff_fsb, irec.br_blockcount, &direc,
+			       &nimaps, 0);
+	if (error)
+		goto out_cancel;
+	ASSERT(nimaps == 1 && direc.br_startoff == destoff_fsb);
+	irec.br_blockcount = min(irec.br_blockcount, direc.br_blockcount);
+
+	if (irec.br_startblock == DELAYSTARTBLOCK ||
+	    irec.br_startblock == HOLESTARTBLOCK ||
+	    irec.br_state == XFS_EXT_UNWRITTEN) {
+		/* nothing to share, only make dest read back zeroes */
+		irec.br_startblock = HOLESTARTBLOCK;
+	} else {
+		error = xfs_trans_reserve_quota_nblks(tp, dest,
+				irec.br_blockcount + resblks, 0,
+				XFS_QMOPT_RES_REGBLKS);
+		if (error)
+			goto out_cancel;
+	}
+
+	xfs_trans_ijoin(tp, dest, 0);
+
+	/*
+	 * Keep every allocation in the AG of the shared extent, whose AGF is
+	 * locked for the refcount update, so that AGFs are locked in order.
+	 */
+	xfs_bmap_init(&free_list, &firstfsb);
+	if (irec.br_startblock != HOLESTARTBLOCK)
+		firstfsb = irec.br_startblock;
+	error = xfs_bunmapi(tp, dest, destoff_fsb, irec.br_blockcount, 0, 1,
+			    &firstfsb, &free_list, &done);
+	if (error)
+		goto out_bmap_cancel;
+
+	/*
+	 * The range covers a single extent of dest, so the unmap normally
+	 * completes here.  If it did not, only commit what was unmapped and
+	 * let the caller come back for the rest.
+	 */
+	if (done && irec.br_startblock != HOLESTARTBLOCK) {
+		error = xfs_refcount_increase(tp, irec.br_startblock,
+					      irec.br_blockcount);
+		if (error)
+			goto out_bmap_cancel;
+
+		error = xfs_bmapi_remap(tp, dest, destoff_fsb,
+					irec.br_blockcount, irec.br_startblock,
+					XFS_EXT_NORM, &firstfsb, &free_list);
+		if (error)
+			goto out_bmap_cancel;
+	}
+
+	error = xfs_bmap_finish(&tp, &free_list, &committed);
+	if (error)
+		goto out_bmap_cancel;
+
+	error = xfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES);
+	if (!error && done)
+		*done_fsb = irec.br_blockcount;
+	goto out_unlock;
+
+out_bmap_cancel:
+	xfs_bmap_cancel(&free_list);
+	xfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES | XFS_TRANS_ABORT);
+	goto out_unlock;
+out_cancel:
+	xfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES);
+out_unlock:
+	xfs_iunlock(src, XFS_ILOCK_EXCL);
+	if (src != dest)
+		xfs_iunlock(dest, XFS_ILOCK_EXCL);
+	return error;
+}
+
+/*
+ * Compare len bytes of two files through the page cache, for
+ * deduplication.  Returns EBADE if they differ.
+ */
+STATIC int
+xfs_reflink_compare_data(
+	struct xfs_inode	*src,
+	xfs_off_t		srcoff,
+	struct xfs_inode	*dest,
+	xfs_off_t		destoff,
+	xfs_off_t		len)
+{
+	struct address_space	*src_mapping = VFS_I(src)->i_mapping;
+	struct address_space	*dest_mapping = VFS_I(dest)->i_mapping;
+	struct page		*src_page;
+	struct page		*dest_page;
+	void			*src_addr;
+	void			*dest_addr;
+	unsigned int		src_poff;
+	unsigned int		dest_poff;
+	unsigned int		cmp_len;
+	int			same;
+
+	while (len > 0) {
+		src_poff = srcoff & (PAGE_CACHE_SIZE - 1);
+		dest_poff = destoff & (PAGE_CACHE_SIZE - 1);
+		cmp_len = min_t(xfs_off_t, len,
+				PAGE_CACHE_SIZE - max(src_poff, dest_poff));
+
+		src_page = read_mapping_page(src_mapping,
+				srcoff >> PAGE_CACHE_SHIFT, NULL);
+		if (IS_ERR(src_page))
+			return -PTR_ERR(src_page);
+		dest_page = read_mapping_page(dest_mapping,
+				destoff >> PAGE_CACHE_SHIFT, NULL);
+		if (IS_ERR(dest_page)) {
+			page_cache_release(src_page);
+			return -PTR_ERR(dest_page);
+		}
+
+		src_addr = kmap_atomic(src_page);
+		dest_addr = kmap_atomic(dest_page);
+		same = !memcmp(src_addr + src_poff, dest_addr + dest_poff,
+			       cmp_len);
+		kunmap_atomic(dest_addr);
+		kunmap_atomic(src_addr);
+		page_cache_release(dest_page);
+		page_cache_release(src_page);
+
+		if (!same)
+			return XFS_ERROR(EBADE);
+
+		srcoff += cmp_len;
+		destoff += cmp_len;
+		len -= cmp_len;
+	}
+	return 0;
+}
+
+/*
+ * Extend dest to cover the cloned range if needed and update its
+ * timestamps, like a write would.
+ */
+STATIC int
+xfs_reflink_update_dest(
+	struct xfs_inode	*dest,
+	xfs_off_t		newlen)
+{
+	struct xfs_mount	*mp = dest->i_mount;
+	struct xfs_trans	*tp;
+	int			error;
+
+	tp = xfs_trans_alloc(mp, XFS_TRANS_REFLINK);
+	error = xfs_trans_reserve(tp, &M_RES(mp)->tr_ichange, 0, 0);
+	if (error) {
+		xfs_trans_cancel(tp, 0);
+		return error;
+	}
+
+	xfs_ilock(dest, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, dest, XFS_ILOCK_EXCL);
+	if (newlen > XFS_ISIZE(dest)) {
+		dest->i_d.di_size = newlen;
+		i_size_write(VFS_I(dest), newlen);
+	}
+	xfs_trans_ichgtime(tp, dest, XFS_ICHGTIME_MOD | XFS_ICHGTIME_CHG);
+	xfs_trans_log_inode(tp, dest, XFS_ILOG_CORE);
+	return xfs_trans_commit(tp, 0);
+}
+
+/*
+ * Make [destoff, destoff + len) of dest share the blocks backing
+ * [srcoff, srcoff + len) of src.  A zero len means up to the end of src.
+ * Offsets must be block aligned, and so must len unless the range ends at
+ * the end of src and at or beyond the end of dest.  With is_dedupe the
+ * ranges must have the same contents, EBADE is returned otherwise, and
+ * dest is neither extended nor has its timestamps changed.
+ */
+int
+xfs_reflink_remap_range(
+	struct xfs_inode	*src,
+	xfs_off_t		srcoff,
+	struct xfs_inode	*dest,
+	xfs_off_t		destoff,
+	xfs_off_t		len,
+	bool			is_dedupe)
+{
+	struct xfs_mount	*mp = src->i_mount;
+	xfs_off_t		blkmask = mp->m_sb.sb_blocksize - 1;
+	xfs_off_t		pgmask = PAGE_CACHE_SIZE - 1;
+	xfs_fileoff_t		srcoff_fsb;
+	xfs_fileoff_t		destoff_fsb;
+	xfs_filblks_t		len_fsb;
+	xfs_filblks_t		done_fsb;
+	int			error;
+
+	if (!xfs_sb_version_hasreflink(&mp->m_sb))
+		return XFS_ERROR(EOPNOTSUPP);
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return XFS_ERROR(EIO);
+	if (XFS_IS_REALTIME_INODE(src) || XFS_IS_REALTIME_INODE(dest))
+		return XFS_ERROR(EINVAL);
+
+	error = xfs_qm_dqattach(dest, 0);
+	if (error)
+		return error;
+
+	/* keep out writes, page faults, truncates and direct I/O */
+	if (src == dest) {
+		xfs_ilock(src, XFS_IOLOCK_EXCL);
+		xfs_ilock(src, XFS_MMAPLOCK_EXCL);
+	} else {
+		xfs_lock_two_inodes(src, dest, XFS_IOLOCK_EXCL);
+		xfs_lock_two_inodes(src, dest, XFS_MMAPLOCK_EXCL);
+	}
+	inode_dio_wait(VFS_I(src));
+	if (src != dest)
+		inode_dio_wait(VFS_I(dest));
+
+	error = XFS_ERROR(EINVAL);
+	if (len == 0)
+		len = XFS_ISIZE(src) - srcoff;
+	if (srcoff < 0 || destoff < 0 || len <= 0 ||
+	    srcoff + len < srcoff || destoff + len < destoff)
+		goto out_unlock;
+	if (srcoff + len > XFS_ISIZE(src))
+		goto out_unlock;
+	if (is_dedupe && destoff + len > XFS_ISIZE(dest))
+		goto out_unlock;
+	if ((srcoff & blkmask) || (destoff & blkmask))
+		goto out_unlock;
+	/*
+	 * A partial last block is only shared when it is the last block of
+	 * src and nothing of dest beyond the range ends up in it.
+	 */
+	if ((len & blkmask) &&
+	    (srcoff + len != XFS_ISIZE(src) ||
+	     destoff + len < XFS_ISIZE(dest)))
+		goto out_unlock;
+	if (src == dest && srcoff + len > destoff && destoff + len > srcoff)
+		goto out_unlock;
+
+	/* only what is on disk can be shared */
+	error = -filemap_write_and_wait_range(VFS_I(src)->i_mapping,
+			srcoff & ~pgmask, (srcoff + len - 1) | pgmask);
+	if (error)
+		goto out_unlock;
+	error = -filemap_write_and_wait_range(VFS_I(dest)->i_mapping,
+			destoff & ~pgmask, (destoff + len - 1) | pgmask);
+	if (error)
+		goto out_unlock;
+
+	if (is_dedupe) {
+		error = xfs_reflink_compare_data(src, srcoff, dest, destoff,
+						 len);
+		if (error)
+			goto out_unlock;
+	}
+
+	error = xfs_reflink_set_inode_flag(src);
+	if (!error)
+		error = xfs_reflink_set_inode_flag(dest);
+	if (error)
+		goto out_unlock;
+
+	srcoff_fsb = XFS_B_TO_FSBT(mp, srcoff);
+	destoff_fsb = XFS_B_TO_FSBT(mp, destoff);
+	len_fsb = XFS_B_TO_FSB(mp, srcoff + len) - srcoff_fsb;
+	while (len_fsb > 0) {
+		error = xfs_reflink_remap_extent(src, srcoff_fsb, dest,
+				destoff_fsb, len_fsb, &done_fsb);
+		if (error)
+			goto out_invalidate;
+		srcoff_fsb += done_fsb;
+		destoff_fsb += done_fsb;
+		len_fsb -= done_fsb;
+	}
+
+	if (!is_dedupe)
+		error = xfs_reflink_update_dest(dest, destoff + len);
+
+out_invalidate:
+	/* the page cache of dest still holds the old, clean contents */
+	invalidate_inode_pages2_range(VFS_I(dest)->i_mapping,
+			destoff >> PAGE_CACHE_SHIFT,
+			(destoff + len - 1) >> PAGE_CACHE_SHIFT);
+out_unlock:
+	xfs_iunlock(src, XFS_MMAPLOCK_EXCL);
+	xfs_iunlock(src, XFS_IOLOCK_EXCL);
+	if (src != dest) {
+		xfs_iunlock(dest, XFS_MMAPLOCK_EXCL);
+		xfs_iunlock(dest, XFS_IOLOCK_EXCL);
+	}
+	return error;
+}
+
+/*
+ * Dirty [pos, pos + len) in the page cache without changing its contents,
+ * so that writeback moves it to blocks of its own.
+ */
+STATIC int
+xfs_reflink_dirty_range(
+	struct xfs_inode	*ip,
+	xfs_off_t		pos,
+	xfs_off_t		len)
+{
+	struct address_space	*mapping = VFS_I(ip)->i_mapping;
+	struct page		*page;
+	void			*fsdata;
+	unsigned int		bytes;
+	int			error;
+
+	while (len > 0) {
+		bytes = min_t(xfs_off_t, len,
+			      PAGE_CACHE_SIZE - (pos & (PAGE_CACHE_SIZE - 1)));
+
+		/* the data must be read in, write_begin skips whole blocks */
+		page = read_mapping_page(mapping, pos >> PAGE_CACHE_SHIFT, NULL);
+		if (IS_ERR(page))
+			return -PTR_ERR(page);
+		page_cache_release(page);
+
+		error = -pagecache_write_begin(NULL, mapping, pos, bytes, 0,
+					       &page, &fsdata);
+		if (error)
+			return error;
+		if (!PageUptodate(page)) {
+			/* reclaimed since we read it, try again */
+			pagecache_write_end(NULL, mapping, pos, bytes, 0,
+					    page, fsdata);
+			continue;
+		}
+		error = pagecache_write_end(NULL, mapping, pos, bytes, bytes,
+					    page, fsdata);
+		if (error < 0)
+			return -error;
+
+		pos += bytes;
+		len -= bytes;
+		balance_dirty_pages_ratelimited(mapping);
+	}
+	return 0;
+}
+
+/*
+ * Give every shared block backing [offset, offset + len) of the file a
+ * copy of its own and write it out, for the paths that write to disk
+ * without going through the page cache.  The caller holds the iolock
+ * exclusively.
+ */
+int
+xfs_reflink_unshare_range(
+	struct xfs_inode	*ip,
+	xfs_off_t		offset,
+	xfs_off_t		len)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_bmbt_irec	imap;
+	xfs_fileoff_t		offset_fsb;
+	xfs_fileoff_t		end_fsb;
+	xfs_extlen_t		soff;
+	xfs_extlen_t		slen;
+	xfs_off_t		isize;
+	xfs_off_t		start;
+	xfs_off_t		end;
+	bool			dirtied = false;
+	uint			lock_mode;
+	int			nimaps;
+	int			error;
+
+	if (!xfs_is_reflink_inode(ip))
+		return 0;
+
+	isize = i_size_read(VFS_I(ip));
+	if (offset >= isize)
+		return 0;
+	if (offset + len > isize)
+		len = isize - offset;
+
+	offset_fsb = XFS_B_TO_FSBT(mp, offset);
+	end_fsb = XFS_B_TO_FSB(mp, offset + len);
+	while (offset_fsb < end_fsb) {
+		nimaps = 1;
+		lock_mode = xfs_ilock_data_map_shared(ip);
+		error = xfs_bmapi_read(ip, offset_fsb, end_fsb - offset_fsb,
+				       &imap, &nimaps, 0);
+		xfs_iunlock(ip, lock_mode);
+		if (error)
+			return error;
+		if (!nimaps)
+			break;
+		offset_fsb = imap.br_startoff + imap.br_blockcount;
+
+		if (imap.br_startblock == HOLESTARTBLOCK ||
+		    imap.br_startblock == DELAYSTARTBLOCK)
+			continue;
+
+		while (imap.br_blockcount) {
+			error = xfs_refcount_find_shared(mp, NULL,
+					imap.br_startblock,
+					imap.br_blockcount, &soff, &slen);
+			if (error)
+				return error;
+			if (!slen)
+				break;
+
+			start = XFS_FSB_TO_B(mp, imap.br_startoff + soff);
+			end = XFS_FSB_TO_B(mp, imap.br_startoff + soff + slen);
+			error = xfs_reflink_dirty_range(ip, start,
+					min(end, isize) - start);
+			if (error)
+				return error;
+			dirtied = true;
+
+			imap.br_startoff += soff + slen;
+			imap.br_startblock += soff + slen;
+			imap.br_blockcount -= soff + slen;
+		}
+	}
+
+	if (!dirtied)
+		return 0;
+	return -filemap_write_and_wait_range(VFS_I(ip)->i_mapping, offset,
+					     offset + len - 1);
+}
+
+/*
+ * The data for the block at offset_fsb has been written to the CoW staging
+ * block fsbno.  In one transaction, remove the staging record, unmap the
+ * block the file had there, which drops its reference, and map the staging
+ * block in its place.  new_size is where the write ended, for the on-disk
+ * inode size.  Called from I/O completion.
+ */
+int
+xfs_reflink_end_cow(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		offset_fsb,
+	xfs_fsblock_t		fsbno,
+	xfs_fsize_t		new_size)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_trans	*tp;
+	struct xfs_bmap_free	free_list;
+	xfs_fsblock_t		firstfsb;
+	xfs_fsize_t		isize;
+	uint			resblks;
+	int			committed;
+	int			done;
+	int			error;
+
+	error = xfs_qm_dqattach(ip, 0);
+	if (error)
+		return error;
+
+	/*
+	 * Like unwritten extent conversion: unmapping the old block and
+	 * mapping the new one can each split an extent.
+	 */
+	resblks = (XFS_DIOSTRAT_SPACE_RES(mp, 0) << 1) +
+		  XFS_REFCOUNT_SPACE_RES(mp);
+
+	sb_start_intwrite(mp->m_super);
+	tp = _xfs_trans_alloc(mp, XFS_TRANS_STRAT_WRITE, KM_NOFS);
+	tp->t_flags |= XFS_TRANS_RESERVE | XFS_TRANS_FREEZE_PROT;
+	error = xfs_trans_reserve(tp, &M_RES(mp)->tr_write, resblks, 0);
+	if (error) {
+		xfs_trans_cancel(tp, 0);
+		return error;
+	}
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, ip, 0);
+
+	/* allocate in the AG of the staging block, whose AGF we lock first */
+	xfs_bmap_init(&free_list, &firstfsb);
+	firstfsb = fsbno;
+	error = xfs_refcount_free_cow_extent(tp, fsbno, 1);
+	if (error)
+		goto out_bmap_cancel;
+
+	error = xfs_bunmapi(tp, ip, offset_fsb, 1, 0, 1, &firstfsb,
+			    &free_list, &done);
+	if (error)
+		goto out_bmap_cancel;
+	ASSERT(done);
+
+	error = xfs_bmapi_remap(tp, ip, offset_fsb, 1, fsbno, XFS_EXT_NORM,
+				&firstfsb, &free_list);
+	if (error)
+		goto out_bmap_cancel;
+
+	isize = xfs_new_eof(ip, new_size);
+	if (isize) {
+		ip->i_d.di_size = isize;
+		xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	}
+
+	error = xfs_bmap_finish(&tp, &free_list, &committed);
+	if (error)
+		goto out_bmap_cancel;
+
+	error = xfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+
+out_bmap_cancel:
+	xfs_bmap_cancel(&free_list);
+	xfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES | XFS_TRANS_ABORT);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+}
+
+/*
+ * Free the CoW staging block fsbno, whose data could not be written.  The
+ * file still maps the block it had.
+ */
+int
+xfs_reflink_cancel_cow(
+	struct xfs_mount	*mp,
+	xfs_fsblock_t		fsbno)
+{
+	struct xfs_trans	*tp;
+	int			error;
+
+	sb_start_intwrite(mp->m_super);
+	tp = _xfs_trans_alloc(mp, XFS_TRANS_STRAT_WRITE, KM_NOFS);
+	tp->t_flags |= XFS_TRANS_RESERVE | XFS_TRANS_FREEZE_PROT;
+	error = xfs_trans_reserve(tp, &M_RES(mp)->tr_write,
+				  XFS_REFCOUNT_SPACE_RES(mp), 0);
+	if (error) {
+		xfs_trans_cancel(tp, 0);
+		return error;
+	}
+
+	error = xfs_refcount_free_cow_extent(tp, fsbno, 1);
+	if (!error)
+		error = xfs_free_extent(tp, fsbno, 1);
+	if (error) {
+		xfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES |
+				 XFS_TRANS_ABORT);
+		return error;
+	}
+	return xfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES);
+}
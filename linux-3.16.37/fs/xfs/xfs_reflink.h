@@ -0,0 +1,41 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef __XFS_REFLINK_H__
+#define	__XFS_REFLINK_H__
+
+struct xfs_inode;
+struct xfs_mount;
+
+/*
+ * Inodes that share blocks with another file, or have done so, check for
+ * shared blocks before overwriting anything.
+ */
+static inline bool
+xfs_is_reflink_inode(
+	struct xfs_inode	*ip)
+{
+	return (ip->i_d.di_flags2 & XFS_DIFLAG2_REFLINK) != 0;
+}
+
+int xfs_reflink_remap_range(struct xfs_inode *src, xfs_off_t srcoff,
+		struct xfs_inode *dest, xfs_off_t destoff, xfs_off_t len,
+		bool is_dedupe);
+int xfs_reflink_unshare_range(struct xfs_inode *ip, xfs_off_t offset,
+		xfs_off_t len);
+int xfs_reflink_end_cow(struct xfs_inode *ip, xfs_fileoff_t offset_fsb,
+		xfs_fsblock_t fsbno, xfs_fsize_t new_size);
+int xfs_reflink_cancel_cow(struct xfs_mount *mp, xfs_fsblock_t fsbno);
+
+#endif	/* __XFS_REFLINK_H__ */
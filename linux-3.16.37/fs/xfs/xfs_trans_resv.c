@@ -167,6 +167,22 @@ xfs_calc_finobt_res(
  */
 
 
+/*
+ * On reflink filesystems, freeing an extent or taking another reference to
+ * it can also split the refcount btree of its AG:
+ *    the refcount btree: nr_ops * (2 * max depth - 1) * block size
+ */
+STATIC uint
+xfs_calc_refcountbt_reservation(
+	struct xfs_mount	*mp,
+	uint			nr_ops)
+{
+	if (!xfs_sb_version_hasreflink(&mp->m_sb))
+		return 0;
+	return xfs_calc_buf_res(nr_ops * (2 * mp->m_refc_maxlevels - 1),
+				XFS_FSB_TO_B(mp, 1));
+}
+
 /*
  * In a write transaction we can allocate a maximum of 2
  * extents.  This gives:
@@ -180,6 +196,7 @@ xfs_calc_finobt_res(
  *    the agfls of the ags containing the blocks: 2 * sector size
  *    the super block free block counter: sector size
  *    the allocation btrees: 2 exts * 2 trees * (2 * max depth - 1) * block size
+ *    the refcount btrees of a reflink filesystem for the 2 exts
  */
 STATIC uint
 xfs_calc_write_reservation(
@@ -194,7 +211,8 @@ xfs_calc_write_reservation(
 				      XFS_FSB_TO_B(mp, 1))),
 		    (xfs_calc_buf_res(5, mp->m_sb.sb_sectsize) +
 		     xfs_calc_buf_res(XFS_ALLOCFREE_LOG_COUNT(mp, 2),
-				      XFS_FSB_TO_B(mp, 1))));
+				      XFS_FSB_TO_B(mp, 1)) +
+		     xfs_calc_refcountbt_reservation(mp, 2)));
 }
 
 /*
@@ -209,6 +227,7 @@ xfs_calc_write_reservation(
  *		4 exts * 2 trees * (2 * max depth - 1) * block size
  *    the inode btree: max depth * blocksize
  *    the allocation btrees: 2 trees * (max depth - 1) * block size
+ *    the refcount btrees of a reflink filesystem for the 4 exts
  */
 STATIC uint
 xfs_calc_itruncate_reservation(
@@ -225,7 +244,8 @@ xfs_calc_itruncate_reservation(
 		    xfs_calc_buf_res(XFS_ALLOCFREE_LOG_COUNT(mp, 1),
 				     XFS_FSB_TO_B(mp, 1)) +
 		    xfs_calc_buf_res(2 + mp->m_ialloc_blks +
-				     mp->m_in_maxlevels, 0)));
+				     mp->m_in_maxlevels, 0) +
+		    xfs_calc_refcountbt_reservation(mp, 4)));
 }
 
 /*
@@ -79,6 +79,9 @@
 	 XFS_DQUOT_CLUSTER_SIZE_FSB)
 #define	XFS_QM_QINOCREATE_SPACE_RES(mp)	\
 	XFS_IALLOC_SPACE_RES(mp)
+/* a refcount update can split a record in two and insert another one */
+#define	XFS_REFCOUNT_SPACE_RES(mp)	\
+	(xfs_sb_version_hasreflink(&mp->m_sb) ? 2 * (mp)->m_refc_maxlevels : 0)
 #define	XFS_REMOVE_SPACE_RES(mp)	\
 	XFS_DIRREMOVE_SPACE_RES(mp)
 #define	XFS_RENAME_SPACE_RES(mp,nl)	\
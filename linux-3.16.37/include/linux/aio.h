@@ -29,6 +29,9 @@ struct kiocb;
 
 typedef int (kiocb_cancel_fn)(struct kiocb *);
 
+/* ki_flags bits */
+#define IOCB_NOWAIT		(1 << 0)	/* fail with -EAGAIN, don't block */
+
 struct kiocb {
 	struct file		*ki_filp;
 	struct kioctx		*ki_ctx;	/* NULL for sync ops */
@@ -43,6 +46,7 @@ struct kiocb {
 	__u64			ki_user_data;	/* user's data for completion */
 	loff_t			ki_pos;
 	size_t			ki_nbytes;	/* copy of iocb->aio_nbytes */
+	int			ki_flags;	/* IOCB_* */
 
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
@@ -65,6 +69,7 @@ static inline void init_sync_kiocb(struct kiocb *kiocb, struct file *filp)
 			.ki_ctx = NULL,
 			.ki_filp = filp,
 			.ki_obj.tsk = current,
+			.ki_flags = 0,
 		};
 }
 
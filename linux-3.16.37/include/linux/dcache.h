@@ -61,7 +61,8 @@ struct dentry_stat_t {
 	long nr_unused;
 	long age_limit;          /* age in seconds */
 	long want_pages;         /* pages requested by system */
-	long dummy[2];
+	long nr_negative;        /* unused negative dentries */
+	long dummy[1];
 };
 extern struct dentry_stat_t dentry_stat;
 
@@ -222,6 +223,7 @@ struct dentry_operations {
 #define DCACHE_FILE_TYPE		0x00400000 /* Other file type */
 
 #define DCACHE_MAY_FREE			0x00800000
+#define DCACHE_PATH_CACHED		0x01000000 /* On a path in some task's path cache */
 
 extern seqlock_t rename_lock;
 
@@ -468,6 +470,7 @@ static inline bool d_is_positive(const struct dentry *dentry)
 }
 
 extern int sysctl_vfs_cache_pressure;
+extern int sysctl_negative_dentry_ratio;
 
 static inline unsigned long vfs_pressure_ratio(unsigned long val)
 {
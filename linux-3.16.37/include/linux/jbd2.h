@@ -269,7 +269,10 @@ typedef struct journal_superblock_s
 /* 0x0050 */
 	__u8	s_checksum_type;	/* checksum type */
 	__u8	s_padding2[3];
-	__u32	s_padding[42];
+/* 0x0054 */
+	__u32	s_padding[41];
+/* 0x00F8 */
+	__be32	s_fc_area_blks;		/* Blocks in the fast commit area */
 	__be32	s_checksum;		/* crc32c(superblock) */
 
 /* 0x0100 */
@@ -294,6 +297,8 @@ typedef struct journal_superblock_s
 #define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 #define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x00000008
 #define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x00000010
+/* Not the mainline fast commit format, kept clear of its bits */
+#define JBD2_FEATURE_INCOMPAT_FC_AREA		0x80000000
 
 /* Features known to this kernel version: */
 #define JBD2_KNOWN_COMPAT_FEATURES	JBD2_FEATURE_COMPAT_CHECKSUM
@@ -302,7 +307,8 @@ typedef struct journal_superblock_s
 					JBD2_FEATURE_INCOMPAT_64BIT | \
 					JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT | \
 					JBD2_FEATURE_INCOMPAT_CSUM_V2 | \
-					JBD2_FEATURE_INCOMPAT_CSUM_V3)
+					JBD2_FEATURE_INCOMPAT_CSUM_V3 | \
+					JBD2_FEATURE_INCOMPAT_FC_AREA)
 
 #ifdef __KERNEL__
 
@@ -666,10 +672,18 @@ struct transaction_run_stats_s {
 	__u32			rs_blocks_logged;
 };
 
+/*
+ * Commit latency histogram: bucket 0 counts commits under 1us, bucket n
+ * those of [2^(n-1), 2^n) us, and the last one everything slower.
+ */
+#define JBD2_COMMIT_HIST_BUCKETS	24
+
 struct transaction_stats_s {
 	unsigned long		ts_tid;
 	unsigned long		ts_requested;
+	unsigned long		ts_overlapped;
 	struct transaction_run_stats_s run;
+	unsigned long		ts_commit_hist[JBD2_COMMIT_HIST_BUCKETS];
 };
 
 static inline unsigned long
@@ -697,6 +711,8 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_barrier: The barrier lock itself
  * @j_running_transaction: The current running transaction..
  * @j_committing_transaction: the transaction we are pushing to disk
+ * @j_finishing_transaction: the previous transaction, still waiting for its
+ *  IO to complete while the next one is being written out
  * @j_checkpoint_transactions: a linked circular list of all transactions
  *  waiting for checkpointing
  * @j_wait_transaction_locked: Wait queue for waiting for a locked transaction
@@ -706,12 +722,24 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_wait_updates: Wait queue to wait for updates to complete
  * @j_wait_reserved: Wait queue to wait for reserved buffer credits to drop
  * @j_checkpoint_mutex: Mutex for locking against concurrent checkpoints
+ * @j_checkpoint_task: Background checkpoint thread
+ * @j_wait_checkpoint: Wait queue to trigger the checkpoint thread
+ * @j_wait_checkpoint_done: Wait queue for checkpoint rounds to complete
+ * @j_checkpoint_request: Number of the latest requested checkpoint round
+ * @j_checkpoint_sequence: Number of the latest completed checkpoint round
+ * @j_checkpoint_low_wm: Free log space below which the checkpoint thread
+ *  starts writing back checkpointed buffers
  * @j_head: Journal head - identifies the first unused block in the journal
  * @j_tail: Journal tail - identifies the oldest still-used block in the
  *  journal.
  * @j_free: Journal free - how many free blocks are there in the journal?
  * @j_first: The block number of the first usable block
  * @j_last: The block number one beyond the last usable block
+ * @j_fc_first: The block number of the first fast commit block
+ * @j_fc_last: The block number one beyond the last fast commit block
+ * @j_fc_off: Number of fast commit blocks used since the last full commit
+ * @j_fc_wbuf: Buffers of the fast commit blocks being written
+ * @j_fc_wait: Wait queue for fast and full commits to wait for each other
  * @j_dev: Device where we store the journal
  * @j_blocksize: blocksize for the location where we store the journal.
  * @j_blk_offset: starting block offset for into the device where we store the
@@ -796,6 +824,14 @@ struct journal_s
 	 */
 	transaction_t		*j_committing_transaction;
 
+	/*
+	 * the previous transaction when two commits overlap: its log blocks
+	 * are written and it waits for its IO while the next one is being
+	 * written out.  Always older than j_committing_transaction.
+	 * [j_state_lock]
+	 */
+	transaction_t		*j_finishing_transaction;
+
 	/*
 	 * ... and a linked circular list of all transactions waiting for
 	 * checkpointing. [j_list_lock]
@@ -830,6 +866,19 @@ struct journal_s
 	 * j_checkpoint_mutex.  [j_checkpoint_mutex]
 	 */
 	struct buffer_head	*j_chkpt_bhs[JBD2_NR_BATCH];
+
+	/*
+	 * Background checkpointing: the thread writes back checkpointed
+	 * buffers while free log space is below j_checkpoint_low_wm, and
+	 * runs a round for each request from tasks waiting for log space.
+	 * [j_list_lock for the request and sequence numbers]
+	 */
+	struct task_struct	*j_checkpoint_task;
+	wait_queue_head_t	j_wait_checkpoint;
+	wait_queue_head_t	j_wait_checkpoint_done;
+	unsigned long		j_checkpoint_request;
+	unsigned long		j_checkpoint_sequence;
+	unsigned long		j_checkpoint_low_wm;
 	
 	/*
 	 * Journal head: identifies the first unused block in the journal.
@@ -856,6 +905,19 @@ struct journal_s
 	unsigned long		j_first;
 	unsigned long		j_last;
 
+	/*
+	 * The fast commit area at the end of the journal, when there is one,
+	 * and how much of it the fast commits since the last full commit
+	 * have used.  [j_state_lock, j_fc_off by the fast commit owner]
+	 */
+	unsigned long		j_fc_first;
+	unsigned long		j_fc_last;
+	unsigned long		j_fc_off;
+	struct buffer_head	**j_fc_wbuf;
+
+	/* Wait queue for a fast commit or a full commit to finish */
+	wait_queue_head_t	j_fc_wait;
+
 	/*
 	 * Device, blocksize and starting block offset for the location where we
 	 * store the journal.
@@ -1008,6 +1070,12 @@ struct journal_s
 						 * data write error in ordered
 						 * mode */
 #define JBD2_REC_ERR	0x080	/* The errno in the sb has been recorded */
+#define JBD2_FAST_COMMIT_ONGOING	0x100	/* A fast commit is being
+						 * written */
+#define JBD2_FULL_COMMIT_ONGOING	0x200	/* A transaction is being
+						 * committed */
+#define JBD2_FC_REPLAY_PENDING	0x400	/* The fast commit area hasn't
+						 * been replayed yet */
 
 /*
  * Function declarations for the journaling transaction and buffer
@@ -1246,10 +1314,23 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
 int jbd2_complete_transaction(journal_t *journal, tid_t tid);
+
+/* Fast commits */
+int jbd2_fc_init(journal_t *journal, unsigned int num_fc_blks);
+void jbd2_fc_replay_done(journal_t *journal);
+int jbd2_fc_begin_commit(journal_t *journal, tid_t tid);
+void jbd2_fc_end_commit(journal_t *journal);
+int jbd2_fc_get_buf(journal_t *journal, struct buffer_head **bhp);
+int jbd2_fc_write_bufs(journal_t *journal, int num_blks);
+void jbd2_fc_release_bufs(journal_t *journal, int num_blks);
+struct buffer_head *jbd2_fc_read_buf(journal_t *journal, unsigned long off);
 int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
+int jbd2_checkpoint_start_thread(journal_t *journal);
+void jbd2_checkpoint_stop_thread(journal_t *journal);
+void jbd2_checkpoint_wakeup(journal_t *journal);
 extern void __jbd2_journal_drop_transaction(journal_t *, transaction_t *);
 extern int jbd2_cleanup_journal_tail(journal_t *);
 
@@ -1349,9 +1430,29 @@ static inline unsigned long jbd2_log_space_left(journal_t *journal)
 		/* Transaction + control blocks */
 		free -= committing + (committing >> JBD2_CONTROL_BLOCKS_SHIFT);
 	}
+	if (journal->j_finishing_transaction) {
+		unsigned long finishing = atomic_read(&journal->
+			j_finishing_transaction->t_outstanding_credits);
+
+		free -= finishing + (finishing >> JBD2_CONTROL_BLOCKS_SHIFT);
+	}
 	return free;
 }
 
+/*
+ * Is @transaction being committed, either as the committing transaction or
+ * as the previous one finishing its commit?  Must be called under
+ * j_state_lock or with a handle open, like the checks of
+ * j_committing_transaction it replaces.
+ */
+static inline int jbd2_transaction_committing(journal_t *journal,
+					      transaction_t *transaction)
+{
+	return transaction &&
+	       (transaction == journal->j_committing_transaction ||
+		transaction == journal->j_finishing_transaction);
+}
+
 /*
  * Definitions which augment the buffer_head layer
  */
@@ -507,6 +507,8 @@ void __memcg_uncharge_slab(struct kmem_cache *cachep, int order);
 
 int __memcg_cleanup_cache_params(struct kmem_cache *s);
 
+struct mem_cgroup *mem_cgroup_from_kmem(void *ptr);
+
 /**
  * memcg_kmem_newpage_charge: verify if a new kmem allocation is allowed.
  * @gfp: the gfp allocation flags.
@@ -749,6 +749,30 @@ struct netdev_phys_port_id {
 	unsigned char id_len;
 };
 
+/* User memory a driver receives into directly, see ndo_umem_setup.
+ * Frames are frame_size bytes at offsets into an area backed by pages[]
+ * and mapped at frames, none of them crosses a page. Packet data goes
+ * headroom bytes into a frame.
+ */
+struct netdev_umem {
+	struct page		**pages;
+	void			*frames;
+	u64			len;
+	u32			frame_size;
+	u32			headroom;
+
+	/* take a free frame, false if user space has none queued */
+	bool			(*get_frame)(struct netdev_umem *umem,
+					     u64 *addr);
+	/* hand a frame back with len bytes of data and TP_STATUS_* status,
+	 * false if there is no room to post it and the driver keeps it
+	 */
+	bool			(*put_frame)(struct netdev_umem *umem,
+					     u64 addr, u32 len, u32 status);
+	/* drop the driver's reference, it no longer holds any frame */
+	void			(*release)(struct netdev_umem *umem);
+};
+
 typedef u16 (*select_queue_fallback_t)(struct net_device *dev,
 				       struct sk_buff *skb);
 
@@ -996,6 +1020,15 @@ typedef u16 (*select_queue_fallback_t)(struct net_device *dev,
  *	Callback to use for xmit over the accelerated station. This
  *	is used in place of ndo_start_xmit on accelerated net
  *	devices.
+ *
+ * int (*ndo_umem_setup)(struct net_device *dev, u16 queue,
+ *			 struct netdev_umem *umem);
+ *	Called with RTNL held to make RX queue 'queue' receive straight into
+ *	the frames of 'umem', or to stop doing so if 'umem' is NULL. Packets
+ *	received into user memory bypass the stack. On success the driver
+ *	holds a reference to 'umem' until it calls umem->release(), which
+ *	may be after it was told to stop if the device still has frames.
+ *	Stopping a device that is down must not sleep.
  */
 struct net_device_ops {
 	int			(*ndo_init)(struct net_device *dev);
@@ -1144,6 +1177,9 @@ struct net_device_ops {
 							struct net_device *dev,
 							void *priv);
 	int			(*ndo_get_lock_subclass)(struct net_device *dev);
+	int			(*ndo_umem_setup)(struct net_device *dev,
+						  u16 queue,
+						  struct netdev_umem *umem);
 };
 
 /**
@@ -3318,6 +3354,7 @@ static inline bool net_gso_ok(netdev_features_t features, int gso_type)
 	BUILD_BUG_ON(SKB_GSO_UDP_TUNNEL != (NETIF_F_GSO_UDP_TUNNEL >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_UDP_TUNNEL_CSUM != (NETIF_F_GSO_UDP_TUNNEL_CSUM >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_MPLS    != (NETIF_F_GSO_MPLS >> NETIF_F_GSO_SHIFT));
+	BUILD_BUG_ON(SKB_GSO_UDP_L4  != (NETIF_F_GSO_UDP_L4 >> NETIF_F_GSO_SHIFT));
 
 	return (features & feature) == feature;
 }
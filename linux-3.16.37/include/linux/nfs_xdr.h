@@ -1231,6 +1231,36 @@ struct nfs41_free_stateid_res {
 	unsigned int			status;
 };
 
+#ifdef CONFIG_NFS_V4_2
+/*
+ * COPY is sent as SEQUENCE, PUTFH(src), SAVEFH, PUTFH(dst), COPY, COMMIT so
+ * that the copied range is on stable storage when the call returns.
+ */
+struct nfs42_copy_args {
+	struct nfs4_sequence_args	seq_args;
+
+	struct nfs_fh			*src_fh;
+	nfs4_stateid			src_stateid;
+	u64				src_pos;
+
+	struct nfs_fh			*dst_fh;
+	nfs4_stateid			dst_stateid;
+	u64				dst_pos;
+
+	u64				count;
+};
+
+struct nfs42_copy_res {
+	struct nfs4_sequence_res	seq_res;
+	u64				count;
+	struct nfs_writeverf		write_verf;
+	bool				consecutive;
+	bool				synchronous;
+	struct nfs_commitres		commit_res;
+	struct nfs_writeverf		commit_verf;
+};
+#endif /* CONFIG_NFS_V4_2 */
+
 static inline void
 nfs_free_pnfs_ds_cinfo(struct pnfs_ds_commit_info *cinfo)
 {
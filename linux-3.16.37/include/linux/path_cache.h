@@ -0,0 +1,82 @@
+/*
+ * Per-task cache of resolved absolute paths, see fs/path_cache.c
+ */
+#ifndef _LINUX_PATH_CACHE_H
+#define _LINUX_PATH_CACHE_H
+
+#include <linux/atomic.h>
+#include <linux/dcache.h>
+
+struct nameidata;
+struct task_struct;
+struct ctl_table;
+
+/* Taken before a walk, checked again before its result is cached */
+struct path_cache_snapshot {
+	unsigned int	len;		/* 0 if the name can't be cached */
+	unsigned int	gen;
+	unsigned	r_seq, m_seq, fs_seq;
+};
+
+struct path_cache_stat_t {
+	long hits;
+	long misses;
+	long stale;		/* found, but invalidated since */
+	long inserts;
+};
+
+#ifdef CONFIG_PATH_CACHE
+extern int sysctl_path_cache;
+extern atomic_t path_cache_gen;
+extern struct path_cache_stat_t path_cache_stat;
+
+int proc_path_cache_state(struct ctl_table *table, int write,
+			  void __user *buffer, size_t *lenp, loff_t *ppos);
+
+bool path_cache_lookup(const char *name, unsigned int flags,
+		       struct nameidata *nd, struct path_cache_snapshot *snap);
+void path_cache_insert(const char *name, unsigned int flags,
+		       struct nameidata *nd, struct path_cache_snapshot *snap);
+void exit_path_cache(struct task_struct *tsk);
+
+/*
+ * Called when something that a cached walk depended on changes in a way
+ * that rename_lock and mount_lock don't catch: a dentry on a cached path
+ * is unhashed or turned negative, or a directory's permissions change.
+ */
+static inline void path_cache_invalidate(void)
+{
+	atomic_inc(&path_cache_gen);
+}
+
+static inline void d_path_cache_invalidate(struct dentry *dentry)
+{
+	if (unlikely(dentry->d_flags & DCACHE_PATH_CACHED))
+		path_cache_invalidate();
+}
+#else
+static inline bool path_cache_lookup(const char *name, unsigned int flags,
+		struct nameidata *nd, struct path_cache_snapshot *snap)
+{
+	return false;
+}
+
+static inline void path_cache_insert(const char *name, unsigned int flags,
+		struct nameidata *nd, struct path_cache_snapshot *snap)
+{
+}
+
+static inline void exit_path_cache(struct task_struct *tsk)
+{
+}
+
+static inline void path_cache_invalidate(void)
+{
+}
+
+static inline void d_path_cache_invalidate(struct dentry *dentry)
+{
+}
+#endif /* CONFIG_PATH_CACHE */
+
+#endif /* _LINUX_PATH_CACHE_H */
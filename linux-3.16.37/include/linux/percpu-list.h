@@ -0,0 +1,61 @@
+/*
+ * Lists sharded by CPU
+ *
+ * A pcpu_list is a set of spinlock protected lists, one per possible CPU.
+ * Additions go to the list of the CPU the caller runs on, and removals
+ * to the list the node was added to, so that adding and removing on
+ * different CPUs doesn't bounce a single lock.  Walkers visit the lists
+ * one at a time with pcpu_list_for_each_head(), taking each list's lock.
+ */
+#ifndef _LINUX_PERCPU_LIST_H
+#define _LINUX_PERCPU_LIST_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/cpumask.h>
+
+struct pcpu_list_head {
+	spinlock_t		lock;
+	struct list_head	list;
+} ____cacheline_aligned_in_smp;
+
+struct pcpu_list {
+	struct pcpu_list_head	*heads;		/* nr_cpu_ids of them */
+};
+
+struct pcpu_list_node {
+	struct list_head	list;
+	struct pcpu_list_head	*head;		/* NULL while not on a list */
+};
+
+int pcpu_list_init(struct pcpu_list *plist);
+void pcpu_list_destroy(struct pcpu_list *plist);
+bool pcpu_list_empty(struct pcpu_list *plist);
+void pcpu_list_add(struct pcpu_list_node *node, struct pcpu_list *plist);
+void pcpu_list_del(struct pcpu_list_node *node);
+
+static inline void pcpu_list_node_init(struct pcpu_list_node *node)
+{
+	INIT_LIST_HEAD(&node->list);
+	node->head = NULL;
+}
+
+static inline bool pcpu_list_node_linked(struct pcpu_list_node *node)
+{
+	return ACCESS_ONCE(node->head) != NULL;
+}
+
+/**
+ * pcpu_list_for_each_head - iterate over the per-CPU lists
+ * @pos:	the struct pcpu_list_head * to use as a loop cursor
+ * @plist:	the struct pcpu_list
+ *
+ * The caller takes @pos->lock around walking @pos->list.  A walker that
+ * drops the lock in the middle of a list has to make sure the entry it
+ * continues from stays on that list, e.g. by holding a reference.
+ */
+#define pcpu_list_for_each_head(pos, plist)				\
+	for ((pos) = (plist)->heads;					\
+	     (pos) < (plist)->heads + nr_cpu_ids; (pos)++)
+
+#endif /* _LINUX_PERCPU_LIST_H */
@@ -0,0 +1,73 @@
+/*
+ * Range locks
+ *
+ * A range lock tree lets tasks lock ranges [start, last] of some index
+ * space, typically page indices of a file, exclusively.  Locks on ranges
+ * that don't overlap are independent of each other; a lock on a range
+ * that overlaps ranges locked (or waited for) earlier sleeps until all of
+ * those are unlocked, so waiters are served in the order they arrived.
+ *
+ * The locked ranges are kept in an interval tree protected by a spinlock,
+ * which is only held while a range is inserted or removed.
+ */
+#ifndef _LINUX_RANGE_LOCK_H
+#define _LINUX_RANGE_LOCK_H
+
+#include <linux/rbtree.h>
+#include <linux/interval_tree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct task_struct;
+
+struct range_lock_tree {
+	struct rb_root		root;
+	spinlock_t		lock;
+	unsigned long		seqnum;		/* of the last lock inserted */
+};
+
+struct range_lock {
+	struct interval_tree_node node;
+	struct task_struct	*task;
+	unsigned long		blocking_ranges;	/* overlapping, older */
+	unsigned long		seqnum;
+};
+
+#define RANGE_LOCK_FULL		(~0UL)
+
+#define __RANGE_LOCK_TREE_INITIALIZER(name)				\
+	{ .root = RB_ROOT,						\
+	  .lock = __SPIN_LOCK_UNLOCKED(name.lock) }
+
+#define DEFINE_RANGE_LOCK_TREE(name)					\
+	struct range_lock_tree name = __RANGE_LOCK_TREE_INITIALIZER(name)
+
+static inline void range_lock_tree_init(struct range_lock_tree *tree)
+{
+	tree->root = RB_ROOT;
+	spin_lock_init(&tree->lock);
+	tree->seqnum = 0;
+}
+
+static inline void range_lock_init(struct range_lock *lock,
+				   unsigned long start, unsigned long last)
+{
+	lock->node.start = start;
+	lock->node.last = last;
+	lock->task = NULL;
+	lock->blocking_ranges = 0;
+	lock->seqnum = 0;
+}
+
+static inline void range_lock_init_full(struct range_lock *lock)
+{
+	range_lock_init(lock, 0, RANGE_LOCK_FULL);
+}
+
+void range_lock(struct range_lock_tree *tree, struct range_lock *lock);
+int range_lock_killable(struct range_lock_tree *tree, struct range_lock *lock);
+bool range_trylock(struct range_lock_tree *tree, struct range_lock *lock);
+void range_unlock(struct range_lock_tree *tree, struct range_lock *lock);
+void range_lock_drain(struct range_lock_tree *tree);
+
+#endif /* _LINUX_RANGE_LOCK_H */
@@ -128,6 +128,7 @@ struct futex_pi_state;
 struct robust_list_head;
 struct bio_list;
 struct fs_struct;
+struct path_cache;
 struct perf_event_context;
 struct blk_plug;
 struct filename;
@@ -1396,6 +1397,9 @@ struct task_struct {
 				     - initialized normally by setup_new_exec */
 /* file system info */
 	int link_count, total_link_count;
+#ifdef CONFIG_PATH_CACHE
+	struct path_cache *path_cache;
+#endif
 #ifdef CONFIG_SYSVIPC
 /* ipc stuff */
 	struct sysv_sem sysvsem;
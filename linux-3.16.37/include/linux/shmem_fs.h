@@ -6,6 +6,7 @@
 #include <linux/pagemap.h>
 #include <linux/percpu_counter.h>
 #include <linux/xattr.h>
+#include <linux/range_lock.h>
 
 /* inode in-kernel data */
 
@@ -20,6 +21,7 @@ struct shmem_inode_info {
 	struct shared_policy	policy;		/* NUMA memory alloc policy */
 	struct list_head	swaplist;	/* chain of maybes on swap */
 	struct simple_xattrs	xattrs;		/* list of xattrs */
+	struct range_lock_tree	write_ranges;	/* see shmem_file_write_iter */
 	struct inode		vfs_inode;
 };
 
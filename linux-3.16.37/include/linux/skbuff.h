@@ -351,6 +351,7 @@ enum {
 
 	SKB_GSO_MPLS = 1 << 12,
 
+	SKB_GSO_UDP_L4 = 1 << 13,
 };
 
 #if BITS_PER_LONG > 32
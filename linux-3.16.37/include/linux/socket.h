@@ -11,6 +11,7 @@
 
 struct pid;
 struct cred;
+struct socket;
 
 #define __sockaddr_check_size(size)	\
 	BUILD_BUG_ON(((size) > sizeof(struct __kernel_sockaddr_storage)))
@@ -321,6 +322,10 @@ struct timespec;
 /* The __sys_...msg variants allow MSG_CMSG_COMPAT */
 extern long __sys_recvmsg(int fd, struct msghdr __user *msg, unsigned flags);
 extern long __sys_sendmsg(int fd, struct msghdr __user *msg, unsigned flags);
+extern long __sys_recvmsg_sock(struct socket *sock, struct msghdr __user *msg,
+			       unsigned flags);
+extern long __sys_sendmsg_sock(struct socket *sock, struct msghdr __user *msg,
+			       unsigned flags);
 extern int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 			  unsigned int flags, struct timespec *timeout);
 extern int __sys_sendmmsg(int fd, struct mmsghdr __user *mmsg,
@@ -72,40 +72,52 @@ static inline bool busy_loop_timeout(unsigned long end_time)
 	return time_after(now, end_time);
 }
 
+/* The NAPI context @napi_id, if its driver can be busy polled.
+ * Called under rcu_read_lock_bh() for the napi hash.
+ */
+static inline struct napi_struct *napi_busy_poll_find(unsigned int napi_id)
+{
+	struct napi_struct *napi = napi_by_id(napi_id);
+
+	if (!napi || !napi->dev->netdev_ops->ndo_busy_poll)
+		return NULL;
+	return napi;
+}
+
+/* Poll @napi once and account the packets to @net.
+ * Called under rcu_read_lock_bh(), which also keeps net_rx_action away.
+ */
+static inline int __napi_busy_poll(struct napi_struct *napi, struct net *net)
+{
+	int rc = napi->dev->netdev_ops->ndo_busy_poll(napi);
+
+	if (rc > 0)
+		/* local bh are disabled so it is ok to use _BH */
+		NET_ADD_STATS_BH(net, LINUX_MIB_BUSYPOLLRXPACKETS, rc);
+	return rc;
+}
+
 /* when used in sock_poll() nonblock is known at compile time to be true
  * so the loop and end_time will be optimized out
  */
 static inline bool sk_busy_loop(struct sock *sk, int nonblock)
 {
 	unsigned long end_time = !nonblock ? sk_busy_loop_end_time(sk) : 0;
-	const struct net_device_ops *ops;
 	struct napi_struct *napi;
 	int rc = false;
 
-	/*
-	 * rcu read lock for napi hash
-	 * bh so we don't race with net_rx_action
-	 */
 	rcu_read_lock_bh();
 
-	napi = napi_by_id(sk->sk_napi_id);
+	napi = napi_busy_poll_find(sk->sk_napi_id);
 	if (!napi)
 		goto out;
 
-	ops = napi->dev->netdev_ops;
-	if (!ops->ndo_busy_poll)
-		goto out;
-
 	do {
-		rc = ops->ndo_busy_poll(napi);
+		rc = __napi_busy_poll(napi, sock_net(sk));
 
 		if (rc == LL_FLUSH_FAILED)
 			break; /* permanent failure */
 
-		if (rc > 0)
-			/* local bh are disabled so it is ok to use _BH */
-			NET_ADD_STATS_BH(sock_net(sk),
-					 LINUX_MIB_BUSYPOLLRXPACKETS, rc);
 		cpu_relax();
 
 	} while (!nonblock && skb_queue_empty(&sk->sk_receive_queue) &&
@@ -117,6 +129,20 @@ out:
 	return rc;
 }
 
+/* Poll one NAPI context once, for callers that watch many sockets */
+static inline int napi_busy_poll_once(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	int rc = 0;
+
+	rcu_read_lock_bh();
+	napi = napi_busy_poll_find(napi_id);
+	if (napi)
+		rc = __napi_busy_poll(napi, dev_net(napi->dev));
+	rcu_read_unlock_bh();
+	return rc;
+}
+
 /* used in the NIC receive handler to mark the skb */
 static inline void skb_mark_napi_id(struct sk_buff *skb,
 				    struct napi_struct *napi)
@@ -165,5 +191,10 @@ static inline bool sk_busy_loop(struct sock *sk, int nonblock)
 	return false;
 }
 
+static inline int napi_busy_poll_once(unsigned int napi_id)
+{
+	return 0;
+}
+
 #endif /* CONFIG_NET_RX_BUSY_POLL */
 #endif /* _LINUX_NET_BUSY_POLL_H */
@@ -319,7 +319,7 @@ static inline bool ipv6_accept_ra(struct inet6_dev *idev)
 #if IS_ENABLED(CONFIG_IPV6)
 static inline int ip6_frag_nqueues(struct net *net)
 {
-	return net->ipv6.frags.nqueues;
+	return inet_frag_nqueues(&net->ipv6.frags);
 }
 
 static inline int ip6_frag_mem(struct net *net)
@@ -506,17 +506,18 @@ enum ip6_defrag_users {
 	__IP6_DEFRAG_CONNTRACK_BRIDGE_IN = IP6_DEFRAG_CONNTRACK_BRIDGE_IN + USHRT_MAX,
 };
 
-struct ip6_create_arg {
-	__be32 id;
-	u32 user;
-	const struct in6_addr *src;
-	const struct in6_addr *dst;
-	int iif;
-	u8 ecn;
-};
-
-void ip6_frag_init(struct inet_frag_queue *q, void *a);
-bool ip6_frag_match(struct inet_frag_queue *q, void *a);
+static inline void ip6_frag_key(struct frag_v6_compare_key *key, __be32 id,
+				u32 user, const struct in6_addr *src,
+				const struct in6_addr *dst, int iif)
+{
+	key->saddr = *src;
+	key->daddr = *dst;
+	key->user = user;
+	key->id = id;
+	/* The interface only tells apart scoped destinations */
+	key->iif = ipv6_addr_type(dst) & (IPV6_ADDR_MULTICAST |
+					  IPV6_ADDR_LINKLOCAL) ? iif : 0;
+}
 
 /*
  *	Equivalent of ipv4 struct ip
@@ -524,11 +525,6 @@ bool ip6_frag_match(struct inet_frag_queue *q, void *a);
 struct frag_queue {
 	struct inet_frag_queue	q;
 
-	__be32			id;		/* fragment id		*/
-	u32			user;
-	struct in6_addr		saddr;
-	struct in6_addr		daddr;
-
 	int			iif;
 	unsigned int		csum;
 	__u16			nhoffset;
@@ -0,0 +1,101 @@
+#ifndef _NF_FLOW_TABLE_H
+#define _NF_FLOW_TABLE_H
+
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/netdevice.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <net/dst.h>
+#include <net/netfilter/nf_conntrack_tuple.h>
+
+/*
+ * Software flow table: established, forwarded connections are looked up
+ * by their 5-tuple on ingress and sent straight to the output device,
+ * skipping the netfilter hooks, routing and conntrack.
+ */
+
+struct nf_conn;
+
+enum flow_offload_tuple_dir {
+	FLOW_OFFLOAD_DIR_ORIGINAL = IP_CT_DIR_ORIGINAL,
+	FLOW_OFFLOAD_DIR_REPLY = IP_CT_DIR_REPLY,
+	FLOW_OFFLOAD_DIR_MAX = IP_CT_DIR_MAX
+};
+
+struct flow_offload_tuple {
+	union {
+		struct in_addr		src_v4;
+		struct in6_addr		src_v6;
+	};
+	union {
+		struct in_addr		dst_v4;
+		struct in6_addr		dst_v6;
+	};
+	struct {
+		__be16			src_port;
+		__be16			dst_port;
+	};
+
+	int				iifidx;
+
+	u8				l3proto;
+	u8				l4proto;
+
+	/* Everything above is the lookup key */
+	u8				dir;
+
+	int				oifidx;
+	u16				mtu;
+
+	struct dst_entry		*dst_cache;
+};
+
+struct flow_offload_tuple_rhash {
+	struct rhash_head		node;
+	struct flow_offload_tuple	tuple;
+};
+
+#define FLOW_OFFLOAD_SNAT	0x1
+#define FLOW_OFFLOAD_DNAT	0x2
+#define FLOW_OFFLOAD_TEARDOWN	0x4
+
+struct flow_offload {
+	struct flow_offload_tuple_rhash	tuplehash[FLOW_OFFLOAD_DIR_MAX];
+	struct nf_conn			*ct;
+	u32				flags;
+	/* jiffies at which an idle entry goes back to conntrack */
+	u32				timeout;
+	/* conntrack timeout the last slow path packet was given */
+	u32				ct_timeout;
+	struct rcu_head			rcu_head;
+};
+
+#define NF_FLOW_TIMEOUT	(30 * HZ)
+
+static inline __s32 nf_flow_timeout_delta(unsigned int timeout)
+{
+	return (__s32)(timeout - (u32)jiffies);
+}
+
+struct nf_flow_route {
+	struct {
+		struct dst_entry	*dst;
+	} tuple[FLOW_OFFLOAD_DIR_MAX];
+};
+
+void flow_offload_ct_tuple(const struct nf_conn *ct,
+			   enum flow_offload_tuple_dir dir, int iifidx,
+			   struct flow_offload_tuple *ft);
+
+struct flow_offload *flow_offload_alloc(struct nf_conn *ct,
+					struct nf_flow_route *route);
+void flow_offload_free(struct flow_offload *flow);
+
+int flow_offload_add(struct net *net, struct flow_offload *flow);
+void flow_offload_teardown(struct flow_offload *flow);
+
+struct flow_offload_tuple_rhash *flow_offload_lookup(struct net *net,
+						     struct flow_offload_tuple *tuple);
+
+#endif /* _NF_FLOW_TABLE_H */
@@ -193,6 +193,7 @@ struct nft_set_estimate {
  *	@insert: insert new element into set
  *	@remove: remove element from set
  *	@walk: iterate over all set elemeennts
+ *	@commit: make the elements changed by a transaction visible (optional)
  *	@privsize: function to return size of set private data
  *	@init: initialize private data of new set instance
  *	@destroy: destroy private data of set instance
@@ -213,6 +214,7 @@ struct nft_set_ops {
 	void				(*walk)(const struct nft_ctx *ctx,
 						const struct nft_set *set,
 						struct nft_set_iter *iter);
+	void				(*commit)(const struct nft_set *set);
 
 	unsigned int			(*privsize)(const struct nlattr * const nla[]);
 	bool				(*estimate)(const struct nft_set_desc *desc,
@@ -230,6 +232,8 @@ struct nft_set_ops {
 
 int nft_register_set(struct nft_set_ops *ops);
 void nft_unregister_set(struct nft_set_ops *ops);
+const struct nft_set_ops *nft_set_ops_next(const struct nft_set_ops *prev,
+					   u32 features);
 
 /**
  * 	struct nft_set - nf_tables set instance
@@ -63,14 +63,17 @@ struct request_sock {
 	struct sock			*sk;
 	u32				secid;
 	u32				peer_secid;
+	u32				syn_cpu; /* CPU that handled the SYN */
 };
 
 static inline struct request_sock *reqsk_alloc(const struct request_sock_ops *ops)
 {
 	struct request_sock *req = kmem_cache_alloc(ops->slab, GFP_ATOMIC);
 
-	if (req != NULL)
+	if (req != NULL) {
 		req->rsk_ops = ops;
+		req->syn_cpu = raw_smp_processor_id();
+	}
 
 	return req;
 }
@@ -132,11 +135,20 @@ struct fastopen_queue {
 	int		max_qlen;	/* != 0 iff TFO is currently enabled */
 };
 
+/* Per-CPU FIFO of established children, see TCP_ACCEPT_PERCPU */
+struct reqsk_cpu_queue {
+	struct request_sock	*head;
+	struct request_sock	*tail;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
+ * @rskq_percpu - Queue children per CPU that handled their SYN
+ * @rskq_cpu_qlen - Children on the per-CPU queues
+ * @cpu_queues - Per-CPU queues, used instead of the FIFO if allocated
  * @syn_wait_lock - serializer
  *
  * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
@@ -153,7 +165,10 @@ struct request_sock_queue {
 	struct request_sock	*rskq_accept_tail;
 	rwlock_t		syn_wait_lock;
 	u8			rskq_defer_accept;
-	/* 3 bytes hole, try to pack */
+	u8			rskq_percpu;
+	/* 2 bytes hole, try to pack */
+	unsigned int		rskq_cpu_qlen;
+	struct reqsk_cpu_queue __percpu *cpu_queues;
 	struct listen_sock	*listen_opt;
 	struct fastopen_queue	*fastopenq; /* This is non-NULL iff TFO has been
 					     * enabled on this listener. Check
@@ -170,18 +185,26 @@ void __reqsk_queue_destroy(struct request_sock_queue *queue);
 void reqsk_queue_destroy(struct request_sock_queue *queue);
 void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req,
 			   bool reset);
+struct request_sock *reqsk_cpu_queue_yank(struct request_sock_queue *queue);
+struct request_sock *reqsk_cpu_queue_remove(struct request_sock_queue *queue);
 
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
 {
 	struct request_sock *req = queue->rskq_accept_head;
 
+	if (queue->cpu_queues)
+		return reqsk_cpu_queue_yank(queue);
+
 	queue->rskq_accept_head = NULL;
 	return req;
 }
 
 static inline int reqsk_queue_empty(struct request_sock_queue *queue)
 {
+	if (queue->cpu_queues)
+		return queue->rskq_cpu_qlen == 0;
+
 	return queue->rskq_accept_head == NULL;
 }
 
@@ -199,15 +222,27 @@ static inline void reqsk_queue_add(struct request_sock_queue *queue,
 				   struct sock *parent,
 				   struct sock *child)
 {
+	struct request_sock **head = &queue->rskq_accept_head;
+	struct request_sock **tail = &queue->rskq_accept_tail;
+
 	req->sk = child;
 	sk_acceptq_added(parent);
 
-	if (queue->rskq_accept_head == NULL)
-		queue->rskq_accept_head = req;
+	if (queue->cpu_queues) {
+		struct reqsk_cpu_queue *cq;
+
+		cq = per_cpu_ptr(queue->cpu_queues, req->syn_cpu);
+		head = &cq->head;
+		tail = &cq->tail;
+		queue->rskq_cpu_qlen++;
+	}
+
+	if (*head == NULL)
+		*head = req;
 	else
-		queue->rskq_accept_tail->dl_next = req;
+		(*tail)->dl_next = req;
 
-	queue->rskq_accept_tail = req;
+	*tail = req;
 	req->dl_next = NULL;
 }
 
@@ -215,6 +250,9 @@ static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue
 {
 	struct request_sock *req = queue->rskq_accept_head;
 
+	if (queue->cpu_queues)
+		return reqsk_cpu_queue_remove(queue);
+
 	WARN_ON(req == NULL);
 
 	queue->rskq_accept_head = req->dl_next;
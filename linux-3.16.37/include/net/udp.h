@@ -29,6 +29,7 @@
 #include <net/snmp.h>
 #include <net/ip.h>
 #include <linux/ipv6.h>
+#include <linux/udp.h>
 #include <linux/seq_file.h>
 #include <linux/poll.h>
 
@@ -176,6 +177,62 @@ int udp_lib_get_port(struct sock *sk, unsigned short snum,
 		     int (*)(const struct sock *, const struct sock *),
 		     unsigned int hash2_nulladdr);
 
+/*
+ * What RFS does for a flow, done for a SO_REUSEPORT group that asked for
+ * it with UDP_REUSEPORT_CPU: lookups prefer the socket whose reader last
+ * ran on the CPU the packet is being processed on.
+ */
+static inline void udp_reader_cpu_update(struct sock *sk)
+{
+	struct udp_sock *up = udp_sk(sk);
+	int cpu;
+
+	if (!up->reuseport_cpu)
+		return;
+	cpu = raw_smp_processor_id();
+	if (unlikely(up->reader_cpu != cpu))
+		up->reader_cpu = cpu;
+}
+
+/*
+ * Lookup score with the CPU preference folded in.  Scores are doubled so
+ * the CPU only breaks ties.  The reader may move at any time, so the
+ * recheck of a result has to compare against the base score, score >> 1.
+ */
+static inline int udp_reader_cpu_score(const struct sock *sk, int score,
+				       int cpu)
+{
+	const struct udp_sock *up = udp_sk(sk);
+
+	if (score < 0)
+		return score;
+
+	score <<= 1;
+	if (up->reuseport_cpu && sk->sk_reuseport &&
+	    ACCESS_ONCE(up->reader_cpu) == cpu)
+		score++;
+	return score;
+}
+
+/* A GRO packet for a socket that did not ask for one has to be split up */
+static inline bool udp_unexpected_gso(struct sock *sk, struct sk_buff *skb)
+{
+	return !udp_sk(sk)->gro_enabled && skb_is_gso(skb) &&
+	       (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4);
+}
+
+static inline void udp_cmsg_recv(struct msghdr *msg, struct sock *sk,
+				 struct sk_buff *skb)
+{
+	int gso_size;
+
+	if (skb_is_gso(skb) &&
+	    (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)) {
+		gso_size = skb_shinfo(skb)->gso_size;
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
+}
+
 /* net/ipv4/udp.c */
 void udp_v4_early_demux(struct sk_buff *skb);
 int udp_get_port(struct sock *sk, unsigned short snum,
@@ -193,6 +250,11 @@ int udp_disconnect(struct sock *sk, int flags);
 unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait);
 struct sk_buff *skb_udp_tunnel_segment(struct sk_buff *skb,
 				       netdev_features_t features);
+struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+				  netdev_features_t features);
+int udp_cmsg_send(struct sock *sk, struct msghdr *msg, u16 *gso_size);
+extern struct static_key udp_gro_needed;
+void udp_gro_enable(void);
 int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		       char __user *optval, int __user *optlen);
 int udp_lib_setsockopt(struct sock *sk, int level, int optname,
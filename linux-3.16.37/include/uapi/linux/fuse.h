@@ -102,6 +102,16 @@
  *  - add ctime and ctimensec to fuse_setattr_in
  *  - add FUSE_RENAME2 request
  *  - add FUSE_NO_OPEN_SUPPORT flag
+ *
+ * Later minor versions are mainline's to number.  The following are
+ * found through INIT flags, open flags and device ioctls instead, and
+ * don't change the minor version:
+ *  - add FUSE_DEV_IOC_CLONE for per-queue device files
+ *  - add FUSE_DEV_IOC_SHM_REGISTER and the FUSE_READ_SHM and FUSE_WRITE_SHM
+ *    flags for payloads in shared memory
+ *  - add shm_slot to fuse_read_in and fuse_write_in, in place of padding
+ *  - add FOPEN_CACHE_DIR, with mainline's value
+ *  - add FUSE_EXPLICIT_INVAL_DATA, with mainline's value
  */
 
 #ifndef _LINUX_FUSE_H
@@ -205,10 +215,13 @@ struct fuse_file_lock {
  * FOPEN_DIRECT_IO: bypass page cache for this open file
  * FOPEN_KEEP_CACHE: don't invalidate the data cache on open
  * FOPEN_NONSEEKABLE: the file is not seekable
+ * FOPEN_CACHE_DIR: allow caching this directory, the cache is kept across
+ *		    opens that also set FOPEN_KEEP_CACHE
  */
 #define FOPEN_DIRECT_IO		(1 << 0)
 #define FOPEN_KEEP_CACHE	(1 << 1)
 #define FOPEN_NONSEEKABLE	(1 << 2)
+#define FOPEN_CACHE_DIR		(1 << 3)
 
 /**
  * INIT request/reply flags
@@ -231,6 +244,8 @@ struct fuse_file_lock {
  * FUSE_ASYNC_DIO: asynchronous direct I/O submission
  * FUSE_WRITEBACK_CACHE: use writeback cache for buffered writes
  * FUSE_NO_OPEN_SUPPORT: kernel supports zero-message opens
+ * FUSE_EXPLICIT_INVAL_DATA: only invalidate cached pages and directory
+ *			     contents on explicit request
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -250,6 +265,7 @@ struct fuse_file_lock {
 #define FUSE_ASYNC_DIO		(1 << 15)
 #define FUSE_WRITEBACK_CACHE	(1 << 16)
 #define FUSE_NO_OPEN_SUPPORT	(1 << 17)
+#define FUSE_EXPLICIT_INVAL_DATA (1 << 25)
 
 /**
  * CUSE INIT request/reply flags
@@ -279,14 +295,21 @@ struct fuse_file_lock {
  *
  * FUSE_WRITE_CACHE: delayed write from page cache, file handle is guessed
  * FUSE_WRITE_LOCKOWNER: lock_owner field is valid
+ * FUSE_WRITE_SHM: data is mapped at shared memory slot shm_slot, not after
+ *		   the fuse_write_in
  */
 #define FUSE_WRITE_CACHE	(1 << 0)
 #define FUSE_WRITE_LOCKOWNER	(1 << 1)
+#define FUSE_WRITE_SHM		(1 << 31)
 
 /**
  * Read flags
+ *
+ * FUSE_READ_SHM: reply data goes to mapped shared memory slot shm_slot, the
+ *		  reply is the fuse_out_header alone with len counting the data
  */
 #define FUSE_READ_LOCKOWNER	(1 << 1)
+#define FUSE_READ_SHM		(1 << 31)
 
 /**
  * Ioctl flags
@@ -504,7 +527,7 @@ struct fuse_read_in {
 	uint32_t	read_flags;
 	uint64_t	lock_owner;
 	uint32_t	flags;
-	uint32_t	padding;
+	uint32_t	shm_slot;
 };
 
 #define FUSE_COMPAT_WRITE_IN_SIZE 24
@@ -516,7 +539,7 @@ struct fuse_write_in {
 	uint32_t	write_flags;
 	uint64_t	lock_owner;
 	uint32_t	flags;
-	uint32_t	padding;
+	uint32_t	shm_slot;
 };
 
 struct fuse_write_out {
@@ -755,4 +778,33 @@ struct fuse_notify_retrieve_in {
 	uint64_t	dummy4;
 };
 
+/**
+ * Shared memory payload area of a device file
+ *
+ * @slot_size: size of one slot, a multiple of the page size
+ * @nr_slots: number of READ slots, and of WRITE slots
+ *
+ * Once registered, the device file may be mapped MAP_SHARED: the READ
+ * slots from offset 0, writable, and the WRITE slots from offset
+ * @nr_slots * @slot_size, read-only.  A slot maps the pages of the
+ * request owning it, so the payload is never copied.
+ *
+ * READ and WRITE requests read from the device file whose payload is
+ * whole pages and fits a free slot are sent with FUSE_READ_SHM or
+ * FUSE_WRITE_SHM set and the slot index in shm_slot, counted from the
+ * first slot of the kind.  The slot belongs to the request until the
+ * reply is written, then it is unmapped.  The pages of a READ slot
+ * start out zeroed.
+ */
+struct fuse_shm_register {
+	uint32_t	slot_size;
+	uint32_t	nr_slots;
+};
+
+/* Device ioctls */
+#define FUSE_DEV_IOC_MAGIC		229
+#define FUSE_DEV_IOC_CLONE		_IOR(FUSE_DEV_IOC_MAGIC, 0, uint32_t)
+#define FUSE_DEV_IOC_SHM_REGISTER	_IOW(FUSE_DEV_IOC_MAGIC, 1, \
+					     struct fuse_shm_register)
+
 #endif /* _LINUX_FUSE_H */
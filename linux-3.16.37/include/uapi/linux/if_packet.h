@@ -54,6 +54,8 @@ struct sockaddr_ll {
 #define PACKET_FANOUT			18
 #define PACKET_TX_HAS_OFF		19
 #define PACKET_QDISC_BYPASS		20
+#define PACKET_UMEM			21
+#define PACKET_RX_QUEUE			22
 
 #define PACKET_FANOUT_HASH		0
 #define PACKET_FANOUT_LB		1
@@ -275,6 +277,55 @@ union tpacket_req_u {
 	struct tpacket_req3	req3;
 };
 
+/*
+   User memory receive mode (PACKET_UMEM):
+
+   User space hands the kernel an area of fixed-size frames and two rings,
+   all in its own memory.  It puts the offsets of free frames on the fill
+   ring.  The kernel writes each received packet into the next free frame,
+   headroom bytes in, and posts a descriptor of it on the completion ring.
+   Ring entries follow struct tpacket_umem_ring.  Both indices run freely
+   and are taken modulo the number of entries, which is a power of two.
+
+   With TP_UMEM_ZEROCOPY the socket must be bound to a device and to one
+   of its RX queues (PACKET_RX_QUEUE), the area must be page aligned and
+   frames no larger than a page.  The driver then posts free frames to the
+   device, which writes packets straight into them, and these packets
+   bypass the stack.  Whenever the fill ring runs dry the queue falls back
+   to ordinary buffers, and packets the socket gets from those are copied.
+   Frames the kernel hands back unused are posted with len 0 and status
+   TP_STATUS_KERNEL.
+ */
+
+#define TP_UMEM_ZEROCOPY	0x1
+
+struct tpacket_umem_ring {
+	__u32	producer;
+	__u32	__pad1[15];
+	__u32	consumer;
+	__u32	__pad2[15];
+};
+
+/* Fill ring entries are __u64 frame offsets, completion entries these */
+struct tpacket_umem_desc {
+	__u64	addr;		/* offset of the packet data in the area */
+	__u32	len;		/* bytes written there */
+	__u32	status;		/* TP_STATUS_* */
+};
+
+struct tpacket_umem_req {
+	__u64	addr;		/* frame area */
+	__u64	len;		/* a multiple of frame_size */
+	__u32	frame_size;	/* power of two, at least 2048 */
+	__u32	headroom;	/* left free in front of the packet */
+	__u64	fill_addr;	/* fill ring */
+	__u64	comp_addr;	/* completion ring */
+	__u32	fill_entries;
+	__u32	comp_entries;
+	__u32	flags;		/* TP_UMEM_* */
+	__u32	__pad;
+};
+
 struct packet_mreq {
 	int		mr_ifindex;
 	unsigned short	mr_type;
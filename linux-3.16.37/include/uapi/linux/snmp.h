@@ -265,6 +265,8 @@ enum
 	LINUX_MIB_TCPWANTZEROWINDOWADV,		/* TCPWantZeroWindowAdv */
 	LINUX_MIB_TCPSYNRETRANS,		/* TCPSynRetrans */
 	LINUX_MIB_TCPORIGDATASENT,		/* TCPOrigDataSent */
+	LINUX_MIB_FRAGMEMPRESSURE,		/* FragMemPressure */
+	LINUX_MIB_FRAGEVICTED,			/* FragEvicted */
 	__LINUX_MIB_MAX
 };
 
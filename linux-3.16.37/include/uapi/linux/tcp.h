@@ -112,6 +112,7 @@ enum {
 #define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 #define TCP_TIMESTAMP		24
 #define TCP_NOTSENT_LOWAT	25	/* limit number of unsent bytes in write queue */
+#define TCP_ACCEPT_PERCPU	26	/* Per-CPU accept queues on listeners */
 
 struct tcp_repair_opt {
 	__u32	opt_code;
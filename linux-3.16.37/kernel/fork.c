@@ -1236,6 +1236,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	INIT_LIST_HEAD(&p->sibling);
 	rcu_copy_process(p);
 	p->vfork_done = NULL;
+#ifdef CONFIG_PATH_CACHE
+	p->path_cache = NULL;
+#endif
 	spin_lock_init(&p->alloc_lock);
 
 	init_sigpending(&p->pending);
@@ -47,6 +47,7 @@
 #include <linux/times.h>
 #include <linux/limits.h>
 #include <linux/dcache.h>
+#include <linux/path_cache.h>
 #include <linux/dnotify.h>
 #include <linux/syscalls.h>
 #include <linux/vmstat.h>
@@ -1552,6 +1553,33 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0444,
 		.proc_handler	= proc_nr_dentry,
 	},
+	{
+		.procname	= "negative-dentry-ratio",
+		.data		= &sysctl_negative_dentry_ratio,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one_hundred,
+	},
+#ifdef CONFIG_PATH_CACHE
+	{
+		.procname	= "path-cache",
+		.data		= &sysctl_path_cache,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{
+		.procname	= "path-cache-state",
+		.data		= &path_cache_stat,
+		.maxlen		= 4*sizeof(long),
+		.mode		= 0444,
+		.proc_handler	= proc_path_cache_state,
+	},
+#endif
 	{
 		.procname	= "overflowuid",
 		.data		= &fs_overflowuid,
@@ -0,0 +1,91 @@
+/*
+ * Lists sharded by CPU, see include/linux/percpu-list.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/percpu-list.h>
+
+/*
+ * All the per-CPU locks share one lockdep class, they are never nested
+ * within each other.
+ */
+static struct lock_class_key pcpu_list_key;
+
+int pcpu_list_init(struct pcpu_list *plist)
+{
+	int i;
+
+	plist->heads = kcalloc(nr_cpu_ids, sizeof(*plist->heads), GFP_KERNEL);
+	if (!plist->heads)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		spin_lock_init(&plist->heads[i].lock);
+		lockdep_set_class(&plist->heads[i].lock, &pcpu_list_key);
+		INIT_LIST_HEAD(&plist->heads[i].list);
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(pcpu_list_init);
+
+void pcpu_list_destroy(struct pcpu_list *plist)
+{
+	kfree(plist->heads);
+	plist->heads = NULL;
+}
+EXPORT_SYMBOL_GPL(pcpu_list_destroy);
+
+/* Unlocked check, only meaningful when no one adds or removes entries */
+bool pcpu_list_empty(struct pcpu_list *plist)
+{
+	struct pcpu_list_head *head;
+
+	pcpu_list_for_each_head(head, plist) {
+		if (!list_empty(&head->list))
+			return false;
+	}
+	return true;
+}
+EXPORT_SYMBOL_GPL(pcpu_list_empty);
+
+/**
+ * pcpu_list_add - add a node to the list of the current CPU
+ * @node:	node to add, must not be on a list
+ * @plist:	the lists to add it to
+ */
+void pcpu_list_add(struct pcpu_list_node *node, struct pcpu_list *plist)
+{
+	struct pcpu_list_head *head;
+
+	/* Any list will do, so being preempted and migrated is harmless */
+	head = &plist->heads[raw_smp_processor_id()];
+
+	spin_lock(&head->lock);
+	list_add(&node->list, &head->list);
+	node->head = head;
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL_GPL(pcpu_list_add);
+
+/**
+ * pcpu_list_del - remove a node from the list it is on
+ * @node:	node to remove
+ *
+ * The caller must make sure the node isn't added or removed concurrently.
+ */
+void pcpu_list_del(struct pcpu_list_node *node)
+{
+	struct pcpu_list_head *head = node->head;
+
+	spin_lock(&head->lock);
+	list_del_init(&node->list);
+	node->head = NULL;
+	spin_unlock(&head->lock);
+}
+EXPORT_SYMBOL_GPL(pcpu_list_del);
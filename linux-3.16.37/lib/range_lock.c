@@ -0,0 +1,193 @@
+/*
+ * Range locks, see include/linux/range_lock.h
+ *
+ * Every lock is inserted into the tree when it is requested, not when it
+ * is granted, and counts the overlapping ranges already in the tree as
+ * its blocking_ranges.  Unlocking a range removes it and decrements the
+ * count of every overlapping range inserted after it; a waiter whose
+ * count drops to zero owns its range.  This is fair, and a lock never
+ * needs to look at the tree again once it has been inserted.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/interval_tree_generic.h>
+#include <linux/range_lock.h>
+
+#define START(node) ((node)->start)
+#define LAST(node)  ((node)->last)
+
+INTERVAL_TREE_DEFINE(struct interval_tree_node, rb,
+		     unsigned long, __subtree_last,
+		     START, LAST, static, range_it)
+
+static inline struct range_lock *to_range_lock(struct interval_tree_node *node)
+{
+	return container_of(node, struct range_lock, node);
+}
+
+/* Insert @lock, returns true if it was granted right away */
+static bool __range_lock_insert(struct range_lock_tree *tree,
+				struct range_lock *lock)
+{
+	struct interval_tree_node *node;
+
+	lock->blocking_ranges = 0;
+	node = range_it_iter_first(&tree->root, lock->node.start,
+				   lock->node.last);
+	while (node) {
+		lock->blocking_ranges++;
+		node = range_it_iter_next(node, lock->node.start,
+					  lock->node.last);
+	}
+	lock->seqnum = ++tree->seqnum;
+	lock->task = current;
+	range_it_insert(&lock->node, &tree->root);
+	return !lock->blocking_ranges;
+}
+
+/* Remove @lock and hand over to the ranges that were waiting for it */
+static void __range_lock_remove(struct range_lock_tree *tree,
+				struct range_lock *lock)
+{
+	struct interval_tree_node *node;
+	struct range_lock *blocked;
+
+	range_it_remove(&lock->node, &tree->root);
+
+	node = range_it_iter_first(&tree->root, lock->node.start,
+				   lock->node.last);
+	while (node) {
+		blocked = to_range_lock(node);
+		/*
+		 * Only ranges inserted after us counted us; seqnums are
+		 * compared the way jiffies are, in case they wrap.
+		 */
+		if ((long)(blocked->seqnum - lock->seqnum) > 0 &&
+		    !--blocked->blocking_ranges)
+			wake_up_process(blocked->task);
+		node = range_it_iter_next(node, lock->node.start,
+					  lock->node.last);
+	}
+}
+
+static int __range_lock(struct range_lock_tree *tree,
+			struct range_lock *lock, long state)
+{
+	int ret = 0;
+
+	spin_lock(&tree->lock);
+	if (__range_lock_insert(tree, lock))
+		goto out;
+
+	for (;;) {
+		set_current_state(state);
+		if (!lock->blocking_ranges)
+			break;
+		if (signal_pending_state(state, current)) {
+			/*
+			 * Ranges waiting behind us have counted us, so we
+			 * have to be removed the way an unlock would.
+			 */
+			__range_lock_remove(tree, lock);
+			ret = -EINTR;
+			break;
+		}
+		spin_unlock(&tree->lock);
+		schedule();
+		spin_lock(&tree->lock);
+	}
+	__set_current_state(TASK_RUNNING);
+out:
+	spin_unlock(&tree->lock);
+	return ret;
+}
+
+/**
+ * range_lock - lock a range
+ * @tree:	the tree to lock the range in
+ * @lock:	the range, set up with range_lock_init()
+ *
+ * Sleeps until no range overlapping @lock that was requested earlier is
+ * locked any more.
+ */
+void range_lock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	might_sleep();
+	__range_lock(tree, lock, TASK_UNINTERRUPTIBLE);
+}
+EXPORT_SYMBOL_GPL(range_lock);
+
+/**
+ * range_lock_killable - lock a range, unless killed
+ * @tree:	the tree to lock the range in
+ * @lock:	the range, set up with range_lock_init()
+ *
+ * Returns 0 with the range locked, or -EINTR if a fatal signal arrived
+ * while waiting.
+ */
+int range_lock_killable(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	might_sleep();
+	return __range_lock(tree, lock, TASK_KILLABLE);
+}
+EXPORT_SYMBOL_GPL(range_lock_killable);
+
+/**
+ * range_trylock - lock a range if nothing overlapping it is locked
+ * @tree:	the tree to lock the range in
+ * @lock:	the range, set up with range_lock_init()
+ */
+bool range_trylock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	bool locked = false;
+
+	spin_lock(&tree->lock);
+	if (!range_it_iter_first(&tree->root, lock->node.start,
+				 lock->node.last))
+		locked = __range_lock_insert(tree, lock);
+	spin_unlock(&tree->lock);
+	return locked;
+}
+EXPORT_SYMBOL_GPL(range_trylock);
+
+/**
+ * range_unlock - unlock a range
+ * @tree:	the tree the range was locked in
+ * @lock:	the range
+ */
+void range_unlock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	spin_lock(&tree->lock);
+	__range_lock_remove(tree, lock);
+	spin_unlock(&tree->lock);
+}
+EXPORT_SYMBOL_GPL(range_unlock);
+
+/**
+ * range_lock_drain - wait until no range is locked
+ * @tree:	the tree to wait for
+ *
+ * The caller has to keep new ranges from being locked, e.g. by holding the
+ * lock that lockers of @tree take before locking their range.
+ */
+void range_lock_drain(struct range_lock_tree *tree)
+{
+	struct range_lock lock;
+
+	spin_lock(&tree->lock);
+	if (RB_EMPTY_ROOT(&tree->root)) {
+		spin_unlock(&tree->lock);
+		return;
+	}
+	spin_unlock(&tree->lock);
+
+	range_lock_init_full(&lock);
+	range_lock(tree, &lock);
+	range_unlock(tree, &lock);
+}
+EXPORT_SYMBOL_GPL(range_lock_drain);
@@ -0,0 +1,268 @@
+/*
+ * IPv4 FIB trie lookup benchmark
+ *
+ * Loads a synthetic routing table shaped like a full BGP feed into a
+ * private FIB table and measures fib_table_lookup() throughput for
+ * addresses covered by the table as well as uniformly random ones.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/rtnetlink.h>
+#include <linux/vmalloc.h>
+#include <net/ip_fib.h>
+#include <net/net_namespace.h>
+
+static unsigned int routes = 600000;
+module_param(routes, uint, 0);
+MODULE_PARM_DESC(routes, "Number of prefixes to load (default: 600000)");
+
+static unsigned int lookups = 4000000;
+module_param(lookups, uint, 0);
+MODULE_PARM_DESC(lookups, "Number of lookups per run (default: 4000000)");
+
+static unsigned int runs = 4;
+module_param(runs, uint, 0);
+MODULE_PARM_DESC(runs, "Number of lookup runs (default: 4)");
+
+static unsigned long seed = 1;
+module_param(seed, ulong, 0);
+MODULE_PARM_DESC(seed, "Seed for the synthetic table (default: 1)");
+
+/* Not a real table id, the table is never linked into a namespace */
+#define TEST_FIB_TABLE_ID	0x7fff0000
+
+#define TEST_FIB_BATCH		1024
+
+struct test_prefix {
+	__be32	dst;
+	u8	len;
+};
+
+static struct test_prefix *prefixes;
+static unsigned int nprefixes;
+
+/*
+ * Rough prefix length distribution of a full IPv4 BGP table, in parts per
+ * thousand: dominated by /24, with most of the rest between /16 and /23.
+ */
+static const struct {
+	u8	len;
+	u16	ppt;
+} test_fib_plen[] = {
+	{  8,   1 }, { 11,   1 }, { 12,   3 }, { 13,   5 }, { 14,  10 },
+	{ 15,  15 }, { 16,  25 }, { 17,  15 }, { 18,  25 }, { 19,  45 },
+	{ 20,  70 }, { 21,  75 }, { 22, 115 }, { 23,  95 }, { 24, 500 },
+};
+
+static u8 test_fib_pick_len(struct rnd_state *rnd)
+{
+	unsigned int r = prandom_u32_state(rnd) % 1000;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(test_fib_plen); i++) {
+		if (r < test_fib_plen[i].ppt)
+			return test_fib_plen[i].len;
+		r -= test_fib_plen[i].ppt;
+	}
+
+	return 24;
+}
+
+static void test_fib_cfg(struct fib_config *cfg, const struct test_prefix *p)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->fc_dst = p->dst;
+	cfg->fc_dst_len = p->len;
+	cfg->fc_table = TEST_FIB_TABLE_ID;
+	cfg->fc_type = RTN_BLACKHOLE;
+	cfg->fc_scope = RT_SCOPE_UNIVERSE;
+	cfg->fc_protocol = RTPROT_STATIC;
+	cfg->fc_nlflags = NLM_F_CREATE | NLM_F_EXCL;
+	cfg->fc_nlinfo.nl_net = &init_net;
+}
+
+static int test_fib_load(struct fib_table *tb)
+{
+	struct rnd_state rnd;
+	struct fib_config cfg;
+	unsigned int i, dups = 0;
+	ktime_t start;
+	int err = 0;
+
+	prandom_seed_state(&rnd, seed);
+	nprefixes = 0;
+
+	start = ktime_get();
+	for (i = 0; i < routes; i++) {
+		struct test_prefix *p = &prefixes[nprefixes];
+		u32 addr;
+
+		/* keep the table inside unicast space, 1.0.0.0 - 223.255.255.255 */
+		p->len = test_fib_pick_len(&rnd);
+		addr = (1 + prandom_u32_state(&rnd) % 223) << 24;
+		addr |= prandom_u32_state(&rnd) & 0x00ffffff;
+		p->dst = htonl(addr & ~((1u << (32 - p->len)) - 1));
+
+		if (!(i % TEST_FIB_BATCH)) {
+			if (i)
+				rtnl_unlock();
+			cond_resched();
+			rtnl_lock();
+		}
+
+		test_fib_cfg(&cfg, p);
+		err = fib_table_insert(tb, &cfg);
+		if (err == -EEXIST) {
+			dups++;
+			err = 0;
+			continue;
+		}
+		if (err) {
+			pr_warn("inserting %pI4/%u failed: %d\n",
+				&p->dst, p->len, err);
+			break;
+		}
+		nprefixes++;
+	}
+	if (routes)
+		rtnl_unlock();
+
+	pr_info("loaded %u prefixes (%u duplicates skipped) in %lld ms\n",
+		nprefixes, dups,
+		div_s64(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			NSEC_PER_MSEC));
+
+	return err;
+}
+
+static void test_fib_unload(struct fib_table *tb)
+{
+	struct fib_config cfg;
+	unsigned int i;
+	ktime_t start;
+	int err;
+
+	start = ktime_get();
+	for (i = 0; i < nprefixes; i++) {
+		if (!(i % TEST_FIB_BATCH)) {
+			if (i)
+				rtnl_unlock();
+			cond_resched();
+			rtnl_lock();
+		}
+
+		test_fib_cfg(&cfg, &prefixes[i]);
+		cfg.fc_nlflags = 0;
+		err = fib_table_delete(tb, &cfg);
+		if (err)
+			pr_warn("deleting %pI4/%u failed: %d\n",
+				&prefixes[i].dst, prefixes[i].len, err);
+	}
+	if (nprefixes)
+		rtnl_unlock();
+
+	pr_info("removed %u prefixes in %lld ms\n", nprefixes,
+		div_s64(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			NSEC_PER_MSEC));
+}
+
+/*
+ * Lookups either hit a random loaded prefix at a random host address
+ * inside it, or go to a uniformly random address which mostly exercises
+ * the backtracking path.
+ */
+static void test_fib_run(struct fib_table *tb, bool covered)
+{
+	struct rnd_state rnd;
+	struct fib_result res;
+	struct flowi4 fl4;
+	unsigned long hits = 0;
+	unsigned int i;
+	ktime_t start;
+	s64 ns;
+
+	prandom_seed_state(&rnd, seed + 1);
+	memset(&fl4, 0, sizeof(fl4));
+
+	start = ktime_get();
+	for (i = 0; i < lookups; i++) {
+		u32 addr = prandom_u32_state(&rnd);
+
+		if (covered) {
+			const struct test_prefix *p;
+
+			p = &prefixes[addr % nprefixes];
+			addr = ntohl(p->dst) |
+			       (prandom_u32_state(&rnd) &
+				((1u << (32 - p->len)) - 1));
+		}
+		fl4.daddr = htonl(addr);
+
+		if (fib_table_lookup(tb, &fl4, &res, FIB_LOOKUP_NOREF) <= 0)
+			hits++;
+
+		if (!(i % TEST_FIB_BATCH))
+			cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("  %s: %u lookups, %lu matched, %lld ns/lookup, %llu lookups/s\n",
+		covered ? "covered" : "random ", lookups, hits,
+		div_s64(ns, lookups),
+		ns ? div64_u64((u64)lookups * NSEC_PER_SEC, ns) : 0);
+}
+
+static int __init test_fib_init(void)
+{
+	struct fib_table *tb;
+	unsigned int i;
+	int err;
+
+	if (!routes || !lookups)
+		return -EINVAL;
+
+	prefixes = vmalloc(routes * sizeof(*prefixes));
+	if (!prefixes)
+		return -ENOMEM;
+
+	tb = fib_trie_table(TEST_FIB_TABLE_ID);
+	if (!tb) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	err = test_fib_load(tb);
+	if (!err && nprefixes) {
+		for (i = 0; i < runs; i++) {
+			pr_info("Run %02u:\n", i);
+			test_fib_run(tb, true);
+			test_fib_run(tb, false);
+		}
+	}
+
+	test_fib_unload(tb);
+	synchronize_rcu();
+	fib_free_table(tb);
+out_free:
+	vfree(prefixes);
+	return err;
+}
+
+static void __exit test_fib_exit(void)
+{
+}
+
+module_init(test_fib_init);
+module_exit(test_fib_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,225 @@
+/*
+ * nf_tables interval set lookup benchmark
+ *
+ * Fills every registered set type that supports intervals with random,
+ * disjoint IPv4 address ranges and measures lookups per second for
+ * uniformly random addresses, for a range of set sizes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+static unsigned int max_ranges = 200000;
+module_param(max_ranges, uint, 0);
+MODULE_PARM_DESC(max_ranges, "Largest set size in ranges (default: 200000)");
+
+static unsigned int lookups = 4000000;
+module_param(lookups, uint, 0);
+MODULE_PARM_DESC(lookups, "Number of lookups per run (default: 4000000)");
+
+static unsigned int runs = 2;
+module_param(runs, uint, 0);
+MODULE_PARM_DESC(runs, "Number of lookup runs per set (default: 2)");
+
+static unsigned long seed = 1;
+module_param(seed, ulong, 0);
+MODULE_PARM_DESC(seed, "Seed for the ranges and lookups (default: 1)");
+
+#define TEST_NFT_SET_BATCH	1024
+
+static struct nft_set *test_nft_set_create(const struct nft_set_ops *ops,
+					   unsigned int nelems)
+{
+	struct nft_set_desc desc = {
+		.klen	= sizeof(u32),
+		.size	= nelems,
+	};
+	struct nft_set *set;
+
+	set = kzalloc(sizeof(*set) + ops->privsize(NULL), GFP_KERNEL);
+	if (set == NULL)
+		return NULL;
+
+	strcpy(set->name, "bench");
+	set->ops   = ops;
+	set->klen  = desc.klen;
+	set->dtype = NFT_DATA_VALUE;
+	set->flags = NFT_SET_INTERVAL;
+	set->size  = desc.size;
+
+	if (ops->init(set, &desc, NULL) < 0) {
+		kfree(set);
+		return NULL;
+	}
+	return set;
+}
+
+static int test_nft_set_add(struct nft_set *set, u32 addr, u32 flags)
+{
+	struct nft_set_elem elem;
+	int err;
+
+	memset(&elem, 0, sizeof(elem));
+	elem.key.data[0] = (__force u32)htonl(addr);
+	elem.flags = flags;
+
+	err = set->ops->insert(set, &elem);
+	if (!err)
+		set->nelems++;
+	return err;
+}
+
+/*
+ * The address space is cut into one slot per range and each range takes
+ * a random part of its slot, so ranges never touch and about half of the
+ * space is covered.
+ */
+static int test_nft_set_load(struct nft_set *set, unsigned int nranges)
+{
+	u32 width = (u32)div_u64(1ULL << 32, nranges);
+	struct rnd_state rnd;
+	unsigned int i;
+	ktime_t start;
+	int err = 0;
+
+	prandom_seed_state(&rnd, seed);
+
+	start = ktime_get();
+	nfnl_lock(NFNL_SUBSYS_NFTABLES);
+	for (i = 0; i < nranges; i++) {
+		u32 len = width / 4 + prandom_u32_state(&rnd) % (width / 2);
+		u32 addr = i * width + prandom_u32_state(&rnd) % (width - len);
+
+		err = test_nft_set_add(set, addr, 0);
+		if (!err)
+			err = test_nft_set_add(set, addr + len,
+					       NFT_SET_ELEM_INTERVAL_END);
+		if (err) {
+			pr_warn("adding range %u failed: %d\n", i, err);
+			break;
+		}
+
+		if (!(i % TEST_NFT_SET_BATCH))
+			cond_resched();
+	}
+	if (set->ops->commit)
+		set->ops->commit(set);
+	nfnl_unlock(NFNL_SUBSYS_NFTABLES);
+
+	pr_info("  loaded %u elements in %lld ms\n", set->nelems,
+		div_s64(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			NSEC_PER_MSEC));
+
+	return err;
+}
+
+static void test_nft_set_run(const struct nft_set *set)
+{
+	struct nft_data key, data;
+	struct rnd_state rnd;
+	unsigned long hits = 0;
+	unsigned int i, j;
+	ktime_t start;
+	s64 ns;
+
+	prandom_seed_state(&rnd, seed + 1);
+	memset(&key, 0, sizeof(key));
+
+	start = ktime_get();
+	for (i = 0; i < lookups; i += TEST_NFT_SET_BATCH) {
+		/* The way the packet path calls in */
+		local_bh_disable();
+		rcu_read_lock();
+		for (j = i; j < min(lookups, i + TEST_NFT_SET_BATCH); j++) {
+			key.data[0] = prandom_u32_state(&rnd);
+			if (set->ops->lookup(set, &key, &data))
+				hits++;
+		}
+		rcu_read_unlock();
+		local_bh_enable();
+		cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("  %u lookups, %lu matched, %lld ns/lookup, %llu lookups/s\n",
+		lookups, hits, div_s64(ns, lookups),
+		ns ? div64_u64((u64)lookups * NSEC_PER_SEC, ns) : 0);
+}
+
+static int test_nft_set_one(const struct nft_set_ops *ops,
+			    unsigned int nranges)
+{
+	struct nft_set *set;
+	unsigned int i;
+	int err;
+
+	set = test_nft_set_create(ops, nranges * 2);
+	if (set == NULL)
+		return -ENOMEM;
+
+	pr_info("%pf, %u ranges:\n", ops->lookup, nranges);
+	err = test_nft_set_load(set, nranges);
+	if (!err) {
+		for (i = 0; i < runs; i++)
+			test_nft_set_run(set);
+	}
+
+	ops->destroy(set);
+	kfree(set);
+	return err;
+}
+
+static int __init test_nft_set_init(void)
+{
+	const struct nft_set_ops *ops = NULL;
+	unsigned int nranges;
+	int err = 0;
+
+	/* Ranges need a few addresses each */
+	if (max_ranges < 2 || max_ranges > (1 << 24) || !lookups)
+		return -EINVAL;
+
+	request_module("nft-set");
+
+	for (;;) {
+		nfnl_lock(NFNL_SUBSYS_NFTABLES);
+		ops = nft_set_ops_next(ops, NFT_SET_INTERVAL);
+		nfnl_unlock(NFNL_SUBSYS_NFTABLES);
+		if (ops == NULL)
+			break;
+
+		for (nranges = 1000; !err; nranges *= 10) {
+			err = test_nft_set_one(ops, min(nranges, max_ranges));
+			if (nranges >= max_ranges)
+				break;
+		}
+		if (err)
+			break;
+	}
+
+	if (ops != NULL)
+		module_put(ops->owner);
+	return err;
+}
+
+static void __exit test_nft_set_exit(void)
+{
+}
+
+module_init(test_nft_set_init);
+module_exit(test_nft_set_exit);
+
+MODULE_LICENSE("GPL v2");
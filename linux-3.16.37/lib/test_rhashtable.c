@@ -0,0 +1,320 @@
+/*
+ * Resizable, Scalable, Concurrent Hash Table
+ *
+ * Self-test and benchmark for the resizable hash table library. Measures
+ * insert and lookup throughput, verifies that lookups and walks never
+ * miss entries while the table is being expanded and shrunk concurrently.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/completion.h>
+#include <linux/err.h>
+
+static unsigned int entries = 50000;
+module_param(entries, uint, 0);
+MODULE_PARM_DESC(entries, "Number of entries to add (default: 50000)");
+
+static unsigned int runs = 4;
+module_param(runs, uint, 0);
+MODULE_PARM_DESC(runs, "Number of test runs per variant (default: 4)");
+
+static unsigned int tcount = 4;
+module_param(tcount, uint, 0);
+MODULE_PARM_DESC(tcount, "Number of concurrent lookup threads (default: 4)");
+
+static unsigned int resizes = 16;
+module_param(resizes, uint, 0);
+MODULE_PARM_DESC(resizes, "Number of forced resizes during the concurrent run (default: 16)");
+
+struct test_obj {
+	int			value;
+	struct rhash_head	node;
+};
+
+struct thread_data {
+	struct rhashtable	*ht;
+	struct task_struct	*task;
+	unsigned long		lookups;
+	unsigned long		misses;
+};
+
+static struct test_obj *array;
+static struct rhashtable ht;
+static atomic_t startup_count;
+static DECLARE_WAIT_QUEUE_HEAD(startup_wait);
+static bool stop_lookups;
+
+static struct rhashtable_params test_rht_params = {
+	.head_offset = offsetof(struct test_obj, node),
+	.key_offset = offsetof(struct test_obj, value),
+	.key_len = sizeof(int),
+	.hashfn = jhash,
+	.automatic_shrinking = true,
+};
+
+static int test_rht_lookup(struct rhashtable *ht, unsigned long *misses)
+{
+	unsigned int i;
+
+	for (i = 0; i < entries; i++) {
+		struct test_obj *obj;
+		int key = i;
+
+		rcu_read_lock();
+		obj = rhashtable_lookup(ht, &key);
+		if (!obj || obj->value != key) {
+			rcu_read_unlock();
+			if (!misses) {
+				pr_warn("key %d not found or mismatch\n", key);
+				return -ENOENT;
+			}
+			(*misses)++;
+			continue;
+		}
+		rcu_read_unlock();
+	}
+
+	return 0;
+}
+
+static unsigned int test_rht_walk(struct rhashtable *ht)
+{
+	struct rhashtable_iter hti;
+	struct test_obj *obj;
+	unsigned int count = 0;
+	int err;
+
+	err = rhashtable_walk_init(ht, &hti);
+	if (err)
+		return 0;
+
+	rhashtable_walk_start(&hti);
+	while ((obj = rhashtable_walk_next(&hti))) {
+		if (IS_ERR(obj)) {
+			if (PTR_ERR(obj) == -EAGAIN) {
+				count = 0;
+				continue;
+			}
+			break;
+		}
+		count++;
+	}
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+
+	return count;
+}
+
+static s64 test_rht_run(struct rhashtable *ht)
+{
+	ktime_t start, ins, look;
+	unsigned int i, count;
+	int err;
+
+	start = ktime_get();
+	for (i = 0; i < entries; i++) {
+		array[i].value = i;
+		rhashtable_insert(ht, &array[i].node);
+	}
+	ins = ktime_get();
+
+	err = test_rht_lookup(ht, NULL);
+	if (err)
+		return err;
+	look = ktime_get();
+
+	count = test_rht_walk(ht);
+	if (count != entries)
+		pr_warn("walk saw %u of %u entries\n", count, entries);
+
+	for (i = 0; i < entries; i++) {
+		if (!rhashtable_remove(ht, &array[i].node)) {
+			pr_warn("entry %u could not be removed\n", i);
+			return -ENOENT;
+		}
+	}
+
+	pr_info("  %u entries: insert %lld ns/op, lookup %lld ns/op\n",
+		entries,
+		div_s64(ktime_to_ns(ktime_sub(ins, start)), entries),
+		div_s64(ktime_to_ns(ktime_sub(look, ins)), entries));
+
+	synchronize_rcu();
+	return ktime_to_ns(ktime_sub(look, start));
+}
+
+static int threadfunc(void *data)
+{
+	struct thread_data *tdata = data;
+
+	if (atomic_dec_and_test(&startup_count))
+		wake_up(&startup_wait);
+
+	while (!ACCESS_ONCE(stop_lookups) && !kthread_should_stop()) {
+		test_rht_lookup(tdata->ht, &tdata->misses);
+		tdata->lookups += entries;
+		cond_resched();
+	}
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+static int test_rht_concurrent(struct rhashtable *ht)
+{
+	struct thread_data *tdata;
+	unsigned long lookups = 0, misses = 0;
+	unsigned int i, started = 0;
+	ktime_t start;
+	s64 ns;
+	int err = 0;
+
+	tdata = kcalloc(tcount, sizeof(*tdata), GFP_KERNEL);
+	if (!tdata)
+		return -ENOMEM;
+
+	for (i = 0; i < entries; i++) {
+		array[i].value = i;
+		rhashtable_insert(ht, &array[i].node);
+	}
+
+	stop_lookups = false;
+	atomic_set(&startup_count, tcount);
+	for (i = 0; i < tcount; i++) {
+		tdata[i].ht = ht;
+		tdata[i].task = kthread_run(threadfunc, &tdata[i],
+					    "rhashtable_thrd[%d]", i);
+		if (IS_ERR(tdata[i].task)) {
+			pr_err("kthread_run failed for thread %u\n", i);
+			atomic_dec(&startup_count);
+			tdata[i].task = NULL;
+			continue;
+		}
+		started++;
+	}
+	if (wait_event_interruptible(startup_wait,
+				     atomic_read(&startup_count) == 0))
+		pr_err("wait_event interrupted\n");
+
+	start = ktime_get();
+	for (i = 0; i < resizes; i++) {
+		mutex_lock(&ht->mutex);
+		if (i & 1)
+			err = rhashtable_shrink(ht);
+		else
+			err = rhashtable_expand(ht);
+		mutex_unlock(&ht->mutex);
+		if (err)
+			break;
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	ACCESS_ONCE(stop_lookups) = true;
+	for (i = 0; i < tcount; i++) {
+		if (!tdata[i].task)
+			continue;
+		kthread_stop(tdata[i].task);
+		lookups += tdata[i].lookups;
+		misses += tdata[i].misses;
+	}
+
+	for (i = 0; i < entries; i++)
+		rhashtable_remove(ht, &array[i].node);
+	synchronize_rcu();
+
+	pr_info("  %u threads, %u resizes in %lld ns: %lu lookups, %lu missed\n",
+		started, resizes, ns, lookups, misses);
+	if (ns)
+		pr_info("  %llu lookups/s under resize\n",
+			div64_u64((u64)lookups * NSEC_PER_SEC, ns));
+
+	kfree(tdata);
+
+	if (misses) {
+		pr_warn("lookups missed entries during resize\n");
+		err = -EINVAL;
+	}
+	return err;
+}
+
+static int __init test_rht_init(void)
+{
+	int i, err;
+	u64 total_time = 0;
+
+	entries = min(entries, 1000000U);
+
+	array = vzalloc(entries * sizeof(*array));
+	if (!array)
+		return -ENOMEM;
+
+	pr_info("Running rhashtable test nelem=%u, max_size=%u, shrinking=%u\n",
+		entries, test_rht_params.max_size,
+		test_rht_params.automatic_shrinking);
+
+	for (i = 0; i < runs; i++) {
+		s64 time;
+
+		pr_info("Test %02d:\n", i);
+		err = rhashtable_init(&ht, &test_rht_params);
+		if (err < 0) {
+			pr_warn("Test failed: Unable to initialize hashtable: %d\n",
+				err);
+			continue;
+		}
+
+		time = test_rht_run(&ht);
+		rhashtable_destroy(&ht);
+		if (time < 0) {
+			vfree(array);
+			pr_warn("Test failed: return code %lld\n", time);
+			return -EINVAL;
+		}
+
+		total_time += time;
+	}
+
+	if (runs)
+		pr_info("Average test time: %llu ns\n",
+			div64_u64(total_time, runs));
+
+	pr_info("Testing concurrent lookups during resize:\n");
+	err = rhashtable_init(&ht, &test_rht_params);
+	if (!err) {
+		err = test_rht_concurrent(&ht);
+		rhashtable_destroy(&ht);
+	}
+
+	vfree(array);
+	return err;
+}
+
+static void __exit test_rht_exit(void)
+{
+}
+
+module_init(test_rht_init);
+module_exit(test_rht_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -34,6 +34,7 @@
 #include <linux/memcontrol.h>
 #include <linux/cleancache.h>
 #include <linux/rmap.h>
+#include <linux/range_lock.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -1438,15 +1439,20 @@ static void shrink_readahead_size_eio(struct file *filp,
  * @ppos:	current file position
  * @iter:	data destination
  * @written:	already copied
+ * @flags:	IOCB_* flags of the request
  *
  * This is a generic file read routine, and uses the
  * mapping->a_ops->readpage() function for the actual low-level stuff.
  *
+ * With IOCB_NOWAIT only pages that are cached and uptodate are copied:
+ * the read stops short, or fails with -EAGAIN, where it would otherwise
+ * have to start I/O or wait for a locked page.
+ *
  * This is really ugly. But the goto's actually try to clarify some
  * of the logic when it comes to error handling etc.
  */
 static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
-		struct iov_iter *iter, ssize_t written)
+		struct iov_iter *iter, ssize_t written, int flags)
 {
 	struct address_space *mapping = filp->f_mapping;
 	struct inode *inode = mapping->host;
@@ -1474,6 +1480,8 @@ static ssize_t do_generic_file_read(struct file *filp, loff_t *ppos,
 find_page:
 		page = find_get_page(mapping, index);
 		if (!page) {
+			if (flags & IOCB_NOWAIT)
+				goto would_block;
 			page_cache_sync_readahead(mapping,
 					ra, filp,
 					index, last_index - index);
@@ -1565,6 +1573,11 @@ page_ok:
 		continue;
 
 page_not_up_to_date:
+		if (flags & IOCB_NOWAIT) {
+			page_cache_release(page);
+			goto would_block;
+		}
+
 		/* Get exclusive access to the page ... */
 		error = lock_page_killable(page);
 		if (unlikely(error))
@@ -1584,6 +1597,12 @@ page_not_up_to_date_locked:
 			goto page_ok;
 		}
 
+		if (flags & IOCB_NOWAIT) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto would_block;
+		}
+
 readpage:
 		/*
 		 * A previous I/O error may have been due to temporary
@@ -1654,6 +1673,8 @@ no_cached_page:
 		goto readpage;
 	}
 
+would_block:
+	error = -EAGAIN;
 out:
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
@@ -1689,6 +1710,11 @@ generic_file_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 
 		if (!count)
 			goto out; /* skip atime */
+		/* Cached pages might have to be written back first */
+		if ((iocb->ki_flags & IOCB_NOWAIT) && mapping->nrpages) {
+			retval = -EAGAIN;
+			goto out;
+		}
 		size = i_size_read(inode);
 		retval = filemap_write_and_wait_range(mapping, pos,
 					pos + count - 1);
@@ -1716,7 +1742,8 @@ generic_file_read_iter(struct kiocb *iocb, struct iov_iter *iter)
 		}
 	}
 
-	retval = do_generic_file_read(file, ppos, iter, retval);
+	retval = do_generic_file_read(file, ppos, iter, retval,
+				      iocb->ki_flags);
 out:
 	return retval;
 }
@@ -2644,6 +2671,107 @@ ssize_t generic_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 }
 EXPORT_SYMBOL(generic_file_write_iter);
 
+/**
+ * generic_file_range_write_iter - write data to a file, range locked
+ * @iocb:	IO state structure
+ * @from:	iov_iter with data to write
+ * @tree:	range lock tree of the file's writers
+ * @can_share:	called under i_mutex, whether buffered writes within i_size
+ *		may currently drop it; NULL if they always may
+ *
+ * Like generic_file_write_iter(), but each write also locks the pages it
+ * covers in @tree.  A buffered write that doesn't extend the file then
+ * only needs i_mutex for the checks, the SUID removal and the time update,
+ * and drops it before copying the data, so that writes to ranges that
+ * don't overlap proceed in parallel.
+ *
+ * A writer whose range overlaps one that is locked doesn't wait for it
+ * under i_mutex, which would hold up writers to every other range: it
+ * drops i_mutex, waits for the range and starts over.
+ *
+ * Anything that relies on i_mutex to keep writers out of the file, like
+ * truncate or hole punching, must therefore range_lock_drain(@tree) after
+ * taking i_mutex.  Writers only lock a range for writing with i_mutex held,
+ * so the file is quiet afterwards.
+ */
+ssize_t generic_file_range_write_iter(struct kiocb *iocb, struct iov_iter *from,
+				      struct range_lock_tree *tree,
+				      bool (*can_share)(struct inode *))
+{
+	struct file *file = iocb->ki_filp;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct range_lock range;
+	loff_t pos;
+	size_t count;
+	bool shared;
+	ssize_t ret;
+
+	for (;;) {
+		pos = iocb->ki_pos;
+		count = iov_iter_count(from);
+		mutex_lock(&inode->i_mutex);
+		ret = generic_write_checks(file, &pos, &count, 0);
+		if (ret || !count) {
+			mutex_unlock(&inode->i_mutex);
+			return ret;
+		}
+
+		range_lock_init(&range, pos >> PAGE_CACHE_SHIFT,
+				(pos + count - 1) >> PAGE_CACHE_SHIFT);
+		if (range_trylock(tree, &range))
+			break;
+
+		/*
+		 * Wait for the overlapping writers without i_mutex.  The
+		 * checks have to be redone afterwards: i_size, and with it
+		 * the range of an O_APPEND write, may have changed.
+		 */
+		mutex_unlock(&inode->i_mutex);
+		range_lock(tree, &range);
+		range_unlock(tree, &range);
+	}
+
+	shared = !(file->f_flags & O_DIRECT) &&
+		 pos + count <= i_size_read(inode) &&
+		 (!can_share || can_share(inode));
+	if (!shared) {
+		ret = __generic_file_write_iter(iocb, from);
+		mutex_unlock(&inode->i_mutex);
+		goto out;
+	}
+
+	iov_iter_truncate(from, count);
+	ret = file_remove_suid(file);
+	if (!ret)
+		ret = file_update_time(file);
+	mutex_unlock(&inode->i_mutex);
+	if (ret)
+		goto out;
+
+	/*
+	 * i_size and the block mapping can't change under us now, and the
+	 * pages are ours as far as other writers are concerned.
+	 */
+	current->backing_dev_info = mapping->backing_dev_info;
+	ret = generic_perform_write(file, from, pos);
+	current->backing_dev_info = NULL;
+	if (likely(ret >= 0))
+		iocb->ki_pos = pos + ret;
+out:
+	range_unlock(tree, &range);
+
+	if (ret > 0) {
+		ssize_t err;
+
+		err = generic_write_sync(file, iocb->ki_pos - ret, ret);
+		if (err < 0)
+			ret = err;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(generic_file_range_write_iter);
+
 /**
  * try_to_release_page() - release old fs-specific metadata on a page
  *
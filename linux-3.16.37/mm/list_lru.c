@@ -9,16 +9,80 @@
 #include <linux/mm.h>
 #include <linux/list_lru.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/memcontrol.h>
+
+#ifdef CONFIG_MEMCG_KMEM
+/*
+ * Cgroup aware lrus, so that their per cgroup arrays can be grown when a
+ * new kmem limited cgroup shows up.
+ */
+static LIST_HEAD(list_lrus);
+static DEFINE_MUTEX(list_lrus_mutex);
+
+static inline bool list_lru_memcg_aware(struct list_lru *lru)
+{
+	return lru->memcg_aware;
+}
+
+static inline struct list_lru_one *
+list_lru_from_memcg_idx(struct list_lru_node *nlru, int idx)
+{
+	/*
+	 * The lock protects the array of per cgroup lists from relocation
+	 * (see memcg_update_list_lru_node).
+	 */
+	lockdep_assert_held(&nlru->lock);
+	if (nlru->memcg_lrus && idx >= 0)
+		return nlru->memcg_lrus->lru[idx];
+
+	return &nlru->lru;
+}
+
+static inline struct list_lru_one *
+list_lru_from_kmem(struct list_lru *lru, struct list_lru_node *nlru,
+		   void *ptr)
+{
+	struct mem_cgroup *memcg;
+
+	if (!list_lru_memcg_aware(lru))
+		return &nlru->lru;
+
+	memcg = mem_cgroup_from_kmem(ptr);
+	return list_lru_from_memcg_idx(nlru, memcg_cache_id(memcg));
+}
+#else
+static inline bool list_lru_memcg_aware(struct list_lru *lru)
+{
+	return false;
+}
+
+static inline struct list_lru_one *
+list_lru_from_memcg_idx(struct list_lru_node *nlru, int idx)
+{
+	return &nlru->lru;
+}
+
+static inline struct list_lru_one *
+list_lru_from_kmem(struct list_lru *lru, struct list_lru_node *nlru,
+		   void *ptr)
+{
+	return &nlru->lru;
+}
+#endif /* CONFIG_MEMCG_KMEM */
 
 bool list_lru_add(struct list_lru *lru, struct list_head *item)
 {
 	int nid = page_to_nid(virt_to_page(item));
 	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_one *l;
 
 	spin_lock(&nlru->lock);
 	WARN_ON_ONCE(nlru->nr_items < 0);
 	if (list_empty(item)) {
-		list_add_tail(item, &nlru->list);
+		l = list_lru_from_kmem(lru, nlru, item);
+		list_add_tail(item, &l->list);
+		l->nr_items++;
 		if (nlru->nr_items++ == 0)
 			node_set(nid, lru->active_nodes);
 		spin_unlock(&nlru->lock);
@@ -33,10 +97,13 @@ bool list_lru_del(struct list_lru *lru, struct list_head *item)
 {
 	int nid = page_to_nid(virt_to_page(item));
 	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_one *l;
 
 	spin_lock(&nlru->lock);
 	if (!list_empty(item)) {
+		l = list_lru_from_kmem(lru, nlru, item);
 		list_del_init(item);
+		l->nr_items--;
 		if (--nlru->nr_items == 0)
 			node_clear(nid, lru->active_nodes);
 		WARN_ON_ONCE(nlru->nr_items < 0);
@@ -48,6 +115,29 @@ bool list_lru_del(struct list_lru *lru, struct list_head *item)
 }
 EXPORT_SYMBOL_GPL(list_lru_del);
 
+static unsigned long __list_lru_count_one(struct list_lru *lru,
+					  int nid, int memcg_idx)
+{
+	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_lru_one *l;
+	unsigned long count;
+
+	spin_lock(&nlru->lock);
+	l = list_lru_from_memcg_idx(nlru, memcg_idx);
+	WARN_ON_ONCE(l->nr_items < 0);
+	count = l->nr_items;
+	spin_unlock(&nlru->lock);
+
+	return count;
+}
+
+unsigned long list_lru_count_one(struct list_lru *lru,
+				 int nid, struct mem_cgroup *memcg)
+{
+	return __list_lru_count_one(lru, nid, memcg_cache_id(memcg));
+}
+EXPORT_SYMBOL_GPL(list_lru_count_one);
+
 unsigned long
 list_lru_count_node(struct list_lru *lru, int nid)
 {
@@ -63,18 +153,21 @@ list_lru_count_node(struct list_lru *lru, int nid)
 }
 EXPORT_SYMBOL_GPL(list_lru_count_node);
 
-unsigned long
-list_lru_walk_node(struct list_lru *lru, int nid, list_lru_walk_cb isolate,
-		   void *cb_arg, unsigned long *nr_to_walk)
+static unsigned long
+__list_lru_walk_one(struct list_lru *lru, int nid, int memcg_idx,
+		    list_lru_walk_cb isolate, void *cb_arg,
+		    unsigned long *nr_to_walk)
 {
 
 	struct list_lru_node	*nlru = &lru->node[nid];
+	struct list_lru_one *l;
 	struct list_head *item, *n;
 	unsigned long isolated = 0;
 
 	spin_lock(&nlru->lock);
+	l = list_lru_from_memcg_idx(nlru, memcg_idx);
 restart:
-	list_for_each_safe(item, n, &nlru->list) {
+	list_for_each_safe(item, n, &l->list) {
 		enum lru_status ret;
 
 		/*
@@ -90,6 +183,7 @@ restart:
 		case LRU_REMOVED_RETRY:
 			assert_spin_locked(&nlru->lock);
 		case LRU_REMOVED:
+			l->nr_items--;
 			if (--nlru->nr_items == 0)
 				node_clear(nid, lru->active_nodes);
 			WARN_ON_ONCE(nlru->nr_items < 0);
@@ -103,7 +197,7 @@ restart:
 				goto restart;
 			break;
 		case LRU_ROTATE:
-			list_move_tail(item, &nlru->list);
+			list_move_tail(item, &l->list);
 			break;
 		case LRU_SKIP:
 			break;
@@ -122,9 +216,249 @@ restart:
 	spin_unlock(&nlru->lock);
 	return isolated;
 }
+
+unsigned long
+list_lru_walk_one(struct list_lru *lru, int nid, struct mem_cgroup *memcg,
+		  list_lru_walk_cb isolate, void *cb_arg,
+		  unsigned long *nr_to_walk)
+{
+	return __list_lru_walk_one(lru, nid, memcg_cache_id(memcg),
+				   isolate, cb_arg, nr_to_walk);
+}
+EXPORT_SYMBOL_GPL(list_lru_walk_one);
+
+unsigned long list_lru_walk_node(struct list_lru *lru, int nid,
+				 list_lru_walk_cb isolate, void *cb_arg,
+				 unsigned long *nr_to_walk)
+{
+	long isolated = 0;
+
+	isolated += __list_lru_walk_one(lru, nid, -1, isolate, cb_arg,
+					nr_to_walk);
+#ifdef CONFIG_MEMCG_KMEM
+	if (list_lru_memcg_aware(lru)) {
+		int memcg_idx;
+
+		/*
+		 * memcg_nr is only ever raised, after the arrays of all nodes
+		 * have been grown, so it is fine to read it unlocked.
+		 */
+		for (memcg_idx = 0; memcg_idx < ACCESS_ONCE(lru->memcg_nr);
+		     memcg_idx++) {
+			if (!*nr_to_walk)
+				break;
+			isolated += __list_lru_walk_one(lru, nid, memcg_idx,
+						isolate, cb_arg, nr_to_walk);
+		}
+	}
+#endif
+	return isolated;
+}
 EXPORT_SYMBOL_GPL(list_lru_walk_node);
 
-int list_lru_init_key(struct list_lru *lru, struct lock_class_key *key)
+static void init_one_lru(struct list_lru_one *l)
+{
+	INIT_LIST_HEAD(&l->list);
+	l->nr_items = 0;
+}
+
+#ifdef CONFIG_MEMCG_KMEM
+static void __memcg_destroy_list_lru_node(struct list_lru_memcg *memcg_lrus,
+					  int begin, int end)
+{
+	int i;
+
+	for (i = begin; i < end; i++)
+		kfree(memcg_lrus->lru[i]);
+}
+
+static int __memcg_init_list_lru_node(struct list_lru_memcg *memcg_lrus,
+				      int begin, int end)
+{
+	int i;
+
+	for (i = begin; i < end; i++) {
+		struct list_lru_one *l;
+
+		l = kmalloc(sizeof(struct list_lru_one), GFP_KERNEL);
+		if (!l)
+			goto fail;
+
+		init_one_lru(l);
+		memcg_lrus->lru[i] = l;
+	}
+	return 0;
+fail:
+	__memcg_destroy_list_lru_node(memcg_lrus, begin, i);
+	return -ENOMEM;
+}
+
+static struct list_lru_memcg *memcg_alloc_list_lru_node(int size)
+{
+	return kmalloc(sizeof(struct list_lru_memcg) +
+		       size * sizeof(struct list_lru_one *), GFP_KERNEL);
+}
+
+static int memcg_init_list_lru_node(struct list_lru_node *nlru, int size)
+{
+	if (!size)
+		return 0;
+
+	nlru->memcg_lrus = memcg_alloc_list_lru_node(size);
+	if (!nlru->memcg_lrus)
+		return -ENOMEM;
+
+	if (__memcg_init_list_lru_node(nlru->memcg_lrus, 0, size)) {
+		kfree(nlru->memcg_lrus);
+		nlru->memcg_lrus = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void memcg_destroy_list_lru_node(struct list_lru_node *nlru, int size)
+{
+	if (!nlru->memcg_lrus)
+		return;
+
+	__memcg_destroy_list_lru_node(nlru->memcg_lrus, 0, size);
+	kfree(nlru->memcg_lrus);
+	nlru->memcg_lrus = NULL;
+}
+
+static int memcg_update_list_lru_node(struct list_lru_node *nlru,
+				      int old_size, int new_size)
+{
+	struct list_lru_memcg *old, *new;
+
+	old = nlru->memcg_lrus;
+	new = memcg_alloc_list_lru_node(new_size);
+	if (!new)
+		return -ENOMEM;
+
+	if (__memcg_init_list_lru_node(new, old_size, new_size)) {
+		kfree(new);
+		return -ENOMEM;
+	}
+
+	if (old_size)
+		memcpy(new->lru, old->lru, old_size * sizeof(void *));
+
+	/*
+	 * The lock guarantees that we won't race with a reader
+	 * (see list_lru_from_memcg_idx).
+	 */
+	spin_lock(&nlru->lock);
+	nlru->memcg_lrus = new;
+	spin_unlock(&nlru->lock);
+
+	kfree(old);
+	return 0;
+}
+
+static int memcg_update_list_lru(struct list_lru *lru, int new_size)
+{
+	int old_size = lru->memcg_nr;
+	int i;
+
+	if (new_size <= old_size)
+		return 0;
+
+	for (i = 0; i < nr_node_ids; i++) {
+		if (memcg_update_list_lru_node(&lru->node[i],
+					       old_size, new_size))
+			goto fail;
+	}
+	lru->memcg_nr = new_size;
+	return 0;
+fail:
+	/* Undo the nodes already grown, the new lists are still empty */
+	while (--i >= 0) {
+		struct list_lru_memcg *memcg_lrus = lru->node[i].memcg_lrus;
+
+		__memcg_destroy_list_lru_node(memcg_lrus, old_size, new_size);
+	}
+	return -ENOMEM;
+}
+
+/**
+ * memcg_update_all_list_lrus - make room for a new kmem limited cgroup
+ * @num_memcgs: number of kmem cgroup ids in use
+ *
+ * Called when a cgroup becomes kmem limited, before any object can be
+ * charged to it, so that the per cgroup arrays of every cgroup aware lru
+ * are large enough to index with its memcg_cache_id().
+ */
+int memcg_update_all_list_lrus(int num_memcgs)
+{
+	struct list_lru *lru;
+	int size = max(num_memcgs, memcg_limited_groups_array_size);
+	int ret = 0;
+
+	mutex_lock(&list_lrus_mutex);
+	list_for_each_entry(lru, &list_lrus, list) {
+		ret = memcg_update_list_lru(lru, size);
+		if (ret)
+			break;
+	}
+	mutex_unlock(&list_lrus_mutex);
+	return ret;
+}
+
+static int memcg_init_list_lru(struct list_lru *lru, bool memcg_aware)
+{
+	int size;
+	int i;
+
+	INIT_LIST_HEAD(&lru->list);
+	lru->memcg_nr = 0;
+	lru->memcg_aware = memcg_aware;
+	if (!memcg_aware)
+		return 0;
+
+	mutex_lock(&list_lrus_mutex);
+	size = memcg_limited_groups_array_size;
+	for (i = 0; i < nr_node_ids; i++) {
+		if (memcg_init_list_lru_node(&lru->node[i], size))
+			goto fail;
+	}
+	lru->memcg_nr = size;
+	list_add(&lru->list, &list_lrus);
+	mutex_unlock(&list_lrus_mutex);
+	return 0;
+fail:
+	while (--i >= 0)
+		memcg_destroy_list_lru_node(&lru->node[i], size);
+	mutex_unlock(&list_lrus_mutex);
+	return -ENOMEM;
+}
+
+static void memcg_destroy_list_lru(struct list_lru *lru)
+{
+	int i;
+
+	if (!list_lru_memcg_aware(lru))
+		return;
+
+	mutex_lock(&list_lrus_mutex);
+	list_del(&lru->list);
+	for (i = 0; i < nr_node_ids; i++)
+		memcg_destroy_list_lru_node(&lru->node[i], lru->memcg_nr);
+	mutex_unlock(&list_lrus_mutex);
+}
+#else
+static int memcg_init_list_lru(struct list_lru *lru, bool memcg_aware)
+{
+	return 0;
+}
+
+static void memcg_destroy_list_lru(struct list_lru *lru)
+{
+}
+#endif /* CONFIG_MEMCG_KMEM */
+
+int __list_lru_init(struct list_lru *lru, bool memcg_aware,
+		    struct lock_class_key *key)
 {
 	int i;
 	size_t size = sizeof(*lru->node) * nr_node_ids;
@@ -138,15 +472,27 @@ int list_lru_init_key(struct list_lru *lru, struct lock_class_key *key)
 		spin_lock_init(&lru->node[i].lock);
 		if (key)
 			lockdep_set_class(&lru->node[i].lock, key);
-		INIT_LIST_HEAD(&lru->node[i].list);
+		init_one_lru(&lru->node[i].lru);
 		lru->node[i].nr_items = 0;
 	}
+
+	if (memcg_init_list_lru(lru, memcg_aware)) {
+		kfree(lru->node);
+		lru->node = NULL;
+		return -ENOMEM;
+	}
 	return 0;
 }
-EXPORT_SYMBOL_GPL(list_lru_init_key);
+EXPORT_SYMBOL_GPL(__list_lru_init);
 
 void list_lru_destroy(struct list_lru *lru)
 {
+	/* Already destroyed or not yet initialized? */
+	if (!lru->node)
+		return;
+
+	memcg_destroy_list_lru(lru);
 	kfree(lru->node);
+	lru->node = NULL;
 }
 EXPORT_SYMBOL_GPL(list_lru_destroy);
@@ -56,6 +56,7 @@
 #include <linux/oom.h>
 #include <linux/lockdep.h>
 #include <linux/file.h>
+#include <linux/list_lru.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/ip.h>
@@ -3223,6 +3224,32 @@ static inline void memcg_resume_kmem_account(void)
 	current->memcg_kmem_skip_account--;
 }
 
+/**
+ * mem_cgroup_from_kmem - memory cgroup a slab object is charged to
+ * @ptr: pointer to the object
+ *
+ * Returns NULL if the object comes from a root cache.  The cgroup can't go
+ * away while the object is allocated, since its kmem charges pin it.
+ */
+struct mem_cgroup *mem_cgroup_from_kmem(void *ptr)
+{
+	struct kmem_cache *cachep;
+	struct page *page;
+
+	if (!memcg_kmem_enabled())
+		return NULL;
+
+	page = virt_to_head_page(ptr);
+	if (!PageSlab(page))
+		return NULL;
+
+	cachep = page->slab_cache;
+	if (is_root_cache(cachep))
+		return NULL;
+
+	return cachep->memcg_params->memcg;
+}
+
 int __memcg_cleanup_cache_params(struct kmem_cache *s)
 {
 	struct kmem_cache *c;
@@ -4955,6 +4982,8 @@ static int __memcg_activate_kmem(struct mem_cgroup *memcg,
 	 */
 	mutex_lock(&memcg_slab_mutex);
 	err = memcg_update_all_caches(memcg_id + 1);
+	if (!err)
+		err = memcg_update_all_list_lrus(memcg_id + 1);
 	mutex_unlock(&memcg_slab_mutex);
 	if (err)
 		goto out_rmid;
@@ -549,6 +549,7 @@ static int shmem_setattr(struct dentry *dentry, struct iattr *attr)
 		loff_t newsize = attr->ia_size;
 
 		if (newsize != oldsize) {
+			range_lock_drain(&SHMEM_I(inode)->write_ranges);
 			i_size_write(inode, newsize);
 			inode->i_ctime = inode->i_mtime = CURRENT_TIME;
 		}
@@ -1393,6 +1394,7 @@ static struct inode *shmem_get_inode(struct super_block *sb, const struct inode
 		info->flags = flags & VM_NORESERVE;
 		INIT_LIST_HEAD(&info->swaplist);
 		simple_xattrs_init(&info->xattrs);
+		range_lock_tree_init(&info->write_ranges);
 		cache_no_acl(inode);
 
 		switch (mode & S_IFMT) {
@@ -1477,6 +1479,18 @@ shmem_write_end(struct file *file, struct address_space *mapping,
 	return copied;
 }
 
+/*
+ * shmem_write_begin() and shmem_write_end() only need i_mutex for writes
+ * that extend the file, others are only serialized by range.
+ */
+static ssize_t shmem_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+
+	return generic_file_range_write_iter(iocb, from,
+					     &SHMEM_I(inode)->write_ranges, NULL);
+}
+
 static ssize_t shmem_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
 	struct file *file = iocb->ki_filp;
@@ -1799,6 +1813,7 @@ static long shmem_fallocate(struct file *file, int mode, loff_t offset,
 		return -EOPNOTSUPP;
 
 	mutex_lock(&inode->i_mutex);
+	range_lock_drain(&SHMEM_I(inode)->write_ranges);
 
 	if (mode & FALLOC_FL_PUNCH_HOLE) {
 		struct address_space *mapping = file->f_mapping;
@@ -2716,7 +2731,7 @@ static const struct file_operations shmem_file_operations = {
 	.read		= new_sync_read,
 	.write		= new_sync_write,
 	.read_iter	= shmem_file_read_iter,
-	.write_iter	= generic_file_write_iter,
+	.write_iter	= shmem_file_write_iter,
 	.fsync		= noop_fsync,
 	.splice_read	= shmem_file_splice_read,
 	.splice_write	= iter_file_splice_write,
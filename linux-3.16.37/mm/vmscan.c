@@ -351,6 +351,9 @@ shrink_slab_node(struct shrink_control *shrinkctl, struct shrinker *shrinker,
  * are eligible for the caller's allocation attempt.  It is used for balancing
  * slab reclaim versus page reclaim.
  *
+ * If shrinkctl->memcg is set, only memcg aware shrinkers are called, and
+ * they are asked to shrink the objects charged to that cgroup.
+ *
  * Returns the number of slab objects which we shrunk.
  */
 unsigned long shrink_slab(struct shrink_control *shrinkctl,
@@ -375,6 +378,10 @@ unsigned long shrink_slab(struct shrink_control *shrinkctl,
 	}
 
 	list_for_each_entry(shrinker, &shrinker_list, list) {
+		if (shrinkctl->memcg &&
+		    !(shrinker->flags & SHRINKER_MEMCG_AWARE))
+			continue;
+
 		if (!(shrinker->flags & SHRINKER_NUMA_AWARE)) {
 			shrinkctl->nid = 0;
 			freed += shrink_slab_node(shrinkctl, shrinker,
@@ -2237,6 +2244,40 @@ static inline bool should_continue_reclaim(struct zone *zone,
 	}
 }
 
+/*
+ * Memory cgroup limit reclaim doesn't go through the global shrink_slab()
+ * call in shrink_zones(), so shrink the slab objects charged to each kmem
+ * limited cgroup in proportion to how much of its LRU was just scanned.
+ */
+static void shrink_slab_memcg(struct zone *zone, struct mem_cgroup *memcg,
+			      struct scan_control *sc,
+			      unsigned long nr_scanned)
+{
+	struct reclaim_state *reclaim_state = current->reclaim_state;
+	struct lruvec *lruvec = mem_cgroup_zone_lruvec(zone, memcg);
+	struct shrink_control shrink = {
+		.gfp_mask = sc->gfp_mask,
+		.memcg = memcg,
+	};
+	unsigned long lru_pages = 0;
+	enum lru_list lru;
+
+	if (memcg_cache_id(memcg) < 0)
+		return;
+
+	for_each_evictable_lru(lru)
+		lru_pages += get_lru_size(lruvec, lru);
+
+	nodes_clear(shrink.nodes_to_scan);
+	node_set(zone_to_nid(zone), shrink.nodes_to_scan);
+
+	shrink_slab(&shrink, nr_scanned, lru_pages);
+	if (reclaim_state) {
+		sc->nr_reclaimed += reclaim_state->reclaimed_slab;
+		reclaim_state->reclaimed_slab = 0;
+	}
+}
+
 static void shrink_zone(struct zone *zone, struct scan_control *sc)
 {
 	unsigned long nr_reclaimed, nr_scanned;
@@ -2254,6 +2295,7 @@ static void shrink_zone(struct zone *zone, struct scan_control *sc)
 
 		memcg = mem_cgroup_iter(root, NULL, &reclaim);
 		do {
+			unsigned long lruvec_scanned = sc->nr_scanned;
 			struct lruvec *lruvec;
 
 			lruvec = mem_cgroup_zone_lruvec(zone, memcg);
@@ -2261,6 +2303,10 @@ static void shrink_zone(struct zone *zone, struct scan_control *sc)
 			sc->swappiness = mem_cgroup_swappiness(memcg);
 			shrink_lruvec(lruvec, sc);
 
+			if (!global_reclaim(sc))
+				shrink_slab_memcg(zone, memcg, sc,
+					sc->nr_scanned - lruvec_scanned);
+
 			/*
 			 * Direct reclaim and kswapd have to scan all memory
 			 * cgroups to fulfill the overall scan target for the
@@ -12,6 +12,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/percpu.h>
 #include <linux/random.h>
 #include <linux/slab.h>
 #include <linux/string.h>
@@ -41,8 +42,15 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 		      unsigned int nr_table_entries)
 {
 	size_t lopt_size = sizeof(struct listen_sock);
+	struct reqsk_cpu_queue __percpu *cpu_queues = NULL;
 	struct listen_sock *lopt;
 
+	if (queue->rskq_percpu) {
+		cpu_queues = alloc_percpu(struct reqsk_cpu_queue);
+		if (cpu_queues == NULL)
+			return -ENOMEM;
+	}
+
 	nr_table_entries = min_t(u32, nr_table_entries, sysctl_max_syn_backlog);
 	nr_table_entries = max_t(u32, nr_table_entries, 8);
 	nr_table_entries = roundup_pow_of_two(nr_table_entries + 1);
@@ -51,8 +59,10 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 		lopt = vzalloc(lopt_size);
 	else
 		lopt = kzalloc(lopt_size, GFP_KERNEL);
-	if (lopt == NULL)
+	if (lopt == NULL) {
+		free_percpu(cpu_queues);
 		return -ENOMEM;
+	}
 
 	for (lopt->max_qlen_log = 3;
 	     (1 << lopt->max_qlen_log) < nr_table_entries;
@@ -61,6 +71,8 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
 	rwlock_init(&queue->syn_wait_lock);
 	queue->rskq_accept_head = NULL;
+	queue->rskq_cpu_qlen = 0;
+	queue->cpu_queues = cpu_queues;
 	lopt->nr_table_entries = nr_table_entries;
 
 	write_lock_bh(&queue->syn_wait_lock);
@@ -88,6 +100,9 @@ void __reqsk_queue_destroy(struct request_sock_queue *queue)
 		vfree(lopt);
 	else
 		kfree(lopt);
+
+	free_percpu(queue->cpu_queues);
+	queue->cpu_queues = NULL;
 }
 
 static inline struct listen_sock *reqsk_queue_yank_listen_sk(
@@ -129,6 +144,62 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 		vfree(lopt);
 	else
 		kfree(lopt);
+
+	/* The children were yanked before */
+	WARN_ON(queue->rskq_cpu_qlen != 0);
+	free_percpu(queue->cpu_queues);
+	queue->cpu_queues = NULL;
+}
+
+/*
+ * Per-CPU accept queues (TCP_ACCEPT_PERCPU).  A child is queued on the CPU
+ * that handled its SYN, and accept() takes from the queue of the CPU it
+ * runs on, stealing from the other CPUs when that one is empty.  Like the
+ * single FIFO, they are protected by the listener's socket lock.
+ */
+struct request_sock *reqsk_cpu_queue_yank(struct request_sock_queue *queue)
+{
+	struct request_sock *head = NULL, **tailp = &head;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct reqsk_cpu_queue *cq = per_cpu_ptr(queue->cpu_queues, cpu);
+
+		if (cq->head == NULL)
+			continue;
+		*tailp = cq->head;
+		tailp = &cq->tail->dl_next;
+		cq->head = cq->tail = NULL;
+	}
+	queue->rskq_cpu_qlen = 0;
+
+	return head;
+}
+
+struct request_sock *reqsk_cpu_queue_remove(struct request_sock_queue *queue)
+{
+	int this_cpu = raw_smp_processor_id(), cpu = this_cpu;
+	struct reqsk_cpu_queue *cq = per_cpu_ptr(queue->cpu_queues, cpu);
+	struct request_sock *req;
+
+	while (cq->head == NULL) {
+		cpu = cpumask_next(cpu, cpu_possible_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_possible_mask);
+		if (cpu == this_cpu)
+			break;
+		cq = per_cpu_ptr(queue->cpu_queues, cpu);
+	}
+
+	req = cq->head;
+	WARN_ON(req == NULL);
+
+	cq->head = req->dl_next;
+	if (cq->head == NULL)
+		cq->tail = NULL;
+	queue->rskq_cpu_qlen--;
+
+	return req;
 }
 
 /*
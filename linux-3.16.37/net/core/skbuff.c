@@ -3983,6 +3983,9 @@ unsigned int skb_gso_transport_seglen(const struct sk_buff *skb)
 	if (likely(shinfo->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6)))
 		return tcp_hdrlen(skb) + shinfo->gso_size;
 
+	if (shinfo->gso_type & SKB_GSO_UDP_L4)
+		return sizeof(struct udphdr) + shinfo->gso_size;
+
 	/* UFO sets gso_size to the size of the fragmentation
 	 * payload, i.e. the size of the L4 (UDP) header is already
 	 * accounted for.
@@ -18,7 +18,6 @@
 #include <linux/list.h>
 #include <linux/netdevice.h>
 #include <linux/random.h>
-#include <linux/jhash.h>
 #include <linux/skbuff.h>
 #include <linux/slab.h>
 #include <linux/export.h>
@@ -46,51 +45,34 @@ static struct inet_frags lowpan_frags;
 static int lowpan_frag_reasm(struct lowpan_frag_queue *fq,
 			     struct sk_buff *prev, struct net_device *dev);
 
-static unsigned int lowpan_hash_frag(__be16 tag, u16 d_size,
-				     const struct ieee802154_addr *saddr,
-				     const struct ieee802154_addr *daddr)
-{
-	u32 c;
-
-	net_get_random_once(&lowpan_frags.rnd, sizeof(lowpan_frags.rnd));
-	c = jhash_3words(ieee802154_addr_hash(saddr),
-			 ieee802154_addr_hash(daddr),
-			 (__force u32)(tag + (d_size << 16)),
-			 lowpan_frags.rnd);
-
-	return c & (INETFRAGS_HASHSZ - 1);
-}
-
-static unsigned int lowpan_hashfn(struct inet_frag_queue *q)
-{
-	struct lowpan_frag_queue *fq;
-
-	fq = container_of(q, struct lowpan_frag_queue, q);
-	return lowpan_hash_frag(fq->tag, fq->d_size, &fq->saddr, &fq->daddr);
-}
-
-static bool lowpan_frag_match(struct inet_frag_queue *q, void *a)
+/* The key is hashed and compared with memcmp(), so padding and the unused
+ * part of the address union must be zeroed.
+ */
+static void lowpan_frag_key_addr(struct ieee802154_addr *k,
+				 const struct ieee802154_addr *a)
 {
-	struct lowpan_frag_queue *fq;
-	struct lowpan_create_arg *arg = a;
-
-	fq = container_of(q, struct lowpan_frag_queue, q);
-	return	fq->tag == arg->tag && fq->d_size == arg->d_size &&
-		ieee802154_addr_equal(&fq->saddr, arg->src) &&
-		ieee802154_addr_equal(&fq->daddr, arg->dst);
+	k->mode = a->mode;
+	k->pan_id = a->pan_id;
+	switch (a->mode) {
+	case IEEE802154_ADDR_LONG:
+		k->extended_addr = a->extended_addr;
+		break;
+	case IEEE802154_ADDR_SHORT:
+		k->short_addr = a->short_addr;
+		break;
+	}
 }
 
-static void lowpan_frag_init(struct inet_frag_queue *q, void *a)
+static void lowpan_frag_key(struct frag_lowpan_compare_key *key,
+			    const struct lowpan_frag_info *frag_info,
+			    const struct ieee802154_addr *src,
+			    const struct ieee802154_addr *dst)
 {
-	struct lowpan_frag_queue *fq;
-	struct lowpan_create_arg *arg = a;
-
-	fq = container_of(q, struct lowpan_frag_queue, q);
-
-	fq->tag = arg->tag;
-	fq->d_size = arg->d_size;
-	fq->saddr = *arg->src;
-	fq->daddr = *arg->dst;
+	memset(key, 0, sizeof(*key));
+	key->tag = frag_info->d_tag;
+	key->d_size = frag_info->d_size;
+	lowpan_frag_key_addr(&key->src, src);
+	lowpan_frag_key_addr(&key->dst, dst);
 }
 
 static void lowpan_frag_expire(unsigned long data)
@@ -117,26 +99,16 @@ fq_find(struct net *net, const struct lowpan_frag_info *frag_info,
 	const struct ieee802154_addr *src,
 	const struct ieee802154_addr *dst)
 {
+	struct frag_lowpan_compare_key key;
 	struct inet_frag_queue *q;
-	struct lowpan_create_arg arg;
-	unsigned int hash;
 	struct netns_ieee802154_lowpan *ieee802154_lowpan =
 		net_ieee802154_lowpan(net);
 
-	arg.tag = frag_info->d_tag;
-	arg.d_size = frag_info->d_size;
-	arg.src = src;
-	arg.dst = dst;
+	lowpan_frag_key(&key, frag_info, src, dst);
 
-	read_lock(&lowpan_frags.lock);
-	hash = lowpan_hash_frag(frag_info->d_tag, frag_info->d_size, src, dst);
-
-	q = inet_frag_find(&ieee802154_lowpan->frags,
-			   &lowpan_frags, &arg, hash);
-	if (IS_ERR_OR_NULL(q)) {
-		inet_frag_maybe_warn_overflow(q, pr_fmt());
+	q = inet_frag_find(&ieee802154_lowpan->frags, &key);
+	if (!q)
 		return NULL;
-	}
 	return container_of(q, struct lowpan_frag_queue, q);
 }
 
@@ -223,7 +195,6 @@ found:
 		return res;
 	}
 
-	inet_frag_lru_move(&fq->q);
 	return -1;
 err:
 	kfree_skb(skb);
@@ -373,8 +344,6 @@ int lowpan_frag_rcv(struct sk_buff *skb, const u8 frag_type)
 	if (frag_info->d_size > ieee802154_lowpan->max_dsize)
 		goto err;
 
-	inet_frag_evictor(&ieee802154_lowpan->frags, &lowpan_frags, false);
-
 	fq = fq_find(net, frag_info, &source, &dest);
 	if (fq != NULL) {
 		int ret;
@@ -425,10 +394,15 @@ static struct ctl_table lowpan_frags_ns_ctl_table[] = {
 	{ }
 };
 
+/* The hash secret is per table and no longer rotated, the sysctl is kept
+ * so that existing configurations still apply.
+ */
+static int lowpan_frags_secret_interval_unused;
+
 static struct ctl_table lowpan_frags_ctl_table[] = {
 	{
 		.procname	= "6lowpanfrag_secret_interval",
-		.data		= &lowpan_frags.secret_interval,
+		.data		= &lowpan_frags_secret_interval_unused,
 		.maxlen		= sizeof(int),
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec_jiffies,
@@ -524,15 +498,23 @@ static int __net_init lowpan_frags_init_net(struct net *net)
 {
 	struct netns_ieee802154_lowpan *ieee802154_lowpan =
 		net_ieee802154_lowpan(net);
+	int res;
 
 	ieee802154_lowpan->frags.high_thresh = IPV6_FRAG_HIGH_THRESH;
 	ieee802154_lowpan->frags.low_thresh = IPV6_FRAG_LOW_THRESH;
 	ieee802154_lowpan->frags.timeout = IPV6_FRAG_TIMEOUT;
 	ieee802154_lowpan->max_dsize = 0xFFFF;
 
-	inet_frags_init_net(&ieee802154_lowpan->frags);
+	res = inet_frags_init_net(&ieee802154_lowpan->frags, &lowpan_frags,
+				  net);
+	if (res)
+		return res;
+
+	res = lowpan_frags_ns_sysctl_register(net);
+	if (res)
+		inet_frags_exit_net(&ieee802154_lowpan->frags, &lowpan_frags);
 
-	return lowpan_frags_ns_sysctl_register(net);
+	return res;
 }
 
 static void __net_exit lowpan_frags_exit_net(struct net *net)
@@ -553,6 +535,18 @@ int __init lowpan_net_frag_init(void)
 {
 	int ret;
 
+	BUILD_BUG_ON(sizeof(struct frag_lowpan_compare_key) >
+		     sizeof(((struct inet_frag_queue *)NULL)->key));
+
+	lowpan_frags.constructor = NULL;
+	lowpan_frags.destructor = NULL;
+	lowpan_frags.skb_free = NULL;
+	lowpan_frags.qsize = sizeof(struct frag_queue);
+	lowpan_frags.frag_expire = lowpan_frag_expire;
+	lowpan_frags.rhash_params.key_len =
+		sizeof(struct frag_lowpan_compare_key);
+	inet_frags_init(&lowpan_frags);
+
 	ret = lowpan_frags_sysctl_register();
 	if (ret)
 		return ret;
@@ -561,16 +555,6 @@ int __init lowpan_net_frag_init(void)
 	if (ret)
 		goto err_pernet;
 
-	lowpan_frags.hashfn = lowpan_hashfn;
-	lowpan_frags.constructor = lowpan_frag_init;
-	lowpan_frags.destructor = NULL;
-	lowpan_frags.skb_free = NULL;
-	lowpan_frags.qsize = sizeof(struct frag_queue);
-	lowpan_frags.match = lowpan_frag_match;
-	lowpan_frags.frag_expire = lowpan_frag_expire;
-	lowpan_frags.secret_interval = 10 * 60 * HZ;
-	inet_frags_init(&lowpan_frags);
-
 	return ret;
 err_pernet:
 	lowpan_frags_sysctl_unregister();
@@ -579,7 +563,6 @@ err_pernet:
 
 void lowpan_net_frag_exit(void)
 {
-	inet_frags_fini(&lowpan_frags);
 	lowpan_frags_sysctl_unregister();
 	unregister_pernet_subsys(&lowpan_frags_ops);
 }
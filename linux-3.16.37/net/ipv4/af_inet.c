@@ -1266,6 +1266,7 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb,
 		       SKB_GSO_UDP_TUNNEL |
 		       SKB_GSO_UDP_TUNNEL_CSUM |
 		       SKB_GSO_MPLS |
+		       SKB_GSO_UDP_L4 |
 		       0)))
 		goto out;
 
@@ -1302,6 +1303,10 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb,
 	else
 		udpfrag = proto == IPPROTO_UDP && !skb->encapsulation;
 
+	/* UDP GSO splits the payload into datagrams, not IP fragments */
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		udpfrag = false;
+
 	ops = rcu_dereference(inet_offloads[proto]);
 	if (likely(ops && ops->callbacks.gso_segment))
 		segs = ops->callbacks.gso_segment(skb, features);
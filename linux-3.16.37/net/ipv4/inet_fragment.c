@@ -16,12 +16,15 @@
 #include <linux/module.h>
 #include <linux/timer.h>
 #include <linux/mm.h>
-#include <linux/random.h>
+#include <linux/jhash.h>
+#include <linux/rhashtable.h>
 #include <linux/skbuff.h>
 #include <linux/rtnetlink.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
+#include <net/ip.h>
 #include <net/inet_frag.h>
 #include <net/inet_ecn.h>
 
@@ -46,103 +49,140 @@ const u8 ip_frag_ecn_table[16] = {
 };
 EXPORT_SYMBOL(ip_frag_ecn_table);
 
-static void inet_frag_secret_rebuild(unsigned long dummy)
+static void inet_frag_schedule_worker(struct netns_frags *nf)
 {
-	struct inet_frags *f = (struct inet_frags *)dummy;
-	unsigned long now = jiffies;
-	int i;
+	schedule_work(&nf->frags_work);
+}
+
+static bool inet_frag_should_evict(struct netns_frags *nf)
+{
+	return frag_mem_limit(nf) > nf->low_thresh;
+}
 
-	/* Per bucket lock NOT needed here, due to write lock protection */
-	write_lock(&f->lock);
+/* Hand the queue over to the protocol's expire handler as if its timer
+ * had fired, flagged so that no timeout is reported for it.  Returns
+ * false if the timer already fired or the queue is being killed.
+ */
+static bool inet_frag_evict(struct inet_frag_queue *q, struct inet_frags *f)
+{
+	if (!del_timer(&q->timer))
+		return false;
 
-	get_random_bytes(&f->rnd, sizeof(u32));
-	for (i = 0; i < INETFRAGS_HASHSZ; i++) {
-		struct inet_frag_bucket *hb;
-		struct inet_frag_queue *q;
-		struct hlist_node *n;
+	spin_lock(&q->lock);
+	q->last_in |= INET_FRAG_EVICTED;
+	spin_unlock(&q->lock);
+
+	f->frag_expire((unsigned long)q);
+	return true;
+}
 
-		hb = &f->hash[i];
-		hlist_for_each_entry_safe(q, n, &hb->chain, list) {
-			unsigned int hval = f->hashfn(q);
+/* Memory limiting on fragments.  Walks the namespace's queues, which are
+ * in no particular order, and tears them down until usage is back under
+ * low_thresh.  A single run is bounded by INETFRAGS_EVICT_MAX queues and
+ * requeues itself if that was not enough.
+ */
+static void inet_frag_worker(struct work_struct *work)
+{
+	struct netns_frags *nf;
+	struct inet_frags *f;
+	struct rhashtable_iter hti;
+	struct inet_frag_queue *q;
+	unsigned int evicted = 0;
 
-			if (hval != i) {
-				struct inet_frag_bucket *hb_dest;
+	nf = container_of(work, struct netns_frags, frags_work);
+	f = nf->f;
 
-				hlist_del(&q->list);
+	if (rhashtable_walk_init(&nf->rhashtable, &hti))
+		return;
 
-				/* Relink to new hash chain. */
-				hb_dest = &f->hash[hval];
-				hlist_add_head(&q->list, &hb_dest->chain);
-			}
+	rhashtable_walk_start(&hti);
+	while (evicted < INETFRAGS_EVICT_MAX && inet_frag_should_evict(nf)) {
+		q = rhashtable_walk_next(&hti);
+		if (!q)
+			break;
+		if (IS_ERR(q)) {
+			if (PTR_ERR(q) == -EAGAIN)
+				continue;
+			break;
 		}
+
+		local_bh_disable();
+		if (inet_frag_evict(q, f))
+			evicted++;
+		local_bh_enable();
 	}
-	write_unlock(&f->lock);
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+
+	if (evicted)
+		NET_ADD_STATS(nf->net, LINUX_MIB_FRAGEVICTED, evicted);
 
-	mod_timer(&f->secret_timer, now + f->secret_interval);
+	if (evicted == INETFRAGS_EVICT_MAX && inet_frag_should_evict(nf))
+		inet_frag_schedule_worker(nf);
 }
 
 void inet_frags_init(struct inet_frags *f)
 {
-	int i;
-
-	for (i = 0; i < INETFRAGS_HASHSZ; i++) {
-		struct inet_frag_bucket *hb = &f->hash[i];
-
-		spin_lock_init(&hb->chain_lock);
-		INIT_HLIST_HEAD(&hb->chain);
-	}
-	rwlock_init(&f->lock);
-
-	setup_timer(&f->secret_timer, inet_frag_secret_rebuild,
-			(unsigned long)f);
-	f->secret_timer.expires = jiffies + f->secret_interval;
-	add_timer(&f->secret_timer);
+	f->rhash_params.head_offset = offsetof(struct inet_frag_queue, node);
+	f->rhash_params.key_offset = offsetof(struct inet_frag_queue, key);
+	f->rhash_params.hashfn = jhash;
+	f->rhash_params.automatic_shrinking = true;
 }
 EXPORT_SYMBOL(inet_frags_init);
 
-void inet_frags_init_net(struct netns_frags *nf)
+int inet_frags_init_net(struct netns_frags *nf, struct inet_frags *f,
+			struct net *net)
 {
-	nf->nqueues = 0;
-	init_frag_mem_limit(nf);
-	INIT_LIST_HEAD(&nf->lru_list);
-	spin_lock_init(&nf->lru_lock);
+	int err;
+
+	nf->f = f;
+	nf->net = net;
+	INIT_WORK(&nf->frags_work, inet_frag_worker);
+
+	err = init_frag_mem_limit(nf);
+	if (err)
+		return err;
+
+	err = rhashtable_init(&nf->rhashtable, &f->rhash_params);
+	if (err)
+		percpu_counter_destroy(&nf->mem);
+
+	return err;
 }
 EXPORT_SYMBOL(inet_frags_init_net);
 
-void inet_frags_fini(struct inet_frags *f)
+static void inet_frags_free_cb(void *ptr, void *arg)
 {
-	del_timer(&f->secret_timer);
-}
-EXPORT_SYMBOL(inet_frags_fini);
+	struct inet_frag_queue *q = ptr;
+	struct inet_frags *f = arg;
 
-void inet_frags_exit_net(struct netns_frags *nf, struct inet_frags *f)
-{
-	nf->low_thresh = 0;
+	/* If the timer can not be cancelled the queue is already being
+	 * torn down by its expire handler.  Otherwise we now own the
+	 * timer's reference until the end of this function.
+	 */
+	if (!del_timer(&q->timer))
+		return;
 
-	local_bh_disable();
-	inet_frag_evictor(nf, f, true);
-	local_bh_enable();
+	spin_lock_bh(&q->lock);
+	if (!(q->last_in & INET_FRAG_COMPLETE)) {
+		q->last_in |= INET_FRAG_COMPLETE;
+		atomic_dec(&q->refcnt);
+	}
+	spin_unlock_bh(&q->lock);
 
-	percpu_counter_destroy(&nf->mem);
+	inet_frag_put(q, f);
 }
-EXPORT_SYMBOL(inet_frags_exit_net);
 
-static inline void fq_unlink(struct inet_frag_queue *fq, struct inet_frags *f)
+void inet_frags_exit_net(struct netns_frags *nf, struct inet_frags *f)
 {
-	struct inet_frag_bucket *hb;
-	unsigned int hash;
-
-	read_lock(&f->lock);
-	hash = f->hashfn(fq);
-	hb = &f->hash[hash];
+	nf->high_thresh = 0; /* prevent creation of new queues */
+	cancel_work_sync(&nf->frags_work);
 
-	spin_lock(&hb->chain_lock);
-	hlist_del(&fq->list);
-	spin_unlock(&hb->chain_lock);
+	rhashtable_free_and_destroy(&nf->rhashtable, inet_frags_free_cb, f);
 
-	read_unlock(&f->lock);
-	inet_frag_lru_del(fq);
+	percpu_counter_destroy(&nf->mem);
 }
+EXPORT_SYMBOL(inet_frags_exit_net);
 
 void inet_frag_kill(struct inet_frag_queue *fq, struct inet_frags *f)
 {
@@ -150,7 +190,7 @@ void inet_frag_kill(struct inet_frag_queue *fq, struct inet_frags *f)
 		atomic_dec(&fq->refcnt);
 
 	if (!(fq->last_in & INET_FRAG_COMPLETE)) {
-		fq_unlink(fq, f);
+		rhashtable_remove(&fq->net->rhashtable, &fq->node);
 		atomic_dec(&fq->refcnt);
 		fq->last_in |= INET_FRAG_COMPLETE;
 	}
@@ -165,12 +205,11 @@ static inline void frag_kfree_skb(struct netns_frags *nf, struct inet_frags *f,
 	kfree_skb(skb);
 }
 
-void inet_frag_destroy(struct inet_frag_queue *q, struct inet_frags *f,
-					int *work)
+void inet_frag_destroy(struct inet_frag_queue *q, struct inet_frags *f)
 {
 	struct sk_buff *fp;
 	struct netns_frags *nf;
-	unsigned int sum, sum_truesize = 0;
+	unsigned int sum_truesize = 0;
 
 	WARN_ON(!(q->last_in & INET_FRAG_COMPLETE));
 	WARN_ON(del_timer(&q->timer) != 0);
@@ -185,108 +224,62 @@ void inet_frag_destroy(struct inet_frag_queue *q, struct inet_frags *f,
 		frag_kfree_skb(nf, f, fp);
 		fp = xp;
 	}
-	sum = sum_truesize + f->qsize;
-	if (work)
-		*work -= sum;
-	sub_frag_mem_limit(q, sum);
+	sub_frag_mem_limit(q, sum_truesize + f->qsize);
 
 	if (f->destructor)
 		f->destructor(q);
-	kfree(q);
 
+	/* Lockless lookups may still be looking at the queue */
+	kfree_rcu(q, rcu);
 }
 EXPORT_SYMBOL(inet_frag_destroy);
 
-int inet_frag_evictor(struct netns_frags *nf, struct inet_frags *f, bool force)
+/* Called under rcu_read_lock(); queues whose last reference is already
+ * gone are on their way out of the table and are treated as absent.
+ */
+static struct inet_frag_queue *inet_frag_lookup(struct netns_frags *nf,
+						void *key)
 {
 	struct inet_frag_queue *q;
-	int work, evicted = 0;
-
-	if (!force) {
-		if (frag_mem_limit(nf) <= nf->high_thresh)
-			return 0;
-	}
-
-	work = frag_mem_limit(nf) - nf->low_thresh;
-	while (work > 0 || force) {
-		spin_lock(&nf->lru_lock);
 
-		if (list_empty(&nf->lru_list)) {
-			spin_unlock(&nf->lru_lock);
-			break;
-		}
-
-		q = list_first_entry(&nf->lru_list,
-				struct inet_frag_queue, lru_list);
-		atomic_inc(&q->refcnt);
-		/* Remove q from list to avoid several CPUs grabbing it */
-		list_del_init(&q->lru_list);
-
-		spin_unlock(&nf->lru_lock);
-
-		spin_lock(&q->lock);
-		if (!(q->last_in & INET_FRAG_COMPLETE))
-			inet_frag_kill(q, f);
-		spin_unlock(&q->lock);
-
-		if (atomic_dec_and_test(&q->refcnt))
-			inet_frag_destroy(q, f, &work);
-		evicted++;
-	}
+	q = rhashtable_lookup(&nf->rhashtable, key);
+	if (q && !atomic_inc_not_zero(&q->refcnt))
+		q = NULL;
 
-	return evicted;
+	return q;
 }
-EXPORT_SYMBOL(inet_frag_evictor);
 
 static struct inet_frag_queue *inet_frag_intern(struct netns_frags *nf,
 		struct inet_frag_queue *qp_in, struct inet_frags *f,
-		void *arg)
+		void *key)
 {
-	struct inet_frag_bucket *hb;
 	struct inet_frag_queue *qp;
-	unsigned int hash;
 
-	read_lock(&f->lock); /* Protects against hash rebuild */
-	/*
-	 * While we stayed w/o the lock other CPU could update
-	 * the rnd seed, so we need to re-calculate the hash
-	 * chain. Fortunatelly the qp_in can be used to get one.
-	 */
-	hash = f->hashfn(qp_in);
-	hb = &f->hash[hash];
-	spin_lock(&hb->chain_lock);
-
-#ifdef CONFIG_SMP
-	/* With SMP race we have to recheck hash table, because
-	 * such entry could be created on other cpu, while we
-	 * released the hash bucket lock.
+	/* One reference for the table, one for the timer, one for the
+	 * caller.  Taken up front as other CPUs can find the queue as
+	 * soon as it is inserted.
 	 */
-	hlist_for_each_entry(qp, &hb->chain, list) {
-		if (qp->net == nf && f->match(qp, arg)) {
-			atomic_inc(&qp->refcnt);
-			spin_unlock(&hb->chain_lock);
-			read_unlock(&f->lock);
-			qp_in->last_in |= INET_FRAG_COMPLETE;
-			inet_frag_put(qp_in, f);
-			return qp;
-		}
+	atomic_set(&qp_in->refcnt, 3);
+	if (likely(rhashtable_lookup_insert(&nf->rhashtable, &qp_in->node))) {
+		mod_timer(&qp_in->timer, jiffies + nf->timeout);
+		return qp_in;
 	}
-#endif
-	qp = qp_in;
-	if (!mod_timer(&qp->timer, jiffies + nf->timeout))
-		atomic_inc(&qp->refcnt);
 
-	atomic_inc(&qp->refcnt);
-	hlist_add_head(&qp->list, &hb->chain);
-	inet_frag_lru_add(nf, qp);
-	spin_unlock(&hb->chain_lock);
-	read_unlock(&f->lock);
+	/* Another CPU created the same queue while we were allocating
+	 * ours, which was never visible to anyone else.
+	 */
+	qp_in->last_in |= INET_FRAG_COMPLETE;
+	inet_frag_destroy(qp_in, f);
+
+	rcu_read_lock();
+	qp = inet_frag_lookup(nf, key);
+	rcu_read_unlock();
 
 	return qp;
 }
 
 static struct inet_frag_queue *inet_frag_alloc(struct netns_frags *nf,
-		struct inet_frags *f, void *arg)
+		struct inet_frags *f, void *key)
 {
 	struct inet_frag_queue *q;
 
@@ -295,67 +288,62 @@ static struct inet_frag_queue *inet_frag_alloc(struct netns_frags *nf,
 		return NULL;
 
 	q->net = nf;
-	f->constructor(q, arg);
+	memcpy(&q->key, key, f->rhash_params.key_len);
+	if (f->constructor)
+		f->constructor(q, key);
 	add_frag_mem_limit(q, f->qsize);
 
 	setup_timer(&q->timer, f->frag_expire, (unsigned long)q);
 	spin_lock_init(&q->lock);
 	atomic_set(&q->refcnt, 1);
-	INIT_LIST_HEAD(&q->lru_list);
 
 	return q;
 }
 
 static struct inet_frag_queue *inet_frag_create(struct netns_frags *nf,
-		struct inet_frags *f, void *arg)
+		struct inet_frags *f, void *key)
 {
 	struct inet_frag_queue *q;
 
-	q = inet_frag_alloc(nf, f, arg);
+	q = inet_frag_alloc(nf, f, key);
 	if (q == NULL)
 		return NULL;
 
-	return inet_frag_intern(nf, q, f, arg);
+	return inet_frag_intern(nf, q, f, key);
 }
 
-struct inet_frag_queue *inet_frag_find(struct netns_frags *nf,
-		struct inet_frags *f, void *key, unsigned int hash)
-	__releases(&f->lock)
+/* Find the queue matching @key, which must be laid out as the protocol's
+ * compare key, or create it.  Returns the queue with a reference held,
+ * or NULL if it does not exist and can not be created.
+ */
+struct inet_frag_queue *inet_frag_find(struct netns_frags *nf, void *key)
 {
-	struct inet_frag_bucket *hb;
 	struct inet_frag_queue *q;
-	int depth = 0;
+	bool pressure = false;
 
-	hb = &f->hash[hash];
+	/* The namespace is being dismantled */
+	if (!nf->high_thresh)
+		return NULL;
 
-	spin_lock(&hb->chain_lock);
-	hlist_for_each_entry(q, &hb->chain, list) {
-		if (q->net == nf && f->match(q, key)) {
-			atomic_inc(&q->refcnt);
-			spin_unlock(&hb->chain_lock);
-			read_unlock(&f->lock);
-			return q;
-		}
-		depth++;
+	if (frag_mem_limit(nf) > nf->high_thresh) {
+		inet_frag_schedule_worker(nf);
+		pressure = true;
 	}
-	spin_unlock(&hb->chain_lock);
-	read_unlock(&f->lock);
 
-	if (depth <= INETFRAGS_MAXDEPTH)
-		return inet_frag_create(nf, f, key);
-	else
-		return ERR_PTR(-ENOBUFS);
-}
-EXPORT_SYMBOL(inet_frag_find);
+	rcu_read_lock();
+	q = inet_frag_lookup(nf, key);
+	rcu_read_unlock();
+	if (q)
+		return q;
 
-void inet_frag_maybe_warn_overflow(struct inet_frag_queue *q,
-				   const char *prefix)
-{
-	static const char msg[] = "inet_frag_find: Fragment hash bucket"
-		" list length grew over limit " __stringify(INETFRAGS_MAXDEPTH)
-		". Dropping fragment.\n";
+	/* Let datagrams already in progress complete, but do not start
+	 * new ones until the worker made room.
+	 */
+	if (pressure) {
+		NET_INC_STATS(nf->net, LINUX_MIB_FRAGMEMPRESSURE);
+		return NULL;
+	}
 
-	if (PTR_ERR(q) == -ENOBUFS)
-		LIMIT_NETDEBUG(KERN_WARNING "%s%s", prefix, msg);
+	return inet_frag_create(nf, nf->f, key);
 }
-EXPORT_SYMBOL(inet_frag_maybe_warn_overflow);
+EXPORT_SYMBOL(inet_frag_find);
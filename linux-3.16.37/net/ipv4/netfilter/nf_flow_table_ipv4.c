@@ -0,0 +1,290 @@
+/*
+ * IPv4 fast path for the netfilter flow table.
+ *
+ * Runs first thing in PREROUTING, right after defragmentation.  Packets of
+ * offloaded connections get their NAT applied and their TTL decremented
+ * here and are handed to the neighbour layer of the cached route, never
+ * reaching conntrack, the filter and NAT tables or the routing code.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/skbuff.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/arp.h>
+#include <net/checksum.h>
+#include <net/ip.h>
+#include <net/neighbour.h>
+#include <net/route.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct flow_ports {
+	__be16 source, dest;
+};
+
+static int nf_flow_tuple_ip(struct sk_buff *skb, const struct net_device *dev,
+			    struct flow_offload_tuple *tuple)
+{
+	struct flow_ports *ports;
+	unsigned int thoff;
+	struct iphdr *iph;
+
+	iph = ip_hdr(skb);
+	thoff = iph->ihl * 4;
+
+	/* Anything unusual is left to the slow path */
+	if (ip_is_fragment(iph) || thoff != sizeof(*iph))
+		return -1;
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		if (!pskb_may_pull(skb, thoff + sizeof(struct tcphdr)))
+			return -1;
+		break;
+	case IPPROTO_UDP:
+		if (!pskb_may_pull(skb, thoff + sizeof(struct udphdr)))
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	iph = ip_hdr(skb);
+	ports = (struct flow_ports *)(skb_network_header(skb) + thoff);
+
+	tuple->src_v4.s_addr	= iph->saddr;
+	tuple->dst_v4.s_addr	= iph->daddr;
+	tuple->src_port		= ports->source;
+	tuple->dst_port		= ports->dest;
+	tuple->l3proto		= NFPROTO_IPV4;
+	tuple->l4proto		= iph->protocol;
+	tuple->iifidx		= dev->ifindex;
+
+	return 0;
+}
+
+/* Connection teardown is conntrack's business */
+static bool nf_flow_state_check(struct flow_offload *flow, struct sk_buff *skb)
+{
+	struct tcphdr *tcph;
+
+	if (ip_hdr(skb)->protocol != IPPROTO_TCP)
+		return true;
+
+	tcph = (struct tcphdr *)(skb_network_header(skb) + ip_hdrlen(skb));
+	if (unlikely(tcph->fin || tcph->rst)) {
+		flow_offload_teardown(flow);
+		return false;
+	}
+
+	return true;
+}
+
+static bool nf_flow_exceeds_mtu(const struct sk_buff *skb, unsigned int mtu)
+{
+	if (skb->len <= mtu)
+		return false;
+
+	if (skb_is_gso(skb) && skb_gso_network_seglen(skb) <= mtu)
+		return false;
+
+	return true;
+}
+
+/*
+ * Rewrite the packet into what the other direction's tuple expects to
+ * see coming back, which covers SNAT and DNAT alike.
+ */
+static void nf_flow_nat_ip(const struct flow_offload *flow,
+			   struct sk_buff *skb,
+			   enum flow_offload_tuple_dir dir)
+{
+	const struct flow_offload_tuple *other = &flow->tuplehash[!dir].tuple;
+	struct iphdr *iph = ip_hdr(skb);
+	struct flow_ports *ports;
+	__sum16 *check = NULL;
+	bool udp_nocsum = false;
+
+	ports = (struct flow_ports *)(skb_network_header(skb) + ip_hdrlen(skb));
+
+	switch (iph->protocol) {
+	case IPPROTO_TCP:
+		check = &((struct tcphdr *)ports)->check;
+		break;
+	case IPPROTO_UDP:
+		check = &((struct udphdr *)ports)->check;
+		if (!*check && skb->ip_summed != CHECKSUM_PARTIAL)
+			udp_nocsum = true;
+		break;
+	}
+
+	if (iph->saddr != other->dst_v4.s_addr) {
+		if (!udp_nocsum)
+			inet_proto_csum_replace4(check, skb, iph->saddr,
+						 other->dst_v4.s_addr, 1);
+		csum_replace4(&iph->check, iph->saddr, other->dst_v4.s_addr);
+		iph->saddr = other->dst_v4.s_addr;
+	}
+	if (iph->daddr != other->src_v4.s_addr) {
+		if (!udp_nocsum)
+			inet_proto_csum_replace4(check, skb, iph->daddr,
+						 other->src_v4.s_addr, 1);
+		csum_replace4(&iph->check, iph->daddr, other->src_v4.s_addr);
+		iph->daddr = other->src_v4.s_addr;
+	}
+	if (ports->source != other->dst_port) {
+		if (!udp_nocsum)
+			inet_proto_csum_replace2(check, skb, ports->source,
+						 other->dst_port, 0);
+		ports->source = other->dst_port;
+	}
+	if (ports->dest != other->src_port) {
+		if (!udp_nocsum)
+			inet_proto_csum_replace2(check, skb, ports->dest,
+						 other->src_port, 0);
+		ports->dest = other->src_port;
+	}
+
+	if (iph->protocol == IPPROTO_UDP && !udp_nocsum && !*check)
+		*check = CSUM_MANGLED_0;
+}
+
+/* The tail of ip_finish_output2(), without the POSTROUTING hook */
+static void nf_flow_xmit_ip(struct sk_buff *skb, struct dst_entry *dst)
+{
+	struct net_device *dev = dst->dev;
+	struct neighbour *neigh;
+	u32 nexthop;
+
+	if (unlikely(dev->header_ops &&
+		     skb_cow_head(skb, LL_RESERVED_SPACE(dev)))) {
+		kfree_skb(skb);
+		return;
+	}
+
+	rcu_read_lock_bh();
+	nexthop = (__force u32)rt_nexthop((struct rtable *)dst,
+					  ip_hdr(skb)->daddr);
+	neigh = __ipv4_neigh_lookup_noref(dev, nexthop);
+	if (unlikely(!neigh))
+		neigh = __neigh_create(&arp_tbl, &nexthop, dev, false);
+	if (!IS_ERR(neigh))
+		dst_neigh_output(dst, neigh, skb);
+	else
+		kfree_skb(skb);
+	rcu_read_unlock_bh();
+}
+
+static unsigned int
+nf_flow_offload_ip_hook(const struct nf_hook_ops *ops,
+			struct sk_buff *skb,
+			const struct net_device *in,
+			const struct net_device *out,
+			int (*okfn)(struct sk_buff *))
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	enum flow_offload_tuple_dir dir;
+	struct flow_offload_tuple tuple;
+	struct nf_conn_acct *acct;
+	struct flow_offload *flow;
+	struct dst_entry *dst;
+	struct iphdr *iph;
+
+	if (skb->pkt_type != PACKET_HOST)
+		return NF_ACCEPT;
+
+	memset(&tuple, 0, sizeof(tuple));
+	if (nf_flow_tuple_ip(skb, in, &tuple) < 0)
+		return NF_ACCEPT;
+
+	tuplehash = flow_offload_lookup(dev_net(in), &tuple);
+	if (!tuplehash)
+		return NF_ACCEPT;
+
+	dir = tuplehash->tuple.dir;
+	flow = container_of(tuplehash, struct flow_offload, tuplehash[dir]);
+
+	if (unlikely((flow->flags & FLOW_OFFLOAD_TEARDOWN) ||
+		     nf_ct_is_dying(flow->ct)))
+		return NF_ACCEPT;
+
+	if (!nf_flow_state_check(flow, skb))
+		return NF_ACCEPT;
+
+	/* Route went away or changed: back to the slow path for good */
+	dst = tuplehash->tuple.dst_cache;
+	if (unlikely(!dst_check(dst, 0))) {
+		flow_offload_teardown(flow);
+		return NF_ACCEPT;
+	}
+
+	/* Let ip_forward() send the ICMP errors */
+	if (ip_hdr(skb)->ttl <= 1 ||
+	    nf_flow_exceeds_mtu(skb, tuplehash->tuple.mtu) ||
+	    skb_warn_if_lro(skb))
+		return NF_ACCEPT;
+
+	if (!skb_make_writable(skb, ip_hdrlen(skb) +
+			       (ip_hdr(skb)->protocol == IPPROTO_TCP ?
+				sizeof(struct tcphdr) : sizeof(struct udphdr))))
+		return NF_DROP;
+
+	if (flow->flags & (FLOW_OFFLOAD_SNAT | FLOW_OFFLOAD_DNAT))
+		nf_flow_nat_ip(flow, skb, dir);
+
+	flow->timeout = (u32)jiffies + NF_FLOW_TIMEOUT;
+
+	acct = nf_conn_acct_find(flow->ct);
+	if (acct) {
+		atomic64_inc(&acct->counter[dir].packets);
+		atomic64_add(skb->len, &acct->counter[dir].bytes);
+	}
+
+	iph = ip_hdr(skb);
+	ip_decrease_ttl(iph);
+	skb_forward_csum(skb);
+
+	skb_dst_drop(skb);
+	skb_dst_set_noref(skb, dst);
+	skb->dev = dst->dev;
+
+	IP_INC_STATS_BH(dev_net(dst->dev), IPSTATS_MIB_OUTFORWDATAGRAMS);
+	nf_flow_xmit_ip(skb, dst);
+
+	return NF_STOLEN;
+}
+
+static struct nf_hook_ops nf_flow_offload_ip_ops __read_mostly = {
+	.hook		= nf_flow_offload_ip_hook,
+	.owner		= THIS_MODULE,
+	.pf		= NFPROTO_IPV4,
+	.hooknum	= NF_INET_PRE_ROUTING,
+	.priority	= NF_IP_PRI_CONNTRACK_DEFRAG + 1,
+};
+
+static int __init nf_flow_ipv4_module_init(void)
+{
+	return nf_register_hook(&nf_flow_offload_ip_ops);
+}
+
+static void __exit nf_flow_ipv4_module_exit(void)
+{
+	nf_unregister_hook(&nf_flow_offload_ip_ops);
+}
+
+module_init(nf_flow_ipv4_module_init);
+module_exit(nf_flow_ipv4_module_exit);
+
+MODULE_LICENSE("GPL");
@@ -286,6 +286,8 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TCPWantZeroWindowAdv", LINUX_MIB_TCPWANTZEROWINDOWADV),
 	SNMP_MIB_ITEM("TCPSynRetrans", LINUX_MIB_TCPSYNRETRANS),
 	SNMP_MIB_ITEM("TCPOrigDataSent", LINUX_MIB_TCPORIGDATASENT),
+	SNMP_MIB_ITEM("FragMemPressure", LINUX_MIB_FRAGMEMPRESSURE),
+	SNMP_MIB_ITEM("FragEvicted", LINUX_MIB_FRAGEVICTED),
 	SNMP_MIB_SENTINEL
 };
 
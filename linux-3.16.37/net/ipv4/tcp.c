@@ -2638,6 +2638,14 @@ static int do_tcp_setsockopt(struct sock *sk, int level,
 					TCP_RTO_MAX / HZ);
 		break;
 
+	case TCP_ACCEPT_PERCPU:
+		/* The queues are set up by listen() */
+		if (sk->sk_state != TCP_CLOSE)
+			err = -EINVAL;
+		else
+			icsk->icsk_accept_queue.rskq_percpu = !!val;
+		break;
+
 	case TCP_WINDOW_CLAMP:
 		if (!val) {
 			if (sk->sk_state != TCP_CLOSE) {
@@ -2858,6 +2866,9 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 		val = retrans_to_secs(icsk->icsk_accept_queue.rskq_defer_accept,
 				      TCP_TIMEOUT_INIT / HZ, TCP_RTO_MAX / HZ);
 		break;
+	case TCP_ACCEPT_PERCPU:
+		val = icsk->icsk_accept_queue.rskq_percpu;
+		break;
 	case TCP_WINDOW_CLAMP:
 		val = tp->window_clamp;
 		break;
@@ -14,6 +14,9 @@
 #include <net/udp.h>
 #include <net/protocol.h>
 
+/* Upper bound on the number of datagrams coalesced into one GRO packet */
+#define UDP_GRO_CNT_MAX 64
+
 static DEFINE_SPINLOCK(udp_offload_lock);
 static struct udp_offload_priv __rcu *udp_offload_base __read_mostly;
 
@@ -47,6 +50,100 @@ static int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/* Split a UDP_SEGMENT (or UDP GRO) packet back into the datagrams it was
+ * built from. Unlike UFO every segment carries its own UDP header, so only
+ * the length and the checksum of each header have to be fixed up.
+ */
+struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+				  netdev_features_t features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *seg;
+	unsigned int sum_truesize = 0;
+	unsigned int oldlen;
+	unsigned int mss;
+	struct udphdr *uh;
+	bool copy_destructor;
+	__sum16 newcheck;
+	__be16 newlen;
+	__be32 delta;
+
+	if (!pskb_may_pull(gso_skb, sizeof(*uh)))
+		goto out;
+
+	mss = skb_shinfo(gso_skb)->gso_size;
+	if (unlikely(gso_skb->len <= sizeof(*uh) + mss))
+		goto out;
+
+	if (skb_gso_ok(gso_skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		skb_shinfo(gso_skb)->gso_segs = DIV_ROUND_UP(gso_skb->len -
+							     sizeof(*uh), mss);
+		segs = NULL;
+		goto out;
+	}
+
+	oldlen = (u16)~gso_skb->len;
+	__skb_pull(gso_skb, sizeof(*uh));
+
+	copy_destructor = gso_skb->destructor == sock_wfree;
+
+	segs = skb_segment(gso_skb, features);
+	if (IS_ERR_OR_NULL(segs))
+		goto out;
+
+	/* all segments but the last carry exactly mss bytes of payload */
+	newlen = htons(sizeof(*uh) + mss);
+	delta = htonl(oldlen + (sizeof(*uh) + mss));
+
+	seg = segs;
+	uh = udp_hdr(seg);
+	newcheck = ~csum_fold((__force __wsum)((__force u32)uh->check +
+					       (__force u32)delta));
+
+	do {
+		uh->len = newlen;
+		uh->check = newcheck;
+
+		if (seg->ip_summed != CHECKSUM_PARTIAL)
+			uh->check = gso_make_checksum(seg, ~uh->check) ? :
+				    CSUM_MANGLED_0;
+
+		if (copy_destructor) {
+			seg->destructor = gso_skb->destructor;
+			seg->sk = gso_skb->sk;
+			sum_truesize += seg->truesize;
+		}
+		seg = seg->next;
+		uh = udp_hdr(seg);
+	} while (seg->next);
+
+	/* Charge the segments to the socket instead of the GSO packet, the
+	 * last one inherits the GSO packet's reference.
+	 */
+	if (copy_destructor) {
+		swap(gso_skb->sk, seg->sk);
+		swap(gso_skb->destructor, seg->destructor);
+		sum_truesize += seg->truesize;
+		atomic_add(sum_truesize - gso_skb->truesize,
+			   &seg->sk->sk_wmem_alloc);
+	}
+
+	/* the last segment may be shorter than mss */
+	newlen = htons(skb_tail_pointer(seg) - skb_transport_header(seg) +
+		       seg->data_len);
+	delta = htonl(oldlen + ntohs(newlen));
+	uh->len = newlen;
+	uh->check = ~csum_fold((__force __wsum)((__force u32)uh->check +
+				(__force u32)delta));
+	if (seg->ip_summed != CHECKSUM_PARTIAL)
+		uh->check = gso_make_checksum(seg, ~uh->check) ? :
+			    CSUM_MANGLED_0;
+out:
+	return segs;
+}
+EXPORT_SYMBOL_GPL(__udp_gso_segment);
+
 static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 					 netdev_features_t features)
 {
@@ -62,6 +159,11 @@ static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 		goto out;
 	}
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
+		segs = __udp_gso_segment(skb, features);
+		goto out;
+	}
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -152,6 +254,109 @@ unlock:
 }
 EXPORT_SYMBOL(udp_del_offload);
 
+/* Only look for a socket once somebody asked for UDP_GRO */
+static bool udp_gro_sk_enabled(struct sk_buff *skb, const struct udphdr *uh)
+{
+	const struct iphdr *iph = skb_gro_network_header(skb);
+	struct sock *sk;
+	bool enabled;
+
+	if (!static_key_false(&udp_gro_needed))
+		return false;
+
+	sk = udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			     iph->daddr, uh->dest, skb->dev->ifindex);
+	if (!sk)
+		return false;
+
+	enabled = udp_sk(sk)->gro_enabled;
+	sock_put(sk);
+	return enabled;
+}
+
+static struct sk_buff **udp_gro_receive_segment(struct sk_buff **head,
+						struct sk_buff *skb,
+						struct udphdr *uh,
+						unsigned int off)
+{
+	const struct iphdr *iph = skb_gro_network_header(skb);
+	struct sk_buff *p, **pp = NULL;
+	struct udphdr *uh2;
+	unsigned int ulen, ulen2;
+	__wsum wsum;
+
+	/* requires non zero csum, for symmetry with GSO */
+	if (!uh->check)
+		goto flush;
+
+	ulen = ntohs(uh->len);
+	if (ulen <= sizeof(*uh) || ulen != skb_gro_len(skb))
+		goto flush;
+
+	/* The merged packet is handed up as CHECKSUM_PARTIAL, so each
+	 * datagram has to be verified before it is coalesced.
+	 */
+	wsum = NAPI_GRO_CB(skb)->csum;
+
+	switch (skb->ip_summed) {
+	case CHECKSUM_UNNECESSARY:
+		break;
+
+	case CHECKSUM_NONE:
+		wsum = skb_checksum(skb, skb_gro_offset(skb), skb_gro_len(skb),
+				    0);
+
+		/* fall through */
+
+	case CHECKSUM_COMPLETE:
+		if (!udp_v4_check(skb_gro_len(skb), iph->saddr, iph->daddr,
+				  wsum)) {
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+			break;
+		}
+
+		/* fall through */
+
+	default:
+		goto flush;
+	}
+
+	skb_gro_pull(skb, sizeof(struct udphdr));
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+
+		/* match ports only, as csum is always non zero */
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* A longer datagram cannot follow: flush and start over with
+		 * this one. A shorter one ends the train after being merged.
+		 */
+		ulen2 = ntohs(uh2->len);
+		if (NAPI_GRO_CB(skb)->flush || NAPI_GRO_CB(p)->flush ||
+		    ulen > ulen2 || skb_gro_receive(head, skb))
+			return head;
+
+		p = *head;
+		if (ulen != ulen2 || NAPI_GRO_CB(p)->count >= UDP_GRO_CNT_MAX)
+			pp = head;
+
+		return pp;
+	}
+
+	return NULL;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
 static struct sk_buff **udp_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 {
 	struct udp_offload_priv *uo_priv;
@@ -160,13 +365,9 @@ static struct sk_buff **udp_gro_receive(struct sk_buff **head, struct sk_buff *s
 	unsigned int hlen, off;
 	int flush = 1;
 
-	if (NAPI_GRO_CB(skb)->encap_mark ||
-	    (!skb->encapsulation && skb->ip_summed != CHECKSUM_COMPLETE))
+	if (NAPI_GRO_CB(skb)->encap_mark)
 		goto out;
 
-	/* mark that this skb passed once through the tunnel gro layer */
-	NAPI_GRO_CB(skb)->encap_mark = 1;
-
 	off  = skb_gro_offset(skb);
 	hlen = off + sizeof(*uh);
 	uh   = skb_gro_header_fast(skb, off);
@@ -177,15 +378,27 @@ static struct sk_buff **udp_gro_receive(struct sk_buff **head, struct sk_buff *s
 	}
 
 	rcu_read_lock();
-	uo_priv = rcu_dereference(udp_offload_base);
-	for (; uo_priv != NULL; uo_priv = rcu_dereference(uo_priv->next)) {
-		if (uo_priv->offload->port == uh->dest &&
-		    uo_priv->offload->callbacks.gro_receive)
-			goto unflush;
+	if (skb->encapsulation || skb->ip_summed == CHECKSUM_COMPLETE) {
+		uo_priv = rcu_dereference(udp_offload_base);
+		for (; uo_priv != NULL;
+		     uo_priv = rcu_dereference(uo_priv->next)) {
+			if (uo_priv->offload->port == uh->dest &&
+			    uo_priv->offload->callbacks.gro_receive)
+				goto unflush;
+		}
+	}
+
+	/* plain datagrams for a socket that asked for UDP_GRO */
+	if (!skb->encapsulation && udp_gro_sk_enabled(skb, uh)) {
+		pp = udp_gro_receive_segment(head, skb, uh, off);
+		rcu_read_unlock();
+		return pp;
 	}
 	goto out_unlock;
 
 unflush:
+	/* mark that this skb passed once through the tunnel gro layer */
+	NAPI_GRO_CB(skb)->encap_mark = 1;
 	flush = 0;
 
 	for (p = *head; p; p = p->next) {
@@ -210,6 +423,22 @@ out:
 	return pp;
 }
 
+static int udp_gro_complete_segment(struct sk_buff *skb, int nhoff)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
+
+	uh->check = ~udp_v4_check(skb->len - nhoff, iph->saddr, iph->daddr, 0);
+	skb->csum_start = (unsigned char *)uh - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_L4;
+
+	return 0;
+}
+
 static int udp_gro_complete(struct sk_buff *skb, int nhoff)
 {
 	struct udp_offload_priv *uo_priv;
@@ -219,6 +448,10 @@ static int udp_gro_complete(struct sk_buff *skb, int nhoff)
 
 	uh->len = newlen;
 
+	/* only tunnel packets are marked, see udp_gro_receive() */
+	if (!NAPI_GRO_CB(skb)->encap_mark)
+		return udp_gro_complete_segment(skb, nhoff);
+
 	rcu_read_lock();
 
 	uo_priv = rcu_dereference(udp_offload_base);
@@ -224,14 +224,16 @@ static struct sock *udp6_lib_lookup2(struct net *net,
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
 	int score, badness, matches = 0, reuseport = 0;
+	int cpu = raw_smp_processor_id();
 	u32 hash = 0;
 
 begin:
 	result = NULL;
 	badness = -1;
 	udp_portaddr_for_each_entry_rcu(sk, node, &hslot2->head) {
-		score = compute_score2(sk, net, saddr, sport,
-				      daddr, hnum, dif);
+		score = udp_reader_cpu_score(sk, compute_score2(sk, net,
+					     saddr, sport, daddr, hnum, dif),
+					     cpu);
 		if (score > badness) {
 			result = sk;
 			badness = score;
@@ -240,7 +242,7 @@ begin:
 				hash = udp6_ehashfn(net, daddr, hnum,
 						    saddr, sport);
 				matches = 1;
-			} else if (score == SCORE2_MAX)
+			} else if (score >> 1 == SCORE2_MAX)
 				goto exact_match;
 		} else if (score == badness && reuseport) {
 			matches++;
@@ -262,7 +264,7 @@ exact_match:
 		if (unlikely(!atomic_inc_not_zero_hint(&result->sk_refcnt, 2)))
 			result = NULL;
 		else if (unlikely(compute_score2(result, net, saddr, sport,
-				  daddr, hnum, dif) < badness)) {
+				  daddr, hnum, dif) < badness >> 1)) {
 			sock_put(result);
 			goto begin;
 		}
@@ -281,9 +283,11 @@ struct sock *__udp6_lib_lookup(struct net *net,
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
 	int score, badness, matches = 0, reuseport = 0;
+	int cpu;
 	u32 hash = 0;
 
 	rcu_read_lock();
+	cpu = raw_smp_processor_id();
 	if (hslot->count > 10) {
 		hash2 = udp6_portaddr_hash(net, daddr, hnum);
 		slot2 = hash2 & udptable->mask;
@@ -312,7 +316,9 @@ begin:
 	result = NULL;
 	badness = -1;
 	sk_nulls_for_each_rcu(sk, node, &hslot->head) {
-		score = compute_score(sk, net, hnum, saddr, sport, daddr, dport, dif);
+		score = udp_reader_cpu_score(sk, compute_score(sk, net, hnum,
+					     saddr, sport, daddr, dport, dif),
+					     cpu);
 		if (score > badness) {
 			result = sk;
 			badness = score;
@@ -341,7 +347,7 @@ begin:
 		if (unlikely(!atomic_inc_not_zero_hint(&result->sk_refcnt, 2)))
 			result = NULL;
 		else if (unlikely(compute_score(result, net, hnum, saddr, sport,
-					daddr, dport, dif) < badness)) {
+					daddr, dport, dif) < badness >> 1)) {
 			sock_put(result);
 			goto begin;
 		}
@@ -396,6 +402,8 @@ int udpv6_recvmsg(struct kiocb *iocb, struct sock *sk,
 	if (flags & MSG_ERRQUEUE)
 		return ipv6_recv_error(sk, msg, len, addr_len);
 
+	udp_reader_cpu_update(sk);
+
 	if (np->rxpmtu && np->rxopt.bits.rxpmtu)
 		return ipv6_recv_rxpmtu(sk, msg, len, addr_len);
 
@@ -480,6 +488,9 @@ try_again:
 		*addr_len = sizeof(*sin6);
 	}
 
+	if (udp_sk(sk)->gro_enabled)
+		udp_cmsg_recv(msg, sk, skb);
+
 	if (np->rxopt.all)
 		ip6_datagram_recv_common_ctl(sk, msg, skb);
 
@@ -1094,6 +1105,7 @@ int udpv6_sendmsg(struct kiocb *iocb, struct sock *sk,
 	int err;
 	int connected = 0;
 	int is_udplite = IS_UDPLITE(sk);
+	u16 gso_size = 0;
 	int (*getfrag)(void *, char *, int, int, int, struct sk_buff *);
 
 	/* destination address check */
@@ -1142,6 +1154,10 @@ do_udp_sendmsg:
 	if (up->pending == AF_INET)
 		return udp_sendmsg(iocb, sk, msg, len);
 
+	/* UDP GSO is only wired up for IPv4 and v4-mapped destinations */
+	if (up->gso_size)
+		return -EOPNOTSUPP;
+
 	/* Rough check on arithmetic overflow,
 	   better check is made in ip6_append_data().
 	   */
@@ -1219,8 +1235,13 @@ do_udp_sendmsg:
 		memset(opt, 0, sizeof(struct ipv6_txoptions));
 		opt->tot_len = sizeof(*opt);
 
-		err = ip6_datagram_send_ctl(sock_net(sk), sk, msg, &fl6, opt,
-					    &hlimit, &tclass, &dontfrag);
+		err = udp_cmsg_send(sk, msg, &gso_size);
+		if (err >= 0 && gso_size)
+			err = -EOPNOTSUPP;
+		else if (err > 0)
+			err = ip6_datagram_send_ctl(sock_net(sk), sk, msg,
+						    &fl6, opt, &hlimit,
+						    &tclass, &dontfrag);
 		if (err < 0) {
 			fl6_sock_release(flowlabel);
 			return err;
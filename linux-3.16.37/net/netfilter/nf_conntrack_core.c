@@ -743,64 +743,80 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
+/* Number of buckets sampled, and entries looked at, per early drop */
 #define NF_CT_EVICTION_RANGE	8
+#define NF_CT_EVICTION_BUDGET	64
 
-/* There's a small race here where we may free a just-assured
-   connection.  Too bad: we're in trouble anyway. */
-static noinline int early_drop(struct net *net, unsigned int _hash)
+/*
+ * Drop the unassured entries of one bucket.  The chain is walked under RCU
+ * only: an entry that gets recycled into another chain meanwhile just makes
+ * us look at a few unrelated entries, which the budget keeps bounded.
+ */
+static unsigned int early_drop_list(struct net *net,
+				    struct hlist_nulls_head *head,
+				    unsigned int *budget)
 {
-	/* Use oldest entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
-	struct nf_conn *ct = NULL, *tmp;
 	struct hlist_nulls_node *n;
-	unsigned int i = 0, cnt = 0;
-	int dropped = 0;
-	unsigned int hash, sequence;
-	spinlock_t *lockp;
-
-	local_bh_disable();
-restart:
-	sequence = read_seqcount_begin(&net->ct.generation);
-	hash = hash_bucket(_hash, net);
-	for (; i < net->ct.htable_size; i++) {
-		lockp = &nf_conntrack_locks[hash % CONNTRACK_LOCKS];
-		spin_lock(lockp);
-		if (read_seqcount_retry(&net->ct.generation, sequence)) {
-			spin_unlock(lockp);
-			goto restart;
-		}
-		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
-					 hnnode) {
-			tmp = nf_ct_tuplehash_to_ctrack(h);
-			if (!test_bit(IPS_ASSURED_BIT, &tmp->status) &&
-			    !nf_ct_is_dying(tmp) &&
-			    atomic_inc_not_zero(&tmp->ct_general.use)) {
-				ct = tmp;
-				break;
-			}
-			cnt++;
-		}
+	unsigned int drops = 0;
+	struct nf_conn *tmp;
 
-		hash = (hash + 1) % net->ct.htable_size;
-		spin_unlock(lockp);
-
-		if (ct || cnt >= NF_CT_EVICTION_RANGE)
+	hlist_nulls_for_each_entry_rcu(h, n, head, hnnode) {
+		if (!*budget)
 			break;
-
+		(*budget)--;
+
+		tmp = nf_ct_tuplehash_to_ctrack(h);
+		if (test_bit(IPS_ASSURED_BIT, &tmp->status) ||
+		    nf_ct_is_dying(tmp) ||
+		    !atomic_inc_not_zero(&tmp->ct_general.use))
+			continue;
+
+		/* Recheck now that it cannot go away: it may have been
+		 * recycled, and only the one owning the timer may kill it.
+		 */
+		if (nf_ct_is_confirmed(tmp) &&
+		    !test_bit(IPS_ASSURED_BIT, &tmp->status) &&
+		    del_timer(&tmp->timeout) &&
+		    nf_ct_delete(tmp, 0, 0))
+			drops++;
+
+		nf_ct_put(tmp);
 	}
-	local_bh_enable();
 
-	if (!ct)
-		return dropped;
+	return drops;
+}
 
-	if (del_timer(&ct->timeout)) {
-		if (nf_ct_delete(ct, 0, 0)) {
-			dropped = 1;
-			NF_CT_STAT_INC_ATOMIC(net, early_drop);
+/* There's a small race here where we may free a just-assured
+   connection.  Too bad: we're in trouble anyway. */
+static noinline int early_drop(struct net *net, unsigned int _hash)
+{
+	unsigned int budget = NF_CT_EVICTION_BUDGET;
+	unsigned int i, hash, sequence, drops;
+	struct hlist_nulls_head *ct_hash;
+
+	/* Sample a few buckets rather than a single chain, which under a
+	 * flood of new connections is often full of assured entries.
+	 */
+	for (i = 0; i < NF_CT_EVICTION_RANGE && budget; i++) {
+		rcu_read_lock();
+		do {
+			sequence = read_seqcount_begin(&net->ct.generation);
+			hash = (hash_bucket(_hash, net) + i) %
+			       net->ct.htable_size;
+			ct_hash = net->ct.hash;
+		} while (read_seqcount_retry(&net->ct.generation, sequence));
+
+		drops = early_drop_list(net, &ct_hash[hash], &budget);
+		rcu_read_unlock();
+
+		if (drops) {
+			NF_CT_STAT_ADD_ATOMIC(net, early_drop, drops);
+			return 1;
 		}
 	}
-	nf_ct_put(ct);
-	return dropped;
+
+	return 0;
 }
 
 void init_nf_conntrack_hash_rnd(void)
@@ -979,7 +995,10 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 			     GFP_ATOMIC);
 
 	local_bh_disable();
-	if (net->ct.expect_count) {
+	/* Most new connections are not expected: check under RCU first so
+	 * that they do not all serialize on the expectation lock.
+	 */
+	if (net->ct.expect_count && __nf_ct_expect_find(net, zone, tuple)) {
 		spin_lock(&nf_conntrack_expect_lock);
 		exp = nf_ct_find_expectation(net, zone, tuple);
 		if (exp) {
@@ -1652,6 +1671,8 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	nf_conntrack_all_unlock();
 	local_bh_enable();
 
+	/* lookups and early_drop() walk the old chains under RCU only */
+	synchronize_net();
 	nf_ct_free_hashtable(old_hash, old_size);
 	return 0;
 }
@@ -191,6 +191,13 @@ void nf_ct_remove_expectations(struct nf_conn *ct)
 	if (!help)
 		return;
 
+	/* Nor do most helped ones by the time they go away.  An insert
+	 * racing with this check is no different from one landing just
+	 * after the locked walk, destroy_conntrack() cleans up the rest.
+	 */
+	if (hlist_empty(&help->expectations))
+		return;
+
 	spin_lock_bh(&nf_conntrack_expect_lock);
 	hlist_for_each_entry_safe(exp, next, &help->expectations, lnode) {
 		if (del_timer(&exp->timeout)) {
@@ -0,0 +1,368 @@
+/*
+ * Software flow table for established, forwarded connections.
+ *
+ * Entries are created from the nftables "flow offload" expression once a
+ * connection is established and both routes are known.  The per-family
+ * ingress hooks then forward matching packets directly, and a per-netns
+ * worker expires idle entries and keeps the conntrack timeouts in sync.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <linux/rhashtable.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_tuple.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct nf_flowtable {
+	struct rhashtable		rhashtable;
+	struct delayed_work		gc_work;
+};
+
+static int nf_flow_table_net_id __read_mostly;
+
+static struct nf_flowtable *nf_flow_table_pernet(struct net *net)
+{
+	return net_generic(net, nf_flow_table_net_id);
+}
+
+/**
+ * flow_offload_ct_tuple - lookup key of one direction of a connection
+ * @ct: the connection
+ * @dir: direction
+ * @iifidx: device the packets of @dir come in on
+ * @ft: zeroed tuple to fill in
+ */
+void flow_offload_ct_tuple(const struct nf_conn *ct,
+			   enum flow_offload_tuple_dir dir, int iifidx,
+			   struct flow_offload_tuple *ft)
+{
+	const struct nf_conntrack_tuple *ctt = &ct->tuplehash[dir].tuple;
+
+	switch (ctt->src.l3num) {
+	case NFPROTO_IPV4:
+		ft->src_v4 = ctt->src.u3.in;
+		ft->dst_v4 = ctt->dst.u3.in;
+		break;
+	case NFPROTO_IPV6:
+		ft->src_v6 = ctt->src.u3.in6;
+		ft->dst_v6 = ctt->dst.u3.in6;
+		break;
+	}
+
+	ft->l3proto = ctt->src.l3num;
+	ft->l4proto = ctt->dst.protonum;
+	ft->src_port = ctt->src.u.tcp.port;
+	ft->dst_port = ctt->dst.u.tcp.port;
+	ft->iifidx = iifidx;
+}
+EXPORT_SYMBOL_GPL(flow_offload_ct_tuple);
+
+static void
+flow_offload_fill_dir(struct flow_offload *flow, struct nf_conn *ct,
+		      struct nf_flow_route *route,
+		      enum flow_offload_tuple_dir dir)
+{
+	struct flow_offload_tuple *ft = &flow->tuplehash[dir].tuple;
+	struct dst_entry *dst = route->tuple[dir].dst;
+	struct dst_entry *other_dst = route->tuple[!dir].dst;
+
+	/* Packets of this direction come in where the other one leaves */
+	flow_offload_ct_tuple(ct, dir, other_dst->dev->ifindex, ft);
+
+	ft->dir = dir;
+	ft->oifidx = dst->dev->ifindex;
+	ft->mtu = dst_mtu(dst);
+	ft->dst_cache = dst;
+}
+
+/**
+ * flow_offload_alloc - allocate a flow table entry for a connection
+ * @ct: established connection, a reference is taken on success
+ * @route: routes of both directions, whose references move to the entry
+ */
+struct flow_offload *
+flow_offload_alloc(struct nf_conn *ct, struct nf_flow_route *route)
+{
+	struct flow_offload *flow;
+	long timeout;
+
+	if (unlikely(nf_ct_is_dying(ct) ||
+	    !atomic_inc_not_zero(&ct->ct_general.use)))
+		return NULL;
+
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow) {
+		nf_ct_put(ct);
+		return NULL;
+	}
+
+	flow->ct = ct;
+	flow_offload_fill_dir(flow, ct, route, FLOW_OFFLOAD_DIR_ORIGINAL);
+	flow_offload_fill_dir(flow, ct, route, FLOW_OFFLOAD_DIR_REPLY);
+
+	if (ct->status & IPS_SRC_NAT)
+		flow->flags |= FLOW_OFFLOAD_SNAT;
+	if (ct->status & IPS_DST_NAT)
+		flow->flags |= FLOW_OFFLOAD_DNAT;
+
+	/* What conntrack just gave this connection is what every packet
+	 * handled by the flow table would have been given as well.
+	 */
+	timeout = (long)(ct->timeout.expires - jiffies);
+	flow->ct_timeout = max_t(long, timeout, HZ);
+
+	return flow;
+}
+EXPORT_SYMBOL_GPL(flow_offload_alloc);
+
+static void flow_offload_free_rcu(struct rcu_head *head)
+{
+	struct flow_offload *flow = container_of(head, struct flow_offload,
+						 rcu_head);
+
+	dst_release(flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.dst_cache);
+	dst_release(flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.dst_cache);
+	nf_ct_put(flow->ct);
+	kfree(flow);
+}
+
+/* The ingress hooks use the routes without a reference, under RCU */
+void flow_offload_free(struct flow_offload *flow)
+{
+	call_rcu(&flow->rcu_head, flow_offload_free_rcu);
+}
+EXPORT_SYMBOL_GPL(flow_offload_free);
+
+int flow_offload_add(struct net *net, struct flow_offload *flow)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_pernet(net);
+
+	flow->timeout = (u32)jiffies + NF_FLOW_TIMEOUT;
+
+	/* Both directions or none, a racing add of the same connection
+	 * makes the first insert fail.
+	 */
+	if (!rhashtable_lookup_insert(&flow_table->rhashtable,
+			&flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node))
+		return -EEXIST;
+
+	if (!rhashtable_lookup_insert(&flow_table->rhashtable,
+			&flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].node)) {
+		rhashtable_remove(&flow_table->rhashtable,
+			&flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node);
+		return -EEXIST;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(flow_offload_add);
+
+/* Conntrack missed every segment in between: let it pick up the window
+ * again from the next packet, as it does for connections it joins late.
+ */
+static void flow_offload_fixup_ct(struct nf_conn *ct)
+{
+	if (nf_ct_protonum(ct) != IPPROTO_TCP)
+		return;
+
+	spin_lock_bh(&ct->lock);
+	ct->proto.tcp.seen[0].td_maxwin = 0;
+	ct->proto.tcp.seen[1].td_maxwin = 0;
+	spin_unlock_bh(&ct->lock);
+}
+
+/**
+ * flow_offload_teardown - hand a connection back to the slow path
+ *
+ * Used when the fast path sees something it cannot handle, e.g. a TCP
+ * FIN or RST. The entry is skipped from now on and reaped by the worker.
+ */
+void flow_offload_teardown(struct flow_offload *flow)
+{
+	if (flow->flags & FLOW_OFFLOAD_TEARDOWN)
+		return;
+
+	flow->flags |= FLOW_OFFLOAD_TEARDOWN;
+	flow_offload_fixup_ct(flow->ct);
+}
+EXPORT_SYMBOL_GPL(flow_offload_teardown);
+
+struct flow_offload_tuple_rhash *
+flow_offload_lookup(struct net *net, struct flow_offload_tuple *tuple)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_pernet(net);
+
+	return rhashtable_lookup(&flow_table->rhashtable, tuple);
+}
+EXPORT_SYMBOL_GPL(flow_offload_lookup);
+
+static void flow_offload_del(struct nf_flowtable *flow_table,
+			     struct flow_offload *flow)
+{
+	rhashtable_remove(&flow_table->rhashtable,
+			  &flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node);
+	rhashtable_remove(&flow_table->rhashtable,
+			  &flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].node);
+
+	if (!(flow->flags & FLOW_OFFLOAD_TEARDOWN))
+		flow_offload_fixup_ct(flow->ct);
+
+	flow_offload_free(flow);
+}
+
+/*
+ * Give the conntrack entry the timeout the slow path would have given it
+ * on the last packet the flow table forwarded, so that it neither expires
+ * under an active flow nor outlives it by more than it normally would.
+ */
+static void flow_offload_sync_ct(struct flow_offload *flow)
+{
+	struct nf_conn *ct = flow->ct;
+	unsigned long last, newtime;
+
+	last = jiffies - (NF_FLOW_TIMEOUT - nf_flow_timeout_delta(flow->timeout));
+	newtime = last + flow->ct_timeout;
+
+	/* Same granularity as __nf_ct_refresh_acct() */
+	if ((long)(newtime - ct->timeout.expires) >= HZ)
+		mod_timer_pending(&ct->timeout, newtime);
+}
+
+static bool nf_flow_has_expired(const struct flow_offload *flow)
+{
+	return nf_flow_timeout_delta(flow->timeout) <= 0;
+}
+
+static void nf_flow_offload_gc_step(struct nf_flowtable *flow_table)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct rhashtable_iter hti;
+	struct flow_offload *flow;
+	int err;
+
+	err = rhashtable_walk_init(&flow_table->rhashtable, &hti);
+	if (err)
+		return;
+
+	err = rhashtable_walk_start(&hti);
+	if (err && err != -EAGAIN)
+		goto out;
+
+	while ((tuplehash = rhashtable_walk_next(&hti))) {
+		if (IS_ERR(tuplehash)) {
+			if (PTR_ERR(tuplehash) != -EAGAIN)
+				break;
+			continue;
+		}
+
+		/* Each entry is hashed twice, visit it once */
+		if (tuplehash->tuple.dir)
+			continue;
+
+		flow = container_of(tuplehash, struct flow_offload,
+				    tuplehash[0]);
+
+		if (nf_flow_has_expired(flow) ||
+		    (flow->flags & FLOW_OFFLOAD_TEARDOWN) ||
+		    nf_ct_is_dying(flow->ct))
+			flow_offload_del(flow_table, flow);
+		else
+			flow_offload_sync_ct(flow);
+	}
+out:
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+}
+
+static void nf_flow_offload_work_gc(struct work_struct *work)
+{
+	struct nf_flowtable *flow_table;
+
+	flow_table = container_of(work, struct nf_flowtable, gc_work.work);
+	nf_flow_offload_gc_step(flow_table);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work,
+			   HZ);
+}
+
+static const struct rhashtable_params nf_flow_offload_rhash_params = {
+	.head_offset		= offsetof(struct flow_offload_tuple_rhash, node),
+	.key_offset		= offsetof(struct flow_offload_tuple_rhash, tuple),
+	.key_len		= offsetof(struct flow_offload_tuple, dir),
+	.hashfn			= jhash,
+	.automatic_shrinking	= true,
+};
+
+static void nf_flow_table_free_one(void *ptr, void *arg)
+{
+	struct flow_offload_tuple_rhash *tuplehash = ptr;
+
+	/* Each entry is hashed twice, free it once */
+	if (tuplehash->tuple.dir)
+		return;
+
+	flow_offload_free(container_of(tuplehash, struct flow_offload,
+				       tuplehash[0]));
+}
+
+static int __net_init nf_flow_table_net_init(struct net *net)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_pernet(net);
+	int err;
+
+	err = rhashtable_init(&flow_table->rhashtable,
+			      &nf_flow_offload_rhash_params);
+	if (err < 0)
+		return err;
+
+	INIT_DEFERRABLE_WORK(&flow_table->gc_work, nf_flow_offload_work_gc);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work,
+			   HZ);
+	return 0;
+}
+
+static void __net_exit nf_flow_table_net_exit(struct net *net)
+{
+	struct nf_flowtable *flow_table = nf_flow_table_pernet(net);
+
+	cancel_delayed_work_sync(&flow_table->gc_work);
+	rhashtable_free_and_destroy(&flow_table->rhashtable,
+				    nf_flow_table_free_one, NULL);
+	/* flow_offload_free_rcu() is ours */
+	rcu_barrier();
+}
+
+static struct pernet_operations nf_flow_table_net_ops = {
+	.init	= nf_flow_table_net_init,
+	.exit	= nf_flow_table_net_exit,
+	.id	= &nf_flow_table_net_id,
+	.size	= sizeof(struct nf_flowtable),
+};
+
+static int __init nf_flow_table_module_init(void)
+{
+	return register_pernet_subsys(&nf_flow_table_net_ops);
+}
+
+static void __exit nf_flow_table_module_exit(void)
+{
+	unregister_pernet_subsys(&nf_flow_table_net_ops);
+}
+
+module_init(nf_flow_table_module_init);
+module_exit(nf_flow_table_module_exit);
+
+MODULE_LICENSE("GPL");
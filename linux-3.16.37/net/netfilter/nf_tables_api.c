@@ -1978,6 +1978,34 @@ void nft_unregister_set(struct nft_set_ops *ops)
 }
 EXPORT_SYMBOL_GPL(nft_unregister_set);
 
+/**
+ *	nft_set_ops_next - iterate over the registered set types
+ *
+ *	@prev: set type returned by the previous call or NULL to start
+ *	@features: features the set type has to support
+ *
+ *	Returns the next set type with a module reference held, the reference
+ *	on @prev is dropped.  The caller has to hold the nfnetlink mutex.
+ */
+const struct nft_set_ops *nft_set_ops_next(const struct nft_set_ops *prev,
+					   u32 features)
+{
+	const struct nft_set_ops *ops;
+
+	ops = list_prepare_entry(prev, &nf_tables_set_ops, list);
+	list_for_each_entry_continue(ops, &nf_tables_set_ops, list) {
+		if ((ops->features & features) != features)
+			continue;
+		if (try_module_get(ops->owner))
+			break;
+	}
+	if (prev != NULL)
+		module_put(prev->owner);
+
+	return &ops->list == &nf_tables_set_ops ? NULL : ops;
+}
+EXPORT_SYMBOL_GPL(nft_set_ops_next);
+
 /*
  * Select a set implementation based on the data characteristics and the
  * given policy. The total memory use might not be known if no size is
@@ -3386,12 +3414,32 @@ static void nf_tables_commit_release_rcu(struct rcu_head *rt)
 	kfree(trans);
 }
 
+/* Let set backends that batch their updates publish the new elements */
+static void nf_tables_set_commit(struct net *net)
+{
+	struct nft_af_info *afi;
+	struct nft_table *table;
+	struct nft_set *set;
+
+	list_for_each_entry(afi, &net->nft.af_info, list) {
+		list_for_each_entry(table, &afi->tables, list) {
+			list_for_each_entry(set, &table->sets, list) {
+				if (set->ops->commit)
+					set->ops->commit(set);
+			}
+		}
+	}
+}
+
 static int nf_tables_commit(struct sk_buff *skb)
 {
 	struct net *net = sock_net(skb->sk);
 	struct nft_trans *trans, *next;
 	struct nft_set *set;
 
+	/* New elements have to be in place before the rules using them */
+	nf_tables_set_commit(net);
+
 	/* Bump generation counter, invalidate any dump in progress */
 	while (++net->nft.base_seq == 0);
 
@@ -3488,6 +3536,8 @@ static int nf_tables_commit(struct sk_buff *skb)
 		}
 	}
 
+	nf_tables_set_commit(net);
+
 	list_for_each_entry_safe(trans, next, &net->nft.commit_list, list) {
 		list_del(&trans->list);
 		trans->ctx.nla = NULL;
@@ -3601,6 +3651,8 @@ static int nf_tables_abort(struct sk_buff *skb)
 		}
 	}
 
+	nf_tables_set_commit(net);
+
 	list_for_each_entry_safe_reverse(trans, next,
 					 &net->nft.commit_list, list) {
 		list_del(&trans->list);
@@ -0,0 +1,593 @@
+/*
+ * nf_tables set type for large interval sets, laid out for lookup speed.
+ *
+ * Elements live in one sorted array that is replaced as a whole when a
+ * transaction commits.  Keys are packed at their own length rounded up
+ * to 32 bits, so a binary search over an IPv4 set touches four bytes per
+ * step.  Lookups run under RCU only, there is no lock and no retry.
+ *
+ * Elements added during a transaction are kept in a small rbtree until
+ * the commit merges them into a new array.  Removed elements are flagged
+ * in a bitmap that lookups honour, which keeps removal from failing.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/mm.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+struct nft_array_table {
+	unsigned int		size;
+	struct rcu_head		rcu_head;
+	unsigned long		*removed;
+	u32			*keys;
+	u8			*flags;
+	struct nft_data		data[];		/* maps only */
+};
+
+struct nft_array_elem {
+	struct rb_node		node;
+	u8			flags;
+	struct nft_data		key;
+	struct nft_data		data[];
+};
+
+struct nft_array {
+	struct nft_array_table __rcu	*table;
+	/* elements inserted since the last commit, in key order */
+	struct rb_root			pending;
+	unsigned int			npending;
+	unsigned int			nremoved;
+	/* a commit could not merge the pending elements, look there too */
+	bool				stale;
+	/* pending tree and table replacement against walks and stale lookups */
+	rwlock_t			lock;
+};
+
+/* Table entries are told apart from pending elements by the low bit */
+#define NFT_ARRAY_COOKIE(i)		((void *)(((unsigned long)(i) << 1) | 1))
+#define NFT_ARRAY_COOKIE_IS_INDEX(c)	((unsigned long)(c) & 1)
+#define NFT_ARRAY_COOKIE_INDEX(c)	((unsigned long)(c) >> 1)
+
+static unsigned int nft_array_kwords(const struct nft_set *set)
+{
+	return DIV_ROUND_UP(set->klen, sizeof(u32));
+}
+
+static const void *nft_array_key(const struct nft_set *set,
+				 const struct nft_array_table *t,
+				 unsigned int i)
+{
+	return &t->keys[i * nft_array_kwords(set)];
+}
+
+static size_t nft_array_table_size(const struct nft_set *set,
+				   unsigned int size)
+{
+	size_t len = sizeof(struct nft_array_table);
+
+	if (set->flags & NFT_SET_MAP)
+		len += size * sizeof(struct nft_data);
+	len += BITS_TO_LONGS(size) * sizeof(unsigned long);
+	len += size * nft_array_kwords(set) * sizeof(u32);
+	len += size * sizeof(u8);
+
+	return len;
+}
+
+static struct nft_array_table *nft_array_table_alloc(const struct nft_set *set,
+						     unsigned int size)
+{
+	struct nft_array_table *t = NULL;
+	size_t len = nft_array_table_size(set, size);
+	void *p;
+
+	if (len <= (PAGE_SIZE << PAGE_ALLOC_COSTLY_ORDER))
+		t = kzalloc(len, GFP_KERNEL | __GFP_NOWARN);
+	if (t == NULL)
+		t = vzalloc(len);
+	if (t == NULL)
+		return NULL;
+
+	t->size = size;
+	p = t->data;
+	if (set->flags & NFT_SET_MAP)
+		p += size * sizeof(struct nft_data);
+	t->removed = p;
+	p += BITS_TO_LONGS(size) * sizeof(unsigned long);
+	t->keys = p;
+	p += size * nft_array_kwords(set) * sizeof(u32);
+	t->flags = p;
+
+	return t;
+}
+
+static void nft_array_table_free_rcu(struct rcu_head *head)
+{
+	kvfree(container_of(head, struct nft_array_table, rcu_head));
+}
+
+/*
+ * Index of the last key not above @key, or -1 if there is none.  Whether
+ * it is an exact match is returned through @exact.
+ */
+static int nft_array_find(const struct nft_set *set,
+			  const struct nft_array_table *t,
+			  const struct nft_data *key, bool *exact)
+{
+	unsigned int base = 0, n = t->size, half;
+	int d;
+
+	if (n == 0)
+		return -1;
+
+	while (n > 1) {
+		half = n / 2;
+		if (memcmp(nft_array_key(set, t, base + half), key->data,
+			   set->klen) <= 0)
+			base += half;
+		n -= half;
+	}
+
+	d = memcmp(nft_array_key(set, t, base), key->data, set->klen);
+	if (d > 0)
+		return -1;
+
+	*exact = d == 0;
+	return base;
+}
+
+/* Step back over removed entries, to what the lookup would find without */
+static int nft_array_find_live(const struct nft_set *set,
+			       const struct nft_array_table *t,
+			       const struct nft_data *key, bool *exact)
+{
+	int i = nft_array_find(set, t, key, exact);
+
+	while (i >= 0 && test_bit(i, t->removed)) {
+		if (!(set->flags & NFT_SET_INTERVAL))
+			return -1;
+		*exact = false;
+		i--;
+	}
+	return i;
+}
+
+static bool nft_array_match(const struct nft_set *set, bool exact, u8 flags)
+{
+	if (!exact && !(set->flags & NFT_SET_INTERVAL))
+		return false;
+	return !(flags & NFT_SET_ELEM_INTERVAL_END);
+}
+
+/* Last pending element not above @key, as in nft_array_find() */
+static struct nft_array_elem *nft_array_pending_find(const struct nft_set *set,
+						     const struct nft_array *priv,
+						     const struct nft_data *key,
+						     bool *exact)
+{
+	struct nft_array_elem *ae, *prev = NULL;
+	const struct rb_node *parent = priv->pending.rb_node;
+	int d;
+
+	while (parent != NULL) {
+		ae = rb_entry(parent, struct nft_array_elem, node);
+
+		d = nft_data_cmp(&ae->key, key, set->klen);
+		if (d > 0)
+			parent = parent->rb_left;
+		else if (d < 0) {
+			prev = ae;
+			parent = parent->rb_right;
+		} else {
+			*exact = true;
+			return ae;
+		}
+	}
+
+	*exact = false;
+	return prev;
+}
+
+static bool nft_array_lookup_stale(const struct nft_set *set,
+				   const struct nft_array_table *t,
+				   const struct nft_data *key,
+				   struct nft_data *data)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	struct nft_array_elem *ae;
+	bool exact = false, ae_exact;
+	bool ret = false;
+	int i;
+
+	read_lock_bh(&priv->lock);
+	i = nft_array_find_live(set, t, key, &exact);
+	ae = nft_array_pending_find(set, priv, key, &ae_exact);
+
+	/* Whichever of the two is closer to the key decides */
+	if (ae != NULL &&
+	    (i < 0 || memcmp(&ae->key, nft_array_key(set, t, i),
+			     set->klen) > 0)) {
+		ret = nft_array_match(set, ae_exact, ae->flags);
+		if (ret && set->flags & NFT_SET_MAP)
+			nft_data_copy(data, ae->data);
+	} else if (i >= 0) {
+		ret = nft_array_match(set, exact, t->flags[i]);
+		if (ret && set->flags & NFT_SET_MAP)
+			nft_data_copy(data, &t->data[i]);
+	}
+	read_unlock_bh(&priv->lock);
+
+	return ret;
+}
+
+static bool nft_array_lookup(const struct nft_set *set,
+			     const struct nft_data *key,
+			     struct nft_data *data)
+{
+	const struct nft_array *priv = nft_set_priv(set);
+	const struct nft_array_table *t = rcu_dereference(priv->table);
+	bool exact = false;
+	int i;
+
+	if (unlikely(ACCESS_ONCE(priv->stale)))
+		return nft_array_lookup_stale(set, t, key, data);
+
+	i = nft_array_find_live(set, t, key, &exact);
+	if (i < 0 || !nft_array_match(set, exact, t->flags[i]))
+		return false;
+
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(data, &t->data[i]);
+	return true;
+}
+
+static int nft_array_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	const struct nft_array_table *t = nft_dereference(priv->table);
+	struct nft_array_elem *ae;
+	bool exact = false;
+	int i;
+
+	i = nft_array_find_live(set, t, &elem->key, &exact);
+	if (i >= 0 && exact) {
+		elem->cookie = NFT_ARRAY_COOKIE(i);
+		elem->flags = t->flags[i];
+		if (set->flags & NFT_SET_MAP &&
+		    !(elem->flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_copy(&elem->data, &t->data[i]);
+		return 0;
+	}
+
+	ae = nft_array_pending_find(set, priv, &elem->key, &exact);
+	if (ae == NULL || !exact)
+		return -ENOENT;
+
+	elem->cookie = ae;
+	elem->flags = ae->flags;
+	if (set->flags & NFT_SET_MAP &&
+	    !(ae->flags & NFT_SET_ELEM_INTERVAL_END))
+		nft_data_copy(&elem->data, ae->data);
+	return 0;
+}
+
+static int nft_array_insert(const struct nft_set *set,
+			    const struct nft_set_elem *elem)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	struct nft_array_elem *ae, *new;
+	struct rb_node *parent, **p;
+	unsigned int size;
+	int d;
+
+	size = sizeof(*new);
+	if (set->flags & NFT_SET_MAP &&
+	    !(elem->flags & NFT_SET_ELEM_INTERVAL_END))
+		size += sizeof(new->data[0]);
+
+	new = kzalloc(size, GFP_KERNEL);
+	if (new == NULL)
+		return -ENOMEM;
+
+	new->flags = elem->flags;
+	nft_data_copy(&new->key, &elem->key);
+	if (set->flags & NFT_SET_MAP &&
+	    !(new->flags & NFT_SET_ELEM_INTERVAL_END))
+		nft_data_copy(new->data, &elem->data);
+
+	write_lock_bh(&priv->lock);
+	parent = NULL;
+	p = &priv->pending.rb_node;
+	while (*p != NULL) {
+		parent = *p;
+		ae = rb_entry(parent, struct nft_array_elem, node);
+		d = nft_data_cmp(&ae->key, &new->key, set->klen);
+		if (d > 0)
+			p = &parent->rb_left;
+		else if (d < 0)
+			p = &parent->rb_right;
+		else {
+			write_unlock_bh(&priv->lock);
+			kfree(new);
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &priv->pending);
+	priv->npending++;
+	write_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static void nft_array_remove(const struct nft_set *set,
+			     const struct nft_set_elem *elem)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	struct nft_array_table *t = nft_dereference(priv->table);
+	struct nft_array_elem *ae;
+
+	if (NFT_ARRAY_COOKIE_IS_INDEX(elem->cookie)) {
+		set_bit(NFT_ARRAY_COOKIE_INDEX(elem->cookie), t->removed);
+		priv->nremoved++;
+		return;
+	}
+
+	ae = elem->cookie;
+	write_lock_bh(&priv->lock);
+	rb_erase(&ae->node, &priv->pending);
+	priv->npending--;
+	write_unlock_bh(&priv->lock);
+	kfree(ae);
+}
+
+static void nft_array_walk(const struct nft_ctx *ctx,
+			   const struct nft_set *set,
+			   struct nft_set_iter *iter)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	const struct nft_array_table *t;
+	const struct nft_array_elem *ae;
+	struct nft_set_elem elem;
+	struct rb_node *node;
+	unsigned int i;
+
+	read_lock_bh(&priv->lock);
+	t = rcu_dereference_protected(priv->table,
+				      lockdep_is_held(&priv->lock));
+	for (i = 0; i < t->size; i++) {
+		if (test_bit(i, t->removed))
+			continue;
+		if (iter->count < iter->skip)
+			goto cont;
+
+		memcpy(elem.key.data, nft_array_key(set, t, i), set->klen);
+		elem.flags = t->flags[i];
+		if (set->flags & NFT_SET_MAP &&
+		    !(elem.flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_copy(&elem.data, &t->data[i]);
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0)
+			goto out;
+cont:
+		iter->count++;
+	}
+
+	for (node = rb_first(&priv->pending); node; node = rb_next(node)) {
+		if (iter->count < iter->skip)
+			goto cont_pending;
+
+		ae = rb_entry(node, struct nft_array_elem, node);
+		nft_data_copy(&elem.key, &ae->key);
+		elem.flags = ae->flags;
+		if (set->flags & NFT_SET_MAP &&
+		    !(ae->flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_copy(&elem.data, ae->data);
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0)
+			goto out;
+cont_pending:
+		iter->count++;
+	}
+out:
+	read_unlock_bh(&priv->lock);
+}
+
+static void nft_array_copy(const struct nft_set *set,
+			   struct nft_array_table *t, unsigned int i,
+			   const void *key, u8 flags, const struct nft_data *data)
+{
+	memcpy((void *)nft_array_key(set, t, i), key, set->klen);
+	t->flags[i] = flags;
+	if (set->flags & NFT_SET_MAP && !(flags & NFT_SET_ELEM_INTERVAL_END))
+		nft_data_copy(&t->data[i], data);
+}
+
+/* Merge the live table entries and the pending elements into a new table */
+static void nft_array_commit(const struct nft_set *set)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	struct nft_array_table *old = nft_dereference(priv->table);
+	struct nft_array_table *new;
+	struct nft_array_elem *ae;
+	struct rb_node *node, *next;
+	unsigned int i = 0, n = 0;
+
+	if (!priv->npending && !priv->nremoved)
+		return;
+
+	new = nft_array_table_alloc(set, old->size - priv->nremoved +
+					 priv->npending);
+	if (new == NULL) {
+		/* Removals already took effect through the bitmap */
+		if (priv->npending) {
+			pr_warn_ratelimited("nf_tables: set %s: no memory to merge %u elements\n",
+					    set->name, priv->npending);
+			ACCESS_ONCE(priv->stale) = true;
+		}
+		return;
+	}
+
+	node = rb_first(&priv->pending);
+	while (i < old->size || node != NULL) {
+		const void *key = i < old->size ? nft_array_key(set, old, i) :
+						  NULL;
+
+		if (key != NULL && test_bit(i, old->removed)) {
+			i++;
+			continue;
+		}
+
+		ae = node ? rb_entry(node, struct nft_array_elem, node) : NULL;
+		if (ae == NULL ||
+		    (key != NULL && memcmp(key, ae->key.data, set->klen) < 0)) {
+			nft_array_copy(set, new, n++, key, old->flags[i],
+				       &old->data[i]);
+			i++;
+		} else {
+			nft_array_copy(set, new, n++, ae->key.data, ae->flags,
+				       ae->data);
+			node = rb_next(node);
+		}
+	}
+	WARN_ON(n != new->size);
+
+	write_lock_bh(&priv->lock);
+	rcu_assign_pointer(priv->table, new);
+	node = rb_first(&priv->pending);
+	priv->pending = RB_ROOT;
+	priv->npending = 0;
+	priv->nremoved = 0;
+	priv->stale = false;
+	write_unlock_bh(&priv->lock);
+
+	/* The key and data references moved over to the new table */
+	while (node != NULL) {
+		next = rb_next(node);
+		kfree(rb_entry(node, struct nft_array_elem, node));
+		node = next;
+	}
+
+	call_rcu(&old->rcu_head, nft_array_table_free_rcu);
+}
+
+static unsigned int nft_array_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_array);
+}
+
+static int nft_array_init(const struct nft_set *set,
+			  const struct nft_set_desc *desc,
+			  const struct nlattr * const nla[])
+{
+	struct nft_array *priv = nft_set_priv(set);
+	struct nft_array_table *t;
+
+	t = nft_array_table_alloc(set, 0);
+	if (t == NULL)
+		return -ENOMEM;
+
+	rwlock_init(&priv->lock);
+	priv->pending = RB_ROOT;
+	RCU_INIT_POINTER(priv->table, t);
+	return 0;
+}
+
+static void nft_array_destroy(const struct nft_set *set)
+{
+	struct nft_array *priv = nft_set_priv(set);
+	/* The set is unreachable by now */
+	struct nft_array_table *t = rcu_dereference_protected(priv->table, 1);
+	struct nft_array_elem *ae;
+	struct rb_node *node;
+	unsigned int i;
+
+	for (i = 0; i < t->size; i++) {
+		if (test_bit(i, t->removed))
+			continue;
+		if (set->flags & NFT_SET_MAP &&
+		    !(t->flags[i] & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_uninit(&t->data[i], set->dtype);
+	}
+	kvfree(t);
+
+	while ((node = priv->pending.rb_node) != NULL) {
+		rb_erase(node, &priv->pending);
+		ae = rb_entry(node, struct nft_array_elem, node);
+		nft_data_uninit(&ae->key, NFT_DATA_VALUE);
+		if (set->flags & NFT_SET_MAP &&
+		    !(ae->flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_uninit(ae->data, set->dtype);
+		kfree(ae);
+	}
+}
+
+static bool nft_array_estimate(const struct nft_set_desc *desc, u32 features,
+			       struct nft_set_estimate *est)
+{
+	unsigned int nsize;
+
+	/* What a committed element costs, pending ones are transient */
+	nsize = round_up(desc->klen, sizeof(u32)) + sizeof(u8);
+	if (features & NFT_SET_MAP)
+		nsize += sizeof(struct nft_data);
+
+	if (desc->size)
+		est->size = sizeof(struct nft_array) +
+			    sizeof(struct nft_array_table) +
+			    desc->size * nsize +
+			    BITS_TO_LONGS(desc->size) * sizeof(unsigned long);
+	else
+		est->size = nsize;
+
+	est->class = NFT_SET_CLASS_O_LOG_N;
+
+	return true;
+}
+
+static struct nft_set_ops nft_array_ops __read_mostly = {
+	.privsize	= nft_array_privsize,
+	.estimate	= nft_array_estimate,
+	.init		= nft_array_init,
+	.destroy	= nft_array_destroy,
+	.insert		= nft_array_insert,
+	.remove		= nft_array_remove,
+	.get		= nft_array_get,
+	.lookup		= nft_array_lookup,
+	.walk		= nft_array_walk,
+	.commit		= nft_array_commit,
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_array_module_init(void)
+{
+	return nft_register_set(&nft_array_ops);
+}
+
+static void __exit nft_array_module_exit(void)
+{
+	nft_unregister_set(&nft_array_ops);
+}
+
+module_init(nft_array_module_init);
+module_exit(nft_array_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_SET();
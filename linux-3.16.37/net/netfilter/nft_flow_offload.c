@@ -0,0 +1,205 @@
+/*
+ * nf_tables "flow offload" expression: moves established, forwarded
+ * connections to the flow table fast path.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/ip.h>
+#include <net/netfilter/nf_tables.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+#include <net/netfilter/nf_conntrack_seqadj.h>
+#include <net/netfilter/nf_conntrack_zones.h>
+#include <net/netfilter/nf_flow_table.h>
+
+/* The route the other direction takes is the way back to our sender */
+static int nft_flow_route(const struct nft_pktinfo *pkt,
+			  const struct nf_conn *ct,
+			  struct nf_flow_route *route,
+			  enum ip_conntrack_dir dir)
+{
+	struct dst_entry *this_dst = skb_dst(pkt->skb);
+	struct dst_entry *other_dst = NULL;
+	const struct nf_afinfo *afinfo;
+	struct flowi fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.u.ip4.daddr = ct->tuplehash[dir].tuple.src.u3.ip;
+	fl.u.ip4.flowi4_oif = pkt->in->ifindex;
+
+	afinfo = nf_get_afinfo(NFPROTO_IPV4);
+	if (!afinfo)
+		return -ENOENT;
+
+	afinfo->route(dev_net(pkt->in), &other_dst, &fl, false);
+	if (!other_dst)
+		return -ENOENT;
+
+	/* IPsec policies are checked on the slow path only */
+	if (dst_xfrm(this_dst) || dst_xfrm(other_dst) ||
+	    other_dst->dev != pkt->in) {
+		dst_release(other_dst);
+		return -EINVAL;
+	}
+
+	route->tuple[dir].dst = dst_clone(this_dst);
+	route->tuple[!dir].dst = other_dst;
+
+	return 0;
+}
+
+static bool nft_flow_offload_ct_ok(const struct nf_conn *ct)
+{
+	/* Helpers and sequence adjustment need to see every packet */
+	if (nfct_help(ct) || nfct_seqadj(ct))
+		return false;
+
+	/* The flow table is not zone aware */
+	if (nf_ct_zone(ct) != NF_CT_DEFAULT_ZONE)
+		return false;
+
+	switch (nf_ct_protonum(ct)) {
+	case IPPROTO_TCP:
+		return ct->proto.tcp.state == TCP_CONNTRACK_ESTABLISHED;
+	case IPPROTO_UDP:
+		return true;
+	}
+
+	return false;
+}
+
+static bool nft_flow_offload_exists(const struct nft_pktinfo *pkt,
+				    const struct nf_conn *ct,
+				    enum ip_conntrack_dir dir)
+{
+	struct flow_offload_tuple tuple;
+
+	memset(&tuple, 0, sizeof(tuple));
+	flow_offload_ct_tuple(ct, dir, pkt->in->ifindex, &tuple);
+
+	return flow_offload_lookup(dev_net(pkt->in), &tuple) != NULL;
+}
+
+static void nft_flow_offload_eval(const struct nft_expr *expr,
+				  struct nft_data data[NFT_REG_MAX + 1],
+				  const struct nft_pktinfo *pkt)
+{
+	struct sk_buff *skb = pkt->skb;
+	enum ip_conntrack_info ctinfo;
+	struct nf_flow_route route;
+	struct flow_offload *flow;
+	enum ip_conntrack_dir dir;
+	struct nf_conn *ct;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct || nf_ct_is_untracked(ct))
+		goto out;
+
+	/* Only IPv4 has a fast path so far */
+	if (nf_ct_l3num(ct) != NFPROTO_IPV4 || !skb_dst(skb) ||
+	    IPCB(skb)->opt.optlen)
+		goto out;
+
+	if (ctinfo != IP_CT_ESTABLISHED && ctinfo != IP_CT_ESTABLISHED_REPLY)
+		goto out;
+
+	if (!nft_flow_offload_ct_ok(ct))
+		goto out;
+
+	/* Packets the fast path sent back to us, e.g. over the MTU */
+	dir = CTINFO2DIR(ctinfo);
+	if (nft_flow_offload_exists(pkt, ct, dir))
+		return;
+
+	if (nft_flow_route(pkt, ct, &route, dir) < 0)
+		goto out;
+
+	flow = flow_offload_alloc(ct, &route);
+	if (!flow)
+		goto err_flow_alloc;
+
+	if (flow_offload_add(dev_net(pkt->in), flow) < 0)
+		flow_offload_free(flow);
+
+	return;
+
+err_flow_alloc:
+	dst_release(route.tuple[IP_CT_DIR_ORIGINAL].dst);
+	dst_release(route.tuple[IP_CT_DIR_REPLY].dst);
+out:
+	data[NFT_REG_VERDICT].verdict = NFT_BREAK;
+}
+
+static int nft_flow_offload_validate(const struct nft_ctx *ctx,
+				     const struct nft_expr *expr,
+				     const struct nft_data **data)
+{
+	if (ctx->chain->flags & NFT_BASE_CHAIN) {
+		const struct nft_base_chain *basechain =
+						nft_base_chain(ctx->chain);
+
+		if (basechain->ops[0].hooknum != NF_INET_FORWARD)
+			return -EOPNOTSUPP;
+	}
+	return 0;
+}
+
+static int nft_flow_offload_init(const struct nft_ctx *ctx,
+				 const struct nft_expr *expr,
+				 const struct nlattr * const tb[])
+{
+	if (ctx->afi->family != NFPROTO_IPV4 &&
+	    ctx->afi->family != NFPROTO_INET)
+		return -EOPNOTSUPP;
+
+	return 0;
+}
+
+static int nft_flow_offload_dump(struct sk_buff *skb,
+				 const struct nft_expr *expr)
+{
+	return 0;
+}
+
+static struct nft_expr_type nft_flow_offload_type;
+static const struct nft_expr_ops nft_flow_offload_ops = {
+	.type		= &nft_flow_offload_type,
+	.size		= NFT_EXPR_SIZE(0),
+	.eval		= nft_flow_offload_eval,
+	.init		= nft_flow_offload_init,
+	.dump		= nft_flow_offload_dump,
+	.validate	= nft_flow_offload_validate,
+};
+
+static struct nft_expr_type nft_flow_offload_type __read_mostly = {
+	.name		= "flow_offload",
+	.ops		= &nft_flow_offload_ops,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_flow_offload_module_init(void)
+{
+	return nft_register_expr(&nft_flow_offload_type);
+}
+
+static void __exit nft_flow_offload_module_exit(void)
+{
+	nft_unregister_expr(&nft_flow_offload_type);
+}
+
+module_init(nft_flow_offload_module_init);
+module_exit(nft_flow_offload_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_EXPR("flow_offload");
+MODULE_SOFTDEP("post: nf_flow_table_ipv4");
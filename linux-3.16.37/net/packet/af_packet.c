@@ -66,6 +66,7 @@
 #include <linux/kmod.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/highmem.h>
 #include <net/net_namespace.h>
 #include <net/ip.h>
 #include <net/protocol.h>
@@ -1736,6 +1737,18 @@ static unsigned int run_filter(const struct sk_buff *skb,
 	return res;
 }
 
+/* A socket bound to an RX queue only sees what was received on it */
+static bool packet_rx_queue_match(const struct packet_sock *po,
+				  const struct sk_buff *skb)
+{
+	if (po->rx_queue < 0)
+		return true;
+
+	return skb->pkt_type != PACKET_OUTGOING &&
+	       skb_rx_queue_recorded(skb) &&
+	       skb_get_rx_queue(skb) == po->rx_queue;
+}
+
 /*
  * This function makes lazy skb cloning in hope that most of packets
  * are discarded by BPF.
@@ -1767,6 +1780,9 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 	if (!net_eq(dev_net(dev), sock_net(sk)))
 		goto drop;
 
+	if (!packet_rx_queue_match(po, skb))
+		goto drop;
+
 	skb->dev = dev;
 
 	if (dev->header_ops) {
@@ -1892,6 +1908,9 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	if (!net_eq(dev_net(dev), sock_net(sk)))
 		goto drop;
 
+	if (!packet_rx_queue_match(po, skb))
+		goto drop;
+
 	if (dev->header_ops) {
 		if (sk->sk_type != SOCK_DGRAM)
 			skb_push(skb, skb->data - skb_mac_header(skb));
@@ -2079,6 +2098,110 @@ ring_is_full:
 	goto drop_n_restore;
 }
 
+/*
+ * Receive into user memory (PACKET_UMEM): take a frame off the fill ring,
+ * copy the packet into it and post it on the completion ring.  The socket
+ * owns both kernel ends, so sk_receive_queue.lock serialises producers the
+ * same way it does for the mmap()ed rings.
+ */
+static int packet_umem_rcv(struct sk_buff *skb, struct net_device *dev,
+			   struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct sock *sk;
+	struct packet_sock *po;
+	struct packet_umem *umem;
+	struct packet_umem_ring *fill, *comp;
+	struct tpacket_umem_desc *desc;
+	u8 *skb_head = skb->data;
+	int skb_len = skb->len;
+	unsigned int snaplen, res;
+	u32 status = TP_STATUS_USER;
+	void *frame;
+	u64 addr;
+
+	if (skb->pkt_type == PACKET_LOOPBACK)
+		goto drop;
+
+	sk = pt->af_packet_priv;
+	po = pkt_sk(sk);
+	umem = po->umem;
+	fill = &umem->fill;
+	comp = &umem->comp;
+
+	if (!net_eq(dev_net(dev), sock_net(sk)))
+		goto drop;
+
+	if (!packet_rx_queue_match(po, skb))
+		goto drop;
+
+	if (dev->header_ops) {
+		if (sk->sk_type != SOCK_DGRAM)
+			skb_push(skb, skb->data - skb_mac_header(skb));
+		else if (skb->pkt_type == PACKET_OUTGOING) {
+			/* Special case: outgoing packets have ll header at head */
+			skb_pull(skb, skb_network_offset(skb));
+		}
+	}
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL)
+		status |= TP_STATUS_CSUMNOTREADY;
+
+	snaplen = skb->len;
+
+	res = run_filter(skb, sk, snaplen);
+	if (!res)
+		goto drop_n_restore;
+	if (snaplen > res)
+		snaplen = res;
+	if (snaplen > umem->frame_size - umem->headroom)
+		snaplen = umem->frame_size - umem->headroom;
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	if (fill->index == smp_load_acquire(&fill->hdr->producer))
+		goto ring_is_full;
+	if (comp->index - smp_load_acquire(&comp->hdr->consumer) > comp->mask)
+		goto ring_is_full;
+
+	addr = ACCESS_ONCE(((u64 *)fill->entries)[fill->index & fill->mask]);
+	smp_store_release(&fill->hdr->consumer, ++fill->index);
+
+	/* The frame is gone from the fill ring either way */
+	if (addr >= umem->len || (addr & (umem->frame_size - 1)))
+		goto ring_is_full;
+
+	frame = umem->frames + addr + umem->headroom;
+	skb_copy_bits(skb, 0, frame, snaplen);
+	flush_kernel_vmap_range(frame, snaplen);
+
+	desc = (struct tpacket_umem_desc *)comp->entries +
+	       (comp->index & comp->mask);
+	desc->addr = addr + umem->headroom;
+	desc->len = snaplen;
+	desc->status = status;
+	smp_store_release(&comp->hdr->producer, ++comp->index);
+
+	po->stats.stats1.tp_packets++;
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	sk->sk_data_ready(sk);
+
+drop_n_restore:
+	if (skb_head != skb->data && skb_shared(skb)) {
+		skb->data = skb_head;
+		skb->len = skb_len;
+	}
+drop:
+	consume_skb(skb);
+	return 0;
+
+ring_is_full:
+	po->stats.stats1.tp_drops++;
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	sk->sk_data_ready(sk);
+	goto drop_n_restore;
+}
+
 static void tpacket_destruct_skb(struct sk_buff *skb)
 {
 	struct packet_sock *po = pkt_sk(skb->sk);
@@ -2584,6 +2707,355 @@ static int packet_sendmsg(struct kiocb *iocb, struct socket *sock,
 		return packet_snd(sock, msg, len);
 }
 
+/*
+ *	User memory receive (PACKET_UMEM).  The frame area and both rings are
+ *	pinned and mapped into the kernel for as long as the socket lives.
+ */
+
+static void packet_unpin(struct packet_pinned *p)
+{
+	unsigned int i;
+
+	if (p->vmap)
+		vunmap(p->vmap);
+	for (i = 0; i < p->npages; i++) {
+		set_page_dirty_lock(p->pages[i]);
+		put_page(p->pages[i]);
+	}
+	kvfree(p->pages);
+	if (p->mm) {
+		down_write(&p->mm->mmap_sem);
+		p->mm->pinned_vm -= p->charged;
+		up_write(&p->mm->mmap_sem);
+		mmdrop(p->mm);
+	}
+	memset(p, 0, sizeof(*p));
+}
+
+static int packet_pin(struct packet_pinned *p, u64 addr, u64 len,
+		      void **kaddr)
+{
+	struct mm_struct *mm = current->mm;
+	unsigned long first, npages, locked;
+	int pinned, err;
+
+	if (!len || addr + len < addr || addr + len > TASK_SIZE)
+		return -EINVAL;
+
+	first = addr >> PAGE_SHIFT;
+	npages = ((addr + len - 1) >> PAGE_SHIFT) - first + 1;
+	if (npages > INT_MAX)
+		return -ENOMEM;
+
+	/* accounted like mlocked memory, together with the owner's others */
+	down_write(&mm->mmap_sem);
+	locked = mm->pinned_vm + npages;
+	if (locked > (rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT) &&
+	    !capable(CAP_IPC_LOCK)) {
+		up_write(&mm->mmap_sem);
+		return -ENOMEM;
+	}
+	mm->pinned_vm = locked;
+	up_write(&mm->mmap_sem);
+	atomic_inc(&mm->mm_count);
+	p->mm = mm;
+	p->charged = npages;
+
+	err = -ENOMEM;
+	p->pages = kcalloc(npages, sizeof(*p->pages),
+			   GFP_KERNEL | __GFP_NOWARN);
+	if (!p->pages)
+		p->pages = vzalloc(npages * sizeof(*p->pages));
+	if (!p->pages)
+		goto out_unpin;
+
+	pinned = get_user_pages_fast(first << PAGE_SHIFT, npages, 1, p->pages);
+	if (pinned < 0) {
+		err = pinned;
+		goto out_unpin;
+	}
+	p->npages = pinned;
+
+	err = -EFAULT;
+	if (pinned != npages)
+		goto out_unpin;
+
+	err = -ENOMEM;
+	p->vmap = vmap(p->pages, npages, VM_MAP, PAGE_KERNEL);
+	if (!p->vmap)
+		goto out_unpin;
+
+	*kaddr = p->vmap + offset_in_page(addr);
+	return 0;
+
+out_unpin:
+	packet_unpin(p);
+	return err;
+}
+
+#define PACKET_UMEM_RING_MAX	(1 << 20)
+
+static int packet_umem_ring_init(struct packet_umem_ring *r, u64 addr,
+				 u32 entries, size_t entry_size)
+{
+	void *kaddr;
+	int err;
+
+	if (!is_power_of_2(entries) || entries > PACKET_UMEM_RING_MAX)
+		return -EINVAL;
+	if (addr & (sizeof(u64) - 1))
+		return -EINVAL;
+
+	err = packet_pin(&r->mem, addr,
+			 sizeof(*r->hdr) + (u64)entries * entry_size, &kaddr);
+	if (err)
+		return err;
+
+	r->hdr = kaddr;
+	r->entries = r->hdr + 1;
+	r->mask = entries - 1;
+	return 0;
+}
+
+static void packet_umem_free(struct packet_umem *umem)
+{
+	packet_unpin(&umem->comp.mem);
+	packet_unpin(&umem->fill.mem);
+	packet_unpin(&umem->mem);
+	kfree(umem);
+}
+
+/*
+ * A driver receiving into the frames may hold on to them after the socket
+ * is gone and drop its reference from softirq context, so the last put
+ * unpins from a workqueue.  The module stays around until then.
+ */
+static struct workqueue_struct *packet_umem_wq;
+
+static void packet_umem_free_work(struct work_struct *work)
+{
+	packet_umem_free(container_of(work, struct packet_umem, free_work));
+	module_put(THIS_MODULE);
+}
+
+static void packet_umem_put(struct packet_umem *umem)
+{
+	if (atomic_dec_and_test(&umem->refcnt))
+		queue_work(packet_umem_wq, &umem->free_work);
+}
+
+static bool packet_umem_get_frame(struct netdev_umem *zc, u64 *addr)
+{
+	struct packet_umem *umem = container_of(zc, struct packet_umem, zc);
+	struct packet_umem_ring *fill = &umem->fill;
+	struct sock *sk = umem->sk;
+	bool ret = false;
+
+	spin_lock_bh(&sk->sk_receive_queue.lock);
+	if (fill->index != smp_load_acquire(&fill->hdr->producer)) {
+		*addr = ACCESS_ONCE(((u64 *)fill->entries)[fill->index &
+							    fill->mask]);
+		smp_store_release(&fill->hdr->consumer, ++fill->index);
+		ret = *addr < umem->len && !(*addr & (umem->frame_size - 1));
+	}
+	spin_unlock_bh(&sk->sk_receive_queue.lock);
+
+	return ret;
+}
+
+static bool packet_umem_put_frame(struct netdev_umem *zc, u64 addr,
+				  u32 len, u32 status)
+{
+	struct packet_umem *umem = container_of(zc, struct packet_umem, zc);
+	struct packet_umem_ring *comp = &umem->comp;
+	struct tpacket_umem_desc *desc;
+	struct sock *sk = umem->sk;
+	struct packet_sock *po = pkt_sk(sk);
+
+	spin_lock_bh(&sk->sk_receive_queue.lock);
+	if (comp->index - smp_load_acquire(&comp->hdr->consumer) > comp->mask) {
+		po->stats.stats1.tp_drops++;
+		spin_unlock_bh(&sk->sk_receive_queue.lock);
+		return false;
+	}
+
+	desc = (struct tpacket_umem_desc *)comp->entries +
+	       (comp->index & comp->mask);
+	desc->addr = addr + umem->headroom;
+	desc->len = len;
+	desc->status = status;
+	smp_store_release(&comp->hdr->producer, ++comp->index);
+
+	if (status & TP_STATUS_USER)
+		po->stats.stats1.tp_packets++;
+	spin_unlock_bh(&sk->sk_receive_queue.lock);
+
+	sk->sk_data_ready(sk);
+	return true;
+}
+
+static void packet_umem_release(struct netdev_umem *zc)
+{
+	packet_umem_put(container_of(zc, struct packet_umem, zc));
+}
+
+/* Have the bound RX queue of the bound device receive into the frames */
+static int packet_umem_bind(struct sock *sk, struct packet_umem *umem)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct netdev_umem *zc = &umem->zc;
+	struct net_device *dev;
+	int err;
+
+	ASSERT_RTNL();
+
+	if (po->ifindex <= 0 || po->rx_queue < 0 || po->rx_queue > U16_MAX)
+		return -EINVAL;
+	dev = __dev_get_by_index(sock_net(sk), po->ifindex);
+	if (!dev)
+		return -ENODEV;
+	if (!dev->netdev_ops->ndo_umem_setup)
+		return -EOPNOTSUPP;
+
+	zc->pages = umem->mem.pages;
+	zc->frames = umem->frames;
+	zc->len = umem->len;
+	zc->frame_size = umem->frame_size;
+	zc->headroom = umem->headroom;
+	zc->get_frame = packet_umem_get_frame;
+	zc->put_frame = packet_umem_put_frame;
+	zc->release = packet_umem_release;
+
+	atomic_inc(&umem->refcnt);
+	err = dev->netdev_ops->ndo_umem_setup(dev, po->rx_queue, zc);
+	if (err) {
+		atomic_dec(&umem->refcnt);
+		return err;
+	}
+
+	dev_hold(dev);
+	umem->zc_dev = dev;
+	umem->zc_queue = po->rx_queue;
+	return 0;
+}
+
+static void packet_umem_unbind(struct packet_umem *umem)
+{
+	struct net_device *dev = umem->zc_dev;
+
+	ASSERT_RTNL();
+
+	if (!dev)
+		return;
+	dev->netdev_ops->ndo_umem_setup(dev, umem->zc_queue, NULL);
+	umem->zc_dev = NULL;
+	dev_put(dev);
+}
+
+static bool packet_umem_bound(const struct packet_sock *po)
+{
+	return po->umem && po->umem->zc_dev;
+}
+
+static int packet_umem_setup(struct sock *sk,
+			     const struct tpacket_umem_req *req)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_umem *umem;
+	int was_running, err;
+	__be16 num;
+
+	if (req->frame_size < 2048 || req->frame_size > PAGE_SIZE << 4 ||
+	    !is_power_of_2(req->frame_size))
+		return -EINVAL;
+	if (req->headroom >= req->frame_size)
+		return -EINVAL;
+	if (req->len & (req->frame_size - 1))
+		return -EINVAL;
+	if (req->flags & ~TP_UMEM_ZEROCOPY)
+		return -EINVAL;
+	if ((req->flags & TP_UMEM_ZEROCOPY) &&
+	    (req->frame_size > PAGE_SIZE || offset_in_page(req->addr)))
+		return -EINVAL;
+
+	umem = kzalloc(sizeof(*umem), GFP_KERNEL);
+	if (!umem)
+		return -ENOMEM;
+
+	err = packet_pin(&umem->mem, req->addr, req->len, &umem->frames);
+	if (err)
+		goto out_free;
+	umem->len = req->len;
+	umem->frame_size = req->frame_size;
+	umem->headroom = req->headroom;
+
+	err = packet_umem_ring_init(&umem->fill, req->fill_addr,
+				    req->fill_entries, sizeof(u64));
+	if (err)
+		goto out_free;
+	err = packet_umem_ring_init(&umem->comp, req->comp_addr,
+				    req->comp_entries,
+				    sizeof(struct tpacket_umem_desc));
+	if (err)
+		goto out_free;
+
+	/* User space may have filled the ring before handing it over */
+	umem->fill.index = ACCESS_ONCE(umem->fill.hdr->consumer);
+	umem->comp.index = ACCESS_ONCE(umem->comp.hdr->producer);
+	umem->sk = sk;
+	atomic_set(&umem->refcnt, 1);
+	INIT_WORK(&umem->free_work, packet_umem_free_work);
+
+	rtnl_lock();
+	lock_sock(sk);
+
+	err = -EBUSY;
+	if (po->umem || po->rx_ring.pg_vec)
+		goto out_unlock;
+
+	if (req->flags & TP_UMEM_ZEROCOPY) {
+		err = packet_umem_bind(sk, umem);
+		if (err)
+			goto out_unlock;
+	}
+
+	/* Detach socket from network */
+	spin_lock(&po->bind_lock);
+	was_running = po->running;
+	num = po->num;
+	if (was_running) {
+		po->num = 0;
+		__unregister_prot_hook(sk, false);
+	}
+	spin_unlock(&po->bind_lock);
+
+	synchronize_net();
+
+	po->umem = umem;
+	po->prot_hook.func = packet_umem_rcv;
+
+	spin_lock(&po->bind_lock);
+	if (was_running) {
+		po->num = num;
+		register_prot_hook(sk);
+	}
+	spin_unlock(&po->bind_lock);
+
+	/* dropped by packet_umem_free_work() */
+	__module_get(THIS_MODULE);
+
+	release_sock(sk);
+	rtnl_unlock();
+	return 0;
+
+out_unlock:
+	release_sock(sk);
+	rtnl_unlock();
+out_free:
+	packet_umem_free(umem);
+	return err;
+}
+
 /*
  *	Close a PACKET socket. This is fairly simple. We immediately go
  *	to 'closed' state and remove our protocol entry in the device list.
@@ -2638,6 +3110,13 @@ static int packet_release(struct socket *sock)
 	/*
 	 *	Now the socket is dead. No more input will appear.
 	 */
+	if (po->umem) {
+		rtnl_lock();
+		packet_umem_unbind(po->umem);
+		rtnl_unlock();
+		packet_umem_put(po->umem);
+		po->umem = NULL;
+	}
 	sock_orphan(sk);
 	sock->sk = NULL;
 
@@ -2670,6 +3149,10 @@ static int packet_do_bind(struct sock *sk, const char *name, int ifindex,
 		return -EINVAL;
 
 	lock_sock(sk);
+	if (packet_umem_bound(po)) {
+		release_sock(sk);
+		return -EBUSY;
+	}
 	spin_lock(&po->bind_lock);
 	rcu_read_lock();
 
@@ -2837,6 +3320,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 
 	spin_lock_init(&po->bind_lock);
 	mutex_init(&po->pg_vec_lock);
+	po->rx_queue = -1;
 	po->prot_hook.func = packet_rcv;
 
 	if (sock->type == SOCK_PACKET)
@@ -3363,7 +3847,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 
 		if (sock->type != SOCK_RAW)
 			return -EINVAL;
-		if (po->rx_ring.pg_vec || po->tx_ring.pg_vec)
+		if (po->rx_ring.pg_vec || po->tx_ring.pg_vec || po->umem)
 			return -EBUSY;
 		if (optlen < sizeof(val))
 			return -EINVAL;
@@ -3421,6 +3905,38 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->xmit = val ? packet_direct_xmit : dev_queue_xmit;
 		return 0;
 	}
+	case PACKET_UMEM:
+	{
+		struct tpacket_umem_req req;
+
+		if (optlen < sizeof(req))
+			return -EINVAL;
+		if (po->has_vnet_hdr)
+			return -EINVAL;
+		if (copy_from_user(&req, optval, sizeof(req)))
+			return -EFAULT;
+		return packet_umem_setup(sk, &req);
+	}
+	case PACKET_RX_QUEUE:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+		if (val < -1)
+			return -EINVAL;
+
+		lock_sock(sk);
+		if (packet_umem_bound(po)) {
+			release_sock(sk);
+			return -EBUSY;
+		}
+		po->rx_queue = val;
+		release_sock(sk);
+		return 0;
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3516,6 +4032,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	case PACKET_QDISC_BYPASS:
 		val = packet_use_direct_xmit(po);
 		break;
+	case PACKET_RX_QUEUE:
+		val = po->rx_queue;
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3557,6 +4076,9 @@ static int packet_notifier(struct notifier_block *this,
 						sk->sk_error_report(sk);
 				}
 				if (msg == NETDEV_UNREGISTER) {
+					/* The device is down, this doesn't sleep */
+					if (po->umem && po->umem->zc_dev == dev)
+						packet_umem_unbind(po->umem);
 					packet_cached_dev_reset(po);
 					po->ifindex = -1;
 					if (po->prot_hook.dev)
@@ -3647,6 +4169,12 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 			TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
+	if (po->umem) {
+		struct packet_umem_ring *comp = &po->umem->comp;
+
+		if (comp->index != ACCESS_ONCE(comp->hdr->consumer))
+			mask |= POLLIN | POLLRDNORM;
+	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
 	spin_lock_bh(&sk->sk_write_queue.lock);
 	if (po->tx_ring.pg_vec) {
@@ -3865,7 +4393,8 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 
 	err = -EBUSY;
 	mutex_lock(&po->pg_vec_lock);
-	if (closing || atomic_read(&po->mapped) == 0) {
+	if ((closing || atomic_read(&po->mapped) == 0) &&
+	    (tx_ring || !po->umem)) {
 		err = 0;
 		spin_lock_bh(&rb_queue->lock);
 		swap(rb->pg_vec, pg_vec);
@@ -3878,7 +4407,10 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		swap(rb->pg_vec_len, req->tp_block_nr);
 
 		rb->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
-		po->prot_hook.func = (po->rx_ring.pg_vec) ?
+		if (po->umem)
+			po->prot_hook.func = packet_umem_rcv;
+		else
+			po->prot_hook.func = (po->rx_ring.pg_vec) ?
 						tpacket_rcv : packet_rcv;
 		skb_queue_purge(rb_queue);
 		if (atomic_read(&po->mapped))
@@ -4118,14 +4650,22 @@ static void __exit packet_exit(void)
 	unregister_pernet_subsys(&packet_net_ops);
 	sock_unregister(PF_PACKET);
 	proto_unregister(&packet_proto);
+	destroy_workqueue(packet_umem_wq);
 }
 
 static int __init packet_init(void)
 {
-	int rc = proto_register(&packet_proto, 0);
+	int rc;
+
+	packet_umem_wq = alloc_workqueue("packet_umem", 0, 0);
+	if (!packet_umem_wq)
+		return -ENOMEM;
 
-	if (rc != 0)
+	rc = proto_register(&packet_proto, 0);
+	if (rc != 0) {
+		destroy_workqueue(packet_umem_wq);
 		goto out;
+	}
 
 	sock_register(&packet_family_ops);
 	register_pernet_subsys(&packet_net_ops);
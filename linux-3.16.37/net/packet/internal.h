@@ -70,6 +70,40 @@ struct packet_ring_buffer {
 	struct tpacket_kbdq_core	prb_bdqc;
 };
 
+/* user memory pinned and mapped into the kernel */
+struct packet_pinned {
+	struct page		**pages;
+	unsigned int		npages;
+	void			*vmap;
+	struct mm_struct	*mm;		/* pinned_vm charged to */
+	unsigned long		charged;
+};
+
+struct packet_umem_ring {
+	struct packet_pinned	mem;
+	struct tpacket_umem_ring *hdr;
+	void			*entries;
+	u32			mask;
+	u32			index;		/* our end, private copy */
+};
+
+struct packet_umem {
+	struct packet_pinned	mem;
+	void			*frames;
+	u64			len;
+	u32			frame_size;
+	u32			headroom;
+	struct packet_umem_ring	fill;
+	struct packet_umem_ring	comp;
+	struct sock		*sk;
+	/* zero-copy receive, the driver holds a reference while bound */
+	struct netdev_umem	zc;
+	struct net_device	*zc_dev;
+	u16			zc_queue;
+	atomic_t		refcnt;
+	struct work_struct	free_work;
+};
+
 extern struct mutex fanout_mutex;
 #define PACKET_FANOUT_MAX	256
 
@@ -105,6 +139,7 @@ struct packet_sock {
 				origdev:1,
 				has_vnet_hdr:1;
 	int			ifindex;	/* bound device		*/
+	int			rx_queue;	/* bound RX queue or -1	*/
 	__be16			num;
 	struct packet_mclist	*mclist;
 	atomic_t		mapped;
@@ -114,6 +149,7 @@ struct packet_sock {
 	unsigned int		tp_loss:1;
 	unsigned int		tp_tx_has_off:1;
 	unsigned int		tp_tstamp;
+	struct packet_umem	*umem;
 	struct net_device __rcu	*cached_dev;
 	int			(*xmit)(struct sk_buff *skb);
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
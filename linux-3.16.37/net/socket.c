@@ -1998,7 +1998,7 @@ static int copy_msghdr_from_user(struct msghdr *kmsg,
 
 static int ___sys_sendmsg(struct socket *sock, struct msghdr __user *msg,
 			 struct msghdr *msg_sys, unsigned int flags,
-			 struct used_address *used_address)
+			 struct used_address *used_address, bool nocmsg)
 {
 	struct compat_msghdr __user *msg_compat =
 	    (struct compat_msghdr __user *)msg;
@@ -2038,6 +2038,10 @@ static int ___sys_sendmsg(struct socket *sock, struct msghdr __user *msg,
 		goto out_freeiov;
 	total_len = err;
 
+	err = -EINVAL;
+	if (nocmsg && msg_sys->msg_controllen)
+		goto out_freeiov;
+
 	err = -ENOBUFS;
 
 	if (msg_sys->msg_controllen > INT_MAX)
@@ -2122,13 +2126,25 @@ long __sys_sendmsg(int fd, struct msghdr __user *msg, unsigned flags)
 	if (!sock)
 		goto out;
 
-	err = ___sys_sendmsg(sock, msg, &msg_sys, flags, NULL);
+	err = ___sys_sendmsg(sock, msg, &msg_sys, flags, NULL, false);
 
 	fput_light(sock->file, fput_needed);
 out:
 	return err;
 }
 
+/*
+ * For callers that already hold the socket, e.g. io_uring.  They may run
+ * in a worker whose file table isn't the sender's, so no ancillary data.
+ */
+long __sys_sendmsg_sock(struct socket *sock, struct msghdr __user *msg,
+			unsigned flags)
+{
+	struct msghdr msg_sys;
+
+	return ___sys_sendmsg(sock, msg, &msg_sys, flags, NULL, true);
+}
+
 SYSCALL_DEFINE3(sendmsg, int, fd, struct msghdr __user *, msg, unsigned int, flags)
 {
 	if (flags & MSG_CMSG_COMPAT)
@@ -2167,7 +2183,8 @@ int __sys_sendmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 	while (datagrams < vlen) {
 		if (MSG_CMSG_COMPAT & flags) {
 			err = ___sys_sendmsg(sock, (struct msghdr __user *)compat_entry,
-					     &msg_sys, flags, &used_address);
+					     &msg_sys, flags, &used_address,
+					     false);
 			if (err < 0)
 				break;
 			err = __put_user(err, &compat_entry->msg_len);
@@ -2175,7 +2192,8 @@ int __sys_sendmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 		} else {
 			err = ___sys_sendmsg(sock,
 					     (struct msghdr __user *)entry,
-					     &msg_sys, flags, &used_address);
+					     &msg_sys, flags, &used_address,
+					     false);
 			if (err < 0)
 				break;
 			err = put_user(err, &entry->msg_len);
@@ -2205,7 +2223,8 @@ SYSCALL_DEFINE4(sendmmsg, int, fd, struct mmsghdr __user *, mmsg,
 }
 
 static int ___sys_recvmsg(struct socket *sock, struct msghdr __user *msg,
-			 struct msghdr *msg_sys, unsigned int flags, int nosec)
+			 struct msghdr *msg_sys, unsigned int flags, int nosec,
+			 bool nocmsg)
 {
 	struct compat_msghdr __user *msg_compat =
 	    (struct compat_msghdr __user *)msg;
@@ -2227,6 +2246,8 @@ static int ___sys_recvmsg(struct socket *sock, struct msghdr __user *msg,
 		err = copy_msghdr_from_user(msg_sys, msg);
 	if (err)
 		return err;
+	if (nocmsg && msg_sys->msg_controllen)
+		return -EINVAL;
 
 	if (msg_sys->msg_iovlen > UIO_FASTIOV) {
 		err = -EMSGSIZE;
@@ -2308,13 +2329,22 @@ long __sys_recvmsg(int fd, struct msghdr __user *msg, unsigned flags)
 	if (!sock)
 		goto out;
 
-	err = ___sys_recvmsg(sock, msg, &msg_sys, flags, 0);
+	err = ___sys_recvmsg(sock, msg, &msg_sys, flags, 0, false);
 
 	fput_light(sock->file, fput_needed);
 out:
 	return err;
 }
 
+/* As __sys_sendmsg_sock(), SCM_RIGHTS would install into the wrong table */
+long __sys_recvmsg_sock(struct socket *sock, struct msghdr __user *msg,
+			unsigned flags)
+{
+	struct msghdr msg_sys;
+
+	return ___sys_recvmsg(sock, msg, &msg_sys, flags, 0, true);
+}
+
 SYSCALL_DEFINE3(recvmsg, int, fd, struct msghdr __user *, msg,
 		unsigned int, flags)
 {
@@ -2362,7 +2392,7 @@ int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 		if (MSG_CMSG_COMPAT & flags) {
 			err = ___sys_recvmsg(sock, (struct msghdr __user *)compat_entry,
 					     &msg_sys, flags & ~MSG_WAITFORONE,
-					     datagrams);
+					     datagrams, false);
 			if (err < 0)
 				break;
 			err = __put_user(err, &compat_entry->msg_len);
@@ -2371,7 +2401,7 @@ int __sys_recvmmsg(int fd, struct mmsghdr __user *mmsg, unsigned int vlen,
 			err = ___sys_recvmsg(sock,
 					     (struct msghdr __user *)entry,
 					     &msg_sys, flags & ~MSG_WAITFORONE,
-					     datagrams);
+					     datagrams, false);
 			if (err < 0)
 				break;
 			err = put_user(err, &entry->msg_len);
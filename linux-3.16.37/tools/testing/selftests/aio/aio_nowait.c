@@ -0,0 +1,127 @@
+/*
+ * Check that RWF_NOWAIT reads submitted through aio only see the page
+ * cache: a read of a file whose cache was just dropped must fail with
+ * EAGAIN, and the same read must succeed once the pages are cached.
+ *
+ * The test file is created in the current directory, which has to be
+ * on a filesystem that supports RWF_NOWAIT (ext4, xfs or btrfs).
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+
+#include <sys/syscall.h>
+
+#define TEST_FILE	"aio-nowait-test-file"
+#define TEST_SIZE	(1024 * 1024)
+
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+/* Returns the result of the read, or -errno if it couldn't be submitted */
+static long read_nowait(aio_context_t ctx, int fd, char *buf, size_t len)
+{
+	struct iocb iocb, *iocbp = &iocb;
+	struct io_event ev;
+
+	memset(&iocb, 0, sizeof(iocb));
+	iocb.aio_fildes = fd;
+	iocb.aio_lio_opcode = IOCB_CMD_PREAD;
+	iocb.aio_buf = (unsigned long)buf;
+	iocb.aio_nbytes = len;
+	iocb.aio_offset = 0;
+	iocb.aio_rw_flags = RWF_NOWAIT;
+
+	if (syscall(__NR_io_submit, ctx, 1, &iocbp) != 1)
+		return -errno;
+	if (syscall(__NR_io_getevents, ctx, 1, 1, &ev, NULL) != 1)
+		return -errno;
+	return ev.res;
+}
+
+int main(int argc, char **argv)
+{
+	aio_context_t ctx = 0;
+	char *buf, *data;
+	int fd, ret = 1;
+	long res;
+
+	buf = malloc(TEST_SIZE);
+	data = malloc(TEST_SIZE);
+	if (!buf || !data) {
+		perror("malloc");
+		return 1;
+	}
+	memset(data, 0x5a, TEST_SIZE);
+
+	fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	unlink(TEST_FILE);
+
+	if (write(fd, data, TEST_SIZE) != TEST_SIZE || fsync(fd)) {
+		perror("write");
+		goto out;
+	}
+	if (io_setup(1, &ctx)) {
+		perror("io_setup");
+		goto out;
+	}
+
+	/* Miss: nothing cached, so the read would have to wait for I/O */
+	posix_fadvise(fd, 0, TEST_SIZE, POSIX_FADV_DONTNEED);
+	res = read_nowait(ctx, fd, buf, TEST_SIZE);
+	if (res == -EOPNOTSUPP) {
+		printf("aio_nowait: RWF_NOWAIT not supported here [SKIP]\n");
+		ret = 0;
+		goto out_destroy;
+	}
+	if (res != -EAGAIN) {
+		printf("aio_nowait: uncached read returned %ld, expected %d [FAIL]\n",
+		       res, -EAGAIN);
+		goto out_destroy;
+	}
+
+	/* Hit: pull the file into the page cache and try again */
+	if (pread(fd, buf, TEST_SIZE, 0) != TEST_SIZE) {
+		perror("pread");
+		goto out_destroy;
+	}
+	memset(buf, 0, TEST_SIZE);
+	res = read_nowait(ctx, fd, buf, TEST_SIZE);
+	if (res != TEST_SIZE) {
+		printf("aio_nowait: cached read returned %ld, expected %d [FAIL]\n",
+		       res, TEST_SIZE);
+		goto out_destroy;
+	}
+	if (memcmp(buf, data, TEST_SIZE)) {
+		printf("aio_nowait: cached read returned wrong data [FAIL]\n");
+		goto out_destroy;
+	}
+
+	printf("aio_nowait: [PASS]\n");
+	ret = 0;
+
+out_destroy:
+	io_destroy(ctx);
+out:
+	close(fd);
+	return ret;
+}
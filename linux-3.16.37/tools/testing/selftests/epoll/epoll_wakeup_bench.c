@@ -0,0 +1,165 @@
+/*
+ * epoll wakeup microbenchmark
+ *
+ * A number of threads each wait in their own epoll instance on the read
+ * end of one shared pipe, the way worker threads share a listening
+ * socket.  The main thread writes one byte at a time and waits until a
+ * worker has consumed it.  This is run once with plain registrations,
+ * where every byte wakes up every worker, and once with EPOLLEXCLUSIVE,
+ * which should wake up about one worker per byte.  Most of the woken
+ * workers find nothing to report when epoll polls the pipe again, so
+ * the herd shows up as CPU time spent per event rather than as returns
+ * from epoll_wait().
+ *
+ * Usage: epoll_wakeup_bench [threads] [events]
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE	(1 << 28)
+#endif
+
+static int pipefd[2];
+static volatile int stop;
+static unsigned long consumed;
+
+static void *worker(void *arg)
+{
+	unsigned int events = (unsigned long)arg;
+	struct epoll_event ev = { .events = events };
+	int epfd;
+	char c;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, pipefd[0], &ev)) {
+		perror("epoll");
+		exit(1);
+	}
+
+	while (!stop) {
+		if (epoll_wait(epfd, &ev, 1, 100) <= 0)
+			continue;
+		if (read(pipefd[0], &c, 1) == 1)
+			__sync_fetch_and_add(&consumed, 1);
+	}
+
+	close(epfd);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* User and system time of the whole process, in seconds */
+static double cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int run(const char *name, unsigned int events, int nthreads,
+	       unsigned long nevents)
+{
+	pthread_t *threads;
+	unsigned long i;
+	double start, secs, cpu;
+	int t;
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads || pipe2(pipefd, O_NONBLOCK)) {
+		perror("setup");
+		return -1;
+	}
+	stop = 0;
+	consumed = 0;
+
+	for (t = 0; t < nthreads; t++) {
+		if (pthread_create(&threads[t], NULL, worker,
+				   (void *)(unsigned long)events)) {
+			perror("pthread_create");
+			return -1;
+		}
+	}
+	/* Let the workers block in epoll_wait() */
+	usleep(100000);
+
+	start = now();
+	cpu = cpu_time();
+	for (i = 0; i < nevents; i++) {
+		if (write(pipefd[1], "x", 1) != 1) {
+			perror("write");
+			return -1;
+		}
+		while (__sync_fetch_and_add(&consumed, 0) <= i)
+			;
+	}
+	secs = now() - start;
+	cpu = cpu_time() - cpu;
+
+	stop = 1;
+	for (t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	free(threads);
+
+	printf("%-10s %4d threads: %8.0f events/s, %7.2f us CPU/event\n",
+	       name, nthreads, nevents / secs, cpu * 1e6 / nevents);
+	return 0;
+}
+
+static int exclusive_supported(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE };
+	int fds[2], epfd, ret;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0 || pipe(fds))
+		return 0;
+	ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev);
+	close(fds[0]);
+	close(fds[1]);
+	close(epfd);
+	return ret == 0;
+}
+
+int main(int argc, char **argv)
+{
+	int nthreads = argc > 1 ? atoi(argv[1]) : 16;
+	unsigned long nevents = argc > 2 ? strtoul(argv[2], NULL, 0) : 20000;
+
+	if (nthreads < 1 || !nevents) {
+		fprintf(stderr, "usage: %s [threads] [events]\n", argv[0]);
+		return 1;
+	}
+
+	if (run("shared", EPOLLIN | EPOLLET, nthreads, nevents))
+		return 1;
+	if (!exclusive_supported()) {
+		printf("EPOLLEXCLUSIVE not supported [SKIP]\n");
+		return 0;
+	}
+	if (run("exclusive", EPOLLIN | EPOLLET | EPOLLEXCLUSIVE, nthreads,
+		nevents))
+		return 1;
+	return 0;
+}
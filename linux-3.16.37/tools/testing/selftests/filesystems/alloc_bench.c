@@ -0,0 +1,129 @@
+/*
+ * Parallel block allocation benchmark.
+ *
+ * Every thread works in a directory of its own and either fallocate()s
+ * files of a given size or creates small files by writing and fsync()ing
+ * them, so all the threads do is allocate blocks; the files are deleted
+ * again every so often to keep the filesystem from filling up.  The run is
+ * repeated for 1, 2, 4, ... threads up to the number of online CPUs.
+ * Every file has to end up with the size asked for and blocks to back
+ * it, and a small file has to read back what was written.
+ *
+ * Allocator behaviour depends a lot on how full and fragmented the
+ * filesystem is, so run it on a scratch filesystem, e.g.
+ *
+ *	truncate -s 8G /tmp/img && mkfs.ext4 -q /tmp/img
+ *	mount -o loop /tmp/img /mnt && alloc_bench -d /mnt
+ *
+ * Usage: alloc_bench [-d dir] [-t seconds] [-n max_threads] [-s size_kb]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include "bench.h"
+
+/* Files a thread keeps before deleting them again */
+#define NR_FILES	256
+
+enum mode { FALLOCATE, SMALL_FILES };
+
+static off_t falloc_size = 1 << 20;
+
+static void clean_dir(struct worker *w)
+{
+	char name[4200];
+	int i;
+
+	for (i = 0; i < NR_FILES; i++) {
+		snprintf(name, sizeof(name), "%s/f%d", w->dir, i);
+		unlink(name);
+	}
+}
+
+/* The file has to be as big as asked for, with blocks for all of it */
+static int check_file(struct worker *w, int fd, const char *buf)
+{
+	off_t size = w->mode == FALLOCATE ? falloc_size : 4096;
+	char rbuf[4096];
+	struct stat st;
+
+	if (fstat(fd, &st) || st.st_size != size ||
+	    st.st_blocks * 512 < size)
+		return bench_bad(w, "file not allocated in full");
+	if (w->mode == SMALL_FILES &&
+	    (pread(fd, rbuf, sizeof(rbuf), 0) != sizeof(rbuf) ||
+	     memcmp(rbuf, buf, sizeof(rbuf))))
+		return bench_bad(w, "file doesn't read back");
+	return 0;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char name[4200], buf[4096];
+	unsigned long i = 0;
+	int fd, ret;
+
+	while (!stop) {
+		if (i && !(i % NR_FILES))
+			clean_dir(w);
+		snprintf(name, sizeof(name), "%s/f%lu", w->dir, i % NR_FILES);
+		fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+		if (fd < 0) {
+			w->err = 1;
+			perror("open");
+			break;
+		}
+		if (w->mode == FALLOCATE) {
+			ret = fallocate(fd, 0, 0, falloc_size);
+		} else {
+			memset(buf, 'a' + i % 26, sizeof(buf));
+			ret = write(fd, buf, sizeof(buf)) != sizeof(buf) ||
+			      fsync(fd);
+		}
+		if (ret) {
+			close(fd);
+			w->err = 1;
+			perror(w->mode == FALLOCATE ? "fallocate" : "write");
+			break;
+		}
+		ret = check_file(w, fd, buf);
+		close(fd);
+		if (ret)
+			break;
+		w->ops++;
+		i++;
+	}
+	clean_dir(w);
+	return NULL;
+}
+
+static int opt_fn(int opt, const char *arg)
+{
+	falloc_size = (off_t)atoi(arg) << 10;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.unit	= "files",
+		.prefix	= "ab",
+		.fn	= worker_fn,
+	};
+	int err;
+
+	if (bench_options(argc, argv, 1, "s:", " [-s size_kb]", opt_fn))
+		return 1;
+	if (falloc_size < 4096)
+		falloc_size = 4096;
+
+	b.title = "fallocate";
+	b.mode = FALLOCATE;
+	err = bench_table(&b);
+	if (!err) {
+		b.title = "small files";
+		b.mode = SMALL_FILES;
+		err = bench_table(&b);
+	}
+	return bench_result("alloc_bench", err);
+}
@@ -0,0 +1,241 @@
+/*
+ * Scaffolding shared by the filesystem scaling benchmarks.
+ *
+ * A benchmark runs a worker function in 1, 2, 4, ... threads up to the
+ * number of online CPUs, either for a number of seconds or until every
+ * worker returns, and prints a table of the rate of operations with the
+ * scaling over one thread.  Workers may get a directory of their own,
+ * which has to be empty again once they are done.  Whatever a worker or
+ * a check hook finds wrong fails the run, and the benchmark ends with
+ * a "name: [PASS]" or "name: [FAIL]" line.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef __maybe_unused
+# define __maybe_unused		__attribute__ ((__unused__))
+#endif
+
+struct worker {
+	pthread_t thread;
+	int idx;		/* index of the worker in the run */
+	int mode;		/* copied from struct bench */
+	char dir[4096];		/* directory of its own, if asked for */
+	unsigned long ops;	/* operations done */
+	double nsecs;		/* time spent in the timed part of them */
+	int err;		/* set on any error or bad result */
+};
+
+struct bench {
+	const char *title;	/* printed above the table, may be NULL */
+	const char *unit;	/* what an operation is, per second */
+	const char *prefix;	/* of the per-worker directories, or NULL */
+	int mode;		/* passed to the workers */
+	int latency;		/* print the average of worker->nsecs */
+	void *(*fn)(void *);	/* gets its struct worker */
+
+	/* optional hooks, all but sync() run outside the timed section */
+	int (*setup)(int nthreads);
+	int (*sync)(void);	/* after the workers are joined */
+	int (*check)(struct worker *w);
+	void (*clean)(struct worker *w);	/* before rmdir() */
+	void (*teardown)(void);
+};
+
+static const char *base = "/tmp";
+static int secs = 2;		/* 0 runs the workers to completion */
+static int max_threads;
+static volatile int stop;
+
+static __maybe_unused double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Report a bad result found by a worker or a check */
+static __maybe_unused int bench_bad(struct worker *w, const char *what)
+{
+	fprintf(stderr, "worker %d: %s\n", w->idx, what);
+	w->err = 1;
+	return -1;
+}
+
+/*
+ * Run @b in @nthreads workers and give the rate of operations per
+ * second.  Returns -1 if anything went wrong.
+ */
+static __maybe_unused int bench_run(struct bench *b, int nthreads,
+				    double *rate, double *lat_us)
+{
+	struct worker *w;
+	unsigned long total = 0;
+	double nsecs = 0, start, elapsed = 0;
+	int i, made = 0, err = 0;
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		return -1;
+
+	for (i = 0; i < nthreads; i++) {
+		w[i].idx = i;
+		w[i].mode = b->mode;
+		if (!b->prefix)
+			continue;
+		snprintf(w[i].dir, sizeof(w[i].dir), "%s/%s.%d.%d",
+			 base, b->prefix, getpid(), i);
+		if (mkdir(w[i].dir, 0700)) {
+			perror("mkdir");
+			err = -1;
+			goto out;
+		}
+		made++;
+	}
+	if (b->setup && b->setup(nthreads)) {
+		err = -1;
+		goto out;
+	}
+
+	stop = 0;
+	start = now_ns();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&w[i].thread, NULL, b->fn, &w[i]);
+	if (secs) {
+		sleep(secs);
+		stop = 1;
+		elapsed = now_ns() - start;
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(w[i].thread, NULL);
+	if (b->sync && b->sync())
+		err = -1;
+	if (!secs)
+		elapsed = now_ns() - start;
+
+	for (i = 0; i < nthreads; i++) {
+		if (!w[i].err && b->check)
+			b->check(&w[i]);
+		total += w[i].ops;
+		nsecs += w[i].nsecs;
+		err |= w[i].err;
+	}
+	*rate = total / (elapsed / 1e9);
+	*lat_us = total ? nsecs / total / 1000 : 0;
+
+	if (b->teardown)
+		b->teardown();
+out:
+	for (i = 0; i < made; i++) {
+		if (b->clean)
+			b->clean(&w[i]);
+		if (rmdir(w[i].dir)) {
+			perror("rmdir");
+			err = -1;
+		}
+	}
+	free(w);
+	return err ? -1 : 0;
+}
+
+/*
+ * Run @b for 1, 2, 4, ... threads up to max_threads and print a line of
+ * the table for each.  Returns -1 on the first failed run.
+ */
+static __maybe_unused int bench_table(struct bench *b)
+{
+	double rate = 0, lat = 0, single = 0;
+	char unit[32];
+	int n;
+
+	if (b->title)
+		printf("%s\n", b->title);
+	snprintf(unit, sizeof(unit), "%s/s", b->unit);
+	printf("%8s %14s %14s %8s", "threads", unit, "per thread",
+	       "scaling");
+	if (b->latency)
+		printf(" %12s", "latency us");
+	printf("\n");
+
+	for (n = 1; n <= max_threads;
+	     n = n < max_threads && n * 2 > max_threads ? max_threads : n * 2) {
+		if (bench_run(b, n, &rate, &lat))
+			return -1;
+		if (n == 1)
+			single = rate;
+		printf("%8d %14.0f %14.0f %7.2fx", n, rate, rate / n,
+		       single ? rate / single : 0);
+		if (b->latency)
+			printf(" %12.1f", lat);
+		printf("\n");
+		if (n == max_threads)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Parse -d dir, -n max_threads and, for timed benchmarks, -t seconds,
+ * handing the options in @opts to @opt_fn.  Returns -1 after printing
+ * the usage, with @usage describing @opts, on a bad option.
+ */
+static __maybe_unused int bench_options(int argc, char **argv, int timed,
+					const char *opts, const char *usage,
+					int (*opt_fn)(int opt,
+						      const char *arg))
+{
+	char optstring[64];
+	int opt;
+
+	snprintf(optstring, sizeof(optstring), "d:n:%s%s",
+		 timed ? "t:" : "", opts ? opts : "");
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!timed)
+		secs = 0;
+
+	while ((opt = getopt(argc, argv, optstring)) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'n':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			if (opt != '?' && opt_fn && !opt_fn(opt, optarg))
+				break;
+			fprintf(stderr,
+				"usage: %s [-d dir]%s [-n threads]%s\n",
+				argv[0], timed ? " [-t seconds]" : "",
+				usage ? usage : "");
+			return -1;
+		}
+	}
+	if (timed && secs < 1)
+		secs = 1;
+	if (max_threads < 1)
+		max_threads = 1;
+	return 0;
+}
+
+/* Print the result line, returns the exit status */
+static __maybe_unused int bench_result(const char *name, int err)
+{
+	printf("%s: [%s]\n", name, err ? "FAIL" : "PASS");
+	return err ? 1 : 0;
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,422 @@
+/*
+ * FICLONE / FICLONERANGE / FIDEDUPERANGE correctness test and benchmark.
+ *
+ * Fills a source file with a known pattern and checks that a whole file
+ * clone, a range clone into the middle of an existing file and a clone of
+ * an unaligned EOF tail read back the right data, that buffered and
+ * O_DIRECT overwrites of a clone leave the source alone, and that
+ * deduplication shares identical ranges and refuses different ones.  Then times cloning the whole file against copying it
+ * with read()/write().
+ *
+ * Needs a filesystem that shares extents, e.g. XFS with reflink or btrfs:
+ *
+ *	truncate -s 4G /tmp/img && mkfs.xfs -q -m crc=1,reflink=1 /tmp/img
+ *	mount -o loop /tmp/img /mnt && clone_bench -d /mnt
+ *
+ * Usage: clone_bench [-d dir] [-s size_mb]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+#ifndef FICLONE
+struct file_clone_range {
+	int64_t src_fd;
+	uint64_t src_offset;
+	uint64_t src_length;
+	uint64_t dest_offset;
+};
+
+#define FILE_DEDUPE_RANGE_SAME		0
+#define FILE_DEDUPE_RANGE_DIFFERS	1
+
+struct file_dedupe_range_info {
+	int64_t dest_fd;
+	uint64_t dest_offset;
+	uint64_t bytes_deduped;
+	int32_t status;
+	uint32_t reserved;
+};
+
+struct file_dedupe_range {
+	uint64_t src_offset;
+	uint64_t src_length;
+	uint16_t dest_count;
+	uint16_t reserved1;
+	uint32_t reserved2;
+	struct file_dedupe_range_info info[0];
+};
+
+#define FICLONE		_IOW(0x94, 9, int)
+#define FICLONERANGE	_IOW(0x94, 13, struct file_clone_range)
+#define FIDEDUPERANGE	_IOWR(0x94, 54, struct file_dedupe_range)
+#endif
+
+#define BUF_SIZE	(1 << 20)
+#define BLOCK		65536	/* a multiple of any filesystem block size */
+
+static const char *base = "/tmp";
+static char src_name[4200], dst_name[4200];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned char pattern(off_t off)
+{
+	return (off * 7 + off / 4096) & 0xff;
+}
+
+static int fill(int fd, off_t size)
+{
+	static unsigned char buf[BUF_SIZE];
+	off_t off, i;
+
+	for (off = 0; off < size; off += BUF_SIZE) {
+		size_t n = size - off < BUF_SIZE ? size - off : BUF_SIZE;
+
+		for (i = 0; i < (off_t)n; i++)
+			buf[i] = pattern(off + i);
+		if (pwrite(fd, buf, n, off) != (ssize_t)n)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * fd must hold the pattern of src offset (o - pos_out + pos_in) in
+ * [pos_out, pos_out + len), @fill_byte elsewhere, and be @size bytes long.
+ */
+static int check(int fd, off_t size, off_t pos_in, off_t pos_out, off_t len,
+		 int fill_byte)
+{
+	static unsigned char buf[BUF_SIZE];
+	off_t off, i;
+
+	if (lseek(fd, 0, SEEK_END) != size) {
+		fprintf(stderr, "size %lld != %lld\n",
+			(long long)lseek(fd, 0, SEEK_END), (long long)size);
+		return -1;
+	}
+	for (off = 0; off < size; off += BUF_SIZE) {
+		ssize_t n = pread(fd, buf, BUF_SIZE, off);
+
+		if (n < 0)
+			return -1;
+		for (i = 0; i < n; i++) {
+			off_t o = off + i;
+			unsigned char want;
+
+			if (o >= pos_out && o < pos_out + len)
+				want = pattern(o - pos_out + pos_in);
+			else
+				want = fill_byte;
+			if (buf[i] != want) {
+				fprintf(stderr, "mismatch at %lld: %02x != %02x\n",
+					(long long)o, buf[i], want);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int clone_range(int src, off_t pos_in, int dst, off_t pos_out,
+		       off_t len)
+{
+	struct file_clone_range fcr = {
+		.src_fd = src,
+		.src_offset = pos_in,
+		.src_length = len,
+		.dest_offset = pos_out,
+	};
+
+	return ioctl(dst, FICLONERANGE, &fcr);
+}
+
+static int open_dst(off_t size)
+{
+	int dst = open(dst_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+
+	if (dst >= 0 && size && ftruncate(dst, size)) {
+		close(dst);
+		return -1;
+	}
+	return dst;
+}
+
+static int result(const char *name, int err)
+{
+	printf("%-28s %s\n", name, err ? "FAILED" : "ok");
+	return err ? -1 : 0;
+}
+
+static int test_clone_file(int src, off_t size)
+{
+	int dst, err;
+
+	dst = open_dst(0);
+	if (dst < 0)
+		return result("clone file", 1);
+	err = ioctl(dst, FICLONE, src) || check(dst, size, 0, 0, size, 0);
+	close(dst);
+	return result("clone file", err);
+}
+
+static int test_clone_range(int src, off_t size)
+{
+	int dst, err;
+
+	dst = open_dst(4 * BLOCK + size / 2);
+	if (dst < 0)
+		return result("clone range", 1);
+	err = clone_range(src, BLOCK, dst, 2 * BLOCK, size / 4) ||
+	      check(dst, 4 * BLOCK + size / 2, BLOCK, 2 * BLOCK, size / 4, 0);
+	close(dst);
+	return result("clone range", err);
+}
+
+/* an unaligned source EOF may be cloned past the end of the destination */
+static int test_clone_tail(off_t size)
+{
+	int tail, dst, err = 1;
+
+	tail = open(src_name, O_RDWR);
+	if (tail < 0 || ftruncate(tail, size - 1000))
+		goto out;
+	dst = open_dst(0);
+	if (dst < 0)
+		goto out;
+	err = clone_range(tail, size - 2 * BLOCK, dst, 0, 0) ||
+	      check(dst, 2 * BLOCK - 1000, size - 2 * BLOCK, 0,
+		    2 * BLOCK - 1000, 0);
+	close(dst);
+out:
+	/* put the pattern back */
+	if (tail >= 0) {
+		err |= fill(tail, size) != 0;
+		close(tail);
+	}
+	return result("clone eof tail", err);
+}
+
+/* writes to a clone must not show through in the source */
+static int test_cow(int src, off_t size, int direct)
+{
+	const char *name = direct ? "copy on write, O_DIRECT" :
+				    "copy on write";
+	void *buf;
+	int dst, wfd, err = 1;
+
+	if (posix_memalign(&buf, BLOCK, BLOCK))
+		return result(name, 1);
+	memset(buf, 0xaa, BLOCK);
+
+	dst = open_dst(0);
+	if (dst < 0 || ioctl(dst, FICLONE, src))
+		goto out;
+	wfd = open(dst_name, O_RDWR | (direct ? O_DIRECT : 0));
+	if (wfd < 0)
+		goto out;
+	err = pwrite(wfd, buf, BLOCK, BLOCK) != BLOCK || fsync(wfd);
+	close(wfd);
+	if (err)
+		goto out;
+
+	/* the source still has the pattern everywhere */
+	err = check(src, size, 0, 0, size, 0);
+	if (!err) {
+		unsigned char *b = malloc(BLOCK);
+
+		err = !b || pread(dst, b, BLOCK, BLOCK) != BLOCK ||
+		      memcmp(b, buf, BLOCK) ||
+		      pread(dst, b, BLOCK, 2 * BLOCK) != BLOCK ||
+		      b[0] != pattern(2 * BLOCK);
+		free(b);
+	}
+out:
+	if (dst >= 0)
+		close(dst);
+	free(buf);
+	return result(name, err);
+}
+
+static int dedupe(int src, off_t pos_in, int dst, off_t pos_out, off_t len,
+		  int *status, uint64_t *deduped)
+{
+	struct {
+		struct file_dedupe_range r;
+		struct file_dedupe_range_info info;
+	} args;
+	int ret;
+
+	memset(&args, 0, sizeof(args));
+	args.r.src_offset = pos_in;
+	args.r.src_length = len;
+	args.r.dest_count = 1;
+	args.info.dest_fd = dst;
+	args.info.dest_offset = pos_out;
+	ret = ioctl(src, FIDEDUPERANGE, &args);
+	*status = args.info.status;
+	*deduped = args.info.bytes_deduped;
+	return ret;
+}
+
+static int test_dedupe(int src, off_t size)
+{
+	uint64_t deduped;
+	unsigned char c = 0;
+	int dst, status, err = 1;
+
+	dst = open_dst(0);
+	if (dst < 0 || fill(dst, size) || fsync(dst))
+		goto out;
+
+	/* identical data is shared, up to what one call handles */
+	if (dedupe(src, BLOCK, dst, BLOCK, 4 * BLOCK, &status, &deduped) ||
+	    status != FILE_DEDUPE_RANGE_SAME || deduped != 4 * BLOCK)
+		goto out;
+	if (check(dst, size, 0, 0, size, 0))
+		goto out;
+
+	/* different data is left alone */
+	if (pwrite(dst, &c, 1, 8 * BLOCK + 5) != 1 || fsync(dst))
+		goto out;
+	if (dedupe(src, 8 * BLOCK, dst, 8 * BLOCK, BLOCK, &status,
+		   &deduped) ||
+	    status != FILE_DEDUPE_RANGE_DIFFERS || deduped != 0)
+		goto out;
+	err = 0;
+out:
+	if (dst >= 0)
+		close(dst);
+	return result("dedupe", err);
+}
+
+static double time_clone(int src)
+{
+	double start;
+	int dst, ret;
+
+	dst = open_dst(0);
+	if (dst < 0)
+		return -1;
+	start = now_ns();
+	ret = ioctl(dst, FICLONE, src) || fsync(dst);
+	start = now_ns() - start;
+	close(dst);
+	return ret ? -1 : start;
+}
+
+static double time_read_write(int src, off_t size)
+{
+	static char buf[BUF_SIZE];
+	double start;
+	off_t off;
+	int dst, ret = 0;
+
+	dst = open_dst(0);
+	if (dst < 0)
+		return -1;
+	start = now_ns();
+	for (off = 0; off < size && !ret; off += BUF_SIZE) {
+		ssize_t n = pread(src, buf, BUF_SIZE, off);
+
+		ret = n <= 0 || pwrite(dst, buf, n, off) != n;
+	}
+	ret = ret || fsync(dst);
+	start = now_ns() - start;
+	close(dst);
+	return ret ? -1 : start;
+}
+
+int main(int argc, char **argv)
+{
+	off_t size = 64 << 20;
+	double t_clone, t_rw;
+	int opt, src, dst, err = 0;
+
+	while ((opt = getopt(argc, argv, "d:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 's':
+			size = (off_t)atoi(optarg) << 20;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dir] [-s size_mb]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (size < (1 << 20))
+		size = 1 << 20;
+
+	snprintf(src_name, sizeof(src_name), "%s/clone_src.%d", base, getpid());
+	snprintf(dst_name, sizeof(dst_name), "%s/clone_dst.%d", base, getpid());
+
+	src = open(src_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (src < 0 || fill(src, size) || fsync(src)) {
+		perror("source file");
+		printf("clone_bench: [FAIL]\n");
+		return 1;
+	}
+
+	dst = open_dst(0);
+	if (dst < 0 || ioctl(dst, FICLONE, src)) {
+		if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV ||
+		    errno == EINVAL) {
+			printf("%s can't share extents (%s)\n", base,
+			       strerror(errno));
+			printf("clone_bench: [SKIP]\n");
+			err = 0;
+		} else {
+			perror("FICLONE");
+			printf("clone_bench: [FAIL]\n");
+			err = 1;
+		}
+		if (dst >= 0)
+			close(dst);
+		goto out;
+	}
+	close(dst);
+
+	err |= test_clone_file(src, size);
+	err |= test_clone_range(src, size);
+	err |= test_clone_tail(size);
+	err |= test_cow(src, size, 0);
+	err |= test_cow(src, size, 1);
+	err |= test_dedupe(src, size);
+
+	t_clone = time_clone(src);
+	t_rw = time_read_write(src, size);
+	if (t_clone < 0 || t_rw < 0) {
+		err = 1;
+	} else {
+		printf("%-28s %10.1f MB/s\n", "clone",
+		       size / (t_clone / 1e9) / (1 << 20));
+		printf("%-28s %10.1f MB/s\n", "read/write",
+		       size / (t_rw / 1e9) / (1 << 20));
+	}
+
+	printf("clone_bench: [%s]\n", err ? "FAIL" : "PASS");
+out:
+	close(src);
+	unlink(src_name);
+	unlink(dst_name);
+	return err ? 1 : 0;
+}
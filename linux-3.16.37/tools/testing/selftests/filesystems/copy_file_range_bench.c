@@ -0,0 +1,327 @@
+/*
+ * copy_file_range() correctness test and benchmark.
+ *
+ * Fills a source file with a known pattern, copies it with
+ * copy_file_range() block aligned, unaligned, into the middle of an
+ * existing file, within one file and through the file positions when no
+ * offsets are passed, and checks every byte of the result.  A copy onto
+ * an overlapping range of the same file must fail with EINVAL and leave
+ * the file alone.  Then times copying the whole file with
+ * copy_file_range() against a read()/write() loop.
+ *
+ * On tmpfs the copy goes through the generic splice fallback; on btrfs
+ * aligned copies are turned into clones and should be close to free,
+ * e.g.
+ *
+ *	truncate -s 4G /tmp/img && mkfs.btrfs -q /tmp/img
+ *	mount -o loop /tmp/img /mnt && copy_file_range_bench -d /mnt
+ *	copy_file_range_bench -d /dev/shm
+ *
+ * Usage: copy_file_range_bench [-d dir] [-s size_mb]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#define BUF_SIZE	(1 << 20)
+
+static const char *base = "/tmp";
+static char src_name[4200], dst_name[4200];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static ssize_t sys_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
+				   loff_t *off_out, size_t len,
+				   unsigned int flags)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out,
+		       len, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static unsigned char pattern(off_t off)
+{
+	return (off * 7 + off / 4096) & 0xff;
+}
+
+static int fill(int fd, off_t size)
+{
+	static unsigned char buf[BUF_SIZE];
+	off_t off, i;
+
+	for (off = 0; off < size; off += BUF_SIZE) {
+		size_t n = size - off < BUF_SIZE ? size - off : BUF_SIZE;
+
+		for (i = 0; i < (off_t)n; i++)
+			buf[i] = pattern(off + i);
+		if (pwrite(fd, buf, n, off) != (ssize_t)n)
+			return -1;
+	}
+	return 0;
+}
+
+/* copy the whole range, looping over short copies */
+static int copy_range(int in, off_t pos_in, int out, off_t pos_out,
+		      size_t len)
+{
+	loff_t off_in = pos_in, off_out = pos_out;
+	ssize_t ret;
+
+	while (len) {
+		ret = sys_copy_file_range(in, &off_in, out, &off_out, len, 0);
+		if (ret <= 0)
+			return ret ? -1 : -2;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* dst[pos_out, pos_out + len) must match src at pos_in, the rest @fill */
+static int check(int fd, off_t size, off_t pos_in, off_t pos_out, size_t len,
+		 int fill_byte)
+{
+	static unsigned char buf[BUF_SIZE];
+	off_t off, i;
+
+	for (off = 0; off < size; off += BUF_SIZE) {
+		ssize_t n = pread(fd, buf, BUF_SIZE, off);
+
+		if (n < 0)
+			return -1;
+		for (i = 0; i < n; i++) {
+			off_t o = off + i;
+			unsigned char want;
+
+			if (o >= pos_out && o < pos_out + (off_t)len)
+				want = pattern(o - pos_out + pos_in);
+			else
+				want = fill_byte;
+			if (buf[i] != want) {
+				fprintf(stderr, "mismatch at %lld: %02x != %02x\n",
+					(long long)o, buf[i], want);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int test_copy(const char *name, int src, off_t pos_in, off_t pos_out,
+		     size_t len, off_t dst_size)
+{
+	int dst, ret;
+
+	dst = open(dst_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (dst < 0)
+		return -1;
+	if (dst_size) {
+		/* zeroes around the copied range */
+		if (ftruncate(dst, dst_size))
+			goto fail;
+	}
+
+	ret = copy_range(src, pos_in, dst, pos_out, len);
+	if (ret)
+		goto fail;
+	if (check(dst, dst_size > pos_out + (off_t)len ? dst_size :
+		  pos_out + len, pos_in, pos_out, len, 0))
+		goto fail;
+	close(dst);
+	printf("%-24s ok\n", name);
+	return 0;
+fail:
+	printf("%-24s FAILED (%s)\n", name, strerror(errno));
+	close(dst);
+	return -1;
+}
+
+/*
+ * Copy within one file: a disjoint range must come out right, an
+ * overlapping one must be refused before anything is written.
+ */
+static int test_same_file(void)
+{
+	static unsigned char buf[BUF_SIZE];
+	off_t size = 4 << 20, pos_out = 2 << 20, off, i;
+	size_t len = 1 << 20;
+	int fd, err = -1;
+
+	fd = open(dst_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (fd < 0 || fill(fd, size))
+		goto out;
+
+	if (copy_range(fd, 0, fd, pos_out, len))
+		goto out;
+	if (copy_range(fd, 4096, fd, 8192, len) != -1 || errno != EINVAL) {
+		fprintf(stderr, "overlapping copy not refused\n");
+		goto out;
+	}
+
+	for (off = 0; off < size; off += BUF_SIZE) {
+		if (pread(fd, buf, BUF_SIZE, off) != BUF_SIZE)
+			goto out;
+		for (i = 0; i < BUF_SIZE; i++) {
+			off_t o = off + i;
+			off_t from = o >= pos_out && o < pos_out + (off_t)len ?
+				     o - pos_out : o;
+
+			if (buf[i] != pattern(from)) {
+				fprintf(stderr, "mismatch at %lld\n",
+					(long long)o);
+				goto out;
+			}
+		}
+	}
+	err = 0;
+out:
+	printf("%-24s %s\n", "same file", err ? "FAILED" : "ok");
+	if (fd >= 0)
+		close(fd);
+	return err;
+}
+
+/* copy with NULL offsets must use and advance both file positions */
+static int test_file_pos(int src, off_t size)
+{
+	int dst, err = -1;
+
+	dst = open(dst_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (dst < 0)
+		return -1;
+	if (lseek(src, 4096, SEEK_SET) != 4096 ||
+	    lseek(dst, 8192, SEEK_SET) != 8192)
+		goto out;
+	if (sys_copy_file_range(src, NULL, dst, NULL, size - 4096, 0) <= 0)
+		goto out;
+	if (lseek(src, 0, SEEK_CUR) <= 4096 || lseek(dst, 0, SEEK_CUR) <= 8192)
+		goto out;
+	err = 0;
+out:
+	printf("%-24s %s\n", "file positions", err ? "FAILED" : "ok");
+	close(dst);
+	return err;
+}
+
+static double time_copy_file_range(int src, off_t size)
+{
+	double start;
+	int dst, ret;
+
+	dst = open(dst_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (dst < 0)
+		return -1;
+	start = now_ns();
+	ret = copy_range(src, 0, dst, 0, size);
+	ret = ret || fsync(dst);
+	start = now_ns() - start;
+	close(dst);
+	return ret ? -1 : start;
+}
+
+static double time_read_write(int src, off_t size)
+{
+	static char buf[BUF_SIZE];
+	double start;
+	off_t off;
+	int dst, ret = 0;
+
+	dst = open(dst_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (dst < 0)
+		return -1;
+	start = now_ns();
+	for (off = 0; off < size && !ret; off += BUF_SIZE) {
+		ssize_t n = pread(src, buf, BUF_SIZE, off);
+
+		ret = n <= 0 || pwrite(dst, buf, n, off) != n;
+	}
+	ret = ret || fsync(dst);
+	start = now_ns() - start;
+	close(dst);
+	return ret ? -1 : start;
+}
+
+int main(int argc, char **argv)
+{
+	off_t size = 64 << 20;
+	double t_cfr, t_rw;
+	int opt, src, err = 0;
+
+	while ((opt = getopt(argc, argv, "d:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 's':
+			size = (off_t)atoi(optarg) << 20;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dir] [-s size_mb]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (size < (1 << 20))
+		size = 1 << 20;
+
+	snprintf(src_name, sizeof(src_name), "%s/cfr_src.%d", base, getpid());
+	snprintf(dst_name, sizeof(dst_name), "%s/cfr_dst.%d", base, getpid());
+
+	src = open(src_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (src < 0 || fill(src, size) || fsync(src)) {
+		perror("source file");
+		printf("copy_file_range_bench: [FAIL]\n");
+		return 1;
+	}
+
+	if (sys_copy_file_range(src, NULL, src, NULL, 0, 0) < 0 &&
+	    errno == ENOSYS) {
+		printf("copy_file_range not supported\n");
+		printf("copy_file_range_bench: [SKIP]\n");
+		goto out;
+	}
+
+	err |= test_copy("aligned", src, 0, 0, size, 0);
+	err |= test_copy("aligned, offset", src, 65536, 131072,
+			 size - 65536, 0);
+	err |= test_copy("unaligned", src, 1000, 3333, size / 2 + 17, 0);
+	err |= test_copy("into existing file", src, 4096, 8192, 1 << 20,
+			 4 << 20);
+	err |= test_copy("eof tail", src, size - 5000, 0, 5000, 0);
+	err |= test_same_file();
+	err |= test_file_pos(src, size);
+
+	t_cfr = time_copy_file_range(src, size);
+	t_rw = time_read_write(src, size);
+	if (t_cfr < 0 || t_rw < 0) {
+		err = 1;
+	} else {
+		printf("%-24s %10.1f MB/s\n", "copy_file_range",
+		       size / (t_cfr / 1e9) / (1 << 20));
+		printf("%-24s %10.1f MB/s\n", "read/write",
+		       size / (t_rw / 1e9) / (1 << 20));
+	}
+
+	printf("copy_file_range_bench: [%s]\n", err ? "FAIL" : "PASS");
+out:
+	close(src);
+	unlink(src_name);
+	unlink(dst_name);
+	return err ? 1 : 0;
+}
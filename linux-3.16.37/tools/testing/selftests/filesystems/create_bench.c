@@ -0,0 +1,128 @@
+/*
+ * Parallel file creation benchmark.
+ *
+ * Every thread creates empty files in a directory of its own and then
+ * changes the mode and timestamps of each, so every file costs a few
+ * small metadata transactions and no data I/O.  The run is repeated for
+ * 1, 2, 4, ... threads up to the number of online CPUs.  Each run ends
+ * with a syncfs() that is included in the time, so the rate covers
+ * writing the metadata to the log as well as committing it.  After it
+ * every file has to be there, empty and with the new mode.  The files
+ * are removed between runs, outside the timed section.
+ *
+ * On XFS the transaction commits of all threads meet in the CIL, e.g.
+ *
+ *	truncate -s 8G /tmp/img && mkfs.xfs -q /tmp/img
+ *	mount -o loop /tmp/img /mnt && create_bench -d /mnt
+ *
+ * Usage: create_bench [-d dir] [-n max_threads] [-f files_per_thread]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include "bench.h"
+
+static int nr_files = 20000;
+static int base_fd = -1;
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char name[4200];
+	int i, fd;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(name, sizeof(name), "%s/f%d", w->dir, i);
+		fd = open(name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+		if (fd < 0 || fchmod(fd, 0644) || futimens(fd, NULL)) {
+			perror("create");
+			w->err = 1;
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+		close(fd);
+		w->ops++;
+	}
+	return NULL;
+}
+
+static int check_files(struct worker *w)
+{
+	char name[4200];
+	struct stat st;
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(name, sizeof(name), "%s/f%d", w->dir, i);
+		if (stat(name, &st))
+			return bench_bad(w, "created file is missing");
+		if (!S_ISREG(st.st_mode) || (st.st_mode & 07777) != 0644 ||
+		    st.st_size)
+			return bench_bad(w, "created file has the wrong mode");
+	}
+	return 0;
+}
+
+static void clean_dir(struct worker *w)
+{
+	char name[4200];
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(name, sizeof(name), "%s/f%d", w->dir, i);
+		unlink(name);
+	}
+}
+
+/* Start from a clean log, so the run only pays for its own metadata */
+static int sync_before(int nthreads)
+{
+	base_fd = open(base, O_RDONLY | O_DIRECTORY);
+	if (base_fd < 0 || syncfs(base_fd)) {
+		perror("syncfs");
+		if (base_fd >= 0)
+			close(base_fd);
+		return -1;
+	}
+	return 0;
+}
+
+static int sync_after(void)
+{
+	if (syncfs(base_fd)) {
+		perror("syncfs");
+		return -1;
+	}
+	return 0;
+}
+
+static void close_dir(void)
+{
+	close(base_fd);
+}
+
+static int opt_fn(int opt, const char *arg)
+{
+	nr_files = atoi(arg);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.unit		= "creates",
+		.prefix		= "cb",
+		.fn		= worker_fn,
+		.setup		= sync_before,
+		.sync		= sync_after,
+		.check		= check_files,
+		.clean		= clean_dir,
+		.teardown	= close_dir,
+	};
+
+	if (bench_options(argc, argv, 0, "f:", " [-f files]", opt_fn))
+		return 1;
+	if (nr_files < 1)
+		nr_files = 1;
+	return bench_result("create_bench", bench_table(&b));
+}
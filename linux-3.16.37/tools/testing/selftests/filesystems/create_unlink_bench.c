@@ -0,0 +1,67 @@
+/*
+ * File create/unlink scaling benchmark.
+ *
+ * Every thread creates and unlinks files in a directory of its own, so
+ * the only state the threads share in the kernel is the superblock
+ * (the s_inodes list in particular) and the inode/dentry caches.  The
+ * run is repeated for 1, 2, 4, ... threads up to the number of online
+ * CPUs; with a global inode list lock the per-thread rate falls off as
+ * threads are added.  Each new file has to be an empty regular file, be
+ * gone after the unlink, and the directories have to be empty at the
+ * end.
+ *
+ * Usage: create_unlink_bench [-d dir] [-t seconds] [-n max_threads]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include "bench.h"
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char name[4200];
+	unsigned long i = 0;
+	struct stat st;
+	int fd;
+
+	while (!stop) {
+		snprintf(name, sizeof(name), "%s/f%lu", w->dir, i++ & 1023);
+		fd = open(name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+		if (fd < 0) {
+			w->err = 1;
+			perror("open");
+			break;
+		}
+		if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size) {
+			close(fd);
+			bench_bad(w, "new file is not empty");
+			break;
+		}
+		close(fd);
+		if (unlink(name)) {
+			w->err = 1;
+			perror("unlink");
+			break;
+		}
+		if (!access(name, F_OK) || errno != ENOENT) {
+			bench_bad(w, "file still there after unlink");
+			break;
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.unit	= "ops",
+		.prefix	= "cub",
+		.fn	= worker_fn,
+	};
+
+	if (bench_options(argc, argv, 1, NULL, NULL, NULL))
+		return 1;
+	return bench_result("create_unlink_bench", bench_table(&b));
+}
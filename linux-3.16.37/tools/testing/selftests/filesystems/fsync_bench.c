@@ -0,0 +1,208 @@
+/*
+ * fsync() latency benchmark.
+ *
+ * Every thread works in a directory of its own and repeatedly either
+ * appends a block to a file, overwrites a block of a file or creates a
+ * small file, and fsync()s after each operation, which is the pattern of
+ * databases and mail servers.  The run is repeated for 1, 2, 4, ...
+ * threads up to the number of online CPUs, printing fsync()s per second
+ * and the average latency of one.  Each operation writes a different
+ * byte, and at the end of a run every thread reads its files back and
+ * checks that they hold the last write of each block.
+ *
+ * Compare an ext4 scratch filesystem mounted with and without fast
+ * commits, e.g.
+ *
+ *	truncate -s 4G /tmp/img && mkfs.ext4 -q /tmp/img
+ *	mount -o loop,journal_fast_commit /tmp/img /mnt && fsync_bench -d /mnt
+ *
+ * Usage: fsync_bench [-d dir] [-t seconds] [-n max_threads]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include "bench.h"
+
+/* Blocks a file grows to before it is truncated again */
+#define NR_BLOCKS	1024
+#define BLOCK_SIZE	4096
+
+enum mode { APPEND, OVERWRITE, CREATE, NR_MODES };
+
+static const char * const mode_names[NR_MODES] = {
+	"append", "overwrite", "create",
+};
+
+/* The byte operation @i writes */
+static int pattern(unsigned long i)
+{
+	return 'a' + i % 26;
+}
+
+static void clean_dir(struct worker *w)
+{
+	char name[4200];
+	int i;
+
+	for (i = 0; i < NR_BLOCKS; i++) {
+		snprintf(name, sizeof(name), "%s/f%d", w->dir, i);
+		unlink(name);
+	}
+}
+
+/* Block @blk of @fd has to be all @c, and the file @size bytes long */
+static int check_block(struct worker *w, int fd, off_t size,
+		       unsigned long blk, int c)
+{
+	char buf[BLOCK_SIZE];
+	struct stat st;
+	size_t j;
+
+	if (fstat(fd, &st) || st.st_size != size ||
+	    pread(fd, buf, sizeof(buf), blk * BLOCK_SIZE) != sizeof(buf))
+		return bench_bad(w, "file has the wrong size");
+	for (j = 0; j < sizeof(buf) && buf[j] == c; j++)
+		;
+	if (j < sizeof(buf))
+		return bench_bad(w, "block doesn't hold the last write");
+	return 0;
+}
+
+/*
+ * Check the files against the w->ops operations done.  Appends and
+ * creates start over every NR_BLOCKS operations, @first is the first
+ * operation since the last time they did.
+ */
+static void check_files(struct worker *w, int fd)
+{
+	unsigned long first = 0;
+	char name[4200];
+	unsigned long i;
+	int ret = 0;
+
+	if (w->ops)
+		first = (w->ops - 1) / NR_BLOCKS * NR_BLOCKS;
+
+	switch (w->mode) {
+	case APPEND:
+		for (i = first; i < w->ops && !ret; i++)
+			ret = check_block(w, fd, (w->ops - first) * BLOCK_SIZE,
+					  i - first, pattern(i));
+		break;
+	case OVERWRITE:
+		/* the last write of block i % NR_BLOCKS is among the last ones */
+		for (i = w->ops > NR_BLOCKS ? w->ops - NR_BLOCKS : 0;
+		     i < w->ops && !ret; i++)
+			ret = check_block(w, fd, NR_BLOCKS * BLOCK_SIZE,
+					  i % NR_BLOCKS, pattern(i));
+		break;
+	case CREATE:
+		for (i = first; i < w->ops && !ret; i++) {
+			snprintf(name, sizeof(name), "%s/f%lu", w->dir,
+				 i - first);
+			fd = open(name, O_RDONLY);
+			if (fd < 0)
+				ret = bench_bad(w, "created file is missing");
+			else
+				ret = check_block(w, fd, BLOCK_SIZE, 0,
+						  pattern(i));
+			if (fd >= 0)
+				close(fd);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char name[4200], buf[BLOCK_SIZE];
+	unsigned long i = 0;
+	double start;
+	off_t off;
+	int fd = -1, ret;
+
+	snprintf(name, sizeof(name), "%s/file", w->dir);
+	if (w->mode != CREATE) {
+		fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+		if (fd < 0 || (w->mode == OVERWRITE &&
+			       (ftruncate(fd, NR_BLOCKS * BLOCK_SIZE) ||
+				fsync(fd)))) {
+			w->err = 1;
+			perror("open");
+			if (fd >= 0) {
+				close(fd);
+				unlink(name);
+			}
+			return NULL;
+		}
+	}
+
+	while (!stop) {
+		if (w->mode == CREATE) {
+			if (i && i % NR_BLOCKS == 0)
+				clean_dir(w);
+			snprintf(name, sizeof(name), "%s/f%lu", w->dir,
+				 i % NR_BLOCKS);
+			fd = open(name, O_CREAT | O_WRONLY, 0600);
+			if (fd < 0) {
+				w->err = 1;
+				perror("open");
+				break;
+			}
+		} else if (w->mode == APPEND && i && i % NR_BLOCKS == 0) {
+			if (ftruncate(fd, 0) || fsync(fd)) {
+				w->err = 1;
+				perror("ftruncate");
+				break;
+			}
+		}
+
+		memset(buf, pattern(i), sizeof(buf));
+		off = w->mode == CREATE ? 0 : (off_t)(i % NR_BLOCKS) * BLOCK_SIZE;
+		ret = pwrite(fd, buf, sizeof(buf), off) != sizeof(buf);
+		start = now_ns();
+		ret = ret || fsync(fd);
+		w->nsecs += now_ns() - start;
+		if (w->mode == CREATE)
+			close(fd);
+		if (ret) {
+			w->err = 1;
+			perror("write");
+			break;
+		}
+		w->ops++;
+		i++;
+	}
+
+	if (!w->err)
+		check_files(w, fd);
+	if (w->mode == CREATE) {
+		clean_dir(w);
+	} else {
+		close(fd);
+		unlink(name);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.unit		= "fsyncs",
+		.prefix		= "fb",
+		.latency	= 1,
+		.fn		= worker_fn,
+	};
+	int err = 0;
+
+	if (bench_options(argc, argv, 1, NULL, NULL, NULL))
+		return 1;
+
+	for (b.mode = 0; b.mode < NR_MODES && !err; b.mode++) {
+		b.title = mode_names[b.mode];
+		err = bench_table(&b);
+	}
+	return bench_result("fsync_bench", err);
+}
@@ -0,0 +1,477 @@
+/*
+ * FUSE request queue benchmark.
+ *
+ * Mounts a tiny in-process FUSE filesystem, served straight off
+ * /dev/fuse without libfuse, that holds a single file backed by memory
+ * and opened with FOPEN_DIRECT_IO, so every read() and write() on it is
+ * a round trip through the daemon.  One client thread per online CPU
+ * reads and then writes random blocks of the file, checking the data
+ * read against the daemon's copy.
+ *
+ * This is run with the single device file of the mount, then with one
+ * device file per CPU cloned with FUSE_DEV_IOC_CLONE and a daemon
+ * thread reading each, and both again with a shared memory payload area
+ * registered on every device file with FUSE_DEV_IOC_SHM_REGISTER and
+ * mapped from it, where the kernel supports it.  The client buffers are
+ * page aligned, so the blocks go through the mapped slots uncopied.
+ * Needs root.
+ *
+ * Usage: fuse_mq_bench [-s size_mb] [-b block_kb] [-t seconds]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+
+#ifndef FUSE_DEV_IOC_CLONE
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, uint32_t)
+#endif
+#ifndef FUSE_DEV_IOC_SHM_REGISTER
+struct fuse_shm_register {
+	uint32_t	slot_size;
+	uint32_t	nr_slots;
+};
+#define FUSE_DEV_IOC_SHM_REGISTER _IOW(229, 1, struct fuse_shm_register)
+#endif
+#ifndef FUSE_READ_SHM
+#define FUSE_READ_SHM		(1 << 31)
+#define FUSE_WRITE_SHM		(1 << 31)
+#endif
+
+/* shm_slot is the last field of fuse_read_in and fuse_write_in */
+#define SHM_SLOT(arg)		(((uint32_t *)((arg) + 1))[-1])
+
+#define MAX_QUEUES		256
+#define MAX_WRITE		(128 << 10)
+#define SHM_SLOTS		16
+#define FILE_INO		2
+
+static const char *name = "fuse_mq_bench";
+static char mnt[] = "/tmp/fuse_mq_bench.XXXXXX";
+static char *data;
+static size_t size = 64 << 20;
+static size_t block = 64 << 10;
+static volatile int stop;
+
+struct queue {
+	pthread_t thread;
+	int fd;
+	char *shm;		/* READ slots, then the read-only WRITE ones */
+};
+
+struct client {
+	pthread_t thread;
+	int fd;
+	int write;
+	unsigned long bytes;
+	int err;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int reply(int fd, uint64_t unique, int error, void *arg, size_t len)
+{
+	struct fuse_out_header oh = {
+		.len = sizeof(oh) + len,
+		.error = error,
+		.unique = unique,
+	};
+	struct iovec iov[2] = {
+		{ &oh, sizeof(oh) },
+		{ arg, len },
+	};
+
+	if (writev(fd, iov, len ? 2 : 1) < 0 && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+static void fill_attr(struct fuse_attr *attr, uint64_t ino)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = ino;
+	attr->nlink = 1;
+	attr->blksize = 4096;
+	if (ino == FUSE_ROOT_ID) {
+		attr->mode = S_IFDIR | 0755;
+	} else {
+		attr->mode = S_IFREG | 0644;
+		attr->size = size;
+		attr->blocks = size / 512;
+	}
+}
+
+static int handle(struct queue *q, struct fuse_in_header *ih, void *arg)
+{
+	switch (ih->opcode) {
+	case FUSE_INIT: {
+		struct fuse_init_in *in = arg;
+		struct fuse_init_out out = {
+			.major = FUSE_KERNEL_VERSION,
+			.minor = in->minor < 23 ? in->minor : 23,
+			.max_readahead = in->max_readahead,
+			.max_background = 64,
+			.congestion_threshold = 48,
+			.max_write = MAX_WRITE,
+		};
+
+		/* the 7.22 layout is understood by every kernel */
+		return reply(q->fd, ih->unique, 0, &out, 24);
+	}
+	case FUSE_LOOKUP: {
+		struct fuse_entry_out out;
+
+		if (ih->nodeid != FUSE_ROOT_ID || strcmp(arg, "file"))
+			return reply(q->fd, ih->unique, -ENOENT, NULL, 0);
+		memset(&out, 0, sizeof(out));
+		out.nodeid = FILE_INO;
+		out.attr_valid = 3600;
+		out.entry_valid = 3600;
+		fill_attr(&out.attr, FILE_INO);
+		return reply(q->fd, ih->unique, 0, &out, sizeof(out));
+	}
+	case FUSE_GETATTR: {
+		struct fuse_attr_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.attr_valid = 3600;
+		fill_attr(&out.attr, ih->nodeid);
+		return reply(q->fd, ih->unique, 0, &out, sizeof(out));
+	}
+	case FUSE_OPEN: {
+		struct fuse_open_out out = { .open_flags = FOPEN_DIRECT_IO };
+
+		return reply(q->fd, ih->unique, 0, &out, sizeof(out));
+	}
+	case FUSE_READ: {
+		struct fuse_read_in *in = arg;
+		size_t count = in->size;
+
+		if (in->offset >= size)
+			count = 0;
+		else if (count > size - in->offset)
+			count = size - in->offset;
+		if (!(in->read_flags & FUSE_READ_SHM))
+			return reply(q->fd, ih->unique, 0,
+				     data + in->offset, count);
+
+		memcpy(q->shm + (size_t)SHM_SLOT(in) * MAX_WRITE,
+		       data + in->offset, count);
+		{
+			/* header alone, len counts the data in the slot */
+			struct fuse_out_header oh = {
+				.len = sizeof(oh) + count,
+				.unique = ih->unique,
+			};
+
+			if (write(q->fd, &oh, sizeof(oh)) < 0 &&
+			    errno != ENOENT)
+				return -1;
+		}
+		return 0;
+	}
+	case FUSE_WRITE: {
+		struct fuse_write_in *in = arg;
+		struct fuse_write_out out = { .size = in->size };
+		char *src = (char *)(in + 1);
+
+		if (in->write_flags & FUSE_WRITE_SHM)
+			src = q->shm + (size_t)(SHM_SLOTS + SHM_SLOT(in)) *
+				       MAX_WRITE;
+		if (in->offset + in->size > size)
+			return reply(q->fd, ih->unique, -EFBIG, NULL, 0);
+		memcpy(data + in->offset, src, in->size);
+		return reply(q->fd, ih->unique, 0, &out, sizeof(out));
+	}
+	case FUSE_FLUSH:
+	case FUSE_RELEASE:
+		return reply(q->fd, ih->unique, 0, NULL, 0);
+	case FUSE_FORGET:
+	case FUSE_BATCH_FORGET:
+	case FUSE_INTERRUPT:
+		return 0;
+	default:
+		return reply(q->fd, ih->unique, -ENOSYS, NULL, 0);
+	}
+}
+
+static void *daemon_fn(void *arg)
+{
+	struct queue *q = arg;
+	size_t bufsize = MAX_WRITE + 4096;
+	char *buf = malloc(bufsize);
+	ssize_t n;
+
+	while (buf) {
+		n = read(q->fd, buf, bufsize);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == ENOENT)
+				continue;
+			break;
+		}
+		if (handle(q, (struct fuse_in_header *)buf,
+			   buf + sizeof(struct fuse_in_header)))
+			break;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *client_fn(void *arg)
+{
+	struct client *c = arg;
+	unsigned int seed = (uintptr_t)c;
+	size_t nblocks = size / block;
+	char *buf;
+	off_t off;
+
+	if (posix_memalign((void **)&buf, 4096, block)) {
+		c->err = 1;
+		return NULL;
+	}
+	while (!stop) {
+		off = (off_t)(rand_r(&seed) % nblocks) * block;
+		if (c->write) {
+			/* write back what is there, so reads stay checkable */
+			memcpy(buf, data + off, block);
+			if (pwrite(c->fd, buf, block, off) != (ssize_t)block) {
+				perror("pwrite");
+				c->err = 1;
+				break;
+			}
+		} else {
+			if (pread(c->fd, buf, block, off) != (ssize_t)block ||
+			    memcmp(buf, data + off, block)) {
+				fprintf(stderr, "bad read at %lld\n",
+					(long long)off);
+				c->err = 1;
+				break;
+			}
+		}
+		c->bytes += block;
+	}
+	free(buf);
+	return NULL;
+}
+
+static int run_clients(int nclients, int write, int secs, double *mbs)
+{
+	struct client *c = calloc(nclients, sizeof(*c));
+	char path[64];
+	unsigned long bytes = 0;
+	double start;
+	int i, err = 0;
+
+	if (!c)
+		return -1;
+	snprintf(path, sizeof(path), "%s/file", mnt);
+	for (i = 0; i < nclients; i++) {
+		c[i].write = write;
+		c[i].fd = open(path, O_RDWR);
+		if (c[i].fd < 0) {
+			perror("open");
+			nclients = i;
+			err = -1;
+			goto out;
+		}
+	}
+
+	stop = 0;
+	start = now_ns();
+	for (i = 0; i < nclients; i++)
+		pthread_create(&c[i].thread, NULL, client_fn, &c[i]);
+	sleep(secs);
+	stop = 1;
+	for (i = 0; i < nclients; i++) {
+		pthread_join(c[i].thread, NULL);
+		bytes += c[i].bytes;
+		err |= c[i].err;
+	}
+	*mbs = bytes / ((now_ns() - start) / 1e9) / (1 << 20);
+out:
+	for (i = 0; i < nclients; i++)
+		close(c[i].fd);
+	free(c);
+	return err ? -1 : 0;
+}
+
+/*
+ * Mount with @nqueues device files, -1 if the kernel can't clone them
+ * or register shared memory when @shm is set, 0 if it worked.
+ */
+static int run(int nqueues, int shm, int secs, int nclients)
+{
+	struct queue *q = calloc(nqueues, sizeof(*q));
+	char opts[128];
+	double rd = 0, wr = 0;
+	int i, started = 0, ret = -1;
+
+	if (!q)
+		return -1;
+	for (i = 0; i < nqueues; i++)
+		q[i].fd = -1;
+
+	q[0].fd = open("/dev/fuse", O_RDWR);
+	if (q[0].fd < 0)
+		goto out;
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=0,group_id=0", q[0].fd);
+	if (mount(name, mnt, "fuse", MS_NOSUID | MS_NODEV, opts)) {
+		perror("mount");
+		goto out;
+	}
+
+	for (i = 1; i < nqueues; i++) {
+		uint32_t oldfd = q[0].fd;
+
+		q[i].fd = open("/dev/fuse", O_RDWR);
+		if (q[i].fd < 0 ||
+		    ioctl(q[i].fd, FUSE_DEV_IOC_CLONE, &oldfd) < 0)
+			goto out_umount;
+	}
+	for (i = 0; shm && i < nqueues; i++) {
+		struct fuse_shm_register reg = {
+			.slot_size = MAX_WRITE,
+			.nr_slots = SHM_SLOTS,
+		};
+		size_t len = (size_t)SHM_SLOTS * MAX_WRITE;
+		char *p;
+
+		if (ioctl(q[i].fd, FUSE_DEV_IOC_SHM_REGISTER, &reg) < 0)
+			goto out_umount;
+		/* one reservation, READ slots writable, WRITE slots not */
+		p = mmap(NULL, 2 * len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1, 0);
+		if (p == MAP_FAILED)
+			goto out_umount;
+		q[i].shm = p;
+		if (mmap(p, len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_FIXED, q[i].fd, 0) == MAP_FAILED ||
+		    mmap(p + len, len, PROT_READ, MAP_SHARED | MAP_FIXED,
+			 q[i].fd, len) == MAP_FAILED)
+			goto out_umount;
+	}
+
+	for (i = 0; i < nqueues; i++)
+		pthread_create(&q[i].thread, NULL, daemon_fn, &q[i]);
+	started = 1;
+
+	if (run_clients(nclients, 0, secs, &rd) ||
+	    run_clients(nclients, 1, secs, &wr)) {
+		ret = -2;
+		goto out_umount;
+	}
+	printf("%8d %6s %12.1f %12.1f\n", nqueues, shm ? "yes" : "no",
+	       rd, wr);
+	ret = 0;
+
+out_umount:
+	umount2(mnt, MNT_DETACH);
+out:
+	/* the unmount disconnects the daemon threads */
+	for (i = 0; started && i < nqueues; i++)
+		pthread_join(q[i].thread, NULL);
+	for (i = 0; i < nqueues; i++) {
+		if (q[i].shm)
+			munmap(q[i].shm, 2 * (size_t)SHM_SLOTS * MAX_WRITE);
+	}
+	for (i = 0; i < nqueues; i++) {
+		if (q[i].fd >= 0)
+			close(q[i].fd);
+	}
+	free(q);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int secs = 2, opt, n, shm, ret, err = 0;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "s:b:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = (size_t)atoi(optarg) << 20;
+			break;
+		case 'b':
+			block = (size_t)atoi(optarg) << 10;
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-s size_mb] [-b block_kb] [-t seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (block < 4096 || block > MAX_WRITE)
+		block = 64 << 10;
+	if (size < block)
+		size = block;
+	size -= size % block;
+	if (secs < 1)
+		secs = 1;
+	if (ncpus > MAX_QUEUES)
+		ncpus = MAX_QUEUES;
+
+	if (geteuid() || access("/dev/fuse", R_OK | W_OK) ||
+	    !mkdtemp(mnt)) {
+		printf("need root and /dev/fuse\n");
+		printf("%s: [SKIP]\n", name);
+		return 0;
+	}
+	data = malloc(size);
+	if (!data) {
+		printf("%s: [FAIL]\n", name);
+		return 1;
+	}
+	for (i = 0; i < size; i++)
+		data[i] = i * 7 + i / 4096;
+
+	printf("%8s %6s %12s %12s\n", "queues", "shm", "read MB/s",
+	       "write MB/s");
+	for (shm = 0; shm <= 1; shm++) {
+		for (n = 1; n <= ncpus; n = n < ncpus ? ncpus : n + 1) {
+			ret = run(n, shm, secs, ncpus);
+			if (ret == -1 && n == 1 && !shm) {
+				/* no FUSE here or not allowed to mount */
+				printf("%s: [SKIP]\n", name);
+				goto out;
+			}
+			if (ret == -1)
+				printf("%8d %6s  not supported\n", n,
+				       shm ? "yes" : "no");
+			else if (ret)
+				err = 1;
+		}
+	}
+	printf("%s: [%s]\n", name, err ? "FAIL" : "PASS");
+out:
+
+	rmdir(mnt);
+	free(data);
+	return err;
+}
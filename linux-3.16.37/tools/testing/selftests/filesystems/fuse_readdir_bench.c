@@ -0,0 +1,322 @@
+/*
+ * FUSE readdir cache test and benchmark.
+ *
+ * Mounts a tiny in-process FUSE filesystem, served straight off
+ * /dev/fuse without libfuse, whose root directory holds a number of
+ * empty files, and lists the directory over and over with
+ * opendir()/readdir(), counting the READDIR requests that reach the
+ * daemon.  The directory is opened plain, and then with FOPEN_CACHE_DIR
+ * and FOPEN_KEEP_CACHE, where after the first listing the kernel
+ * should answer from its cache without asking the daemon.  Finally more
+ * entries are added and the daemon sends FUSE_NOTIFY_INVAL_INODE for
+ * the directory, after which the listing has to show them.  Needs root.
+ *
+ * Usage: fuse_readdir_bench [-n entries] [-t seconds]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+
+#ifndef FOPEN_CACHE_DIR
+#define FOPEN_CACHE_DIR		(1 << 3)
+#endif
+
+static const char *name = "fuse_readdir_bench";
+static char mnt[] = "/tmp/fuse_readdir_bench.XXXXXX";
+static volatile int nr_entries = 1000;
+static volatile uint32_t opendir_flags;
+static volatile unsigned long nr_readdir;
+static uint32_t minor;
+static int devfd = -1;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int reply(uint64_t unique, int error, void *arg, size_t len)
+{
+	struct fuse_out_header oh = {
+		.len = sizeof(oh) + len,
+		.error = error,
+		.unique = unique,
+	};
+	struct iovec iov[2] = {
+		{ &oh, sizeof(oh) },
+		{ arg, len },
+	};
+
+	if (writev(devfd, iov, len ? 2 : 1) < 0 && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+static void fill_attr(struct fuse_attr *attr, uint64_t ino)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = ino;
+	attr->nlink = 1;
+	attr->blksize = 4096;
+	attr->mode = ino == FUSE_ROOT_ID ? S_IFDIR | 0755 : S_IFREG | 0644;
+}
+
+/* Fill @buf with entries starting at @offset, the offset of an entry is
+ * its index plus one */
+static size_t fill_dir(char *buf, size_t size, uint64_t offset)
+{
+	size_t len = 0;
+	uint64_t i;
+
+	for (i = offset; i < (uint64_t)nr_entries; i++) {
+		struct fuse_dirent *dirent = (struct fuse_dirent *)(buf + len);
+		char fname[32];
+		size_t namelen = snprintf(fname, sizeof(fname), "f%llu",
+					  (unsigned long long)i);
+
+		if (len + FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen) > size)
+			break;
+		memset(dirent, 0, FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen));
+		dirent->ino = i + 2;
+		dirent->off = i + 1;
+		dirent->namelen = namelen;
+		dirent->type = DT_REG;
+		memcpy(dirent->name, fname, namelen);
+		len += FUSE_DIRENT_SIZE(dirent);
+	}
+	return len;
+}
+
+static int handle(struct fuse_in_header *ih, void *arg)
+{
+	static char dirbuf[1 << 17];
+
+	switch (ih->opcode) {
+	case FUSE_INIT: {
+		struct fuse_init_in *in = arg;
+		struct fuse_init_out out = {
+			.major = FUSE_KERNEL_VERSION,
+			.minor = in->minor < 25 ? in->minor : 25,
+			.max_readahead = in->max_readahead,
+			.max_write = 4096,
+		};
+
+		minor = in->minor;
+		/* the 7.22 layout is understood by every kernel */
+		return reply(ih->unique, 0, &out, 24);
+	}
+	case FUSE_GETATTR: {
+		struct fuse_attr_out out;
+
+		memset(&out, 0, sizeof(out));
+		out.attr_valid = 3600;
+		fill_attr(&out.attr, ih->nodeid);
+		return reply(ih->unique, 0, &out, sizeof(out));
+	}
+	case FUSE_OPENDIR: {
+		struct fuse_open_out out = { .open_flags = opendir_flags };
+
+		return reply(ih->unique, 0, &out, sizeof(out));
+	}
+	case FUSE_READDIR: {
+		struct fuse_read_in *in = arg;
+		size_t size = in->size < sizeof(dirbuf) ? in->size :
+			      sizeof(dirbuf);
+
+		__sync_fetch_and_add(&nr_readdir, 1);
+		return reply(ih->unique, 0, dirbuf,
+			     fill_dir(dirbuf, size, in->offset));
+	}
+	case FUSE_RELEASEDIR:
+		return reply(ih->unique, 0, NULL, 0);
+	case FUSE_FORGET:
+	case FUSE_BATCH_FORGET:
+	case FUSE_INTERRUPT:
+		return 0;
+	case FUSE_LOOKUP:
+		return reply(ih->unique, -ENOENT, NULL, 0);
+	default:
+		return reply(ih->unique, -ENOSYS, NULL, 0);
+	}
+}
+
+static void *daemon_fn(void *arg)
+{
+	size_t bufsize = 1 << 17;
+	char *buf = malloc(bufsize);
+	ssize_t n;
+
+	while (buf) {
+		n = read(devfd, buf, bufsize);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == ENOENT)
+				continue;
+			break;
+		}
+		if (handle((struct fuse_in_header *)buf,
+			   buf + sizeof(struct fuse_in_header)))
+			break;
+	}
+	free(buf);
+	return NULL;
+}
+
+/* List the directory once, returns the number of entries or -1 */
+static int list_dir(void)
+{
+	DIR *dir = opendir(mnt);
+	struct dirent *de;
+	int n = 0;
+
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+			n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+static int run(const char *mode, uint32_t flags, int secs)
+{
+	unsigned long listings = 0, before;
+	double start, elapsed;
+	int n;
+
+	opendir_flags = flags;
+	/* the first listing fills the cache if there is one */
+	if (list_dir() != nr_entries)
+		return -1;
+
+	before = nr_readdir;
+	start = now_ns();
+	do {
+		n = list_dir();
+		if (n != nr_entries) {
+			fprintf(stderr, "%s: listed %d of %d entries\n",
+				mode, n, nr_entries);
+			return -1;
+		}
+		listings++;
+	} while (now_ns() - start < secs * 1e9);
+	elapsed = now_ns() - start;
+
+	printf("%-10s %12.0f %14.2f\n", mode, listings / (elapsed / 1e9),
+	       (double)(nr_readdir - before) / listings);
+	if ((flags & FOPEN_CACHE_DIR) && minor >= 25 && nr_readdir != before) {
+		fprintf(stderr, "%s: cached listings sent READDIR\n", mode);
+		return -1;
+	}
+	return 0;
+}
+
+/* Add entries behind the daemon's back, then tell the kernel */
+static int test_inval(void)
+{
+	struct {
+		struct fuse_out_header oh;
+		struct fuse_notify_inval_inode_out arg;
+	} notify = {
+		.oh = {
+			.len = sizeof(notify),
+			.error = FUSE_NOTIFY_INVAL_INODE,
+		},
+		.arg = {
+			.ino = FUSE_ROOT_ID,
+		},
+	};
+	int n;
+
+	nr_entries += 10;
+	if (write(devfd, &notify, sizeof(notify)) != sizeof(notify)) {
+		perror("notify");
+		return -1;
+	}
+	n = list_dir();
+	printf("%-10s %s\n", "inval", n == nr_entries ? "ok" : "FAILED");
+	return n == nr_entries ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t daemon;
+	char opts[128];
+	int secs = 2, opt, err = 0;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_entries = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n entries] [-t seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_entries < 1)
+		nr_entries = 1;
+	if (secs < 1)
+		secs = 1;
+
+	if (geteuid()) {
+		printf("need root\n");
+		printf("%s: [SKIP]\n", name);
+		return 0;
+	}
+	if (!mkdtemp(mnt)) {
+		perror("mkdtemp");
+		printf("%s: [SKIP]\n", name);
+		return 0;
+	}
+	devfd = open("/dev/fuse", O_RDWR);
+	if (devfd < 0) {
+		printf("no /dev/fuse\n");
+		goto skip;
+	}
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=0,group_id=0", devfd);
+	if (mount(name, mnt, "fuse", MS_NOSUID | MS_NODEV, opts)) {
+		perror("mount");
+		close(devfd);
+		goto skip;
+	}
+	pthread_create(&daemon, NULL, daemon_fn, NULL);
+
+	printf("%-10s %12s %14s\n", "mode", "listings/s", "READDIR/list");
+	err |= run("uncached", 0, secs);
+	err |= run("cached", FOPEN_CACHE_DIR | FOPEN_KEEP_CACHE, secs);
+	err |= test_inval();
+
+	umount2(mnt, MNT_DETACH);
+	pthread_join(daemon, NULL);
+	close(devfd);
+	rmdir(mnt);
+	printf("%s: [%s]\n", name, err ? "FAIL" : "PASS");
+	return err ? 1 : 0;
+
+skip:
+	rmdir(mnt);
+	printf("%s: [SKIP]\n", name);
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Concurrent writes to one file.
+ *
+ * Every thread pwrite()s to a region of a shared, preallocated file that
+ * no other thread touches, so the writes never overlap and never extend
+ * the file.  When writers serialize on the inode's i_mutex the aggregate
+ * rate stays flat as threads are added; with range locked writes it
+ * should scale.  The run is repeated for 1, 2, 4, ... threads up to the
+ * number of online CPUs.  Point -d at an ext4 or tmpfs directory.
+ *
+ * Each pass over a region writes a different byte, so when a run is
+ * over every region is read back and has to hold the last write of each
+ * of its blocks, and zeroes where nothing was written.
+ *
+ * Usage: range_write_bench [-d dir] [-t seconds] [-n max_threads] [-b bs]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include "bench.h"
+
+/* Each thread cycles through a region this big */
+#define REGION_SIZE	(4UL << 20)
+
+static size_t bs = 4096;
+static int fd = -1;
+
+/* The byte pass @pass of worker @idx writes */
+static int pattern(int idx, unsigned long pass)
+{
+	return 'a' + (idx + pass) % 26;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	off_t start = w->idx * REGION_SIZE;
+	unsigned long pass = 0;
+	off_t off = 0;
+	char *buf;
+
+	buf = malloc(bs);
+	if (!buf) {
+		w->err = 1;
+		return NULL;
+	}
+	memset(buf, pattern(w->idx, pass), bs);
+
+	while (!stop) {
+		if (pwrite(fd, buf, bs, start + off) != (ssize_t)bs) {
+			w->err = 1;
+			perror("pwrite");
+			break;
+		}
+		off += bs;
+		if (off + bs > REGION_SIZE) {
+			off = 0;
+			memset(buf, pattern(w->idx, ++pass), bs);
+		}
+		w->ops++;
+	}
+	free(buf);
+	return NULL;
+}
+
+static int check_region(struct worker *w)
+{
+	unsigned long nblocks = REGION_SIZE / bs;
+	unsigned long passes = w->ops / nblocks;
+	unsigned long rem = w->ops % nblocks;
+	off_t start = w->idx * REGION_SIZE;
+	unsigned long i;
+	size_t j;
+	char *buf;
+	int c;
+
+	buf = malloc(bs);
+	if (!buf)
+		return bench_bad(w, "out of memory");
+	for (i = 0; i < nblocks; i++) {
+		if (pread(fd, buf, bs, start + i * bs) != (ssize_t)bs) {
+			perror("pread");
+			break;
+		}
+		if (i < rem)
+			c = pattern(w->idx, passes);
+		else
+			c = passes ? pattern(w->idx, passes - 1) : 0;
+		for (j = 0; j < bs && buf[j] == c; j++)
+			;
+		if (j < bs)
+			break;
+	}
+	free(buf);
+	if (i < nblocks)
+		return bench_bad(w, "region doesn't hold the last writes");
+	return 0;
+}
+
+static int open_file(int nthreads)
+{
+	char name[4096];
+
+	snprintf(name, sizeof(name), "%s/rwb.%d", base, getpid());
+	fd = open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+	unlink(name);
+	if (ftruncate(fd, nthreads * REGION_SIZE)) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void close_file(void)
+{
+	close(fd);
+}
+
+static int opt_fn(int opt, const char *arg)
+{
+	bs = strtoul(arg, NULL, 0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.unit		= "writes",
+		.fn		= worker_fn,
+		.setup		= open_file,
+		.check		= check_region,
+		.teardown	= close_file,
+	};
+
+	if (bench_options(argc, argv, 1, "b:", " [-b bs]", opt_fn))
+		return 1;
+	if (bs < 1 || bs > REGION_SIZE)
+		bs = 4096;
+	return bench_result("range_write_bench", bench_table(&b));
+}
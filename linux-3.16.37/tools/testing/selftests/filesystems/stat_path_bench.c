@@ -0,0 +1,266 @@
+/*
+ * Repeated lookup of a deep path.
+ *
+ * Builds a chain of nested directories and stat()s the file at the bottom
+ * of it in a loop, which is what build tools checking include paths spend
+ * much of their time doing.  With fs.path-cache enabled most of these
+ * lookups should be served from the task's path cache; the counters from
+ * fs.path-cache-state are printed when available.
+ *
+ * Afterwards a directory in the middle of the chain is renamed, and the
+ * old name must then fail to resolve: a cached result must never outlive
+ * the rename.  Likewise, taking search permission away from a directory
+ * on a cached path, or from the root of the mount it is on, must deny the
+ * next lookup.  That is checked as an unprivileged user, in a tmpfs
+ * mounted for the purpose when run as root.  fs.path-cache is turned on
+ * for the run if it can be.
+ *
+ * Usage: stat_path_bench [-d dir] [-t seconds] [-n depth]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define STATE_FILE	"/proc/sys/fs/path-cache-state"
+#define ENABLE_FILE	"/proc/sys/fs/path-cache"
+#define NOBODY		65534
+
+static const char *base = "/tmp";
+
+static void print_state(const char *when)
+{
+	long hits, misses, stale, inserts;
+	FILE *f = fopen(STATE_FILE, "r");
+
+	if (!f)
+		return;
+	if (fscanf(f, "%ld %ld %ld %ld", &hits, &misses, &stale,
+		   &inserts) == 4)
+		printf("%-8s hits %ld misses %ld stale %ld inserts %ld\n",
+		       when, hits, misses, stale, inserts);
+	fclose(f);
+}
+
+/* Set fs.path-cache, returns the old value or -1 */
+static int set_path_cache(int val)
+{
+	FILE *f = fopen(ENABLE_FILE, "r+");
+	int old = -1;
+
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &old) == 1) {
+		rewind(f);
+		fprintf(f, "%d\n", val);
+	}
+	fclose(f);
+	return old;
+}
+
+/* Stat @path until it is cached, then take search permission from @dir */
+static int check_revoke(const char *dir, const char *path)
+{
+	struct stat st;
+	int i, ret = 0;
+
+	for (i = 0; i < 100; i++) {
+		if (stat(path, &st)) {
+			perror("stat");
+			return -1;
+		}
+	}
+	if (chmod(dir, 0600)) {
+		perror("chmod");
+		return -1;
+	}
+	if (!stat(path, &st) || errno != EACCES) {
+		printf("lookup through %s allowed after chmod\n", dir);
+		ret = -1;
+	}
+	chmod(dir, 0700);
+	return ret;
+}
+
+/*
+ * Revoke search permission on a directory in the path and on the root of
+ * the mount the path is on.  Runs as an unprivileged user, since root
+ * would pass the permission checks anyway.
+ */
+static int test_revoke(const char *mnt)
+{
+	char dir[4096], path[4200];
+	int fd, ret;
+
+	snprintf(dir, sizeof(dir), "%s/spr.%d", mnt, getpid());
+	snprintf(path, sizeof(path), "%s/dir/file", dir);
+	if (mkdir(dir, 0700)) {
+		perror("mkdir");
+		return -1;
+	}
+	*strrchr(path, '/') = '\0';
+	mkdir(path, 0700);
+	strcat(path, "/file");
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	if (fd < 0) {
+		perror("open");
+		ret = -1;
+		goto out;
+	}
+	close(fd);
+
+	ret = check_revoke(dir, path);
+	/* the mount root is only ours if it was mounted for us */
+	if (!ret && strcmp(mnt, base))
+		ret = check_revoke(mnt, path);
+out:
+	unlink(path);
+	*strrchr(path, '/') = '\0';
+	rmdir(path);
+	rmdir(dir);
+	return ret;
+}
+
+static int run_revoke(void)
+{
+	char mnt[] = "/tmp/spb_mnt.XXXXXX";
+	const char *where = base;
+	int status;
+	pid_t pid;
+
+	if (!geteuid()) {
+		if (!mkdtemp(mnt))
+			return -1;
+		if (mount("tmpfs", mnt, "tmpfs", 0, "mode=0700,uid=65534"))
+			perror("mount tmpfs");
+		else
+			where = mnt;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		if (!geteuid() && (setgid(NOBODY) || setuid(NOBODY))) {
+			perror("setuid");
+			_exit(1);
+		}
+		_exit(test_revoke(where) ? 1 : 0);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) != pid)
+		status = 1;
+
+	if (where != base)
+		umount2(mnt, MNT_DETACH);
+	if (!geteuid())
+		rmdir(mnt);
+	return status ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	char top[4096], path[4096], mid[4096], moved[4200];
+	int secs = 2, depth = 16, opt, i, fd, ret = 1, old;
+	unsigned long ops = 0;
+	struct stat st;
+	time_t end;
+
+	while ((opt = getopt(argc, argv, "d:t:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			base = optarg;
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'n':
+			depth = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-d dir] [-t seconds] [-n depth]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (secs < 1)
+		secs = 1;
+	if (depth < 2)
+		depth = 2;
+	if (depth > 64)
+		depth = 64;
+
+	snprintf(top, sizeof(top), "%s/spb.%d", base, getpid());
+	if (mkdir(top, 0700)) {
+		perror("mkdir");
+		return 1;
+	}
+	old = set_path_cache(1);
+	strcpy(path, top);
+	for (i = 0; i < depth; i++) {
+		if (i == depth / 2)
+			strcpy(mid, path);
+		strcat(path, "/dir");
+		if (mkdir(path, 0700)) {
+			perror("mkdir");
+			goto out;
+		}
+	}
+	strcat(path, "/file");
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	if (fd < 0) {
+		perror("open");
+		goto out;
+	}
+	close(fd);
+
+	print_state("before");
+	end = time(NULL) + secs;
+	while (time(NULL) < end) {
+		for (i = 0; i < 1000; i++) {
+			if (stat(path, &st)) {
+				perror("stat");
+				goto out;
+			}
+		}
+		ops += 1000;
+	}
+	printf("depth %d: %.0f stat/s\n", depth, (double)ops / secs);
+	print_state("after");
+
+	/* The old name must be gone as soon as the rename returns */
+	snprintf(moved, sizeof(moved), "%s/moved", mid);
+	strcat(mid, "/dir");
+	if (rename(mid, moved)) {
+		perror("rename");
+		goto out;
+	}
+	if (!stat(path, &st) || errno != ENOENT)
+		printf("stale lookup after rename\n");
+	else
+		ret = 0;
+	if (rename(moved, mid)) {
+		perror("rename");
+		ret = 1;
+	}
+	if (!ret && run_revoke())
+		ret = 1;
+out:
+	/* Tear the chain down from the bottom */
+	unlink(path);
+	while (strlen(path) > strlen(top)) {
+		*strrchr(path, '/') = '\0';
+		rmdir(path);
+	}
+	rmdir(top);
+	if (old >= 0)
+		set_path_cache(old);
+	printf("stat_path_bench: [%s]\n", ret ? "FAIL" : "PASS");
+	return ret;
+}
@@ -0,0 +1,109 @@
+#!/bin/bash
+#
+# Conntrack insertion benchmark: pktgen floods a veth pair with UDP packets
+# from random sources, so that nearly every packet creates a new conntrack
+# entry in the receiving namespace. The table is kept small to exercise
+# early drop. Reports the per-second insert, early drop and drop rates
+# taken from /proc/net/stat/nf_conntrack.
+#
+# usage: nf_conntrack_bench.sh [seconds] [conntrack max]
+
+readonly NS_RX="ctbench-rx-$$"
+readonly RX_ADDR="10.98.0.2"
+readonly TX_DEV="veth-ctbench"
+readonly RX_DEV="veth-ctbench-rx"
+readonly PGDEV="/proc/net/pktgen"
+
+readonly RUNTIME="${1:-5}"
+readonly CT_MAX="${2:-65536}"
+
+if [ $(id -u) != 0 ]; then
+	echo "$0 must be run as root" >&2
+	exit 0
+fi
+
+modprobe pktgen || exit 0
+modprobe nf_conntrack_ipv4 || exit 0
+
+pgset() {
+	local -r file="$1"
+	local -r cmd="$2"
+
+	echo "${cmd}" > "${file}"
+	if ! grep -q "^Result: OK" "${file}"; then
+		echo "pktgen: \"${cmd}\" failed on ${file}" >&2
+		grep "^Result:" "${file}" >&2
+		exit 1
+	fi
+}
+
+# sum one column of /proc/net/stat/nf_conntrack over all cpus
+ct_stat() {
+	local -r field="$1"
+
+	ip netns exec "${NS_RX}" awk -v f="${field}" '
+		function hex(s,    i, v) {
+			v = 0
+			for (i = 1; i <= length(s); i++)
+				v = v * 16 + index("0123456789abcdef",
+						   substr(s, i, 1)) - 1
+			return v
+		}
+		NR == 1 { for (i = 1; i <= NF; i++) if ($i == f) col = i; next }
+		{ sum += hex($col) }
+		END { print sum }' /proc/net/stat/nf_conntrack
+}
+
+cleanup() {
+	[ -e "${PGDEV}/pgctrl" ] && echo "reset" > "${PGDEV}/pgctrl"
+	ip netns del "${NS_RX}" 2>/dev/null
+	ip link del "${TX_DEV}" 2>/dev/null
+}
+trap cleanup EXIT
+
+ip netns add "${NS_RX}" || exit 1
+ip link add "${TX_DEV}" type veth peer name "${RX_DEV}" || exit 1
+ip link set "${RX_DEV}" netns "${NS_RX}"
+ip link set "${TX_DEV}" up
+ip -netns "${NS_RX}" addr add "${RX_ADDR}/24" dev "${RX_DEV}"
+ip -netns "${NS_RX}" link set "${RX_DEV}" up
+
+# the conntrack hooks are global, no rule is needed to track the flood
+echo "${CT_MAX}" > /proc/sys/net/netfilter/nf_conntrack_max
+
+RX_MAC=$(ip -netns "${NS_RX}" link show "${RX_DEV}" | \
+	 awk '/link\/ether/ { print $2 }')
+
+echo "reset" > "${PGDEV}/pgctrl"
+pgset "${PGDEV}/kpktgend_0" "rem_device_all"
+pgset "${PGDEV}/kpktgend_0" "add_device ${TX_DEV}"
+pgset "${PGDEV}/${TX_DEV}" "count 0"
+pgset "${PGDEV}/${TX_DEV}" "delay 0"
+pgset "${PGDEV}/${TX_DEV}" "pkt_size 64"
+pgset "${PGDEV}/${TX_DEV}" "dst ${RX_ADDR}"
+pgset "${PGDEV}/${TX_DEV}" "dst_mac ${RX_MAC}"
+pgset "${PGDEV}/${TX_DEV}" "src_min 10.96.0.1"
+pgset "${PGDEV}/${TX_DEV}" "src_max 10.97.255.254"
+pgset "${PGDEV}/${TX_DEV}" "flag IPSRC_RND"
+pgset "${PGDEV}/${TX_DEV}" "udp_src_min 1024"
+pgset "${PGDEV}/${TX_DEV}" "udp_src_max 65535"
+pgset "${PGDEV}/${TX_DEV}" "flag UDPSRC_RND"
+pgset "${PGDEV}/${TX_DEV}" "udp_dst_min 9"
+pgset "${PGDEV}/${TX_DEV}" "udp_dst_max 9"
+
+echo "start" > "${PGDEV}/pgctrl" &
+PG_PID=$!
+
+for i in $(seq "${RUNTIME}"); do
+	insert=$(ct_stat insert)
+	early_drop=$(ct_stat early_drop)
+	drop=$(ct_stat drop)
+	sleep 1
+	printf "conntrack: %8u insert/s %8u early_drop/s %8u drop/s\n" \
+		$(( $(ct_stat insert) - insert )) \
+		$(( $(ct_stat early_drop) - early_drop )) \
+		$(( $(ct_stat drop) - drop ))
+done
+
+echo "stop" > "${PGDEV}/pgctrl"
+wait "${PG_PID}" 2>/dev/null
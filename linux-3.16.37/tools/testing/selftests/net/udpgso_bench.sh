@@ -0,0 +1,66 @@
+#!/bin/bash
+#
+# Compare UDP throughput with and without UDP_SEGMENT on the sender and
+# UDP_GRO on the receiver, over loopback and over a veth pair.
+
+readonly NS_RX="udpgso-rx-$$"
+readonly RX_ADDR="10.99.0.2"
+readonly TX_ADDR="10.99.0.1"
+
+if [ $(id -u) != 0 ]; then
+	echo "$0 must be run as root" >&2
+	exit 0
+fi
+
+# run_one <label> <rx args> <tx args> [rx netns]
+run_one() {
+	local -r label="$1"
+	local -r rx_args="$2"
+	local -r tx_args="$3"
+	local -r ns="$4"
+
+	echo "--- ${label}"
+	if [ -n "${ns}" ]; then
+		ip netns exec "${ns}" ./udpgso_bench_rx -l 5 ${rx_args} &
+	else
+		./udpgso_bench_rx -l 5 ${rx_args} &
+	fi
+	sleep 0.2
+	./udpgso_bench_tx -l 3 ${tx_args}
+	wait
+}
+
+run_all() {
+	local -r ns="$1"
+	local -r dst="$2"
+
+	run_one "no GSO" "" "-D ${dst}" "${ns}"
+	run_one "GSO" "" "-D ${dst} -S" "${ns}"
+	run_one "GSO, cmsg" "" "-D ${dst} -S -c" "${ns}"
+	run_one "GSO, GRO receiver" "-G" "-D ${dst} -S" "${ns}"
+}
+
+cleanup() {
+	ip netns del "${NS_RX}" 2>/dev/null
+	ip link del veth-udpgso 2>/dev/null
+}
+
+echo "--------------------"
+echo "udpgso benchmark over loopback"
+echo "--------------------"
+run_all "" "127.0.0.1"
+
+echo "--------------------"
+echo "udpgso benchmark over veth"
+echo "--------------------"
+trap cleanup EXIT
+ip netns add "${NS_RX}" || exit 1
+ip link add veth-udpgso type veth peer name veth-udpgso-rx || exit 1
+ip link set veth-udpgso-rx netns "${NS_RX}"
+ip addr add "${TX_ADDR}/24" dev veth-udpgso
+ip link set veth-udpgso up
+ip -netns "${NS_RX}" addr add "${RX_ADDR}/24" dev veth-udpgso-rx
+ip -netns "${NS_RX}" link set veth-udpgso-rx up
+ip -netns "${NS_RX}" link set lo up
+
+run_all "${NS_RX}" "${RX_ADDR}"
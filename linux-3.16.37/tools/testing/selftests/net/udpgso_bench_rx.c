@@ -0,0 +1,190 @@
+/*
+ * UDP GRO (UDP_GRO) receiver benchmark.
+ *
+ * Counts the bytes, receive calls and datagrams arriving on a UDP port and
+ * reports them once a second. With -G the socket accepts coalesced packets
+ * and the original datagram size is read from the UDP_GRO control message.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO		104
+#endif
+
+static char rbuf[65536];
+
+static bool cfg_gro;
+static int cfg_port = 8000;
+static int cfg_runtime_s = 4;
+
+static unsigned long gettimeofday_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static int do_socket(void)
+{
+	struct sockaddr_in addr = {0};
+	int fd, val;
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	val = 1 << 21;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)))
+		error(1, errno, "setsockopt rcvbuf");
+
+	if (cfg_gro) {
+		val = 1;
+		if (setsockopt(fd, SOL_UDP, UDP_GRO, &val, sizeof(val)))
+			error(1, errno, "setsockopt udp gro");
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(cfg_port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (void *) &addr, sizeof(addr)))
+		error(1, errno, "bind");
+
+	return fd;
+}
+
+/* returns the number of datagrams in the buffer just read, or 0 */
+static int do_recv(int fd, unsigned long *bytes)
+{
+	char control[CMSG_SPACE(sizeof(int))] = {0};
+	struct msghdr msg = {0};
+	struct iovec iov = {0};
+	struct cmsghdr *cm;
+	int ret, gso_size = 0;
+
+	iov.iov_base = rbuf;
+	iov.iov_len = sizeof(rbuf);
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ret = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (ret == -1) {
+		if (errno == EAGAIN)
+			return 0;
+		error(1, errno, "recvmsg");
+	}
+	if (msg.msg_flags & MSG_TRUNC)
+		error(1, 0, "recvmsg: truncated");
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+			gso_size = *(int *) CMSG_DATA(cm);
+	}
+
+	*bytes += ret;
+	if (!gso_size)
+		return 1;
+	return (ret + gso_size - 1) / gso_size;
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-G] [-l secs] [-p port]", filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "Gl:p:")) != -1) {
+		switch (c) {
+		case 'G':
+			cfg_gro = true;
+			break;
+		case 'l':
+			cfg_runtime_s = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc)
+		usage(argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long num_bytes, num_msgs, num_recvs;
+	unsigned long tnow, treport, tstop;
+	struct pollfd pfd = {0};
+	int fd, ret;
+
+	parse_opts(argc, argv);
+
+	fd = do_socket();
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	num_bytes = num_msgs = num_recvs = 0;
+	tnow = gettimeofday_ms();
+	tstop = tnow + cfg_runtime_s * 1000;
+	treport = tnow + 1000;
+
+	do {
+		ret = poll(&pfd, 1, 100);
+		if (ret == -1)
+			error(1, errno, "poll");
+
+		while ((ret = do_recv(fd, &num_bytes))) {
+			num_msgs += ret;
+			num_recvs++;
+		}
+
+		tnow = gettimeofday_ms();
+		if (tnow > treport) {
+			if (num_recvs)
+				fprintf(stderr,
+					"udp rx: %6lu MB/s %8lu calls/s %6lu msg/s\n",
+					num_bytes >> 20, num_recvs, num_msgs);
+			num_bytes = num_msgs = num_recvs = 0;
+			treport = tnow + 1000;
+		}
+	} while (tnow < tstop);
+
+	if (close(fd))
+		error(1, errno, "close");
+
+	return 0;
+}
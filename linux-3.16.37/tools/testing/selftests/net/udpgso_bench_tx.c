@@ -0,0 +1,223 @@
+/*
+ * UDP segmentation offload (UDP_SEGMENT) sender benchmark.
+ *
+ * Sends large buffers to a UDP receiver and reports throughput and the
+ * number of send calls and datagrams per second. With -S each buffer is
+ * split into gso_size datagrams by the kernel, without it each call sends
+ * a single datagram of at most gso_size bytes.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103
+#endif
+
+/* IPv4 MTU 1500 minus IP and UDP headers */
+#define CONST_MSS_V4	(1500 - 20 - 8)
+#define CONST_MAX_SEGS	64
+
+static char buf[65535 - 20 - 8];
+
+static bool cfg_cmsg;
+static bool cfg_gso;
+static int cfg_gso_size = CONST_MSS_V4;
+static int cfg_len = CONST_MSS_V4 * CONST_MAX_SEGS;
+static int cfg_port = 8000;
+static int cfg_runtime_s = 4;
+static struct sockaddr_in cfg_dst_addr;
+
+static unsigned long gettimeofday_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static int send_one(int fd, int len, int gso_size)
+{
+	char control[CMSG_SPACE(sizeof(uint16_t))] = {0};
+	struct msghdr msg = {0};
+	struct iovec iov = {0};
+	struct cmsghdr *cm;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (gso_size) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_UDP;
+		cm->cmsg_type = UDP_SEGMENT;
+		cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		*((uint16_t *) CMSG_DATA(cm)) = gso_size;
+	}
+
+	return sendmsg(fd, &msg, 0);
+}
+
+static int send_buffer(int fd)
+{
+	int ret, off = 0, calls = 0;
+
+	if (cfg_gso) {
+		ret = send_one(fd, cfg_len, cfg_cmsg ? cfg_gso_size : 0);
+		if (ret == -1)
+			error(1, errno, "sendmsg");
+		if (ret != cfg_len)
+			error(1, 0, "sendmsg: %u != %u", ret, cfg_len);
+		return 1;
+	}
+
+	/* same payload as one GSO call, but one datagram per call */
+	while (off < cfg_len) {
+		int len = cfg_len - off;
+
+		if (len > cfg_gso_size)
+			len = cfg_gso_size;
+
+		ret = send(fd, buf + off, len, 0);
+		if (ret == -1)
+			error(1, errno, "send");
+		if (ret != len)
+			error(1, 0, "send: %u != %u", ret, len);
+
+		off += len;
+		calls++;
+	}
+
+	return calls;
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-c] [-D dst ip] [-l secs] [-p port] [-s sendsize] [-S] [-M gso_size]",
+	      filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	cfg_dst_addr.sin_family = AF_INET;
+	cfg_dst_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	while ((c = getopt(argc, argv, "cD:l:M:p:s:S")) != -1) {
+		switch (c) {
+		case 'c':
+			cfg_cmsg = true;
+			break;
+		case 'D':
+			if (inet_pton(AF_INET, optarg,
+				      &cfg_dst_addr.sin_addr) != 1)
+				error(1, 0, "ipv4 parse error: %s", optarg);
+			break;
+		case 'l':
+			cfg_runtime_s = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			cfg_gso_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			cfg_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			cfg_gso = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc)
+		usage(argv[0]);
+
+	if (cfg_len > sizeof(buf))
+		error(1, 0, "send size %u exceeds max %lu",
+		      cfg_len, (unsigned long) sizeof(buf));
+	if (cfg_gso_size <= 0 || cfg_gso_size > CONST_MSS_V4)
+		error(1, 0, "gso size %u out of range", cfg_gso_size);
+
+	cfg_dst_addr.sin_port = htons(cfg_port);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long num_bytes, num_msgs, num_sends;
+	unsigned long tnow, treport, tstop;
+	int fd, i, val;
+
+	parse_opts(argc, argv);
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = 'a' + (i % 26);
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	if (connect(fd, (void *) &cfg_dst_addr, sizeof(cfg_dst_addr)))
+		error(1, errno, "connect");
+
+	if (cfg_gso && !cfg_cmsg) {
+		val = cfg_gso_size;
+		if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)))
+			error(1, errno, "setsockopt udp segment");
+	}
+
+	num_bytes = num_msgs = num_sends = 0;
+	tnow = gettimeofday_ms();
+	tstop = tnow + cfg_runtime_s * 1000;
+	treport = tnow + 1000;
+
+	do {
+		num_sends += send_buffer(fd);
+		num_bytes += cfg_len;
+		num_msgs += (cfg_len + cfg_gso_size - 1) / cfg_gso_size;
+
+		tnow = gettimeofday_ms();
+		if (tnow > treport) {
+			fprintf(stderr,
+				"udp tx: %6lu MB/s %8lu calls/s %6lu msg/s\n",
+				num_bytes >> 20, num_sends, num_msgs);
+			num_bytes = num_msgs = num_sends = 0;
+			treport = tnow + 1000;
+		}
+	} while (tnow < tstop);
+
+	if (close(fd))
+		error(1, errno, "close");
+
+	return 0;
+}